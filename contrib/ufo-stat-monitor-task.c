@@ -25,23 +25,16 @@
 #include <math.h>
 #include "ufo-stat-monitor-task.h"
 #include "ufo-sxc-common.h"
+#include "../src/common/ufo-reduction.h"
 
 struct _UfoStatMonitorTaskPrivate {
     FILE * stat_file;
     gchar * stat_fn;
     gboolean trace_count;
     gboolean be_quiet;
-    gboolean node_has_fp64;
-    cl_kernel kernel;
-    cl_kernel kernel_final;
+    UfoReduction *reduction;
     gsize im_index;
     guint n_items;
-    cl_ulong max_local_mem;
-    size_t local_scratch_size;
-    cl_uint wg_size;
-    cl_uint wg_num;
-    cl_mem stat_out_buff;   /* The buffer used by the kernel to output its results */
-    cl_mem stat_out_red;    /* The buffer used by the final reduction kernel */
     guint sm_index;
 };
 
@@ -77,91 +70,16 @@ ufo_stat_monitor_task_setup (UfoTask *task,
 {
     UfoStatMonitorTaskPrivate *priv;
     UfoGpuNode *node;
-    cl_command_queue cmd_queue;
-    cl_context context_cl;
-    cl_device_id dev_cl;
-    cl_int err_code;
-    cl_uint num_cu;
-    size_t max_wgs, max_wis[3];
-    size_t ker_pref_wgs;
 
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
-    cmd_queue = ufo_gpu_node_get_cmd_queue (node);
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clGetCommandQueueInfo (cmd_queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &dev_cl, NULL), error);
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clGetCommandQueueInfo (cmd_queue, CL_QUEUE_CONTEXT, sizeof (cl_context), &context_cl, NULL), error);
-
     priv = UFO_STAT_MONITOR_TASK_GET_PRIVATE (task);
 
-    priv->node_has_fp64 = device_has_extension (node, "cl_khr_fp64");
-
-    /* Error : kernel compilation is buggy is one device has fp64 and another has not ! */
-    if (priv->node_has_fp64) {
-        priv->kernel = ufo_resources_get_kernel (resources, "stat-monitor.cl", "stat_monitor_f64", NULL, error);
-        priv->kernel_final = ufo_resources_get_kernel (resources, "stat-monitor.cl", "stat_monitor_f64_fin", NULL, error);
-    }
-    else {
-        priv->kernel = ufo_resources_get_kernel (resources, "stat-monitor.cl", "stat_monitor_f32", NULL, error);
-        priv->kernel_final = ufo_resources_get_kernel (resources, "stat-monitor.cl", "stat_monitor_f32_fin", NULL, error);
-    }
+    /* Single-pass Welford statistics shared with the measure filter */
+    priv->reduction = ufo_reduction_new (resources, node, FALSE, error);
 
-    if (priv->kernel == NULL || priv->kernel_final == NULL)
+    if (priv->reduction == NULL)
         return;
 
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel), error);
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel_final), error);
-
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clGetDeviceInfo (dev_cl, CL_DEVICE_LOCAL_MEM_SIZE, sizeof(cl_ulong), &(priv->max_local_mem), NULL), error);
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clGetDeviceInfo (dev_cl, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(cl_uint), &num_cu, NULL), error);
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clGetDeviceInfo (dev_cl, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(size_t), &max_wgs, NULL), error);
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clGetDeviceInfo (dev_cl, CL_DEVICE_MAX_WORK_ITEM_SIZES, sizeof(max_wis), max_wis, NULL), error);
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clGetKernelWorkGroupInfo (priv->kernel, dev_cl, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE, sizeof(size_t), &ker_pref_wgs, NULL), error);
-
-    /* 4 work-groups per comput unit. */
-    priv->wg_num = num_cu << 2;
-
-    if (priv->wg_num > max_wis[0]) { 
-        /*
-         * We have to reduce the number of workgroup so that last reduction can
-         * be done in a single workgroup (hence 1-value per workroup should
-         * eventually fit within a single workgroup.
-         */
-        priv->wg_num = max_wis[0];
-    }
-
-    priv->wg_size = ker_pref_wgs;
-
-    if (priv->wg_size > max_wis[0]) {
-        priv->wg_size = max_wis[0];
-    }
-
-    if (priv->wg_size < priv->wg_num) { // To ensure the final reduction step.
-        priv->wg_num = priv->wg_size;
-    }
-
-    /* dividing by 2 the total local memory. */
-    priv->local_scratch_size = (size_t) (priv->max_local_mem >> 1);
-
-    if (priv->node_has_fp64) {
-        /*
-         * Each workgroup needs 4 items * 8 bytes per work-item, that is
-         * (wg_size << 5) B of local memory.
-         */
-        if (priv->local_scratch_size > (priv->wg_size << 5))
-            priv->local_scratch_size = (priv->wg_size << 5);
-        else
-            priv->wg_size = (priv->local_scratch_size) >> 5;
-    }
-    else {
-        /*
-         * Each workgroup needs 4 items * 4 bytes per work-item, that is
-         * (wg_size << 4) B of local memory.
-         */
-        if (priv->local_scratch_size > (priv->wg_size << 4))
-            priv->local_scratch_size = (priv->wg_size << 4);
-        else
-            priv->wg_size = (priv->local_scratch_size) >> 4;
-    }
-
     priv->im_index = 0;
 
     /* Opening (if required) the statistic file */
@@ -174,24 +92,6 @@ ufo_stat_monitor_task_setup (UfoTask *task,
         priv->stat_file = stdout;
         fprintf (stdout, "stat-monitor (%u) will outputs its results to stdout\n", priv->sm_index);
     }
-
-    /* Allocating once for all the output buffer that will be used for statistcis output. */
-    if ( priv->node_has_fp64 ) {
-        /* min, max, mean, sd (one 4-tuple per work-group) */
-        priv->stat_out_buff = clCreateBuffer (context_cl, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, priv->wg_num << 5, NULL, &err_code);
-        UFO_RESOURCES_CHECK_SET_AND_RETURN (err_code, error);
-        /* min, max, mean, sd (one 4-tuple once only) */
-        priv->stat_out_red = clCreateBuffer (context_cl, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, 1 << 5, NULL, &err_code);
-        UFO_RESOURCES_CHECK_SET_AND_RETURN (err_code, error);
-    }
-    else {
-        /* min, max, mean, sd (one 4-tuple per work-group) */
-        priv->stat_out_buff = clCreateBuffer (context_cl, CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, priv->wg_num << 4, NULL, &err_code);
-        UFO_RESOURCES_CHECK_SET_AND_RETURN (err_code, error);
-        /* min, max, mean, sd (one 4-tuple once only) */
-        priv->stat_out_red = clCreateBuffer (context_cl, CL_MEM_READ_WRITE | CL_MEM_HOST_READ_ONLY, 1 << 4, NULL, &err_code);
-        UFO_RESOURCES_CHECK_SET_AND_RETURN (err_code, error);
-    }
 }
 
 static void
@@ -260,8 +160,12 @@ ufo_stat_monitor_task_process (UfoTask *task,
     UfoProfiler *profiler;
     cl_command_queue cmd_queue;
     cl_mem in_mem;
-    cl_uint img_size;
+    cl_mem stat_mem;
+    gsize img_size;
     UfoRequisition img_req;
+    UfoStatistics stats;
+    gdouble stat_res[6];
+    gdouble n;
 
     UfoBufferLocation location;
     GList *keys;
@@ -286,73 +190,24 @@ ufo_stat_monitor_task_process (UfoTask *task,
     for (guint i = 0; i < img_req.n_dims; i++)
         img_size *= img_req.dims[i];
 
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 0, sizeof (cl_mem), &in_mem));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 1, sizeof (cl_mem), &(priv->stat_out_buff)));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 2, sizeof (cl_uint), &img_size));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 3, priv->local_scratch_size, NULL));
-
-    gsize total_wi = priv->wg_num * priv->wg_size;
-    gsize wg_size = (gsize)(priv->wg_size);
-
-    gsize true_wi = (total_wi < (gsize)img_size) ? total_wi : (gsize)img_size;
-    gsize true_wg_num = ((true_wi-1) / priv->wg_size) + 1;
-
-    /* Making sure that true_wi is a mulitple of work group size. */
-    true_wi = priv->wg_size * true_wg_num;
-
     profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-
-    /* First reduction step : */
-    ufo_profiler_call (profiler, cmd_queue, priv->kernel, 1, &true_wi, &wg_size);
-
-    /* At this time, we need to have a second kernel to further reduce the
-     * results of the previous results that where produced at the rate of one
-     * per work-group. */
-
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel_final, 0, sizeof (cl_mem), &(priv->stat_out_buff)));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel_final, 1, sizeof (cl_mem), &(priv->stat_out_red)));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel_final, 2, sizeof (cl_uint), &(true_wg_num)));
-
-    if (priv->node_has_fp64) {
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel_final, 3, sizeof(cl_double)*4*true_wg_num, NULL));
-    }
-    else {
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel_final, 3, sizeof(cl_float)*4*true_wg_num, NULL));
-    }
-
-    total_wi = (true_wg_num & 0x1) + (true_wg_num >> 1);
-
-    /* Second reduction step : */
-    ufo_profiler_call(profiler, cmd_queue, priv->kernel_final, 1, &total_wi, &total_wi);
-
-    if (priv->node_has_fp64) {
-        double stat_res[6];
-        double img_size_f = (double) img_size;
-
-        UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (cmd_queue, priv->stat_out_red, CL_TRUE, 0, 4<<3, stat_res, 0, NULL, NULL));
-
-        stat_res[4] = stat_res[2] / img_size_f;
-        stat_res[5] = (stat_res[3] - img_size_f * stat_res[4] * stat_res[4]) / (img_size_f - 1.0);
-
-        if (stdout == priv->stat_file) {
-            fprintf (priv->stat_file, "(%u) ", priv->sm_index);
-        }
-        fprintf (priv->stat_file, "%zu %le %le %le %le %le %le\n", priv->im_index, stat_res[0], stat_res[1], stat_res[2], stat_res[3], stat_res[4], stat_res[5]);
-    }
-    else {
-        float stat_res[6];
-        float img_size_f = (float)img_size;
-
-        UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer(cmd_queue, priv->stat_out_red, CL_TRUE, 0, 4<<2, stat_res, 0, NULL, NULL));
-
-        stat_res[4] = stat_res[2] / img_size_f;
-        stat_res[5] = (stat_res[3] - img_size_f * stat_res[4] * stat_res[4]) / (img_size_f - 1.0f);
-
-        if (stdout == priv->stat_file) {
-            fprintf (priv->stat_file, "(%u) ", priv->sm_index);
-        }
-        fprintf (priv->stat_file, "%zu %e %e %e %e %e %e\n", priv->im_index, stat_res[0], stat_res[1], stat_res[2], stat_res[3], stat_res[4], stat_res[5]);
+    stat_mem = ufo_reduction_execute (priv->reduction, cmd_queue, profiler, in_mem, img_size, 1, -1, NULL);
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (cmd_queue, stat_mem, CL_TRUE, 0, sizeof (UfoStatistics),
+                                                    &stats, 0, NULL, NULL));
+
+    /* Columns are min, max, sum, sum of squares, mean and sample variance */
+    n = stats.count;
+    stat_res[0] = stats.min;
+    stat_res[1] = stats.max;
+    stat_res[2] = n * stats.mean;
+    stat_res[3] = stats.m2 + n * stats.mean * stats.mean;
+    stat_res[4] = stats.mean;
+    stat_res[5] = stats.m2 / (n - 1.0);
+
+    if (stdout == priv->stat_file) {
+        fprintf (priv->stat_file, "(%u) ", priv->sm_index);
     }
+    fprintf (priv->stat_file, "%zu %le %le %le %le %le %le\n", priv->im_index, stat_res[0], stat_res[1], stat_res[2], stat_res[3], stat_res[4], stat_res[5]);
 
     if (priv->trace_count)
         fprintf (stdout, "stat-monitor (%u) : done frame %zu\n", priv->sm_index, priv->im_index);
@@ -486,17 +341,10 @@ ufo_stat_monitor_task_finalize (GObject *object)
     g_free (priv->stat_fn);
     priv->stat_fn = NULL;
 
-    if (priv->kernel)
-        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->kernel));
-
-    if (priv->kernel_final)
-        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->kernel_final));
-
-    if (priv->stat_out_buff)
-        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->stat_out_buff));
-
-    if (priv->stat_out_red)
-        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->stat_out_red));
+    if (priv->reduction) {
+        ufo_reduction_destroy (priv->reduction);
+        priv->reduction = NULL;
+    }
 
     G_OBJECT_CLASS (ufo_stat_monitor_task_parent_class)->finalize (object);
 }
@@ -567,5 +415,6 @@ ufo_stat_monitor_task_init(UfoStatMonitorTask *self)
     self->priv->trace_count = FALSE;
     self->priv->be_quiet = FALSE;
     self->priv->n_items = 0;
+    self->priv->reduction = NULL;
     self->priv->sm_index = sm_next_index++;
 }
@@ -29,20 +29,146 @@
 
 #include "ufo-fft.h"
 
+#ifndef HAVE_AMD
+enum {
+    KERNEL_REAL_COPY = 0,
+    KERNEL_REAL_SPLIT,
+    KERNEL_REAL_MERGE,
+    KERNEL_REAL_SPREAD,
+    KERNEL_REAL_EXTRACT,
+    KERNEL_HERMITIAN_CROP,
+    KERNEL_HERMITIAN_EXPAND,
+    N_REAL_KERNELS
+};
+#endif
+
+/* Maximum number of plans that are kept for re-use while no UfoFft needs them */
+#define MAX_IDLE_PLANS 16
+
+typedef struct {
+    cl_context context;
+    cl_command_queue queue;
+    UfoFftParameter param;
+
+#ifdef HAVE_AMD
+    clfftPlanHandle amd_plan;
+    clfftPlanHandle amd_inverse_plan;
+#else
+    clFFT_Plan apple_plan;
+#endif
+} FftPlan;
+
 struct _UfoFft {
     UfoFftParameter seen;
+    cl_context context;
+    cl_command_queue queue;
+
+    FftPlan *plan;
+    FftPlan *batch_plan;
+    gsize num_batch_frames;
 
 #ifdef HAVE_AMD
-    clfftPlanHandle amd_plan;
     clfftSetupData amd_setup;
 #else
-    clFFT_Plan apple_plan;
+    /* real layouts are emulated on top of the complex transform */
+    cl_program real_program;
+    cl_kernel real_kernels[N_REAL_KERNELS];
+    cl_mem scratch;
+    gsize scratch_size;
 #endif
 };
 
-#ifdef HAVE_AMD
-static GMutex amd_mutex;
-static GList *ffts_created = NULL;
+/* Plans are expensive to create, idle ones are kept with the most recently used
+ * first until the last UfoFft is destroyed */
+static GMutex plan_mutex;
+static GQueue idle_plans = G_QUEUE_INIT;
+static guint num_ffts = 0;
+
+#ifndef HAVE_AMD
+/*
+ * A real row of length N is transformed as N / 2 complex values z[n] = x[2n] +
+ * i x[2n + 1] in 1D and the spectrum is split into the even and odd parts
+ * afterwards. In 2D and 3D, rows are expanded to complex, transformed and
+ * cropped to the non-redundant half.
+ */
+static const gchar *real_kernel_source =
+"kernel void real_copy (global float *in, global float *out, int in_stride, int out_stride)\n"
+"{\n"
+"    const int x = get_global_id (0);\n"
+"    const int row = get_global_id (1);\n"
+"    out[row * out_stride + x] = in[row * in_stride + x];\n"
+"}\n"
+"kernel void real_split (global float2 *z, global float2 *out, int k_len)\n"
+"{\n"
+"    const int k = get_global_id (0);\n"
+"    const int row = get_global_id (1);\n"
+"    const float2 a = z[row * k_len + k % k_len];\n"
+"    const float2 b = z[row * k_len + (k_len - k) % k_len];\n"
+"    const float2 even = (float2) (a.x + b.x, a.y - b.y) * 0.5f;\n"
+"    const float2 odd = (float2) (a.y + b.y, b.x - a.x) * 0.5f;\n"
+"    float c, s = sincos (M_PI_F * k / k_len, &c);\n"
+"    out[row * (k_len + 1) + k] = (float2) (even.x + c * odd.x + s * odd.y, even.y + c * odd.y - s * odd.x);\n"
+"}\n"
+"kernel void real_merge (global float2 *in, global float2 *z, int k_len)\n"
+"{\n"
+"    const int k = get_global_id (0);\n"
+"    const int row = get_global_id (1);\n"
+"    const float2 a = in[row * (k_len + 1) + k];\n"
+"    const float2 b = in[row * (k_len + 1) + k_len - k];\n"
+"    const float2 sum = (float2) (a.x + b.x, a.y - b.y);\n"
+"    const float2 diff = (float2) (a.x - b.x, a.y + b.y);\n"
+"    float c, s = sincos (M_PI_F * k / k_len, &c);\n"
+"    const float2 t = (float2) (c * diff.x - s * diff.y, c * diff.y + s * diff.x);\n"
+"    z[row * k_len + k] = (float2) (sum.x - t.y, sum.y + t.x);\n"
+"}\n"
+"kernel void real_spread (global float *in, global float2 *out, int in_stride)\n"
+"{\n"
+"    const int x = get_global_id (0);\n"
+"    const int row = get_global_id (1);\n"
+"    out[row * get_global_size (0) + x] = (float2) (in[row * in_stride + x], 0.0f);\n"
+"}\n"
+"kernel void real_extract (global float2 *in, global float *out, int out_stride)\n"
+"{\n"
+"    const int x = get_global_id (0);\n"
+"    const int row = get_global_id (1);\n"
+"    out[row * out_stride + x] = in[row * get_global_size (0) + x].x;\n"
+"}\n"
+"kernel void hermitian_crop (global float2 *in, global float2 *out, int width)\n"
+"{\n"
+"    const int x = get_global_id (0);\n"
+"    const int row = get_global_id (1);\n"
+"    out[row * get_global_size (0) + x] = in[row * width + x];\n"
+"}\n"
+"kernel void hermitian_expand (global float2 *in, global float2 *out, int half_width, int height, int depth)\n"
+"{\n"
+"    const int x = get_global_id (0);\n"
+"    const int row = get_global_id (1);\n"
+"    const int width = get_global_size (0);\n"
+"    const int y = row % height;\n"
+"    const int z = (row / height) % depth;\n"
+"    const int frame = row / height / depth;\n"
+"    int mirrored;\n"
+"    float2 value;\n"
+"    if (x < half_width) {\n"
+"        value = in[row * half_width + x];\n"
+"    }\n"
+"    else {\n"
+"        mirrored = (frame * depth + (depth - z) % depth) * height + (height - y) % height;\n"
+"        value = in[mirrored * half_width + width - x];\n"
+"        value.y = -value.y;\n"
+"    }\n"
+"    out[row * width + x] = value;\n"
+"}\n";
+
+static const gchar *real_kernel_names[N_REAL_KERNELS] = {
+    "real_copy",
+    "real_split",
+    "real_merge",
+    "real_spread",
+    "real_extract",
+    "hermitian_crop",
+    "hermitian_expand",
+};
 #endif
 
 
@@ -53,12 +179,17 @@ ufo_fft_new (void)
 
     fft = g_malloc0 (sizeof (UfoFft));
 
+    g_mutex_lock (&plan_mutex);
+    num_ffts++;
+
 #ifdef HAVE_AMD
+    /* Under the lock, so that it cannot interleave with a teardown */
     UFO_RESOURCES_CHECK_CLERR (clfftSetup (&fft->amd_setup));
+#endif
+
+    g_mutex_unlock (&plan_mutex);
 
-    g_mutex_lock (&amd_mutex);
-    ffts_created = g_list_append (ffts_created, fft);
-    g_mutex_unlock (&amd_mutex);
+#ifdef HAVE_AMD
     g_debug ("INFO Create new plan using AMD FFT");
 #else
     g_debug ("INFO Create new plan using Apple FFT");
@@ -67,37 +198,334 @@ ufo_fft_new (void)
     return fft;
 }
 
-cl_int
-ufo_fft_update (UfoFft *fft, cl_context context, cl_command_queue queue, UfoFftParameter *param)
+static gsize
+get_num_rows (UfoFftParameter *param)
 {
-    gboolean changed;
-    cl_int error;
+    gsize rows = param->batch;
 
-    error = CL_SUCCESS;
-    changed = param->size[0] != fft->seen.size[0] || param->size[1] != fft->seen.size[1];
+    if (param->dimensions > UFO_FFT_1D)
+        rows *= param->size[1];
 
-    if (changed)
-        memcpy (&fft->seen, param, sizeof (UfoFftParameter));
+    if (param->dimensions > UFO_FFT_2D)
+        rows *= param->size[2];
+
+    return rows;
+}
+
+static gsize
+get_real_stride (UfoFftParameter *param)
+{
+    return param->zeropad ? 2 * (param->size[0] / 2 + 1) : param->size[0];
+}
 
 #ifdef HAVE_AMD
-    if (fft->amd_plan == 0 || changed) {
-        /* we use param->dimension to index into this array! */
-        clfftDim dimension[4] = { 0, CLFFT_1D, CLFFT_2D, CLFFT_3D };
+static void
+set_real_layout (clfftPlanHandle plan, UfoFftParameter *param, UfoFftDirection direction)
+{
+    /* we use param->dimension to index into this array! */
+    clfftDim dimension[4] = { 0, CLFFT_1D, CLFFT_2D, CLFFT_3D };
+    size_t real_strides[3];
+    size_t complex_strides[3];
+    size_t real_distance;
+    size_t complex_distance;
+
+    real_strides[0] = complex_strides[0] = 1;
+    real_strides[1] = get_real_stride (param);
+    complex_strides[1] = param->size[0] / 2 + 1;
+    real_strides[2] = real_strides[1] * param->size[1];
+    complex_strides[2] = complex_strides[1] * param->size[1];
+    real_distance = real_strides[param->dimensions];
+    complex_distance = complex_strides[param->dimensions];
+
+    if (param->dimensions == UFO_FFT_3D) {
+        real_distance *= param->size[2];
+        complex_distance *= param->size[2];
+    }
+
+    if (direction == UFO_FFT_FORWARD) {
+        UFO_RESOURCES_CHECK_CLERR (clfftSetLayout (plan, CLFFT_REAL, CLFFT_HERMITIAN_INTERLEAVED));
+        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanInStride (plan, dimension[param->dimensions], real_strides));
+        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanOutStride (plan, dimension[param->dimensions], complex_strides));
+        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanDistance (plan, real_distance, complex_distance));
+    }
+    else {
+        UFO_RESOURCES_CHECK_CLERR (clfftSetLayout (plan, CLFFT_HERMITIAN_INTERLEAVED, CLFFT_REAL));
+        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanInStride (plan, dimension[param->dimensions], complex_strides));
+        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanOutStride (plan, dimension[param->dimensions], real_strides));
+        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanDistance (plan, complex_distance, real_distance));
+    }
+}
+
+static clfftPlanHandle
+create_amd_plan (cl_context context, cl_command_queue queue, UfoFftParameter *param, UfoFftDirection direction)
+{
+    /* we use param->dimension to index into this array! */
+    clfftDim dimension[4] = { 0, CLFFT_1D, CLFFT_2D, CLFFT_3D };
+    clfftPlanHandle plan;
+
+    UFO_RESOURCES_CHECK_CLERR (clfftCreateDefaultPlan (&plan, context, dimension[param->dimensions], param->size));
+    UFO_RESOURCES_CHECK_CLERR (clfftSetPlanBatchSize (plan, param->batch));
+    UFO_RESOURCES_CHECK_CLERR (clfftSetPlanPrecision (plan, CLFFT_SINGLE));
 
-        if (fft->amd_plan != 0) {
-            clfftDestroyPlan (&fft->amd_plan);
-            fft->amd_plan = 0;
+    if (param->layout == UFO_FFT_LAYOUT_REAL)
+        set_real_layout (plan, param, direction);
+    else
+        UFO_RESOURCES_CHECK_CLERR (clfftSetLayout (plan, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED));
+
+    UFO_RESOURCES_CHECK_CLERR (clfftSetResultLocation (plan, param->zeropad ? CLFFT_INPLACE : CLFFT_OUTOFPLACE));
+
+    /* Leave the inverse unnormalized like oclFFT, users scale on their own */
+    UFO_RESOURCES_CHECK_CLERR (clfftSetPlanScale (plan, CLFFT_BACKWARD, 1.0f));
+    UFO_RESOURCES_CHECK_CLERR (clfftBakePlan (plan, 1, &queue, NULL, NULL));
+
+    return plan;
+}
+#else
+static void
+release_real_emulation (UfoFft *fft)
+{
+    for (guint i = 0; i < N_REAL_KERNELS; i++) {
+        if (fft->real_kernels[i] != NULL) {
+            UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (fft->real_kernels[i]));
+            fft->real_kernels[i] = NULL;
+        }
+    }
+
+    if (fft->real_program != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseProgram (fft->real_program));
+        fft->real_program = NULL;
+    }
+
+    if (fft->scratch != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (fft->scratch));
+        fft->scratch = NULL;
+        fft->scratch_size = 0;
+    }
+}
+
+static cl_int
+setup_real_emulation (UfoFft *fft, UfoFftParameter *param)
+{
+    gsize scratch_size;
+    cl_int error = CL_SUCCESS;
+
+    if (fft->real_program == NULL) {
+        fft->real_program = clCreateProgramWithSource (fft->context, 1, &real_kernel_source, NULL, &error);
+
+        if (error != CL_SUCCESS)
+            return error;
+
+        error = clBuildProgram (fft->real_program, 0, NULL, NULL, NULL, NULL);
+
+        if (error != CL_SUCCESS)
+            return error;
+
+        for (guint i = 0; i < N_REAL_KERNELS; i++) {
+            fft->real_kernels[i] = clCreateKernel (fft->real_program, real_kernel_names[i], &error);
+
+            if (error != CL_SUCCESS)
+                return error;
         }
+    }
+
+    /* 1D rows are packed into half as many complex values, others expanded */
+    scratch_size = get_num_rows (param) * sizeof (cl_float) *
+                   (param->dimensions == UFO_FFT_1D ? param->size[0] : 2 * param->size[0]);
 
-        UFO_RESOURCES_CHECK_CLERR (clfftCreateDefaultPlan (&fft->amd_plan, context, dimension[param->dimensions], param->size));
-        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanBatchSize (fft->amd_plan, param->batch));
-        UFO_RESOURCES_CHECK_CLERR (clfftSetPlanPrecision (fft->amd_plan, CLFFT_SINGLE));
-        UFO_RESOURCES_CHECK_CLERR (clfftSetLayout (fft->amd_plan, CLFFT_COMPLEX_INTERLEAVED, CLFFT_COMPLEX_INTERLEAVED));
-        UFO_RESOURCES_CHECK_CLERR (clfftSetResultLocation (fft->amd_plan, param->zeropad ? CLFFT_INPLACE : CLFFT_OUTOFPLACE));
-        UFO_RESOURCES_CHECK_CLERR (clfftBakePlan (fft->amd_plan, 1, &queue, NULL, NULL));
+    if (fft->scratch != NULL && fft->scratch_size < scratch_size) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (fft->scratch));
+        fft->scratch = NULL;
     }
+
+    if (fft->scratch == NULL) {
+        fft->scratch = clCreateBuffer (fft->context, CL_MEM_READ_WRITE, scratch_size, NULL, &error);
+        fft->scratch_size = scratch_size;
+    }
+
+    return error;
+}
+
+static cl_int
+enqueue_real_kernel (UfoFft *fft, cl_command_queue queue, guint index,
+                     cl_mem in_mem, cl_mem out_mem, guint num_args, cl_int *args,
+                     gsize width, gsize rows,
+                     cl_uint num_events, cl_event *event_list, cl_event *event)
+{
+    cl_kernel kernel;
+    gsize global_work_size[2];
+
+    kernel = fft->real_kernels[index];
+    global_work_size[0] = width;
+    global_work_size[1] = rows;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &out_mem));
+
+    for (guint i = 0; i < num_args; i++)
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2 + i, sizeof (cl_int), &args[i]));
+
+    return clEnqueueNDRangeKernel (queue, kernel, 2, NULL, global_work_size, NULL,
+                                   num_events, event_list, event);
+}
+
+static cl_int
+execute_real_emulation (UfoFft *fft, FftPlan *plan, UfoFftParameter *param,
+                        cl_command_queue queue, UfoProfiler *profiler,
+                        cl_mem in_mem, cl_mem out_mem, UfoFftDirection direction,
+                        cl_uint num_events, cl_event *event_list, cl_event *event)
+{
+    guint pre_kernel;
+    guint post_kernel;
+    cl_int pre_args[3];
+    cl_int post_args[2];
+    guint num_pre_args;
+    guint num_post_args;
+    gsize pre_width;
+    gsize post_width;
+    gsize width;
+    gsize half_width;
+    gsize rows;
+    cl_int stride;
+    cl_int error;
+
+    error = setup_real_emulation (fft, param);
+
+    if (error != CL_SUCCESS)
+        return error;
+
+    width = param->size[0];
+    half_width = width / 2 + 1;
+    stride = (cl_int) get_real_stride (param);
+    rows = get_num_rows (param);
+
+    if (param->dimensions == UFO_FFT_1D) {
+        /* packed rows are transformed with a plan of half the length */
+        if (direction == UFO_FFT_FORWARD) {
+            pre_kernel = KERNEL_REAL_COPY;
+            pre_args[0] = stride;
+            pre_args[1] = (cl_int) width;
+            num_pre_args = 2;
+            pre_width = width;
+            post_kernel = KERNEL_REAL_SPLIT;
+            post_args[0] = (cl_int) width / 2;
+            num_post_args = 1;
+            post_width = half_width;
+        }
+        else {
+            pre_kernel = KERNEL_REAL_MERGE;
+            pre_args[0] = (cl_int) width / 2;
+            num_pre_args = 1;
+            pre_width = width / 2;
+            post_kernel = KERNEL_REAL_COPY;
+            post_args[0] = (cl_int) width;
+            post_args[1] = stride;
+            num_post_args = 2;
+            post_width = width;
+        }
+    }
+    else {
+        if (direction == UFO_FFT_FORWARD) {
+            pre_kernel = KERNEL_REAL_SPREAD;
+            pre_args[0] = stride;
+            num_pre_args = 1;
+            pre_width = width;
+            post_kernel = KERNEL_HERMITIAN_CROP;
+            post_args[0] = (cl_int) width;
+            num_post_args = 1;
+            post_width = half_width;
+        }
+        else {
+            pre_kernel = KERNEL_HERMITIAN_EXPAND;
+            pre_args[0] = (cl_int) half_width;
+            pre_args[1] = (cl_int) param->size[1];
+            pre_args[2] = param->dimensions == UFO_FFT_3D ? (cl_int) param->size[2] : 1;
+            num_pre_args = 3;
+            pre_width = width;
+            post_kernel = KERNEL_REAL_EXTRACT;
+            post_args[0] = stride;
+            num_post_args = 1;
+            post_width = width;
+        }
+    }
+
+    error = enqueue_real_kernel (fft, queue, pre_kernel, in_mem, fft->scratch, num_pre_args, pre_args,
+                                 pre_width, rows, num_events, event_list, NULL);
+
+    if (error == CL_SUCCESS)
+        error = clFFT_ExecuteInterleaved_Ufo (queue, plan->apple_plan, param->batch,
+                                              direction == UFO_FFT_FORWARD ? clFFT_Forward : clFFT_Inverse,
+                                              fft->scratch, fft->scratch, 0, NULL, NULL, profiler);
+
+    if (error == CL_SUCCESS)
+        error = enqueue_real_kernel (fft, queue, post_kernel, fft->scratch, out_mem, num_post_args, post_args,
+                                     post_width, rows, 0, NULL, event);
+
+    return error;
+}
+#endif
+
+static gboolean
+plan_matches (FftPlan *plan, cl_context context, cl_command_queue queue, UfoFftParameter *param)
+{
+    if (plan->context != context || plan->queue != queue ||
+        plan->param.dimensions != param->dimensions ||
+        plan->param.layout != param->layout ||
+        plan->param.size[0] != param->size[0] ||
+        plan->param.size[1] != param->size[1] ||
+        plan->param.size[2] != param->size[2])
+        return FALSE;
+
+#ifdef HAVE_AMD
+    /* batch size and result location are baked into the plan */
+    return plan->param.batch == param->batch && plan->param.zeropad == param->zeropad;
 #else
-    if (fft->apple_plan == NULL || changed) {
+    return TRUE;
+#endif
+}
+
+static void
+plan_free (FftPlan *plan)
+{
+#ifdef HAVE_AMD
+    if (plan->amd_plan != 0)
+        clfftDestroyPlan (&plan->amd_plan);
+
+    if (plan->amd_inverse_plan != 0)
+        clfftDestroyPlan (&plan->amd_inverse_plan);
+#else
+    if (plan->apple_plan != NULL)
+        clFFT_DestroyPlan (plan->apple_plan);
+#endif
+
+    UFO_RESOURCES_CHECK_CLERR (clReleaseCommandQueue (plan->queue));
+    UFO_RESOURCES_CHECK_CLERR (clReleaseContext (plan->context));
+    g_free (plan);
+}
+
+static FftPlan *
+plan_new (cl_context context, cl_command_queue queue, UfoFftParameter *param, cl_int *error)
+{
+    FftPlan *plan;
+
+    plan = g_malloc0 (sizeof (FftPlan));
+    plan->context = context;
+    plan->queue = queue;
+    memcpy (&plan->param, param, sizeof (UfoFftParameter));
+
+    /* keep handles valid, so that they cannot be mistaken for new ones */
+    UFO_RESOURCES_CHECK_CLERR (clRetainContext (context));
+    UFO_RESOURCES_CHECK_CLERR (clRetainCommandQueue (queue));
+
+#ifdef HAVE_AMD
+    plan->amd_plan = create_amd_plan (context, queue, param, UFO_FFT_FORWARD);
+
+    /* layouts of real transforms differ per direction */
+    if (param->layout == UFO_FFT_LAYOUT_REAL)
+        plan->amd_inverse_plan = create_amd_plan (context, queue, param, UFO_FFT_BACKWARD);
+
+    *error = CL_SUCCESS;
+#else
+    {
         clFFT_Dim3 size;
 
         /* we use param->dimension to index into this array! */
@@ -107,15 +535,109 @@ ufo_fft_update (UfoFft *fft, cl_context context, cl_command_queue queue, UfoFftP
         size.y = param->size[1];
         size.z = param->size[2];
 
-        if (fft->apple_plan != NULL) {
-            clFFT_DestroyPlan (fft->apple_plan);
-            fft->apple_plan = NULL;
+        if (param->layout == UFO_FFT_LAYOUT_REAL && param->dimensions == UFO_FFT_1D)
+            size.x = param->size[0] / 2;
+
+        plan->apple_plan = clFFT_CreatePlan (context, size, dimension[param->dimensions], clFFT_InterleavedComplexFormat, error);
+    }
+#endif
+
+    if (*error != CL_SUCCESS) {
+        plan_free (plan);
+        return NULL;
+    }
+
+    return plan;
+}
+
+/*
+ * Take a plan out of the idle cache or create a new one. The caller has
+ * exclusive use of the plan until it is given back with plan_release().
+ */
+static FftPlan *
+plan_acquire (cl_context context, cl_command_queue queue, UfoFftParameter *param, cl_int *error)
+{
+    FftPlan *plan = NULL;
+
+    g_mutex_lock (&plan_mutex);
+
+    for (GList *it = g_queue_peek_head_link (&idle_plans); it != NULL; it = g_list_next (it)) {
+        if (plan_matches ((FftPlan *) it->data, context, queue, param)) {
+            plan = (FftPlan *) it->data;
+            g_queue_delete_link (&idle_plans, it);
+            break;
         }
+    }
 
-        fft->apple_plan = clFFT_CreatePlan (context, size, dimension[param->dimensions], clFFT_InterleavedComplexFormat, &error);
+    g_mutex_unlock (&plan_mutex);
+
+    if (plan != NULL) {
+        *error = CL_SUCCESS;
+        g_debug ("INFO Re-use cached FFT plan");
+        return plan;
     }
+
+    return plan_new (context, queue, param, error);
+}
+
+static void
+plan_release (FftPlan *plan)
+{
+    GQueue evicted = G_QUEUE_INIT;
+
+    if (plan == NULL)
+        return;
+
+    g_mutex_lock (&plan_mutex);
+    g_queue_push_head (&idle_plans, plan);
+
+    while (g_queue_get_length (&idle_plans) > MAX_IDLE_PLANS)
+        g_queue_push_tail (&evicted, g_queue_pop_tail (&idle_plans));
+
+    g_mutex_unlock (&plan_mutex);
+
+    while (!g_queue_is_empty (&evicted))
+        plan_free ((FftPlan *) g_queue_pop_head (&evicted));
+}
+
+cl_int
+ufo_fft_update (UfoFft *fft, cl_context context, cl_command_queue queue, UfoFftParameter *param)
+{
+    gboolean changed;
+    cl_int error;
+
+    error = CL_SUCCESS;
+    changed = param->size[0] != fft->seen.size[0] ||
+              param->size[1] != fft->seen.size[1] ||
+              param->size[2] != fft->seen.size[2] ||
+              param->dimensions != fft->seen.dimensions ||
+              param->batch != fft->seen.batch ||
+              param->layout != fft->seen.layout ||
+              param->zeropad != fft->seen.zeropad ||
+              context != fft->context || queue != fft->queue;
+
+    if (param->layout == UFO_FFT_LAYOUT_REAL && param->size[0] % 2) {
+        g_warning ("Real FFT requires an even width but got %" G_GSIZE_FORMAT, param->size[0]);
+        return CL_INVALID_VALUE;
+    }
+
+    if (fft->plan == NULL || changed) {
+#ifndef HAVE_AMD
+        if (context != fft->context)
+            release_real_emulation (fft);
 #endif
 
+        memcpy (&fft->seen, param, sizeof (UfoFftParameter));
+        fft->context = context;
+        fft->queue = queue;
+
+        /* other plans go back to the cache where other nodes can pick them up */
+        plan_release (fft->plan);
+        plan_release (fft->batch_plan);
+        fft->batch_plan = NULL;
+        fft->plan = plan_acquire (context, queue, param, &error);
+    }
+
     return error;
 }
 
@@ -124,14 +646,66 @@ ufo_fft_execute (UfoFft *fft, cl_command_queue queue, UfoProfiler *profiler,
                  cl_mem in_mem, cl_mem out_mem, UfoFftDirection direction,
                  cl_uint num_events, cl_event *event_list, cl_event *event)
 {
+    return ufo_fft_execute_batch (fft, queue, profiler, in_mem, out_mem, direction, 1,
+                                  num_events, event_list, event);
+}
+
+/**
+ * ufo_fft_execute_batch:
+ * @fft: A #UfoFft
+ * @queue: Command queue
+ * @profiler: Profiler used for the transform
+ * @in_mem: Input buffer
+ * @out_mem: Output buffer
+ * @direction: Transform direction
+ * @num_frames: Number of frames stacked along the third dimension
+ * @num_events: Number of events to wait for
+ * @event_list: Events to wait for
+ * @event: Location for the event of the transform or %NULL
+ *
+ * Transform @num_frames consecutive frames, each described by the parameters
+ * of the last ufo_fft_update(), in one call.
+ */
+cl_int
+ufo_fft_execute_batch (UfoFft *fft, cl_command_queue queue, UfoProfiler *profiler,
+                       cl_mem in_mem, cl_mem out_mem, UfoFftDirection direction,
+                       gsize num_frames,
+                       cl_uint num_events, cl_event *event_list, cl_event *event)
+{
+    UfoFftParameter param;
+    FftPlan *plan;
+    cl_int error = CL_SUCCESS;
+
+    memcpy (&param, &fft->seen, sizeof (UfoFftParameter));
+    param.batch *= num_frames;
+    plan = fft->plan;
+
+    if (num_frames > 1) {
+        if (fft->batch_plan == NULL || fft->num_batch_frames != num_frames) {
+            plan_release (fft->batch_plan);
+            fft->batch_plan = plan_acquire (fft->context, fft->queue, &param, &error);
+            fft->num_batch_frames = num_frames;
+
+            if (error != CL_SUCCESS)
+                return error;
+        }
+
+        plan = fft->batch_plan;
+    }
+
 #ifdef HAVE_AMD
-    return clfftEnqueueTransform (fft->amd_plan,
+    return clfftEnqueueTransform (direction == UFO_FFT_BACKWARD && plan->amd_inverse_plan != 0 ?
+                                    plan->amd_inverse_plan : plan->amd_plan,
                                   direction == UFO_FFT_FORWARD ? CLFFT_FORWARD : CLFFT_BACKWARD,
                                   1, &queue,
                                   num_events, event_list, event, &in_mem, &out_mem, NULL);
 #else
-    return clFFT_ExecuteInterleaved_Ufo (queue, fft->apple_plan,
-                                         fft->seen.batch,
+    if (param.layout == UFO_FFT_LAYOUT_REAL)
+        return execute_real_emulation (fft, plan, &param, queue, profiler, in_mem, out_mem, direction,
+                                       num_events, event_list, event);
+
+    return clFFT_ExecuteInterleaved_Ufo (queue, plan->apple_plan,
+                                         param.batch,
                                          direction == UFO_FFT_FORWARD ? clFFT_Forward : clFFT_Inverse,
                                          in_mem, out_mem, num_events, event_list, event, profiler);
 #endif
@@ -140,19 +714,26 @@ ufo_fft_execute (UfoFft *fft, cl_command_queue queue, UfoProfiler *profiler,
 void
 ufo_fft_destroy (UfoFft *fft)
 {
-#ifdef HAVE_AMD
-    g_mutex_lock (&amd_mutex);
+    plan_release (fft->plan);
+    plan_release (fft->batch_plan);
 
-    clfftDestroyPlan (&fft->amd_plan);
-    ffts_created = g_list_remove (ffts_created, fft);
+#ifndef HAVE_AMD
+    release_real_emulation (fft);
+#endif
 
-    if (g_list_length (ffts_created) == 0)
-        clfftTeardown ();
+    g_mutex_lock (&plan_mutex);
 
-    g_mutex_unlock (&amd_mutex);
-#else
-    clFFT_DestroyPlan (fft->apple_plan);
+    /* Idle plans keep their context and queue alive and would be invalid after
+     * a teardown, so they go with the last user */
+    if (--num_ffts == 0) {
+        while (!g_queue_is_empty (&idle_plans))
+            plan_free ((FftPlan *) g_queue_pop_head (&idle_plans));
+
+#ifdef HAVE_AMD
+        clfftTeardown ();
 #endif
+    }
 
+    g_mutex_unlock (&plan_mutex);
     g_free (fft);
 }
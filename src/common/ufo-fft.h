@@ -28,6 +28,13 @@
 
 #include <ufo/ufo.h>
 
+/*
+ * With UFO_FFT_LAYOUT_REAL, size[0] is the (even) number of real samples per
+ * row and the forward transform produces only the size[0] / 2 + 1 non-redundant
+ * complex values of each row, the backward transform consumes them. If zeropad
+ * is set, the transform is computed in-place and real rows are stored with a
+ * stride of 2 * (size[0] / 2 + 1) floats, otherwise real rows are contiguous.
+ */
 typedef struct {
     enum {
         UFO_FFT_1D = 1,
@@ -35,6 +42,11 @@ typedef struct {
         UFO_FFT_3D
     } dimensions;
 
+    enum {
+        UFO_FFT_LAYOUT_COMPLEX = 0,
+        UFO_FFT_LAYOUT_REAL
+    } layout;
+
     gsize size[3];
     gsize batch;
     gboolean zeropad;
@@ -61,6 +73,17 @@ cl_int  ufo_fft_execute (UfoFft            *fft,
                          cl_uint            num_events,
                          cl_event          *event_list,
                          cl_event          *event);
+cl_int  ufo_fft_execute_batch
+                        (UfoFft            *fft,
+                         cl_command_queue   queue,
+                         UfoProfiler       *profiler,
+                         cl_mem             in_mem,
+                         cl_mem             out_mem,
+                         UfoFftDirection    direction,
+                         gsize              num_frames,
+                         cl_uint            num_events,
+                         cl_event          *event_list,
+                         cl_event          *event);
 void    ufo_fft_destroy (UfoFft            *fft);
 
 #endif
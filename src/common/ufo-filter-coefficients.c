@@ -0,0 +1,283 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <math.h>
+
+#include "ufo-filter-coefficients.h"
+#include "ufo-fft.h"
+
+typedef void (*SetupFunc)(UfoFilterParameter *param, gfloat *coefficients, guint width);
+
+static void compute_ramp_coefficients (UfoFilterParameter *, gfloat *, guint);
+static void compute_real_space_ramp_coefficients (UfoFilterParameter *, gfloat *, guint);
+static void compute_butterworth_coefficients (UfoFilterParameter *, gfloat *, guint);
+static void compute_faris_byer_coefficients (UfoFilterParameter *, gfloat *, guint);
+static void compute_hamming_coefficients (UfoFilterParameter *, gfloat *, guint);
+static void compute_bh3_coefficients (UfoFilterParameter *, gfloat *, guint);
+
+GEnumValue ufo_filter_type_values[] = {
+    { UFO_FILTER_RAMP,          "FILTER_RAMP",          "ramp" },
+    { UFO_FILTER_RAMP_FROMREAL, "FILTER_RAMP_FROMREAL", "ramp-fromreal" },
+    { UFO_FILTER_BUTTERWORTH,   "FILTER_BUTTERWORTH",   "butterworth"},
+    { UFO_FILTER_FARIS_BYER,    "FILTER_FARIS_BYER",    "faris-byer"},
+    { UFO_FILTER_HAMMING,       "FILTER_HAMMING",       "hamming"},
+    { UFO_FILTER_BH3,           "FILTER_BH3",           "bh3" },
+    { 0, NULL, NULL}
+};
+
+static SetupFunc filter_funcs[] = {
+    &compute_ramp_coefficients,
+    &compute_real_space_ramp_coefficients,
+    &compute_butterworth_coefficients,
+    &compute_faris_byer_coefficients,
+    &compute_hamming_coefficients,
+    &compute_bh3_coefficients,
+};
+
+static void
+mirror_coefficients (gfloat *filter, guint width)
+{
+    for (guint k = width/2 + 2; k < width; k += 2) {
+        filter[k] = filter[width - k];
+        filter[k + 1] = filter[width - k + 1];
+    }
+}
+
+static void
+compute_ramp_coefficients (UfoFilterParameter *param,
+                           gfloat *filter,
+                           guint width)
+{
+    const gdouble step = 2.0 / width;
+
+    for (guint k = 1; k < width / 4 + 1; k++) {
+        filter[2*k] = k * step * param->scale;
+        filter[2*k + 1] = filter[2*k];
+    }
+}
+
+static void
+compute_real_space_ramp_coefficients (UfoFilterParameter *param,
+                                      gfloat *filter,
+                                      guint width)
+{
+    filter[0] = filter[1] = 0.25 * param->scale;
+
+    for (guint k = 1; k < width / 4 + 1; k++) {
+        filter[2*k] = k % 2 ? - param->scale / (k * k * G_PI * G_PI) : 0.0;
+        filter[2*k + 1] = filter[2*k];
+    }
+}
+
+static void
+compute_butterworth_coefficients (UfoFilterParameter *param,
+                                  gfloat *filter,
+                                  guint width)
+{
+    const gdouble step = 2.0 / width;
+
+    for (guint k = 0; k < (width / 4) + 1; k++) {
+        const gdouble f = k * step;
+        filter[2*k] = (gfloat) (f / (1.0 + pow (f / param->cutoff, 2.0 * param->bw_order)) * param->scale);
+        filter[2*k+1] = filter[2*k];
+    }
+}
+
+static void
+compute_hamming_coefficients (UfoFilterParameter *param,
+                              gfloat *filter,
+                              guint width)
+{
+    const gdouble step = 2.0 / width;
+
+    for (guint k = 0; k < (width / 4) + 1; k++) {
+        const gdouble f = k * step;
+
+        filter[2*k] = f < param->cutoff ? f * (0.54 + 0.46 * cos (G_PI * f / param->cutoff)) * param->scale : 0;
+        filter[2*k+1] = filter[2*k];
+    }
+}
+
+static void
+compute_bh3_coefficients (UfoFilterParameter *param,
+                           gfloat *filter,
+                           guint width)
+{
+    const gdouble step = 2.0 / width;
+    const gdouble a0 = 0.42;
+    const gdouble a1 = 0.5;
+    const gdouble a2 = 0.08;
+    for (guint k = 1; k < width / 4 + 1; k++) {
+        const gdouble f = k * step;
+        filter[2*k] = f * ( a0 + a1 * cos(f * G_PI) + a2 * cos(2.0 * f * G_PI ) ) * param->scale;
+        filter[2*k + 1] = filter[2*k];
+    }
+}
+
+static guint
+get_padding_value (guint x)
+{
+    guint padding = 2 * x;
+    guint result = 1;
+
+    while (result < padding)
+        result *= 2;
+
+    return result;
+}
+
+static void
+compute_faris_byer_coefficients (UfoFilterParameter *param,
+                                 gfloat *filter,
+                                 guint width)
+{
+    const gdouble pi_squared_tau = G_PI * G_PI * param->fb_tau;
+    const gdouble sin_theta_2 = - sin (param->fb_theta) / 2;
+    const guint padding = get_padding_value (width);
+
+    filter[0] = 0;
+
+    for (guint x = 1; x <= width / 2; x++) {
+        if (x % 2 != 0)
+            filter[x] = 1 / (pi_squared_tau * x);
+    }
+
+    for (guint i = width / 2 + 1; i < width; i++) {
+        guint x = width + 1 - i;
+
+        if (x % 2 != 0)
+            filter[padding - width - i - 1] = sin_theta_2 / (x * x * pi_squared_tau);
+    }
+}
+
+#ifndef HAVE_FFT
+/*
+ * Without an FFT library the width / 2 complex coefficients are transformed
+ * with a direct DFT on the host. This is done once per filter, so the
+ * quadratic cost does not matter.
+ */
+static void
+transform_coefficients (gfloat *filter, guint width)
+{
+    const guint n = width / 2;
+    gdouble *twiddles;
+    gdouble *result;
+
+    twiddles = g_new (gdouble, 2 * n);
+    result = g_new0 (gdouble, width);
+
+    for (guint k = 0; k < n; k++) {
+        twiddles[2*k] = cos (-2.0 * G_PI * k / n);
+        twiddles[2*k + 1] = sin (-2.0 * G_PI * k / n);
+    }
+
+    for (guint j = 0; j < n; j++) {
+        for (guint k = 0; k < n; k++) {
+            const guint t = (guint) (((guint64) j * k) % n);
+            const gdouble c = twiddles[2*t];
+            const gdouble s = twiddles[2*t + 1];
+
+            result[2*j] += filter[2*k] * c - filter[2*k + 1] * s;
+            result[2*j + 1] += filter[2*k] * s + filter[2*k + 1] * c;
+        }
+    }
+
+    for (guint i = 0; i < width; i++)
+        filter[i] = (gfloat) result[i];
+
+    g_free (twiddles);
+    g_free (result);
+}
+#endif
+
+/**
+ * ufo_filter_coefficients_new:
+ * @param: filter parameters
+ * @width: width of the complex interleaved frequency data, i.e. twice the
+ * number of complex values
+ * @context: OpenCL context
+ * @queue: command queue used to transform real space coefficients
+ * @profiler: profiler used for the transformation
+ *
+ * Compute the filter coefficients for one row of interleaved complex data and
+ * upload them to a new device buffer.
+ *
+ * Returns: a new device buffer with @width floats.
+ */
+cl_mem
+ufo_filter_coefficients_new (UfoFilterParameter *param,
+                             guint width,
+                             cl_context context,
+                             cl_command_queue queue,
+                             UfoProfiler *profiler)
+{
+    cl_mem filter_mem;
+    cl_int cl_err;
+    gfloat *coefficients;
+
+    coefficients = g_malloc0 (width * sizeof (gfloat));
+
+    coefficients[0] = 0.5 / width;
+    coefficients[1] = coefficients[0];
+
+    filter_funcs[param->type] (param, coefficients, width);
+    mirror_coefficients (coefficients, width);
+
+#ifndef HAVE_FFT
+    if (param->type == UFO_FILTER_RAMP_FROMREAL)
+        transform_coefficients (coefficients, width);
+#endif
+
+    filter_mem = clCreateBuffer (context,
+                                 CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                                 width * sizeof(float),
+                                 coefficients,
+                                 &cl_err);
+    UFO_RESOURCES_CHECK_CLERR (cl_err);
+    g_free (coefficients);
+
+#ifdef HAVE_FFT
+    if (param->type == UFO_FILTER_RAMP_FROMREAL) {
+        UfoFftParameter fft_param;
+        UfoFft *fft;
+
+        fft_param.dimensions = UFO_FFT_1D;
+        fft_param.layout = UFO_FFT_LAYOUT_COMPLEX;
+        fft_param.size[0] = width / 2;
+        fft_param.size[1] = 1;
+        fft_param.size[2] = 1;
+        fft_param.batch = 1;
+        /* transform in-place */
+        fft_param.zeropad = TRUE;
+
+        fft = ufo_fft_new ();
+        UFO_RESOURCES_CHECK_CLERR (ufo_fft_update (fft, context, queue, &fft_param));
+        UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (fft, queue, profiler, filter_mem, filter_mem,
+                                                    UFO_FFT_FORWARD, 0, NULL, NULL));
+
+        /* The plan must not be destroyed before the transform is finished */
+        UFO_RESOURCES_CHECK_CLERR (clFinish (queue));
+        ufo_fft_destroy (fft);
+    }
+#endif
+
+    return filter_mem;
+}
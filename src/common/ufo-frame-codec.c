@@ -0,0 +1,482 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#include "ufo-frame-codec.h"
+
+/*
+ * Encoded layout:
+ *
+ *   CodecHeader
+ *   guint32 block_sizes[num_blocks]
+ *   block data
+ *
+ * Block i holds the narrowed elements [i * n / num_blocks, (i + 1) * n /
+ * num_blocks). If the most significant bit of its size is set, the block is
+ * stored without compression.
+ */
+#define BLOCK_SIZE          (256 * 1024)
+#define MAX_BLOCKS          256
+#define BLOCK_STORED        0x80000000u
+#define ZSTD_LEVEL          1
+
+typedef struct {
+    gfloat scale;
+    gfloat offset;
+    guint32 num_blocks;
+} __attribute__((packed)) CodecHeader;
+
+gboolean
+ufo_frame_compression_available (UfoFrameCompression compression)
+{
+    switch (compression) {
+        case UFO_FRAME_COMPRESSION_NONE:
+            return TRUE;
+#ifdef HAVE_LZ4
+        case UFO_FRAME_COMPRESSION_LZ4:
+            return TRUE;
+#endif
+#ifdef HAVE_ZSTD
+        case UFO_FRAME_COMPRESSION_ZSTD:
+            return TRUE;
+#endif
+        default:
+            return FALSE;
+    }
+}
+
+static gsize
+get_element_size (UfoFrameEncoding encoding)
+{
+    return encoding == UFO_FRAME_ENCODING_FLOAT32 ? sizeof (gfloat) : sizeof (guint16);
+}
+
+/*
+ * IEEE 754 binary16 conversion with round to nearest even, overflow saturates
+ * to infinity and NaN stays NaN.
+ */
+static inline guint16
+float_to_half (gfloat value)
+{
+    union { gfloat f; guint32 u; } v = { value };
+    guint32 sign = (v.u >> 16) & 0x8000;
+    guint32 exponent = v.u & 0x7f800000;
+    guint32 mantissa;
+
+    if (exponent >= 0x47800000) {
+        if (exponent == 0x7f800000 && (v.u & 0x007fffff))
+            return (guint16) (sign | 0x7e00);
+
+        return (guint16) (sign | 0x7c00);
+    }
+
+    if (exponent <= 0x38000000) {
+        /* Subnormal or zero */
+        if (exponent < 0x33000000)
+            return (guint16) sign;
+
+        mantissa = (0x00800000 + (v.u & 0x007fffff)) >> (113 - (exponent >> 23));
+
+        if ((mantissa & 0x3fff) != 0x1000 || (v.u & 0x7ff))
+            mantissa += 0x1000;
+
+        return (guint16) (sign + (mantissa >> 13));
+    }
+
+    mantissa = v.u & 0x007fffff;
+
+    if ((mantissa & 0x3fff) != 0x1000)
+        mantissa += 0x1000;
+
+    /* A carry of the mantissa correctly increments the exponent */
+    return (guint16) (sign + ((exponent - 0x38000000) >> 13) + (mantissa >> 13));
+}
+
+static inline gfloat
+half_to_float (guint16 value)
+{
+    union { gfloat f; guint32 u; } v;
+    guint32 sign = ((guint32) value & 0x8000) << 16;
+    guint32 exponent = (value >> 10) & 0x1f;
+    guint32 mantissa = value & 0x3ff;
+
+    if (exponent == 0) {
+        /* Zero or subnormal, 2^-24 is the smallest subnormal */
+        v.f = ldexpf ((gfloat) mantissa, -24);
+        v.u |= sign;
+        return v.f;
+    }
+
+    if (exponent == 31)
+        v.u = sign | 0x7f800000 | (mantissa << 13);
+    else
+        v.u = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+
+    return v.f;
+}
+
+static void
+find_min_max (const gfloat *data, gsize n, gfloat *min, gfloat *max)
+{
+    gfloat lower = G_MAXFLOAT;
+    gfloat upper = -G_MAXFLOAT;
+
+#pragma omp parallel for reduction(min:lower) reduction(max:upper)
+    for (gsize i = 0; i < n; i++) {
+        if (data[i] < lower)
+            lower = data[i];
+        if (data[i] > upper)
+            upper = data[i];
+    }
+
+    *min = lower;
+    *max = upper;
+}
+
+static gpointer
+narrow (const gfloat *data, gsize n, UfoFrameEncoding encoding, CodecHeader *header)
+{
+    guint16 *narrowed;
+
+    header->scale = 1.0f;
+    header->offset = 0.0f;
+
+    if (encoding == UFO_FRAME_ENCODING_FLOAT32)
+        return (gpointer) data;
+
+    narrowed = g_malloc (n * sizeof (guint16));
+
+    if (encoding == UFO_FRAME_ENCODING_FLOAT16) {
+#pragma omp parallel for simd
+        for (gsize i = 0; i < n; i++)
+            narrowed[i] = float_to_half (data[i]);
+    }
+    else {
+        gfloat min, max, inv_scale;
+
+        /* Map the frame range to the full 16 bit range */
+        find_min_max (data, n, &min, &max);
+        header->offset = min;
+        header->scale = max > min ? (max - min) / 65535.0f : 1.0f;
+        inv_scale = 1.0f / header->scale;
+
+#pragma omp parallel for simd
+        for (gsize i = 0; i < n; i++)
+            narrowed[i] = (guint16) CLAMP ((data[i] - min) * inv_scale + 0.5f, 0.0f, 65535.0f);
+    }
+
+    return narrowed;
+}
+
+static void
+widen (const guint16 *narrowed, gfloat *data, gsize n, UfoFrameEncoding encoding, const CodecHeader *header)
+{
+    const gfloat scale = header->scale;
+    const gfloat offset = header->offset;
+
+    if (encoding == UFO_FRAME_ENCODING_FLOAT16) {
+#pragma omp parallel for simd
+        for (gsize i = 0; i < n; i++)
+            data[i] = half_to_float (narrowed[i]);
+    }
+    else {
+#pragma omp parallel for simd
+        for (gsize i = 0; i < n; i++)
+            data[i] = narrowed[i] * scale + offset;
+    }
+}
+
+/*
+ * Group the i-th bytes of all elements together, which makes the slowly
+ * varying high bytes of neighbouring pixels compress much better.
+ */
+static void
+shuffle (const guint8 *src, guint8 *dst, gsize n, gsize element_size)
+{
+    for (gsize b = 0; b < element_size; b++)
+        for (gsize i = 0; i < n; i++)
+            dst[b * n + i] = src[i * element_size + b];
+}
+
+static void
+unshuffle (const guint8 *src, guint8 *dst, gsize n, gsize element_size)
+{
+    for (gsize b = 0; b < element_size; b++)
+        for (gsize i = 0; i < n; i++)
+            dst[i * element_size + b] = src[b * n + i];
+}
+
+static gsize
+compress_bound (UfoFrameCompression compression, gsize size)
+{
+    switch (compression) {
+#ifdef HAVE_LZ4
+        case UFO_FRAME_COMPRESSION_LZ4:
+            return (gsize) LZ4_compressBound ((int) size);
+#endif
+#ifdef HAVE_ZSTD
+        case UFO_FRAME_COMPRESSION_ZSTD:
+            return ZSTD_compressBound (size);
+#endif
+        default:
+            return size;
+    }
+}
+
+/* Returns the compressed size or 0 if the block does not shrink */
+static gsize
+compress_block (UfoFrameCompression compression, const guint8 *src, gsize size, guint8 *dst, gsize dst_size)
+{
+    gsize result = 0;
+
+    switch (compression) {
+#ifdef HAVE_LZ4
+        case UFO_FRAME_COMPRESSION_LZ4:
+            result = (gsize) MAX (LZ4_compress_default ((const char *) src, (char *) dst, (int) size, (int) dst_size), 0);
+            break;
+#endif
+#ifdef HAVE_ZSTD
+        case UFO_FRAME_COMPRESSION_ZSTD:
+            result = ZSTD_compress (dst, dst_size, src, size, ZSTD_LEVEL);
+            result = ZSTD_isError (result) ? 0 : result;
+            break;
+#endif
+        default:
+            break;
+    }
+
+    return result < size ? result : 0;
+}
+
+static gboolean
+decompress_block (UfoFrameCompression compression, const guint8 *src, gsize size, guint8 *dst, gsize dst_size)
+{
+    switch (compression) {
+#ifdef HAVE_LZ4
+        case UFO_FRAME_COMPRESSION_LZ4:
+            return LZ4_decompress_safe ((const char *) src, (char *) dst, (int) size, (int) dst_size) == (int) dst_size;
+#endif
+#ifdef HAVE_ZSTD
+        case UFO_FRAME_COMPRESSION_ZSTD:
+            return ZSTD_decompress (dst, dst_size, src, size) == dst_size;
+#endif
+        default:
+            return FALSE;
+    }
+}
+
+static guint
+get_num_blocks (gsize size, UfoFrameCompression compression)
+{
+    if (compression == UFO_FRAME_COMPRESSION_NONE)
+        return 1;
+
+    return (guint) CLAMP (size / BLOCK_SIZE, 1, MAX_BLOCKS);
+}
+
+/*
+ * Encode @num_pixels floats of @data. Returns newly allocated memory which must
+ * be freed with g_free.
+ */
+gpointer
+ufo_frame_encode (const gfloat *data,
+                  gsize num_pixels,
+                  UfoFrameEncoding encoding,
+                  UfoFrameCompression compression,
+                  gsize *encoded_size)
+{
+    CodecHeader header;
+    const guint8 *narrowed;
+    guint8 **blocks;
+    guint32 *block_sizes;
+    guint8 *encoded;
+    gsize element_size, offset;
+    guint num_blocks;
+
+    g_return_val_if_fail (ufo_frame_compression_available (compression), NULL);
+
+    element_size = get_element_size (encoding);
+    narrowed = narrow (data, num_pixels, encoding, &header);
+    num_blocks = get_num_blocks (num_pixels * element_size, compression);
+    header.num_blocks = num_blocks;
+    blocks = g_new0 (guint8 *, num_blocks);
+    block_sizes = g_new0 (guint32, num_blocks);
+
+#pragma omp parallel for schedule(dynamic)
+    for (guint i = 0; i < num_blocks; i++) {
+        gsize first = i * num_pixels / num_blocks;
+        gsize n = (i + 1) * num_pixels / num_blocks - first;
+        gsize size = n * element_size;
+        const guint8 *src = narrowed + first * element_size;
+        guint8 *shuffled;
+        gsize compressed_size = 0;
+
+        if (compression == UFO_FRAME_COMPRESSION_NONE) {
+            blocks[i] = (guint8 *) src;
+            block_sizes[i] = (guint32) size | BLOCK_STORED;
+            continue;
+        }
+
+        shuffled = g_malloc (size);
+        shuffle (src, shuffled, n, element_size);
+        blocks[i] = g_malloc (compress_bound (compression, size));
+        compressed_size = compress_block (compression, shuffled, size, blocks[i], compress_bound (compression, size));
+
+        if (compressed_size > 0) {
+            block_sizes[i] = (guint32) compressed_size;
+            g_free (shuffled);
+        }
+        else {
+            g_free (blocks[i]);
+            blocks[i] = shuffled;
+            block_sizes[i] = (guint32) size | BLOCK_STORED;
+        }
+    }
+
+    *encoded_size = sizeof (CodecHeader) + num_blocks * sizeof (guint32);
+
+    for (guint i = 0; i < num_blocks; i++)
+        *encoded_size += block_sizes[i] & ~BLOCK_STORED;
+
+    encoded = g_malloc (*encoded_size);
+    memcpy (encoded, &header, sizeof (CodecHeader));
+    memcpy (encoded + sizeof (CodecHeader), block_sizes, num_blocks * sizeof (guint32));
+    offset = sizeof (CodecHeader) + num_blocks * sizeof (guint32);
+
+    for (guint i = 0; i < num_blocks; i++) {
+        memcpy (encoded + offset, blocks[i], block_sizes[i] & ~BLOCK_STORED);
+        offset += block_sizes[i] & ~BLOCK_STORED;
+
+        if (compression != UFO_FRAME_COMPRESSION_NONE)
+            g_free (blocks[i]);
+    }
+
+    if ((gconstpointer) narrowed != (gconstpointer) data)
+        g_free ((gpointer) narrowed);
+
+    g_free (blocks);
+    g_free (block_sizes);
+
+    return encoded;
+}
+
+/*
+ * Decode @encoded into @num_pixels floats of @data. Returns FALSE if the data
+ * is malformed or the compression is not supported.
+ */
+gboolean
+ufo_frame_decode (gconstpointer encoded,
+                  gsize encoded_size,
+                  gfloat *data,
+                  gsize num_pixels,
+                  UfoFrameEncoding encoding,
+                  UfoFrameCompression compression)
+{
+    CodecHeader header;
+    const guint8 *src = encoded;
+    const guint32 *block_sizes;
+    gsize *offsets;
+    guint8 *narrowed;
+    gsize element_size, offset;
+    gboolean success = TRUE;
+
+    if (!ufo_frame_compression_available (compression) || encoded_size < sizeof (CodecHeader))
+        return FALSE;
+
+    memcpy (&header, src, sizeof (CodecHeader));
+
+    if (header.num_blocks == 0 || header.num_blocks > MAX_BLOCKS ||
+        encoded_size < sizeof (CodecHeader) + header.num_blocks * sizeof (guint32))
+        return FALSE;
+
+    element_size = get_element_size (encoding);
+    block_sizes = (const guint32 *) (src + sizeof (CodecHeader));
+    offsets = g_new0 (gsize, header.num_blocks);
+    offset = sizeof (CodecHeader) + header.num_blocks * sizeof (guint32);
+
+    for (guint i = 0; i < header.num_blocks; i++) {
+        offsets[i] = offset;
+        offset += block_sizes[i] & ~BLOCK_STORED;
+    }
+
+    if (offset != encoded_size) {
+        g_free (offsets);
+        return FALSE;
+    }
+
+    narrowed = encoding == UFO_FRAME_ENCODING_FLOAT32 ? (guint8 *) data : g_malloc (num_pixels * element_size);
+
+#pragma omp parallel for schedule(dynamic)
+    for (guint i = 0; i < header.num_blocks; i++) {
+        gsize first = i * num_pixels / header.num_blocks;
+        gsize n = (i + 1) * num_pixels / header.num_blocks - first;
+        gsize size = n * element_size;
+        gsize block_size = block_sizes[i] & ~BLOCK_STORED;
+        guint8 *dst = narrowed + first * element_size;
+        guint8 *shuffled;
+
+        if (compression == UFO_FRAME_COMPRESSION_NONE) {
+            if (block_size == size)
+                memcpy (dst, src + offsets[i], size);
+            else
+                success = FALSE;
+
+            continue;
+        }
+
+        if (block_sizes[i] & BLOCK_STORED) {
+            if (block_size == size)
+                unshuffle (src + offsets[i], dst, n, element_size);
+            else
+                success = FALSE;
+
+            continue;
+        }
+
+        shuffled = g_malloc (size);
+
+        if (decompress_block (compression, src + offsets[i], block_size, shuffled, size))
+            unshuffle (shuffled, dst, n, element_size);
+        else
+            success = FALSE;
+
+        g_free (shuffled);
+    }
+
+    if (encoding != UFO_FRAME_ENCODING_FLOAT32) {
+        if (success)
+            widen ((const guint16 *) narrowed, data, num_pixels, encoding, &header);
+
+        g_free (narrowed);
+    }
+
+    g_free (offsets);
+    return success;
+}
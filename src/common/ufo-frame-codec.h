@@ -0,0 +1,56 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UFO_FRAME_CODEC_H
+#define UFO_FRAME_CODEC_H
+
+#include <glib.h>
+
+/*
+ * Compact encoding of float frames for transport. Frames are optionally
+ * narrowed to 16 bit and then split into blocks which are byte-shuffled and
+ * compressed in parallel. The encoded data is self-contained apart from the
+ * encoding, compression and the number of pixels.
+ */
+typedef enum {
+    UFO_FRAME_ENCODING_FLOAT32 = 0,
+    UFO_FRAME_ENCODING_FLOAT16,
+    UFO_FRAME_ENCODING_UINT16,
+} UfoFrameEncoding;
+
+typedef enum {
+    UFO_FRAME_COMPRESSION_NONE = 0,
+    UFO_FRAME_COMPRESSION_LZ4,
+    UFO_FRAME_COMPRESSION_ZSTD,
+} UfoFrameCompression;
+
+gboolean    ufo_frame_compression_available (UfoFrameCompression  compression);
+gpointer    ufo_frame_encode                (const gfloat        *data,
+                                             gsize                num_pixels,
+                                             UfoFrameEncoding     encoding,
+                                             UfoFrameCompression  compression,
+                                             gsize               *encoded_size);
+gboolean    ufo_frame_decode                (gconstpointer        encoded,
+                                             gsize                encoded_size,
+                                             gfloat              *data,
+                                             gsize                num_pixels,
+                                             UfoFrameEncoding     encoding,
+                                             UfoFrameCompression  compression);
+
+#endif
@@ -0,0 +1,239 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ufo-pinned.h"
+
+typedef struct {
+    cl_command_queue queue;
+    cl_mem mem;
+    gpointer host;
+    gsize size;
+} PinnedRegion;
+
+struct _UfoPinnedPool {
+    cl_context context;
+    cl_command_queue queue;
+    GHashTable *keyed;          /* key -> PinnedRegion */
+    GHashTable *attached;       /* host pointer -> PinnedRegion */
+    GMutex lock;
+    gint ref_count;             /* owner and every attached buffer */
+};
+
+static PinnedRegion *
+region_new (UfoPinnedPool *pool, gsize size)
+{
+    PinnedRegion *region;
+    cl_int err;
+
+    region = g_new0 (PinnedRegion, 1);
+    region->queue = pool->queue;
+    region->size = size;
+    region->mem = clCreateBuffer (pool->context, CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, size, NULL, &err);
+
+    if (err == CL_SUCCESS) {
+        region->host = clEnqueueMapBuffer (pool->queue, region->mem, CL_TRUE, CL_MAP_READ | CL_MAP_WRITE,
+                                           0, size, 0, NULL, NULL, &err);
+
+        if (err == CL_SUCCESS)
+            return region;
+
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (region->mem));
+        region->mem = NULL;
+    }
+
+    g_debug ("Could not allocate %zu bytes of pinned memory, using pageable memory", size);
+    region->host = g_malloc (size);
+    return region;
+}
+
+static void
+region_free (PinnedRegion *region)
+{
+    if (region->mem != NULL) {
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueUnmapMemObject (region->queue, region->mem, region->host, 0, NULL, NULL));
+        UFO_RESOURCES_CHECK_CLERR (clFinish (region->queue));
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (region->mem));
+    }
+    else {
+        g_free (region->host);
+    }
+
+    g_free (region);
+}
+
+UfoPinnedPool *
+ufo_pinned_pool_new (cl_context context, GError **error)
+{
+    UfoPinnedPool *pool;
+    cl_device_id device;
+    cl_int err;
+
+    /* Mapping needs a queue, the first device of the context is as good as any */
+    UFO_RESOURCES_CHECK_SET_AND_RETURN_VALUE (clGetContextInfo (context, CL_CONTEXT_DEVICES,
+                                                                sizeof (cl_device_id), &device, NULL),
+                                              error, NULL);
+
+    pool = g_new0 (UfoPinnedPool, 1);
+    pool->context = context;
+    UFO_RESOURCES_CHECK_CLERR (clRetainContext (context));
+
+    pool->queue = clCreateCommandQueue (context, device, 0, &err);
+
+    if (err != CL_SUCCESS) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (context));
+        g_free (pool);
+        UFO_RESOURCES_CHECK_SET_AND_RETURN_VALUE (err, error, NULL);
+    }
+
+    pool->keyed = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) region_free);
+    pool->attached = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) region_free);
+    g_mutex_init (&pool->lock);
+    pool->ref_count = 1;
+
+    return pool;
+}
+
+static UfoPinnedPool *
+pool_ref (UfoPinnedPool *pool)
+{
+    g_atomic_int_inc (&pool->ref_count);
+    return pool;
+}
+
+static void
+pool_unref (UfoPinnedPool *pool)
+{
+    if (!g_atomic_int_dec_and_test (&pool->ref_count))
+        return;
+
+    g_hash_table_destroy (pool->keyed);
+    g_hash_table_destroy (pool->attached);
+    g_mutex_clear (&pool->lock);
+    UFO_RESOURCES_CHECK_CLERR (clReleaseCommandQueue (pool->queue));
+    UFO_RESOURCES_CHECK_CLERR (clReleaseContext (pool->context));
+    g_free (pool);
+}
+
+/*
+ * Let @buffer keep the pool alive. Buffers exchange their host arrays with
+ * ufo_buffer_swap_data, so a region may end up in any of the attached buffers
+ * and can only be released once none of them exists anymore.
+ */
+static void
+hold_pool (UfoPinnedPool *pool, UfoBuffer *buffer)
+{
+    if (g_object_get_data (G_OBJECT (buffer), "ufo-pinned-pool") != pool)
+        g_object_set_data_full (G_OBJECT (buffer), "ufo-pinned-pool", pool_ref (pool),
+                                (GDestroyNotify) pool_unref);
+}
+
+/*
+ * Return at least @size bytes of pinned memory associated with @key. The
+ * memory is reused for the same key and only reallocated if it grows, its
+ * contents are not preserved in that case.
+ */
+gpointer
+ufo_pinned_pool_get (UfoPinnedPool *pool, gconstpointer key, gsize size)
+{
+    PinnedRegion *region;
+
+    g_mutex_lock (&pool->lock);
+    region = g_hash_table_lookup (pool->keyed, key);
+
+    if (region == NULL || region->size < size) {
+        region = region_new (pool, size);
+        g_hash_table_replace (pool->keyed, (gpointer) key, region);
+    }
+
+    g_mutex_unlock (&pool->lock);
+    return region->host;
+}
+
+/*
+ * Back the host array of @buffer with pinned memory and return it. Buffers
+ * whose host array already comes from the pool are left as they are, so
+ * buffers may swap their data among each other. The pinned memory lives until
+ * the pool is destroyed and all attached buffers are finalized, buffers that
+ * swap data with an attached buffer must be attached as well.
+ */
+gpointer
+ufo_pinned_pool_attach (UfoPinnedPool *pool, UfoBuffer *buffer)
+{
+    PinnedRegion *region;
+    gpointer host;
+    gsize size;
+
+    size = ufo_buffer_get_size (buffer);
+    host = ufo_buffer_get_host_array (buffer, NULL);
+
+    g_mutex_lock (&pool->lock);
+    region = g_hash_table_lookup (pool->attached, host);
+
+    if (region != NULL && region->size >= size) {
+        g_mutex_unlock (&pool->lock);
+        hold_pool (pool, buffer);
+        return host;
+    }
+
+    /* The buffer grew, its old region is replaced right away */
+    if (region != NULL)
+        g_hash_table_remove (pool->attached, host);
+
+    region = region_new (pool, size);
+    g_hash_table_insert (pool->attached, region->host, region);
+    g_mutex_unlock (&pool->lock);
+
+    ufo_buffer_set_host_array (buffer, region->host, FALSE);
+    hold_pool (pool, buffer);
+    return region->host;
+}
+
+/*
+ * Return the host data of @buffer. If the data is on the device, it is read
+ * into pinned staging memory owned by the pool instead of the host array of
+ * @buffer. The staging memory is reused by the next call.
+ */
+gpointer
+ufo_pinned_pool_download (UfoPinnedPool *pool, UfoBuffer *buffer, cl_command_queue queue)
+{
+    gpointer host;
+    cl_mem mem;
+    gsize size;
+
+    if (ufo_buffer_get_location (buffer) != UFO_BUFFER_LOCATION_DEVICE)
+        return ufo_buffer_get_host_array (buffer, queue);
+
+    size = ufo_buffer_get_size (buffer);
+    mem = ufo_buffer_get_device_array (buffer, queue);
+    host = ufo_pinned_pool_get (pool, pool, size);
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (queue, mem, CL_TRUE, 0, size, host, 0, NULL, NULL));
+
+    return host;
+}
+
+/*
+ * Drop the reference of the pool owner. Memory handed out by
+ * ufo_pinned_pool_get must not be used afterwards, attached regions are
+ * released with the last attached buffer.
+ */
+void
+ufo_pinned_pool_destroy (UfoPinnedPool *pool)
+{
+    pool_unref (pool);
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UFO_PINNED_H
+#define UFO_PINNED_H
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <ufo/ufo.h>
+
+/*
+ * Page-locked host memory for host <-> device transfers. The regions are
+ * allocated with CL_MEM_ALLOC_HOST_PTR and stay mapped for the lifetime of the
+ * pool, so that copies from and to them can use DMA. Buffers backed by the pool
+ * keep it alive past ufo_pinned_pool_destroy. If pinned memory cannot
+ * be allocated, the pool silently hands out regular host memory instead.
+ * All functions are thread-safe.
+ */
+typedef struct _UfoPinnedPool UfoPinnedPool;
+
+UfoPinnedPool  *ufo_pinned_pool_new         (cl_context        context,
+                                             GError          **error);
+gpointer        ufo_pinned_pool_get         (UfoPinnedPool    *pool,
+                                             gconstpointer     key,
+                                             gsize             size);
+gpointer        ufo_pinned_pool_attach      (UfoPinnedPool    *pool,
+                                             UfoBuffer        *buffer);
+gpointer        ufo_pinned_pool_download    (UfoPinnedPool    *pool,
+                                             UfoBuffer        *buffer,
+                                             cl_command_queue  queue);
+void            ufo_pinned_pool_destroy     (UfoPinnedPool    *pool);
+
+#endif
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ufo-reduction.h"
+
+#define MAX_LOCAL_SIZE 256
+
+struct _UfoReduction {
+    cl_context context;
+    cl_kernel rows_kernel;
+    cl_kernel columns_kernel;
+    cl_kernel finish_kernel;
+    cl_kernel extract_kernel;
+    gsize local_size;
+    guint num_compute_units;
+    cl_mem partials;
+    gsize partials_size;
+    cl_mem results;
+    gsize results_size;
+    guint n_results;
+};
+
+static cl_kernel
+get_kernel (UfoResources *resources, const gchar *name, const gchar *options, GError **error)
+{
+    cl_kernel kernel;
+
+    kernel = ufo_resources_get_kernel (resources, "reduction.cl", name, options, error);
+
+    if (kernel != NULL)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN_VALUE (clRetainKernel (kernel), error, NULL);
+
+    return kernel;
+}
+
+UfoReduction *
+ufo_reduction_new (UfoResources *resources,
+                   UfoGpuNode *node,
+                   gboolean higher_moments,
+                   GError **error)
+{
+    UfoReduction *reduction;
+    GValue *max_size_value;
+    cl_command_queue queue;
+    cl_device_id device;
+    const gchar *options;
+    gsize max_size;
+    gsize kernel_size;
+
+    reduction = g_new0 (UfoReduction, 1);
+    options = higher_moments ? "-DHIGHER_MOMENTS" : NULL;
+    reduction->rows_kernel = get_kernel (resources, "reduce_statistics_rows", options, error);
+    reduction->columns_kernel = get_kernel (resources, "reduce_statistics_columns", options, error);
+    reduction->finish_kernel = get_kernel (resources, "reduce_statistics_finish", options, error);
+    reduction->extract_kernel = get_kernel (resources, "reduce_statistics_extract", options, error);
+
+    if (error && *error) {
+        ufo_reduction_destroy (reduction);
+        return NULL;
+    }
+
+    reduction->context = ufo_resources_get_context (resources);
+    UFO_RESOURCES_CHECK_CLERR (clRetainContext (reduction->context));
+
+    queue = ufo_gpu_node_get_cmd_queue (node);
+    UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof (cl_uint),
+                                                &reduction->num_compute_units, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (reduction->rows_kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                                         sizeof (gsize), &kernel_size, NULL));
+
+    max_size_value = ufo_gpu_node_get_info (node, UFO_GPU_NODE_INFO_MAX_WORK_GROUP_SIZE);
+    max_size = MIN (MIN (g_value_get_ulong (max_size_value), kernel_size), MAX_LOCAL_SIZE);
+    g_value_unset (max_size_value);
+
+    /* The work group tree reduction needs a power of two */
+    reduction->local_size = 1;
+
+    while (reduction->local_size * 2 <= max_size)
+        reduction->local_size *= 2;
+
+    return reduction;
+}
+
+static cl_mem
+ensure_buffer (cl_context context, cl_mem mem, gsize *current_size, gsize size)
+{
+    cl_int error;
+
+    if (mem != NULL && *current_size >= size)
+        return mem;
+
+    if (mem != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (mem));
+
+    mem = clCreateBuffer (context, CL_MEM_READ_WRITE, size, NULL, &error);
+    UFO_RESOURCES_CHECK_CLERR (error);
+    *current_size = size;
+
+    return mem;
+}
+
+cl_mem
+ufo_reduction_execute (UfoReduction *reduction,
+                       cl_command_queue queue,
+                       UfoProfiler *profiler,
+                       cl_mem input,
+                       gsize width,
+                       gsize height,
+                       gint axis,
+                       guint *n_results)
+{
+    cl_uint length, pitch, n_parts;
+    gsize n_rows;
+    gsize target_items;
+
+    target_items = 4 * reduction->num_compute_units * reduction->local_size;
+
+    if (axis == 1) {
+        /* Columns are reduced by one work item each, split along the column
+         * to keep enough work items busy */
+        n_rows = width;
+        length = height;
+        n_parts = CLAMP (target_items / n_rows, 1, length);
+    }
+    else {
+        n_rows = axis == 0 ? height : 1;
+        length = axis == 0 ? width : width * height;
+        n_parts = CLAMP (target_items / (n_rows * reduction->local_size), 1,
+                         (length - 1) / reduction->local_size + 1);
+    }
+
+    reduction->partials = ensure_buffer (reduction->context, reduction->partials, &reduction->partials_size,
+                                         n_rows * n_parts * sizeof (UfoStatistics));
+    reduction->results = ensure_buffer (reduction->context, reduction->results, &reduction->results_size,
+                                        n_rows * sizeof (UfoStatistics));
+
+    if (axis == 1) {
+        gsize global_size[2] = { n_rows, n_parts };
+        cl_uint n_columns = width;
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->columns_kernel, 0, sizeof (cl_mem), &input));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->columns_kernel, 1, sizeof (cl_mem), &reduction->partials));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->columns_kernel, 2, sizeof (cl_uint), &length));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->columns_kernel, 3, sizeof (cl_uint), &n_columns));
+        ufo_profiler_call (profiler, queue, reduction->columns_kernel, 2, global_size, NULL);
+    }
+    else {
+        gsize global_size[2] = { n_parts * reduction->local_size, n_rows };
+        gsize local_size[2] = { reduction->local_size, 1 };
+
+        pitch = width;
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->rows_kernel, 0, sizeof (cl_mem), &input));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->rows_kernel, 1, sizeof (cl_mem), &reduction->partials));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->rows_kernel, 2, reduction->local_size * sizeof (UfoStatistics), NULL));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->rows_kernel, 3, sizeof (cl_uint), &length));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->rows_kernel, 4, sizeof (cl_uint), &pitch));
+        ufo_profiler_call (profiler, queue, reduction->rows_kernel, 2, global_size, local_size);
+    }
+
+    /* Merge the few partial results of each row */
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->finish_kernel, 0, sizeof (cl_mem), &reduction->partials));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->finish_kernel, 1, sizeof (cl_mem), &reduction->results));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->finish_kernel, 2, sizeof (cl_uint), &n_parts));
+    ufo_profiler_call (profiler, queue, reduction->finish_kernel, 1, &n_rows, NULL);
+
+    reduction->n_results = n_rows;
+
+    if (n_results != NULL)
+        *n_results = n_rows;
+
+    return reduction->results;
+}
+
+void
+ufo_reduction_extract (UfoReduction *reduction,
+                       cl_command_queue queue,
+                       UfoProfiler *profiler,
+                       UfoReductionQuantity quantity,
+                       cl_mem output)
+{
+    gsize n_results = reduction->n_results;
+    cl_int quantity_arg = (cl_int) quantity;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->extract_kernel, 0, sizeof (cl_mem), &reduction->results));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->extract_kernel, 1, sizeof (cl_mem), &output));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (reduction->extract_kernel, 2, sizeof (cl_int), &quantity_arg));
+    ufo_profiler_call (profiler, queue, reduction->extract_kernel, 1, &n_results, NULL);
+}
+
+static void
+release_kernel (cl_kernel kernel)
+{
+    if (kernel != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (kernel));
+}
+
+void
+ufo_reduction_destroy (UfoReduction *reduction)
+{
+    release_kernel (reduction->rows_kernel);
+    release_kernel (reduction->columns_kernel);
+    release_kernel (reduction->finish_kernel);
+    release_kernel (reduction->extract_kernel);
+
+    if (reduction->partials != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (reduction->partials));
+
+    if (reduction->results != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (reduction->results));
+
+    if (reduction->context != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (reduction->context));
+
+    g_free (reduction);
+}
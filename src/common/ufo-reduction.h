@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UFO_REDUCTION_H
+#define UFO_REDUCTION_H
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <ufo/ufo.h>
+
+/*
+ * Single-pass statistics of 2D data on the device. Each result consists of the
+ * number of values, mean, the second, third and fourth central moment sums,
+ * minimum, maximum and an unused value. The third and fourth moments are only
+ * computed if the reduction was created with higher_moments set.
+ *
+ * With axis -1 there is one result for all pixels, with axis 0 one result per
+ * row and with axis 1 one result per column.
+ *
+ * There is no histogram: its bins depend on the range, which is only known
+ * after this pass, and none of the users needs one.
+ *
+ * The layout must match Statistics in reduction.cl.
+ */
+typedef struct {
+    guint count;
+    gfloat mean;
+    gfloat m2;
+    gfloat m3;
+    gfloat m4;
+    gfloat min;
+    gfloat max;
+    gfloat unused;
+} UfoStatistics;
+
+/* Must be kept in sync with reduce_statistics_extract in reduction.cl */
+typedef enum {
+    UFO_REDUCTION_MIN = 0,
+    UFO_REDUCTION_MAX,
+    UFO_REDUCTION_SUM,
+    UFO_REDUCTION_MEAN,
+    UFO_REDUCTION_VAR,
+    UFO_REDUCTION_STD,
+    UFO_REDUCTION_SKEW,
+    UFO_REDUCTION_KURTOSIS,
+} UfoReductionQuantity;
+
+typedef struct _UfoReduction UfoReduction;
+
+UfoReduction *ufo_reduction_new      (UfoResources          *resources,
+                                      UfoGpuNode            *node,
+                                      gboolean               higher_moments,
+                                      GError               **error);
+cl_mem        ufo_reduction_execute  (UfoReduction          *reduction,
+                                      cl_command_queue       queue,
+                                      UfoProfiler           *profiler,
+                                      cl_mem                 input,
+                                      gsize                  width,
+                                      gsize                  height,
+                                      gint                   axis,
+                                      guint                 *n_results);
+void          ufo_reduction_extract  (UfoReduction          *reduction,
+                                      cl_command_queue       queue,
+                                      UfoProfiler           *profiler,
+                                      UfoReductionQuantity   quantity,
+                                      cl_mem                 output);
+void          ufo_reduction_destroy  (UfoReduction          *reduction);
+
+#endif
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ufo-tile.h"
+
+gboolean
+ufo_tile_get_work_size (cl_command_queue queue,
+                        cl_kernel kernel,
+                        const gsize *size,
+                        const gsize *halo,
+                        gsize *global_size,
+                        gsize *local_size,
+                        gsize *local_mem_size)
+{
+    static const gsize widths[] = { 64, 32, 16, 8, 4 };
+    static const gsize heights[] = { 16, 8, 4, 2, 1 };
+    cl_device_id device;
+    cl_ulong max_local_mem;
+    gsize max_group_size;
+    gsize multiple;
+    gdouble best_overhead = G_MAXDOUBLE;
+    gsize best_group_size = 0;
+
+    UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, CL_DEVICE_LOCAL_MEM_SIZE, sizeof (cl_ulong), &max_local_mem, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                                         sizeof (gsize), &max_group_size, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+                                                         sizeof (gsize), &multiple, NULL));
+
+    /* Leave room for the kernel's own local variables */
+    max_local_mem /= 2;
+
+    for (guint i = 0; i < G_N_ELEMENTS (widths); i++) {
+        for (guint j = 0; j < G_N_ELEMENTS (heights); j++) {
+            gsize group_size = widths[i] * heights[j];
+            gsize tile_size = (widths[i] + halo[0]) * (heights[j] + halo[1]);
+            gdouble overhead = (gdouble) tile_size / group_size;
+
+            if (group_size > max_group_size || tile_size * sizeof (gfloat) > max_local_mem)
+                continue;
+
+            /* Do not waste lanes with tiny or oddly sized groups */
+            if (group_size < MIN (64, max_group_size) || (multiple > 0 && group_size % multiple != 0 && group_size > multiple))
+                continue;
+
+            if (overhead < best_overhead || (overhead == best_overhead && group_size > best_group_size)) {
+                best_overhead = overhead;
+                best_group_size = group_size;
+                local_size[0] = widths[i];
+                local_size[1] = heights[j];
+            }
+        }
+    }
+
+    if (best_group_size == 0)
+        return FALSE;
+
+    for (guint i = 0; i < 2; i++)
+        global_size[i] = ((size[i] - 1) / local_size[i] + 1) * local_size[i];
+
+    *local_mem_size = (local_size[0] + halo[0]) * (local_size[1] + halo[1]) * sizeof (gfloat);
+
+    return TRUE;
+}
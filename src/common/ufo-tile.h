@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UFO_TILE_H
+#define UFO_TILE_H
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <ufo/ufo.h>
+
+/*
+ * Work sizes for kernels which stage the block of input pixels needed by a
+ * work group, i.e. the local size plus halo[0] additional columns and halo[1]
+ * additional rows, in local memory (see tile.cl). The local size is chosen to
+ * fit the device limits of @kernel and to minimize the redundant halo loads,
+ * the global size is @size rounded up to a multiple of it. Returns FALSE if no
+ * tile fits into local memory, in which case the caller has to fall back to an
+ * untiled kernel.
+ */
+gboolean ufo_tile_get_work_size (cl_command_queue  queue,
+                                 cl_kernel         kernel,
+                                 const gsize      *size,
+                                 const gsize      *halo,
+                                 gsize            *global_size,
+                                 gsize            *local_size,
+                                 gsize            *local_mem_size);
+
+#endif
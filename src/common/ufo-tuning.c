@@ -0,0 +1,395 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include "ufo-tuning.h"
+
+/* Every candidate is run once to warm up and then timed this many times, the
+ * fastest run counts */
+#define NUM_TIMED_RUNS 3
+
+/* Work group shapes tried besides the runtime's choice. The x extent is kept a
+ * multiple of the SIMD width of most GPUs, smaller shapes are there for CPU
+ * implementations with small maximum work group sizes. */
+static const gsize shapes_1d[][3] = {
+    {32, 1, 1}, {64, 1, 1}, {128, 1, 1}, {256, 1, 1}, {8, 1, 1},
+};
+
+static const gsize shapes_2d[][3] = {
+    {8, 8, 1}, {16, 8, 1}, {16, 16, 1}, {32, 4, 1}, {32, 8, 1}, {32, 16, 1}, {64, 4, 1}, {4, 4, 1},
+};
+
+static const gsize shapes_3d[][3] = {
+    {16, 8, 1}, {16, 8, 2}, {16, 8, 4}, {16, 8, 8}, {32, 4, 2}, {32, 8, 2}, {16, 16, 2}, {8, 8, 4}, {4, 4, 4},
+};
+
+static GMutex profile_lock;
+
+static cl_device_id
+get_device (cl_command_queue queue)
+{
+    cl_device_id device;
+
+    UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+
+    return device;
+}
+
+static gchar *
+get_device_string (cl_device_id device, cl_device_info param)
+{
+    gsize size;
+    gchar *value;
+
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, param, 0, NULL, &size));
+    value = g_malloc0 (size + 1);
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, param, size, value, NULL));
+
+    return g_strstrip (value);
+}
+
+/*
+ * The profile is specific to the device and its driver, a driver update may
+ * well change the optimum.
+ */
+static gchar *
+get_profile_filename (cl_command_queue queue)
+{
+    cl_device_id device;
+    gchar *name, *driver, *basename, *path;
+
+    device = get_device (queue);
+    name = get_device_string (device, CL_DEVICE_NAME);
+    driver = get_device_string (device, CL_DRIVER_VERSION);
+    basename = g_strdup_printf ("%s-%s.ini", name, driver);
+    g_strcanon (basename, G_CSET_a_2_z G_CSET_A_2_Z G_CSET_DIGITS "-_.", '_');
+    path = g_build_filename (g_get_user_cache_dir (), "ufo", "tuning", basename, NULL);
+
+    g_free (basename);
+    g_free (driver);
+    g_free (name);
+
+    return path;
+}
+
+/*
+ * Return all combinations of the work group shapes which fit the device and
+ * divide *divide* (if not NULL) with the given unroll factors and bursts. The
+ * runtime's choice of the local work size is always the first shape.
+ */
+GArray *
+ufo_tuning_candidates_new (cl_command_queue queue,
+                           guint n_dims,
+                           const gsize *divide,
+                           const guint *unrolls,
+                           guint num_unrolls,
+                           const guint *bursts,
+                           guint num_bursts)
+{
+    GArray *candidates;
+    cl_device_id device;
+    gsize max_work_group_size, *max_work_item_sizes, num_shapes;
+    cl_uint max_dims;
+    const gsize (*shapes)[3];
+    const guint no_value = 0;
+    UfoTuningParameters candidate;
+
+    g_return_val_if_fail (n_dims >= 1 && n_dims <= 3, NULL);
+
+    switch (n_dims) {
+        case 1:
+            shapes = shapes_1d;
+            num_shapes = G_N_ELEMENTS (shapes_1d);
+            break;
+        case 2:
+            shapes = shapes_2d;
+            num_shapes = G_N_ELEMENTS (shapes_2d);
+            break;
+        default:
+            shapes = shapes_3d;
+            num_shapes = G_N_ELEMENTS (shapes_3d);
+            break;
+    }
+
+    if (!unrolls || !num_unrolls) {
+        unrolls = &no_value;
+        num_unrolls = 1;
+    }
+
+    if (!bursts || !num_bursts) {
+        bursts = &no_value;
+        num_bursts = 1;
+    }
+
+    device = get_device (queue);
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, CL_DEVICE_MAX_WORK_GROUP_SIZE,
+                                                sizeof (gsize), &max_work_group_size, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, CL_DEVICE_MAX_WORK_ITEM_DIMENSIONS,
+                                                sizeof (cl_uint), &max_dims, NULL));
+    max_work_item_sizes = g_new0 (gsize, MAX (max_dims, 3));
+    UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, CL_DEVICE_MAX_WORK_ITEM_SIZES,
+                                                max_dims * sizeof (gsize), max_work_item_sizes, NULL));
+
+    candidates = g_array_new (FALSE, TRUE, sizeof (UfoTuningParameters));
+
+    for (gsize s = 0; s <= num_shapes; s++) {
+        gsize size = 1;
+        gboolean fits = TRUE;
+
+        memset (&candidate, 0, sizeof (UfoTuningParameters));
+
+        if (s > 0) {
+            for (guint i = 0; i < n_dims; i++) {
+                candidate.local_work_size[i] = shapes[s - 1][i];
+                size *= shapes[s - 1][i];
+                fits = fits && shapes[s - 1][i] <= max_work_item_sizes[i] &&
+                       (!divide || divide[i] % shapes[s - 1][i] == 0);
+            }
+
+            if (!fits || size > max_work_group_size) {
+                continue;
+            }
+        }
+
+        for (guint u = 0; u < num_unrolls; u++) {
+            for (guint b = 0; b < num_bursts; b++) {
+                candidate.unroll = unrolls[u];
+                candidate.burst = bursts[b];
+                g_array_append_val (candidates, candidate);
+            }
+        }
+    }
+
+    g_free (max_work_item_sizes);
+
+    return candidates;
+}
+
+/*
+ * Look up the tuned parameters for *name* on the device of *queue*, return
+ * FALSE if the device has not been tuned for it yet.
+ */
+gboolean
+ufo_tuning_lookup (cl_command_queue queue,
+                   const gchar *name,
+                   UfoTuningParameters *parameters)
+{
+    GKeyFile *key_file;
+    GError *error = NULL;
+    gchar *path;
+    gint *sizes = NULL;
+    gint unroll = -1, burst = -1;
+    gsize length = 0;
+    gboolean valid;
+
+    path = get_profile_filename (queue);
+    key_file = g_key_file_new ();
+
+    g_mutex_lock (&profile_lock);
+    valid = g_key_file_load_from_file (key_file, path, G_KEY_FILE_NONE, NULL) &&
+            g_key_file_has_group (key_file, name);
+    g_mutex_unlock (&profile_lock);
+
+    if (valid) {
+        sizes = g_key_file_get_integer_list (key_file, name, "local-work-size", &length, &error);
+
+        if (!error)
+            unroll = g_key_file_get_integer (key_file, name, "unroll", &error);
+
+        if (!error)
+            burst = g_key_file_get_integer (key_file, name, "burst", &error);
+
+        valid = !error && length == 3 && sizes[0] >= 0 && sizes[1] >= 0 && sizes[2] >= 0 &&
+                unroll >= 0 && burst >= 0;
+
+        if (valid) {
+            for (guint i = 0; i < 3; i++) {
+                parameters->local_work_size[i] = (gsize) sizes[i];
+            }
+
+            parameters->unroll = (guint) unroll;
+            parameters->burst = (guint) burst;
+        }
+        else {
+            g_debug ("Ignoring invalid tuning parameters for %s in %s", name, path);
+            g_clear_error (&error);
+        }
+    }
+
+    g_free (sizes);
+    g_free (path);
+    g_key_file_free (key_file);
+
+    return valid;
+}
+
+void
+ufo_tuning_store (cl_command_queue queue,
+                  const gchar *name,
+                  const UfoTuningParameters *parameters)
+{
+    GKeyFile *key_file;
+    GError *error = NULL;
+    gchar *path, *dirname, *data;
+    gint sizes[3];
+    gsize length;
+
+    for (guint i = 0; i < 3; i++) {
+        sizes[i] = (gint) parameters->local_work_size[i];
+    }
+
+    path = get_profile_filename (queue);
+    dirname = g_path_get_dirname (path);
+    key_file = g_key_file_new ();
+
+    g_mutex_lock (&profile_lock);
+    g_key_file_load_from_file (key_file, path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+    g_key_file_set_integer_list (key_file, name, "local-work-size", sizes, 3);
+    g_key_file_set_integer (key_file, name, "unroll", (gint) parameters->unroll);
+    g_key_file_set_integer (key_file, name, "burst", (gint) parameters->burst);
+    data = g_key_file_to_data (key_file, &length, NULL);
+
+    /* g_file_set_contents replaces the file atomically, so concurrent
+     * processes never see a partial profile */
+    if (g_mkdir_with_parents (dirname, 0755) || !g_file_set_contents (path, data, length, &error)) {
+        g_debug ("Could not store tuning parameters in %s", path);
+        g_clear_error (&error);
+    }
+    g_mutex_unlock (&profile_lock);
+
+    g_free (data);
+    g_free (dirname);
+    g_free (path);
+    g_key_file_free (key_file);
+}
+
+/*
+ * Check that the local work size of *parameters* does not exceed the work group
+ * size *kernel* can be launched with on the device of *queue*. This depends on
+ * the resources the compiled kernel uses, so a stored profile may not fit a
+ * kernel built from different code or options.
+ */
+gboolean
+ufo_tuning_fits_kernel (cl_command_queue queue,
+                        cl_kernel kernel,
+                        const UfoTuningParameters *parameters)
+{
+    gsize kernel_size;
+    gsize size = 1;
+
+    if (kernel == NULL) {
+        return FALSE;
+    }
+
+    if (!parameters->local_work_size[0]) {
+        return TRUE;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (kernel, get_device (queue), CL_KERNEL_WORK_GROUP_SIZE,
+                                                         sizeof (gsize), &kernel_size, NULL));
+
+    for (guint i = 0; i < 3; i++) {
+        size *= MAX (parameters->local_work_size[i], 1);
+    }
+
+    return size <= kernel_size;
+}
+
+/*
+ * Time all *candidates* with *run* on *queue*, store the fastest one as *name*
+ * in the profile of the device and return it in *best*. The kernel runs are
+ * timed on the host, so that no profiling queue is needed. Return FALSE if no
+ * candidate could be run at all.
+ */
+gboolean
+ufo_tuning_search (cl_command_queue queue,
+                   const gchar *name,
+                   GArray *candidates,
+                   UfoTuningRunFunc run,
+                   gpointer user_data,
+                   UfoTuningParameters *best)
+{
+    gdouble time, best_time = G_MAXDOUBLE;
+
+    for (guint i = 0; i < candidates->len; i++) {
+        const UfoTuningParameters *candidate = &g_array_index (candidates, UfoTuningParameters, i);
+        gint64 start, min_time = G_MAXINT64;
+        gboolean valid;
+
+        valid = run (candidate, user_data) && clFinish (queue) == CL_SUCCESS;
+
+        for (guint j = 0; valid && j < NUM_TIMED_RUNS; j++) {
+            start = g_get_monotonic_time ();
+            valid = run (candidate, user_data) && clFinish (queue) == CL_SUCCESS;
+            min_time = MIN (min_time, g_get_monotonic_time () - start);
+        }
+
+        if (!valid) {
+            g_debug ("%s: skipping local work size %zu %zu %zu, unroll %u, burst %u", name,
+                     candidate->local_work_size[0], candidate->local_work_size[1],
+                     candidate->local_work_size[2], candidate->unroll, candidate->burst);
+            continue;
+        }
+
+        time = (gdouble) min_time / MAX (candidate->burst, 1);
+        g_debug ("%s: local work size %zu %zu %zu, unroll %u, burst %u: %.1f us", name,
+                 candidate->local_work_size[0], candidate->local_work_size[1],
+                 candidate->local_work_size[2], candidate->unroll, candidate->burst, time);
+
+        if (time < best_time) {
+            best_time = time;
+            *best = *candidate;
+        }
+    }
+
+    if (best_time == G_MAXDOUBLE) {
+        return FALSE;
+    }
+
+    ufo_tuning_store (queue, name, best);
+
+    return TRUE;
+}
+
+/*
+ * Return the local work size to pass to the kernel invocation, NULL if the
+ * runtime shall decide.
+ */
+const gsize *
+ufo_tuning_get_local_work_size (const UfoTuningParameters *parameters)
+{
+    return parameters->local_work_size[0] ? parameters->local_work_size : NULL;
+}
+
+/*
+ * Pad *dims* to multiples of the local work size, the kernels must skip the
+ * padding themselves.
+ */
+void
+ufo_tuning_get_global_work_size (const UfoTuningParameters *parameters,
+                                 guint n_dims,
+                                 const gsize *dims,
+                                 gsize *global_work_size)
+{
+    for (guint i = 0; i < n_dims; i++) {
+        const gsize local = parameters->local_work_size[0] ? parameters->local_work_size[i] : 1;
+
+        global_work_size[i] = (dims[i] + local - 1) / local * local;
+    }
+}
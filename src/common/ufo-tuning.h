@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef UFO_TUNING_H
+#define UFO_TUNING_H
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include <ufo/ufo.h>
+
+/*
+ * Launch parameters of a kernel which are found by benchmarking candidates on
+ * the device at hand. A zero local work size leaves the choice to the OpenCL
+ * runtime, a zero unroll factor to the compiler. burst is the number of
+ * projections processed by one kernel invocation, the time of a candidate is
+ * divided by it to make candidates with different bursts comparable.
+ *
+ * Winners are stored in a key file per device and driver in the user cache
+ * directory with one group per tuned kernel, so that only the first run on a
+ * device pays for the search. Remove the file to tune again. Stored parameters
+ * which the kernel cannot be launched with are tuned again as well.
+ */
+typedef struct {
+    gsize local_work_size[3];
+    guint unroll;
+    guint burst;
+} UfoTuningParameters;
+
+/*
+ * Enqueue one invocation with *parameters* on the tuning queue without
+ * blocking, return FALSE if the candidate cannot be run.
+ */
+typedef gboolean (*UfoTuningRunFunc) (const UfoTuningParameters *parameters,
+                                      gpointer                   user_data);
+
+GArray         *ufo_tuning_candidates_new       (cl_command_queue           queue,
+                                                 guint                      n_dims,
+                                                 const gsize               *divide,
+                                                 const guint               *unrolls,
+                                                 guint                      num_unrolls,
+                                                 const guint               *bursts,
+                                                 guint                      num_bursts);
+gboolean        ufo_tuning_lookup               (cl_command_queue           queue,
+                                                 const gchar               *name,
+                                                 UfoTuningParameters       *parameters);
+void            ufo_tuning_store                (cl_command_queue           queue,
+                                                 const gchar               *name,
+                                                 const UfoTuningParameters *parameters);
+gboolean        ufo_tuning_fits_kernel          (cl_command_queue           queue,
+                                                 cl_kernel                  kernel,
+                                                 const UfoTuningParameters *parameters);
+gboolean        ufo_tuning_search               (cl_command_queue           queue,
+                                                 const gchar               *name,
+                                                 GArray                    *candidates,
+                                                 UfoTuningRunFunc           run,
+                                                 gpointer                   user_data,
+                                                 UfoTuningParameters       *best);
+const gsize    *ufo_tuning_get_local_work_size  (const UfoTuningParameters *parameters);
+void            ufo_tuning_get_global_work_size (const UfoTuningParameters *parameters,
+                                                 guint                      n_dims,
+                                                 const gsize               *dims,
+                                                 gsize                     *global_work_size);
+
+#endif
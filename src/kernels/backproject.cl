@@ -21,6 +21,11 @@ constant sampler_t volumeSampler = CLK_NORMALIZED_COORDS_FALSE |
                                    CLK_ADDRESS_CLAMP |
                                    CLK_FILTER_LINEAR;
 
+/*
+ * The projection loops are unrolled UNROLL times if it is defined, which the
+ * backproject task does with the factor tuned for the device. Otherwise the
+ * factors known to be good for some GPUs are used.
+ */
 kernel void
 backproject_nearest (global float *sinogram,
                      global float *slice,
@@ -39,6 +44,9 @@ backproject_nearest (global float *sinogram,
     const float by = idy - axis_pos + y_offset + 0.5f;
     float sum = 0.0f;
 
+#ifdef UNROLL
+#pragma unroll UNROLL
+#endif
     for(int proj = 0; proj < n_projections; proj++) {
         float h = axis_pos + bx * cos_lut[angle_offset + proj] + by * sin_lut[angle_offset + proj];
         sum += sinogram[(int)(proj * width + h)];
@@ -64,22 +72,19 @@ backproject_tex (read_only image2d_t sinogram,
     const float by = idy - axis_pos + y_offset + 0.5f;
     float sum = 0.0f;
 
-#ifdef DEVICE_TESLA_K20XM
+#if defined(UNROLL)
+#pragma unroll UNROLL
+#elif defined(DEVICE_TESLA_K20XM)
 #pragma unroll 4
-#endif
-#ifdef DEVICE_TESLA_P100_PCIE_16GB
+#elif defined(DEVICE_TESLA_P100_PCIE_16GB)
 #pragma unroll 2
-#endif
-#ifdef DEVICE_GEFORCE_GTX_TITAN_BLACK
+#elif defined(DEVICE_GEFORCE_GTX_TITAN_BLACK)
 #pragma unroll 8
-#endif
-#ifdef DEVICE_GEFORCE_GTX_TITAN
+#elif defined(DEVICE_GEFORCE_GTX_TITAN)
 #pragma unroll 14
-#endif
-#ifdef DEVICE_GEFORCE_GTX_1080_TI
+#elif defined(DEVICE_GEFORCE_GTX_1080_TI)
 #pragma unroll 10
-#endif
-#ifdef DEVICE_QUADRO_M6000
+#elif defined(DEVICE_QUADRO_M6000)
 #pragma unroll 2
 #endif
     for(int proj = 0; proj < n_projections; proj++) {
@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Copy the row pairs into zero-padded rows of stride floats. The first
+ * num_pairs rows receive the first row of each pair, the next num_pairs rows
+ * the mirrored second row which is offset rows further down.
+ */
+kernel void
+spread_pairs (global float *output,
+              global float *sinogram,
+              const int width,
+              const int pair_step,
+              const int offset,
+              const int num_pairs,
+              const int stride)
+{
+    const int x = get_global_id (0);
+    const int y = get_global_id (1);
+    const int pair = y % num_pairs;
+    const int mirrored = y >= num_pairs;
+    const int row = pair * pair_step + (mirrored ? offset : 0);
+
+    if (x >= width)
+        output[y * stride + x] = 0.0f;
+    else
+        output[y * stride + x] = sinogram[row * width + (mirrored ? width - 1 - x : x)];
+}
+
+/*
+ * Remove the mean of every row, otherwise the overlap of the padded rows
+ * biases the correlation towards zero displacement. The energy of the result
+ * is used to normalize the correlation peak.
+ */
+kernel void
+subtract_mean (global float *rows,
+               global float *energies,
+               const int width,
+               const int stride)
+{
+    const int y = get_global_id (0);
+    global float *row = rows + y * stride;
+    float mean = 0.0f;
+    float energy = 0.0f;
+
+    for (int x = 0; x < width; x++)
+        mean += row[x];
+
+    mean /= width;
+
+    for (int x = 0; x < width; x++) {
+        const float value = row[x] - mean;
+        row[x] = value;
+        energy += value * value;
+    }
+
+    energies[y] = energy;
+}
+
+/*
+ * Sum the cross-power spectra of all pairs into the first row, thus a single
+ * inverse transform yields the averaged correlation.
+ */
+kernel void
+cross_power (global float2 *spectra,
+             const int num_pairs)
+{
+    const int k = get_global_id (0);
+    const int stride = get_global_size (0);
+    float2 sum = (float2) (0.0f, 0.0f);
+
+    for (int pair = 0; pair < num_pairs; pair++) {
+        const float2 a = spectra[pair * stride + k];
+        const float2 b = spectra[(num_pairs + pair) * stride + k];
+
+        /* a * conj (b) */
+        sum += (float2) (a.x * b.x + a.y * b.y, a.y * b.x - a.x * b.y);
+    }
+
+    spectra[k] = sum;
+}
@@ -0,0 +1,84 @@
+/*
+ * Copyright (C) 2011-2015 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Each work group reduces a strided part of the n elements starting at offset
+ * to one (min, max) pair, the partial results are combined on the host.
+ */
+kernel void
+find_min_max (global float *input,
+              global float2 *result,
+              local float2 *scratch,
+              const unsigned long offset,
+              const unsigned long n)
+{
+    size_t lid = get_local_id (0);
+    float lower = INFINITY;
+    float upper = -INFINITY;
+
+    for (size_t i = get_global_id (0); i < n; i += get_global_size (0)) {
+        lower = fmin (lower, input[offset + i]);
+        upper = fmax (upper, input[offset + i]);
+    }
+
+    scratch[lid] = (float2) (lower, upper);
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    for (size_t stride = get_local_size (0) / 2; stride > 0; stride >>= 1) {
+        if (lid < stride) {
+            scratch[lid].x = fmin (scratch[lid].x, scratch[lid + stride].x);
+            scratch[lid].y = fmax (scratch[lid].y, scratch[lid + stride].y);
+        }
+
+        barrier (CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0)
+        result[get_group_id (0)] = scratch[0];
+}
+
+/*
+ * Clip to [lower, upper], subtract offset and scale like ufo_writer_convert_inplace
+ * on the host.
+ */
+kernel void
+convert_to_8bit (global float *input,
+                 global uchar *output,
+                 const unsigned long offset,
+                 const float shift,
+                 const float scale,
+                 const float lower,
+                 const float upper)
+{
+    size_t idx = offset + get_global_id (0);
+    output[idx] = convert_uchar_sat_rtz ((clamp (input[idx], lower, upper) - shift) * scale);
+}
+
+kernel void
+convert_to_16bit (global float *input,
+                  global ushort *output,
+                  const unsigned long offset,
+                  const float shift,
+                  const float scale,
+                  const float lower,
+                  const float upper)
+{
+    size_t idx = offset + get_global_id (0);
+    output[idx] = convert_ushort_sat_rtz ((clamp (input[idx], lower, upper) - shift) * scale);
+}
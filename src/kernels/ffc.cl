@@ -17,6 +17,10 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * The correction kernels run over a frame or a stack of frames along the third
+ * dimension, all frames of a stack share the same dark and flat.
+ */
 kernel void
 flat_correct (global float *corrected,
               global float *data,
@@ -27,8 +31,9 @@ flat_correct (global float *corrected,
               const int fix_abnormal,
               const float dark_scale)
 {
-    const int gid = get_global_id(1) * get_global_size(0) + get_global_id(0);
-    const int corr_idx = sinogram_input ? get_global_id(0) : gid;
+    const int idx = get_global_id(1) * get_global_size(0) + get_global_id(0);
+    const int gid = get_global_id(2) * get_global_size(1) * get_global_size(0) + idx;
+    const int corr_idx = sinogram_input ? get_global_id(0) : idx;
     const float cdark = dark[corr_idx] * dark_scale;
     float result;
 
@@ -45,3 +50,181 @@ flat_correct (global float *corrected,
 
     corrected[gid] = result;
 }
+
+/*
+ * Reduction of a stack of reference frames. Frame i of the stack starts at
+ * i * get_global_size(0), the reduced frame is written to output.
+ */
+kernel void
+ffc_reduce_mean (global const float *stack,
+                 global float *output,
+                 const int first,
+                 const int count)
+{
+    const size_t idx = get_global_id (0);
+    const size_t n_pixels = get_global_size (0);
+    float sum = 0.0f;
+
+    for (int i = first; i < first + count; i++)
+        sum += stack[i * n_pixels + idx];
+
+    output[idx] = sum / count;
+}
+
+/*
+ * Per-pixel median via Wirth's selection. The stack is reordered in place, so
+ * it must be a scratch copy of the input.
+ */
+kernel void
+ffc_reduce_median (global float *stack,
+                   global float *output,
+                   const int first,
+                   const int count)
+{
+    const size_t idx = get_global_id (0);
+    const size_t n_pixels = get_global_size (0);
+    global float *values = stack + first * n_pixels + idx;
+    const int k = count / 2;
+    int left = 0;
+    int right = count - 1;
+    float result;
+
+    while (left < right) {
+        const float pivot = values[k * n_pixels];
+        int i = left;
+        int j = right;
+
+        do {
+            while (values[i * n_pixels] < pivot)
+                i++;
+
+            while (pivot < values[j * n_pixels])
+                j--;
+
+            if (i <= j) {
+                const float tmp = values[i * n_pixels];
+                values[i * n_pixels] = values[j * n_pixels];
+                values[j * n_pixels] = tmp;
+                i++;
+                j--;
+            }
+        } while (i <= j);
+
+        if (j < k)
+            left = i;
+
+        if (k < i)
+            right = j;
+    }
+
+    result = values[k * n_pixels];
+
+    if (count % 2 == 0) {
+        /* All values below k are smaller, their maximum is the lower median */
+        float lower = values[0];
+
+        for (int i = 1; i < k; i++)
+            lower = max (lower, values[i * n_pixels]);
+
+        result = 0.5f * (lower + result);
+    }
+
+    output[idx] = result;
+}
+
+/*
+ * Turn reduced dark and flat into gain = 1 / (flat - dark) and
+ * offset = -dark / (flat - dark), in place.
+ */
+kernel void
+ffc_prepare (global float *dark,
+             global float *flat,
+             const float dark_scale)
+{
+    const size_t idx = get_global_id (0);
+    const float cdark = dark[idx] * dark_scale;
+    const float gain = 1.0f / (flat[idx] - cdark);
+
+    dark[idx] = gain;
+    flat[idx] = -cdark * gain;
+}
+
+/*
+ * Scale the dark, subtract it from the flat before the scan and turn the flat
+ * after the scan into the difference of both, in place.
+ */
+kernel void
+ffc_prepare_interpolate (global float *dark,
+                         global float *flat_before,
+                         global float *flat_after,
+                         const float dark_scale)
+{
+    const size_t idx = get_global_id (0);
+    const float cdark = dark[idx] * dark_scale;
+
+    dark[idx] = cdark;
+    flat_after[idx] -= flat_before[idx];
+    flat_before[idx] -= cdark;
+}
+
+kernel void
+flat_correct_cached (global float *corrected,
+                     global const float *data,
+                     global const float *gain,
+                     global const float *offset,
+                     const int sinogram_input,
+                     const int absorptivity,
+                     const int fix_abnormal)
+{
+    const int idx = get_global_id(1) * get_global_size(0) + get_global_id(0);
+    const int gid = get_global_id(2) * get_global_size(1) * get_global_size(0) + idx;
+    const int corr_idx = sinogram_input ? get_global_id(0) : idx;
+    float result;
+
+    result = fma (data[gid], gain[corr_idx], offset[corr_idx]);
+
+    if (absorptivity)
+        result = -log (result);
+
+    if (fix_abnormal && (isnan (result) || isinf (result))) {
+        result = 0.0f;
+    }
+
+    corrected[gid] = result;
+}
+
+/*
+ * The flat of a row is flat_before + t * flat_delta with t = t_start + y *
+ * t_step + z * t_frame_step, so that projections use a constant t per frame
+ * and sinograms vary it per row.
+ */
+kernel void
+flat_correct_interpolate (global float *corrected,
+                          global const float *data,
+                          global const float *dark,
+                          global const float *flat_before,
+                          global const float *flat_delta,
+                          const int sinogram_input,
+                          const int absorptivity,
+                          const int fix_abnormal,
+                          const float t_start,
+                          const float t_step,
+                          const float t_frame_step)
+{
+    const int idx = get_global_id(1) * get_global_size(0) + get_global_id(0);
+    const int gid = get_global_id(2) * get_global_size(1) * get_global_size(0) + idx;
+    const int corr_idx = sinogram_input ? get_global_id(0) : idx;
+    const float t = min (t_start + get_global_id(1) * t_step + get_global_id(2) * t_frame_step, 1.0f);
+    float result;
+
+    result = (data[gid] - dark[corr_idx]) / (flat_before[corr_idx] + t * flat_delta[corr_idx]);
+
+    if (absorptivity)
+        result = -log (result);
+
+    if (fix_abnormal && (isnan (result) || isinf (result))) {
+        result = 0.0f;
+    }
+
+    corrected[gid] = result;
+}
@@ -71,6 +71,49 @@ fft_pack (global float *in,
             = in[idz*stride_y_in + idy*stride_x_in + idx*2] * scale;
 }
 
+kernel void
+fft_spread_real (global float *out,
+                 global float *in,
+                 const int width,
+                 const int height,
+                 const int out_stride)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int idz = get_global_id(2);
+    const int len_y = get_global_size(1);
+
+    const int stride_y = out_stride * len_y;
+    const int stride_x_in = width;
+    const int stride_y_in = stride_x_in * height;
+
+    if ((idy >= height) || (idx >= width))
+        out[idz*stride_y + idy*out_stride + idx] = 0.0f;
+    else
+        out[idz*stride_y + idy*out_stride + idx] = in[idz*stride_y_in + idy*stride_x_in + idx];
+}
+
+kernel void
+fft_pack_real (global float *in,
+               global float *out,
+               const int width,
+               const int height,
+               const int in_stride,
+               const float scale)
+{
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int idz = get_global_id(2);
+    const int len_y = get_global_size(1);
+
+    const int stride_y_in = len_y * in_stride;
+    const int stride_x = width;
+    const int stride_y = height * stride_x;
+
+    if (idx < width && idy < height)
+        out[idz*stride_y + idy*stride_x + idx] = in[idz*stride_y_in + idy*in_stride + idx] * scale;
+}
+
 kernel void
 fft_normalize (global float *data)
 {
@@ -17,23 +17,27 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "tile.cl"
+
+/*
+ * Separable Gaussian passes. The num_weights taps are centered on the output
+ * pixel and pixels outside of the image are clamped to the nearest edge.
+ */
+
 kernel void
 h_gaussian (global float *input,
             global float *output,
             constant float *weights,
-            int half_num_weights)
+            const int num_weights)
 {
     const int x = get_global_id(0);
     const int y = get_global_id(1);
     const int width = get_global_size(0);
-    const int height = get_global_size(1);
-
-    const int from = max(0, x - half_num_weights);
-    const int to = min(width, x + half_num_weights);
+    const int from = x - num_weights / 2;
     float sum = 0.0f;
 
-    for (int i = from; i < to; i++)
-        sum += input[y * width + i] * weights[i - from];
+    for (int i = 0; i < num_weights; i++)
+        sum += input[y * width + clamp (from + i, 0, width - 1)] * weights[i];
 
     output[y * width + x] = sum;
 }
@@ -42,18 +46,79 @@ kernel void
 v_gaussian (global float *input,
             global float *output,
             constant float *weights,
-            int half_num_weights)
+            const int num_weights)
 {
     const int x = get_global_id(0);
     const int y = get_global_id(1);
     const int width = get_global_size(0);
     const int height = get_global_size(1);
+    const int from = y - num_weights / 2;
+    float sum = 0.0f;
+
+    for (int i = 0; i < num_weights; i++)
+        sum += input[clamp (from + i, 0, height - 1) * width + x] * weights[i];
+
+    output[y * width + x] = sum;
+}
+
+kernel void
+h_gaussian_tiled (global const float *input,
+                  global float *output,
+                  constant float *weights,
+                  const int num_weights,
+                  local float *tile,
+                  const int width,
+                  const int height)
+{
+    const int x = get_global_id (0);
+    const int y = get_global_id (1);
+    const int tile_width = get_local_size (0) + num_weights - 1;
+    local const float *row;
+    float sum = 0.0f;
+
+    load_tile (input, tile, width, height,
+               get_group_id (0) * get_local_size (0) - num_weights / 2,
+               get_group_id (1) * get_local_size (1),
+               tile_width, get_local_size (1));
+
+    if (x >= width || y >= height)
+        return;
+
+    row = tile + get_local_id (1) * tile_width + get_local_id (0);
+
+    for (int i = 0; i < num_weights; i++)
+        sum += row[i] * weights[i];
+
+    output[y * width + x] = sum;
+}
 
-    const int from = max(0, y - half_num_weights);
-    const int to = min(height, y + half_num_weights);
+kernel void
+v_gaussian_tiled (global const float *input,
+                  global float *output,
+                  constant float *weights,
+                  const int num_weights,
+                  local float *tile,
+                  const int width,
+                  const int height)
+{
+    const int x = get_global_id (0);
+    const int y = get_global_id (1);
+    const int tile_width = get_local_size (0);
+    local const float *column;
     float sum = 0.0f;
-    for (int i = from; i < to; i++)
-        sum += input[i * width + x] * weights[i - from];
+
+    load_tile (input, tile, width, height,
+               get_group_id (0) * get_local_size (0),
+               get_group_id (1) * get_local_size (1) - num_weights / 2,
+               tile_width, get_local_size (1) + num_weights - 1);
+
+    if (x >= width || y >= height)
+        return;
+
+    column = tile + get_local_id (1) * tile_width + get_local_id (0);
+
+    for (int i = 0; i < num_weights; i++)
+        sum += column[i * tile_width] * weights[i];
 
     output[y * width + x] = sum;
 }
@@ -17,6 +17,8 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "tile.cl"
+
 /* These kernels assume that MEDIAN_BOX_SIZE is defined! */
 #ifndef MEDIAN_BOX_SIZE
 0   /* Hope the compilers complain about that */
@@ -36,6 +38,10 @@ filter_inner (global float *input,
     int width = get_global_size(0) + MEDIAN_BOX_SIZE - 1;
     int height = get_global_size(1) + MEDIAN_BOX_SIZE - 1;
 
+    /* Frames of a batch are stacked along the third dimension */
+    input += get_global_id(2) * width * height;
+    output += get_global_id(2) * width * height;
+
     float elements[MEDIAN_BOX_SIZE * MEDIAN_BOX_SIZE];
 
     /* Start at top left corner and pull out data */
@@ -63,6 +69,52 @@ filter_inner (global float *input,
     output[idy * width + idx] = elements[MEDIAN_BOX_SIZE * MEDIAN_BOX_SIZE / 2];
 }
 
+kernel void
+filter_inner_tiled (global const float *input,
+                    global float *output,
+                    local float *tile,
+                    const int width,
+                    const int height)
+{
+    const int HALF_SIZE = (MEDIAN_BOX_SIZE - 1) / 2;
+    const int lx = get_local_id (0);
+    const int ly = get_local_id (1);
+    const int tile_width = get_local_size (0) + MEDIAN_BOX_SIZE - 1;
+    const int idx = get_global_id (0);
+    const int idy = get_global_id (1);
+    float elements[MEDIAN_BOX_SIZE * MEDIAN_BOX_SIZE];
+    int i = 0;
+
+    input += get_global_id (2) * width * height;
+    output += get_global_id (2) * width * height;
+
+    load_tile (input, tile, width, height,
+               get_group_id (0) * get_local_size (0), get_group_id (1) * get_local_size (1),
+               tile_width, get_local_size (1) + MEDIAN_BOX_SIZE - 1);
+
+    if (idx >= width - MEDIAN_BOX_SIZE + 1 || idy >= height - MEDIAN_BOX_SIZE + 1)
+        return;
+
+    for (int y = ly; y < ly + MEDIAN_BOX_SIZE; y++) {
+        for (int x = lx; x < lx + MEDIAN_BOX_SIZE; x++) {
+            elements[i++] = tile[y * tile_width + x];
+        }
+    }
+
+    for (int i = 1; i < MEDIAN_BOX_SIZE * MEDIAN_BOX_SIZE; i++) {
+        int j = i;
+
+        while (j > 0 && elements[j-1] > elements[j]) {
+            float tmp = elements[j-1];
+            elements[j-1] = elements[j];
+            elements[j] = tmp;
+            j--;
+        }
+    }
+
+    output[(idy + HALF_SIZE) * width + idx + HALF_SIZE] = elements[MEDIAN_BOX_SIZE * MEDIAN_BOX_SIZE / 2];
+}
+
 kernel void
 fill (global float *input,
       global float *output)
@@ -72,7 +124,106 @@ fill (global float *input,
     int idy = get_global_id(1);
     int width = get_global_size(0);
     int height = get_global_size(1);
+    size_t offset = get_global_id(2) * width * height;
 
     if (abs(idx - width) < HALF_SIZE && abs(idy - height) < HALF_SIZE)
-        output[idy * width + idx] = input[idy * width + idx];
+        output[offset + idy * width + idx] = input[offset + idy * width + idx];
+}
+
+/*
+ * Sliding histogram median for large boxes. The input is quantized to 16 bit
+ * by quantize, the upper 8 bits index a coarse histogram which is updated
+ * incrementally while a work item slides down a band of rows, the lower 8 bits
+ * are resolved with a fine histogram of the coarse median bin only.
+ */
+kernel void
+quantize (global float *input,
+          global ushort *output,
+          const float minimum,
+          const float scale)
+{
+    size_t idx = (get_global_id (2) * get_global_size (1) + get_global_id (1)) * get_global_size (0) + get_global_id (0);
+    output[idx] = convert_ushort_sat_rte ((input[idx] - minimum) * scale);
+}
+
+kernel void
+filter_inner_histogram (global float *input,
+                        global ushort *quantized,
+                        global float *output,
+                        local ushort *histograms,
+                        const int width,
+                        const int height,
+                        const int band)
+{
+    const int HALF_SIZE = (MEDIAN_BOX_SIZE - 1) / 2;
+    const int RANK = MEDIAN_BOX_SIZE * MEDIAN_BOX_SIZE / 2;
+    const int x = get_global_id (0) + HALF_SIZE;
+    const int y_start = get_global_id (1) * band + HALF_SIZE;
+    const int y_end = min (y_start + band, height - HALF_SIZE);
+    local ushort *coarse = histograms + get_local_id (0) * 512;
+    local ushort *fine = coarse + 256;
+    const size_t offset = get_global_id (2) * width * height;
+
+    if (x >= width - HALF_SIZE || y_start >= y_end)
+        return;
+
+    input += offset;
+    quantized += offset;
+    output += offset;
+
+    for (int i = 0; i < 256; i++)
+        coarse[i] = 0;
+
+    /* All but the last row of the first window, which is added in the loop */
+    for (int y = y_start - HALF_SIZE; y < y_start + HALF_SIZE; y++) {
+        for (int dx = -HALF_SIZE; dx <= HALF_SIZE; dx++)
+            coarse[quantized[y * width + x + dx] >> 8]++;
+    }
+
+    for (int y = y_start; y < y_end; y++) {
+        int count = 0;
+        int c = 0;
+        int f = 0;
+        ushort target;
+        float result = 0.0f;
+        bool found = false;
+
+        for (int dx = -HALF_SIZE; dx <= HALF_SIZE; dx++)
+            coarse[quantized[(y + HALF_SIZE) * width + x + dx] >> 8]++;
+
+        while (count + coarse[c] <= RANK)
+            count += coarse[c++];
+
+        for (int i = 0; i < 256; i++)
+            fine[i] = 0;
+
+        for (int wy = y - HALF_SIZE; wy <= y + HALF_SIZE; wy++) {
+            for (int dx = -HALF_SIZE; dx <= HALF_SIZE; dx++) {
+                ushort q = quantized[wy * width + x + dx];
+
+                if ((q >> 8) == c)
+                    fine[q & 0xff]++;
+            }
+        }
+
+        while (count + fine[f] <= RANK)
+            count += fine[f++];
+
+        /* Output an original value of the median bin instead of its center */
+        target = (ushort) ((c << 8) | f);
+
+        for (int wy = y - HALF_SIZE; wy <= y + HALF_SIZE && !found; wy++) {
+            for (int dx = -HALF_SIZE; dx <= HALF_SIZE && !found; dx++) {
+                if (quantized[wy * width + x + dx] == target) {
+                    result = input[wy * width + x + dx];
+                    found = true;
+                }
+            }
+        }
+
+        output[y * width + x] = result;
+
+        for (int dx = -HALF_SIZE; dx <= HALF_SIZE; dx++)
+            coarse[quantized[(y - HALF_SIZE) * width + x + dx] >> 8]--;
+    }
 }
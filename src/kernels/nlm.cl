@@ -80,3 +80,176 @@ nlm_noise_reduction (global float *input,
 
     output[y * width + x] = pixel_value / total_weight;
 }
+
+/*
+ * Fast variant after Darbon et al. For every offset of the search window the
+ * squared differences between the image and its shifted copy are box-summed
+ * over the patch, which makes the cost independent of the patch size. Columns
+ * are summed with a running sum, rows with a prefix sum in local memory. With
+ * NLM_HALF the intermediate column sums are stored as half floats.
+ */
+#ifdef NLM_HALF
+#define sum_type half
+#define load_sum(sums, i) vload_half ((i), (sums))
+#define store_sum(sums, i, value) vstore_half ((value), (i), (sums))
+#else
+#define sum_type float
+#define load_sum(sums, i) ((sums)[i])
+#define store_sum(sums, i, value) ((sums)[i] = (value))
+#endif
+
+int4
+decode_offset (int offset, int search_radius, int slice_radius)
+{
+    const int side = 2 * search_radius + 1;
+
+    return (int4) (offset % side - search_radius,
+                   (offset / side) % side - search_radius,
+                   offset / (side * side) - slice_radius,
+                   0);
+}
+
+float
+pixel (global float *input, int x, int y, int z, int width, int height, int depth)
+{
+    x = clamp (x, 0, width - 1);
+    y = clamp (y, 0, height - 1);
+    z = clamp (z, 0, depth - 1);
+
+    return input[(z * height + y) * width + x];
+}
+
+/*
+ * Squared differences summed over the slices of the patch. Patches are
+ * extended beyond the borders by repeating the outermost differences.
+ */
+float
+slice_diff (global float *input, int x, int y, int z, int4 d,
+            int slice_radius, int width, int height, int depth)
+{
+    float sum = 0.0f;
+
+    y = clamp (y, 0, height - 1);
+
+    for (int k = -slice_radius; k <= slice_radius; k++) {
+        const int zk = clamp (z + k, 0, depth - 1);
+        const float diff = pixel (input, x, y, zk, width, height, depth) -
+                           pixel (input, x + d.x, y + d.y, zk + d.z, width, height, depth);
+        sum += diff * diff;
+    }
+
+    return sum;
+}
+
+kernel void
+nlm_column_sums (global float *input,
+                 global sum_type *sums,
+                 const int first_offset,
+                 const int search_radius,
+                 const int slice_radius,
+                 const int patch_radius,
+                 const int width,
+                 const int height,
+                 const int depth)
+{
+    const int x = get_global_id (0);
+    const int z = get_global_id (1);
+    const int batch = get_global_id (2);
+    const int4 d = decode_offset (first_offset + batch, search_radius, slice_radius);
+    global sum_type *column = sums + ((size_t) batch * depth + z) * height * width + x;
+    float sum = 0.0f;
+
+    for (int k = -patch_radius; k <= patch_radius; k++)
+        sum += slice_diff (input, x, k, z, d, slice_radius, width, height, depth);
+
+    store_sum (column, 0, sum);
+
+    for (int y = 1; y < height; y++) {
+        sum += slice_diff (input, x, y + patch_radius, z, d, slice_radius, width, height, depth) -
+               slice_diff (input, x, y - 1 - patch_radius, z, d, slice_radius, width, height, depth);
+        store_sum (column, y * width, sum);
+    }
+}
+
+kernel void
+nlm_row_weights (global float *input,
+                 global sum_type *sums,
+                 global float *numerator,
+                 global float *denominator,
+                 const int first_offset,
+                 const int num_offsets,
+                 const int search_radius,
+                 const int slice_radius,
+                 const int patch_radius,
+                 const float sigma,
+                 const int width,
+                 const int height,
+                 const int depth,
+                 const int first,
+                 local float *scan_a,
+                 local float *scan_b)
+{
+    const int lx = get_local_id (0);
+    const int row_size = get_local_size (0);
+    const int x0 = get_group_id (0) * row_size;
+    const int x = x0 + lx;
+    const int row = get_global_id (1);
+    const int y = row % height;
+    const int z = row / height;
+    const int tile_size = row_size + 2 * patch_radius;
+    const size_t size = (size_t) width * height * depth;
+    const float sigma_2 = sigma * sigma;
+    const float patch_size = (2.0f * patch_radius + 1.0f) * (2.0f * patch_radius + 1.0f) *
+                             (2.0f * slice_radius + 1.0f);
+    float pixel_value = 0.0f;
+    float total_weight = 0.0f;
+
+    for (int batch = 0; batch < num_offsets; batch++) {
+        const int4 d = decode_offset (first_offset + batch, search_radius, slice_radius);
+        global sum_type *row_sums = sums + batch * size + (size_t) row * width;
+        local float *tmp;
+
+        for (int i = lx; i < tile_size; i += row_size)
+            scan_a[i] = load_sum (row_sums, clamp (x0 - patch_radius + i, 0, width - 1));
+
+        barrier (CLK_LOCAL_MEM_FENCE);
+
+        /* Inclusive prefix sum of the tile */
+        for (int step = 1; step < tile_size; step *= 2) {
+            for (int i = lx; i < tile_size; i += row_size)
+                scan_b[i] = scan_a[i] + (i >= step ? scan_a[i - step] : 0.0f);
+
+            barrier (CLK_LOCAL_MEM_FENCE);
+            tmp = scan_a;
+            scan_a = scan_b;
+            scan_b = tmp;
+        }
+
+        if (x < width) {
+            const float dist = scan_a[lx + 2 * patch_radius] - (lx > 0 ? scan_a[lx - 1] : 0.0f);
+            const float weight = exp (- sigma_2 * dist / patch_size);
+
+            pixel_value += weight * pixel (input, x + d.x, y + d.y, z + d.z, width, height, depth);
+            total_weight += weight;
+        }
+
+        barrier (CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (x < width) {
+        const size_t idx = (size_t) row * width + x;
+
+        numerator[idx] = first ? pixel_value : numerator[idx] + pixel_value;
+        denominator[idx] = first ? total_weight : denominator[idx] + total_weight;
+    }
+}
+
+kernel void
+nlm_normalize (global float *numerator,
+               global float *denominator,
+               global float *output)
+{
+    const size_t idx = get_global_id (0);
+
+    output[idx] = numerator[idx] / denominator[idx];
+}
@@ -102,3 +102,66 @@ load_elements_from_pattern (global float *src,
         }
     }
 }
+
+/* Same as load_elements_from_pattern but the pixels of the work group and the
+ * filter footprint around them are staged in local memory first */
+kernel void
+load_elements_from_pattern_tiled (global const float *src,
+                                  global float *dst,
+                                  global const float *pattern,
+                                  int dimension,
+                                  int num_ones,
+                                  int width,
+                                  int height,
+                                  unsigned y_offset,
+                                  int rows,
+                                  local float *tile)
+{
+    const int x = get_global_id(0);
+    const int local_y = get_global_id(1);
+    const int lx = get_local_id(0);
+    const int ly = get_local_id(1);
+    const int tile_width = get_local_size(0) + dimension - 1;
+    const int tile_height = get_local_size(1) + dimension - 1;
+    int2 center;
+
+    get_center (dimension, dimension, &center);
+
+    {
+        const int x0 = get_group_id(0) * get_local_size(0) - center.x;
+        const int y0 = get_group_id(1) * get_local_size(1) + y_offset - center.y;
+
+        for (int j = ly; j < tile_height; j += get_local_size(1)) {
+            int y = y0 + j;
+
+            if (y < 0 || y >= height)
+                y = get_position (y, height);
+
+            for (int i = lx; i < tile_width; i += get_local_size(0)) {
+                int xx = x0 + i;
+
+                if (xx < 0 || xx >= width)
+                    xx = get_position (xx, width);
+
+                tile[j * tile_width + i] = src[y * width + xx];
+            }
+        }
+    }
+
+    barrier(CLK_LOCAL_MEM_FENCE);
+
+    if (x >= width || local_y >= rows)
+        return;
+
+    /* Don't apply the offset for the dst buffer */
+    global float *tmpDst = dst + num_ones * (x + local_y * width);
+
+    for (int j = 0; j < dimension; ++j) {
+        for (int i = 0; i < dimension; ++i) {
+            if (pattern[i + j * dimension]) {
+                *tmpDst = tile[(ly + j) * tile_width + lx + i];
+                ++tmpDst;
+            }
+        }
+    }
+}
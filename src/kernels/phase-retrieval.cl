@@ -106,3 +106,10 @@ mult_by_value(global float *input, global float *values, global float *output)
     int idx = get_global_id(1) * get_global_size(0) + get_global_id(0);
     output[idx] = input[idx] * values[idx];
 }
+
+kernel void
+mult_by_value_half(global float *input, global float *values, global float *output, const int values_width)
+{
+    int idx = get_global_id(1) * get_global_size(0) + get_global_id(0);
+    output[idx] = input[idx] * values[get_global_id(1) * values_width + get_global_id(0)];
+}
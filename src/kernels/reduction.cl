@@ -0,0 +1,219 @@
+/*
+ * Copyright (C) 2011-2013 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Statistics consist of the number of values, the mean, the sums of the second,
+ * third and fourth powers of the deviations from the mean, minimum, maximum and
+ * an unused value, laid out like UfoStatistics on the host. Single values are
+ * accumulated with Welford's update and partial statistics are merged with the
+ * pairwise formulas by Chan and Pébay, thus the data is read exactly once. The
+ * third and fourth moments are only tracked if HIGHER_MOMENTS is defined.
+ */
+typedef struct {
+    uint count;
+    float mean;
+    float m2;
+    float m3;
+    float m4;
+    float min;
+    float max;
+    float unused;
+} Statistics;
+
+Statistics
+stats_empty (void)
+{
+    Statistics s = { 0, 0.0f, 0.0f, 0.0f, 0.0f, INFINITY, -INFINITY, 0.0f };
+
+    return s;
+}
+
+Statistics
+stats_update (Statistics s, float x)
+{
+    const float n1 = (float) s.count;
+    const float n = n1 + 1.0f;
+    const float delta = x - s.mean;
+    const float delta_n = delta / n;
+    const float term = delta * delta_n * n1;
+
+#ifdef HIGHER_MOMENTS
+    const float delta_n2 = delta_n * delta_n;
+
+    s.m4 += term * delta_n2 * (n * n - 3.0f * n + 3.0f) + 6.0f * delta_n2 * s.m2 - 4.0f * delta_n * s.m3;
+    s.m3 += term * delta_n * (n - 2.0f) - 3.0f * delta_n * s.m2;
+#endif
+    s.m2 += term;
+    s.mean += delta_n;
+    s.count++;
+    s.min = fmin (s.min, x);
+    s.max = fmax (s.max, x);
+
+    return s;
+}
+
+Statistics
+stats_merge (Statistics a, Statistics b)
+{
+    Statistics r;
+    float na, nb, n, delta, delta_n, na_nb;
+
+    if (a.count == 0)
+        return b;
+
+    if (b.count == 0)
+        return a;
+
+    na = (float) a.count;
+    nb = (float) b.count;
+    n = na + nb;
+    delta = b.mean - a.mean;
+    delta_n = delta / n;
+    na_nb = na * nb;
+
+    r.count = a.count + b.count;
+    r.mean = a.mean + nb * delta_n;
+    r.m2 = a.m2 + b.m2 + delta * delta_n * na_nb;
+#ifdef HIGHER_MOMENTS
+    r.m3 = a.m3 + b.m3 + delta * delta_n * delta_n * na_nb * (na - nb) +
+           3.0f * delta_n * (na * b.m2 - nb * a.m2);
+    r.m4 = a.m4 + b.m4 + delta * delta_n * delta_n * delta_n * na_nb * (na * na - na_nb + nb * nb) +
+           6.0f * delta_n * delta_n * (na * na * b.m2 + nb * nb * a.m2) +
+           4.0f * delta_n * (na * b.m3 - nb * a.m3);
+#else
+    r.m3 = 0.0f;
+    r.m4 = 0.0f;
+#endif
+    r.min = fmin (a.min, b.min);
+    r.max = fmax (a.max, b.max);
+    r.unused = 0.0f;
+
+    return r;
+}
+
+/*
+ * Reduce contiguous rows of length elements, pitch elements apart. Every work
+ * group writes one partial result per row, the local size must be a power of
+ * two.
+ */
+kernel void
+reduce_statistics_rows (global const float *input,
+                        global Statistics *partials,
+                        local Statistics *scratch,
+                        const uint length,
+                        const uint pitch)
+{
+    const uint lid = get_local_id (0);
+    const uint row = get_global_id (1);
+    global const float *in = input + (size_t) row * pitch;
+    Statistics s = stats_empty ();
+
+    for (uint i = get_global_id (0); i < length; i += get_global_size (0))
+        s = stats_update (s, in[i]);
+
+    scratch[lid] = s;
+    barrier (CLK_LOCAL_MEM_FENCE);
+
+    for (uint offset = get_local_size (0) >> 1; offset > 0; offset >>= 1) {
+        if (lid < offset)
+            scratch[lid] = stats_merge (scratch[lid], scratch[lid + offset]);
+
+        barrier (CLK_LOCAL_MEM_FENCE);
+    }
+
+    if (lid == 0)
+        partials[row * get_num_groups (0) + get_group_id (0)] = scratch[0];
+}
+
+/*
+ * Reduce columns of length elements. Neighbouring work items process
+ * neighbouring columns for coalesced reads, the second dimension splits each
+ * column into interleaved parts.
+ */
+kernel void
+reduce_statistics_columns (global const float *input,
+                           global Statistics *partials,
+                           const uint length,
+                           const uint n_columns)
+{
+    const uint column = get_global_id (0);
+    const uint part = get_global_id (1);
+    const uint n_parts = get_global_size (1);
+    Statistics s = stats_empty ();
+
+    for (uint i = part; i < length; i += n_parts)
+        s = stats_update (s, input[(size_t) i * n_columns + column]);
+
+    partials[column * n_parts + part] = s;
+}
+
+kernel void
+reduce_statistics_finish (global const Statistics *partials,
+                          global Statistics *output,
+                          const uint n_parts)
+{
+    const uint row = get_global_id (0);
+    Statistics s = partials[row * n_parts];
+
+    for (uint i = 1; i < n_parts; i++)
+        s = stats_merge (s, partials[row * n_parts + i]);
+
+    output[row] = s;
+}
+
+/* quantity follows UfoReductionQuantity */
+kernel void
+reduce_statistics_extract (global const Statistics *stats,
+                           global float *output,
+                           const int quantity)
+{
+    const uint idx = get_global_id (0);
+    const Statistics s = stats[idx];
+    const float var = s.m2 / s.count;
+    float result;
+
+    switch (quantity) {
+        case 0:
+            result = s.min;
+            break;
+        case 1:
+            result = s.max;
+            break;
+        case 2:
+            result = s.mean * s.count;
+            break;
+        case 3:
+            result = s.mean;
+            break;
+        case 4:
+            result = var;
+            break;
+        case 5:
+            result = sqrt (var);
+            break;
+        case 6:
+            result = var != 0.0f ? s.m3 / s.count / pow (var, 1.5f) : 0.0f;
+            break;
+        default:
+            result = (var != 0.0f ? s.m4 / s.count / (var * var) : 0.0f) - 3.0f;
+            break;
+    }
+
+    output[idx] = result;
+}
@@ -17,56 +17,93 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "tile.cl"
+
 #ifndef BOX_SIZE
 #define BOX_SIZE 3
 #endif
 
+#define ARR_SIZE (BOX_SIZE * BOX_SIZE)
+
+float
+replace_outlier (float *elements,
+                 const float value,
+                 const float o_threshold,
+                 const int o_sign)
+{
+    /* Sort elements with (for now) insertion sort */
+    for (int i = 1; i < ARR_SIZE; i++) {
+        int j = i;
+        while (j > 0 && elements[j-1] > elements[j]) {
+            float tmp = elements[j-1];
+            elements[j-1] = elements[j];
+            elements[j] = tmp;
+            j--;
+        }
+    }
+
+    if (value * o_sign > elements[(ARR_SIZE - 1) / 2] * o_sign + o_threshold)
+        return (elements[(ARR_SIZE - 1) / 2] + elements[(ARR_SIZE - 1) / 2 - o_sign]) / 2;
+
+    return value;
+}
+
 kernel void
 filter (global float *input,
-              global float *output,
-              const float o_threshold,
-              const int o_sign)
+        global float *output,
+        const float o_threshold,
+        const int o_sign)
 {
     const int HALF_SIZE = (BOX_SIZE - 1) / 2;
-    const int ARR_SIZE = BOX_SIZE * BOX_SIZE;
+    const int idx = get_global_id(0);
+    const int idy = get_global_id(1);
+    const int width = get_global_size(0);
+    const int height = get_global_size(1);
+    float elements[ARR_SIZE];
+    int i = 0;
+
+    /* Pixels outside of the image are clamped to the nearest edge */
+    for (int y = idy - HALF_SIZE; y < idy + HALF_SIZE + 1; y++) {
+        for (int x = idx - HALF_SIZE; x < idx + HALF_SIZE + 1; x++) {
+            elements[i++] = input[clamp (y, 0, height - 1) * width + clamp (x, 0, width - 1)];
+        }
+    }
 
-    int idx = get_global_id(0);
-    int idy = get_global_id(1);
+    output[idy * width + idx] = replace_outlier (elements, input[idy * width + idx], o_threshold, o_sign);
+}
 
-    int width = get_global_size(0);
-    int height = get_global_size(1);
+kernel void
+filter_tiled (global const float *input,
+              global float *output,
+              local float *tile,
+              const float o_threshold,
+              const int o_sign,
+              const int width,
+              const int height)
+{
+    const int HALF_SIZE = (BOX_SIZE - 1) / 2;
+    const int lx = get_local_id (0);
+    const int ly = get_local_id (1);
+    const int tile_width = get_local_size (0) + BOX_SIZE - 1;
+    const int idx = get_global_id (0);
+    const int idy = get_global_id (1);
+    float elements[ARR_SIZE];
+    int i = 0;
 
-    /* Check for boundary elements */
-    if (abs(idx - width) < HALF_SIZE && abs(idy - height) < HALF_SIZE)
-        output[idy * width + idx] = input[idy * width + idx];
-    else {
-        float elements[BOX_SIZE * BOX_SIZE];
+    load_tile (input, tile, width, height,
+               get_group_id (0) * get_local_size (0) - HALF_SIZE,
+               get_group_id (1) * get_local_size (1) - HALF_SIZE,
+               tile_width, get_local_size (1) + BOX_SIZE - 1);
 
-        /* Start at top left corner and pull out data */
-        /* int index = (idy - HALF_SIZE) * width + idx - HALF_SIZE; */
-        int i = 0;
+    if (idx >= width || idy >= height)
+        return;
 
-        for (int y = idy - HALF_SIZE; y < idy + HALF_SIZE + 1; y++) {
-            for (int x = idx - HALF_SIZE; x < idx + HALF_SIZE + 1; x++) {
-                elements[i++] = input[y * width + x];
-            }
-        }
-        /* Sort elements with (for now) insertion sort */
-        for (int i = 1; i < ARR_SIZE; i++) {
-            int j = i;
-            while (j > 0 && elements[j-1] > elements[j]) {
-                float tmp = elements[j-1];
-                elements[j-1] = elements[j];
-                elements[j] = tmp;
-                j--;
-            }
-        }
-        if (input[idy * width + idx]*o_sign > elements[(ARR_SIZE - 1)/ 2]*o_sign + o_threshold) {
-            float median_unbiased = ( elements[(ARR_SIZE - 1) / 2] + elements[(ARR_SIZE - 1) / 2 - o_sign] ) / 2 ;
-            output[idy * width + idx] = (float)(median_unbiased);
-        }
-        else {
-            output[idy * width + idx] = input[idy * width + idx];
+    for (int y = ly; y < ly + BOX_SIZE; y++) {
+        for (int x = lx; x < lx + BOX_SIZE; x++) {
+            elements[i++] = tile[y * tile_width + x];
         }
     }
+
+    output[idy * width + idx] = replace_outlier (elements, tile[(ly + HALF_SIZE) * tile_width + lx + HALF_SIZE],
+                                                 o_threshold, o_sign);
 }
@@ -0,0 +1,59 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Helpers for neighbourhood filters which stage the input pixels of a work
+ * group in local memory. The host sizes the tile with
+ * ufo_tile_get_work_size(), i.e. the local size plus the halo of the filter.
+ */
+
+#ifndef UFO_TILE_CL
+#define UFO_TILE_CL
+
+/*
+ * Copy the tile_width x tile_height input region starting at (x0, y0) to
+ * @tile. Coordinates outside of the image are clamped to the nearest edge.
+ * Must be reached by all work items of the group.
+ */
+void
+load_tile (global const float *input,
+           local float *tile,
+           const int width,
+           const int height,
+           const int x0,
+           const int y0,
+           const int tile_width,
+           const int tile_height)
+{
+    const int lx = get_local_id (0);
+    const int ly = get_local_id (1);
+    const int local_width = get_local_size (0);
+    const int local_height = get_local_size (1);
+
+    for (int y = ly; y < tile_height; y += local_height) {
+        const int row = clamp (y0 + y, 0, height - 1) * width;
+
+        for (int x = lx; x < tile_width; x += local_width)
+            tile[y * tile_width + x] = input[row + clamp (x0 + x, 0, width - 1)];
+    }
+
+    barrier (CLK_LOCAL_MEM_FENCE);
+}
+
+#endif
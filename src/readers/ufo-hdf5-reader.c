@@ -17,10 +17,21 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+
 #include "common/hdf5.h"
 #include "readers/ufo-reader.h"
 #include "readers/ufo-hdf5-reader.h"
 
+/* Upper bound for the batch size derived from the chunk layout */
+#define MAX_AUTO_BATCH_BYTES    (64 * 1024 * 1024)
+
+/* Upper bound for the chunk cache holding all chunks of one frame */
+#define MAX_CHUNK_CACHE_BYTES   (512 * 1024 * 1024)
+
+/* Interval between checks for new frames in SWMR mode */
+#define SWMR_POLL_INTERVAL      (G_USEC_PER_SEC / 10)
+
 
 struct _UfoHdf5ReaderPrivate {
     hid_t file_id;
@@ -29,9 +40,33 @@ struct _UfoHdf5ReaderPrivate {
 
     gint n_dims;
     hsize_t dims[3];
+    hsize_t chunk_dims[3];
+    gboolean chunked;
     guint current;
+
+    guint batch;
+    gboolean swmr;
+    guint swmr_timeout;
+
+    /* Frames read ahead in one hyperslab call */
+    gfloat *cache;
+    gsize cache_size;
+    guint cache_start;
+    guint cache_count;
+    guint cache_roi_y;
+    guint cache_roi_step;
 };
 
+enum {
+    PROP_0,
+    PROP_BATCH,
+    PROP_SWMR,
+    PROP_SWMR_TIMEOUT,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
 static void ufo_reader_interface_init (UfoReaderIface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (UfoHdf5Reader, ufo_hdf5_reader, G_TYPE_OBJECT,
@@ -53,6 +88,61 @@ ufo_hdf5_reader_can_open (UfoReader *reader,
     return ufo_hdf5_can_open (filename);
 }
 
+/*
+ * Open the dataset and, if it is chunked, size the chunk cache such that all
+ * chunks of one frame fit. Otherwise chunks spanning several frames would be
+ * decompressed again for each frame.
+ */
+static hid_t
+open_dataset (UfoHdf5ReaderPrivate *priv,
+              const gchar *name)
+{
+    hid_t dataset_id;
+    hid_t dcpl;
+    hid_t dapl;
+    hid_t type_id;
+    hid_t space_id;
+    gsize chunk_bytes;
+    gsize cache_bytes;
+    gsize n_chunks;
+
+    dataset_id = H5Dopen (priv->file_id, name, H5P_DEFAULT);
+
+    if (dataset_id < 0)
+        return dataset_id;
+
+    dcpl = H5Dget_create_plist (dataset_id);
+    priv->chunked = H5Pget_layout (dcpl) == H5D_CHUNKED &&
+                    H5Pget_chunk (dcpl, 3, priv->chunk_dims) == 3;
+    H5Pclose (dcpl);
+
+    if (!priv->chunked)
+        return dataset_id;
+
+    type_id = H5Dget_type (dataset_id);
+    chunk_bytes = priv->chunk_dims[0] * priv->chunk_dims[1] * priv->chunk_dims[2] * H5Tget_size (type_id);
+    H5Tclose (type_id);
+
+    space_id = H5Dget_space (dataset_id);
+    H5Sget_simple_extent_dims (space_id, priv->dims, NULL);
+    H5Sclose (space_id);
+
+    n_chunks = ((priv->dims[1] + priv->chunk_dims[1] - 1) / priv->chunk_dims[1]) *
+               ((priv->dims[2] + priv->chunk_dims[2] - 1) / priv->chunk_dims[2]);
+    cache_bytes = MIN (n_chunks * chunk_bytes, MAX_CHUNK_CACHE_BYTES);
+
+    if (cache_bytes <= 1024 * 1024)
+        return dataset_id;
+
+    H5Dclose (dataset_id);
+    dapl = H5Pcreate (H5P_DATASET_ACCESS);
+    H5Pset_chunk_cache (dapl, H5D_CHUNK_CACHE_NSLOTS_DEFAULT, cache_bytes, 1.0);
+    dataset_id = H5Dopen (priv->file_id, name, dapl);
+    H5Pclose (dapl);
+
+    return dataset_id;
+}
+
 static gboolean
 ufo_hdf5_reader_open (UfoReader *reader,
                       const gchar *filename,
@@ -76,8 +166,26 @@ ufo_hdf5_reader_open (UfoReader *reader,
     h5_filename = components[0];
     h5_dataset = components[1];
 
-    priv->file_id = H5Fopen (h5_filename, H5F_ACC_RDWR, H5P_DEFAULT);
-    priv->dataset_id = H5Dopen (priv->file_id, h5_dataset, H5P_DEFAULT);
+    if (priv->swmr) {
+#if H5_VERSION_GE(1,10,0)
+        priv->file_id = H5Fopen (h5_filename, H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+#else
+        g_warning ("hdf5: SWMR requires HDF5 1.10, reading static file");
+        priv->file_id = H5Fopen (h5_filename, H5F_ACC_RDONLY, H5P_DEFAULT);
+#endif
+    }
+    else {
+        priv->file_id = H5Fopen (h5_filename, H5F_ACC_RDWR, H5P_DEFAULT);
+    }
+
+    if (priv->file_id < 0) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "hdf5: cannot open `%s'", h5_filename);
+        g_strfreev (components);
+        return FALSE;
+    }
+
+    priv->dataset_id = open_dataset (priv, h5_dataset);
     priv->src_dataspace_id = H5Dget_space (priv->dataset_id);
     priv->n_dims = H5Sget_simple_extent_ndims (priv->src_dataspace_id);
 
@@ -90,6 +198,7 @@ ufo_hdf5_reader_open (UfoReader *reader,
     H5Sget_simple_extent_dims (priv->src_dataspace_id, priv->dims, NULL);
 
     priv->current = start;
+    priv->cache_count = 0;
     g_strfreev (components);
     return TRUE;
 }
@@ -113,7 +222,46 @@ ufo_hdf5_reader_data_available (UfoReader *reader)
 
     priv = UFO_HDF5_READER_GET_PRIVATE (reader);
 
-    return priv->current < priv->dims[0];
+    if (priv->current < priv->dims[0])
+        return TRUE;
+
+#if H5_VERSION_GE(1,10,0)
+    if (priv->swmr) {
+        gint64 end_time;
+
+        end_time = g_get_monotonic_time () + ((gint64) priv->swmr_timeout) * G_USEC_PER_SEC;
+
+        /* Wait for the writer to append more frames */
+        do {
+            if (H5Drefresh (priv->dataset_id) >= 0) {
+                H5Sclose (priv->src_dataspace_id);
+                priv->src_dataspace_id = H5Dget_space (priv->dataset_id);
+                H5Sget_simple_extent_dims (priv->src_dataspace_id, priv->dims, NULL);
+
+                if (priv->current < priv->dims[0])
+                    return TRUE;
+            }
+
+            g_usleep (SWMR_POLL_INTERVAL);
+        } while (g_get_monotonic_time () < end_time);
+    }
+#endif
+
+    return FALSE;
+}
+
+static guint
+get_batch_size (UfoHdf5ReaderPrivate *priv,
+                gsize frame_size)
+{
+    if (priv->batch > 0)
+        return priv->batch;
+
+    /* Read as many frames at once as are stored together in a chunk */
+    if (priv->chunked && priv->chunk_dims[0] > 1)
+        return (guint) MAX (1, MIN (priv->chunk_dims[0], MAX_AUTO_BATCH_BYTES / frame_size));
+
+    return 1;
 }
 
 static void
@@ -127,22 +275,63 @@ ufo_hdf5_reader_read (UfoReader *reader,
     UfoHdf5ReaderPrivate *priv;
     gpointer data;
     hid_t dst_dataspace_id;
-    hsize_t dst_dims[2];
+    hsize_t dst_dims[3];
+    gsize frame_size;
+    guint batch;
 
     priv = UFO_HDF5_READER_GET_PRIVATE (reader);
     data = ufo_buffer_get_host_array (buffer, NULL);
 
-    hsize_t offset[3] = { priv->current, roi_y, 0 };
-    hsize_t count[3] = { 1, roi_height, requisition->dims[0] };
+    /* Rows are picked by the hyperslab stride, so we never read too much */
+    dst_dims[1] = requisition->dims[1];
+    dst_dims[2] = requisition->dims[0];
+    frame_size = dst_dims[1] * dst_dims[2] * sizeof (gfloat);
+    batch = get_batch_size (priv, frame_size);
+
+    if (batch == 1) {
+        hsize_t offset[3] = { priv->current, roi_y, 0 };
+        hsize_t stride[3] = { 1, roi_step, 1 };
+        hsize_t count[3] = { 1, dst_dims[1], dst_dims[2] };
 
-    dst_dims[0] = roi_height;
-    dst_dims[1] = requisition->dims[0];
-    dst_dataspace_id = H5Screate_simple (2, dst_dims, NULL);
+        dst_dataspace_id = H5Screate_simple (2, &dst_dims[1], NULL);
+        H5Sselect_hyperslab (priv->src_dataspace_id, H5S_SELECT_SET, offset, stride, count, NULL);
+        H5Dread (priv->dataset_id, H5T_NATIVE_FLOAT, dst_dataspace_id, priv->src_dataspace_id, H5P_DEFAULT, data);
+        H5Sclose (dst_dataspace_id);
+
+        priv->current++;
+        return;
+    }
 
-    H5Sselect_hyperslab (priv->src_dataspace_id, H5S_SELECT_SET, offset, NULL, count, NULL);
-    H5Dread (priv->dataset_id, H5T_NATIVE_FLOAT, dst_dataspace_id, priv->src_dataspace_id, H5P_DEFAULT, data);
-    H5Sclose (dst_dataspace_id);
+    if (priv->current < priv->cache_start ||
+        priv->current >= priv->cache_start + priv->cache_count ||
+        priv->cache_roi_y != roi_y || priv->cache_roi_step != roi_step) {
+        hsize_t offset[3] = { priv->current, roi_y, 0 };
+        hsize_t stride[3] = { 1, roi_step, 1 };
+        hsize_t count[3];
+
+        dst_dims[0] = MIN (batch, priv->dims[0] - priv->current);
+        count[0] = dst_dims[0];
+        count[1] = dst_dims[1];
+        count[2] = dst_dims[2];
+
+        if (priv->cache_size < dst_dims[0] * frame_size) {
+            g_free (priv->cache);
+            priv->cache_size = batch * frame_size;
+            priv->cache = g_malloc (priv->cache_size);
+        }
+
+        dst_dataspace_id = H5Screate_simple (3, dst_dims, NULL);
+        H5Sselect_hyperslab (priv->src_dataspace_id, H5S_SELECT_SET, offset, stride, count, NULL);
+        H5Dread (priv->dataset_id, H5T_NATIVE_FLOAT, dst_dataspace_id, priv->src_dataspace_id, H5P_DEFAULT, priv->cache);
+        H5Sclose (dst_dataspace_id);
+
+        priv->cache_start = priv->current;
+        priv->cache_count = (guint) dst_dims[0];
+        priv->cache_roi_y = roi_y;
+        priv->cache_roi_step = roi_step;
+    }
 
+    memcpy (data, ((gchar *) priv->cache) + (priv->current - priv->cache_start) * frame_size, frame_size);
     priv->current++;
 }
 
@@ -174,14 +363,114 @@ ufo_reader_interface_init (UfoReaderIface *iface)
     iface->data_available = ufo_hdf5_reader_data_available;
 }
 
+static void
+ufo_hdf5_reader_set_property (GObject *object,
+                              guint property_id,
+                              const GValue *value,
+                              GParamSpec *pspec)
+{
+    UfoHdf5ReaderPrivate *priv = UFO_HDF5_READER_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_BATCH:
+            priv->batch = g_value_get_uint (value);
+            break;
+        case PROP_SWMR:
+            priv->swmr = g_value_get_boolean (value);
+            break;
+        case PROP_SWMR_TIMEOUT:
+            priv->swmr_timeout = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_hdf5_reader_get_property (GObject *object,
+                              guint property_id,
+                              GValue *value,
+                              GParamSpec *pspec)
+{
+    UfoHdf5ReaderPrivate *priv = UFO_HDF5_READER_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_BATCH:
+            g_value_set_uint (value, priv->batch);
+            break;
+        case PROP_SWMR:
+            g_value_set_boolean (value, priv->swmr);
+            break;
+        case PROP_SWMR_TIMEOUT:
+            g_value_set_uint (value, priv->swmr_timeout);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_hdf5_reader_finalize (GObject *object)
+{
+    UfoHdf5ReaderPrivate *priv;
+
+    priv = UFO_HDF5_READER_GET_PRIVATE (object);
+    g_free (priv->cache);
+    priv->cache = NULL;
+
+    G_OBJECT_CLASS (ufo_hdf5_reader_parent_class)->finalize (object);
+}
+
 static void
 ufo_hdf5_reader_class_init(UfoHdf5ReaderClass *klass)
 {
-    g_type_class_add_private (G_OBJECT_CLASS (klass), sizeof (UfoHdf5ReaderPrivate));
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+
+    gobject_class->set_property = ufo_hdf5_reader_set_property;
+    gobject_class->get_property = ufo_hdf5_reader_get_property;
+    gobject_class->finalize = ufo_hdf5_reader_finalize;
+
+    properties[PROP_BATCH] =
+        g_param_spec_uint ("batch",
+            "Number of frames read at once, 0 derives it from the chunk layout",
+            "Number of frames read at once, 0 derives it from the chunk layout",
+            0, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
+    properties[PROP_SWMR] =
+        g_param_spec_boolean ("swmr",
+            "Follow a file that is being written in SWMR mode",
+            "Follow a file that is being written in SWMR mode",
+            FALSE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_SWMR_TIMEOUT] =
+        g_param_spec_uint ("swmr-timeout",
+            "Seconds to wait for new frames in SWMR mode",
+            "Seconds to wait for new frames in SWMR mode",
+            0, G_MAXUINT, 10,
+            G_PARAM_READWRITE);
+
+    for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
+        g_object_class_install_property (gobject_class, i, properties[i]);
+
+    g_type_class_add_private (gobject_class, sizeof (UfoHdf5ReaderPrivate));
 }
 
 static void
 ufo_hdf5_reader_init (UfoHdf5Reader *self)
 {
-    self->priv = UFO_HDF5_READER_GET_PRIVATE (self);
+    UfoHdf5ReaderPrivate *priv;
+
+    self->priv = priv = UFO_HDF5_READER_GET_PRIVATE (self);
+    priv->chunked = FALSE;
+    priv->batch = 1;
+    priv->swmr = FALSE;
+    priv->swmr_timeout = 10;
+    priv->cache = NULL;
+    priv->cache_size = 0;
+    priv->cache_start = 0;
+    priv->cache_count = 0;
 }
@@ -19,6 +19,9 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 #include "readers/ufo-reader.h"
 #include "readers/ufo-raw-reader.h"
@@ -26,6 +29,10 @@
 
 struct _UfoRawReaderPrivate {
     FILE *fp;
+    GMappedFile *mapped_file;
+    const gchar *contents;
+    gsize offset;
+    gboolean use_mmap;
     gsize total_size;
     gsize frame_size;
     gsize bytes_per_pixel;
@@ -51,6 +58,7 @@ enum {
     PROP_BITDEPTH,
     PROP_PRE_OFFSET,
     PROP_POST_OFFSET,
+    PROP_MMAP,
     N_PROPERTIES
 };
 
@@ -91,11 +99,29 @@ ufo_raw_reader_open (UfoReader *reader,
     UfoRawReaderPrivate *priv;
 
     priv = UFO_RAW_READER_GET_PRIVATE (reader);
+    priv->frame_size = priv->width * priv->height * priv->bytes_per_pixel;
+
+    if (priv->use_mmap) {
+        priv->mapped_file = g_mapped_file_new (filename, FALSE, error);
+
+        if (priv->mapped_file == NULL)
+            return FALSE;
+
+        priv->contents = g_mapped_file_get_contents (priv->mapped_file);
+        priv->total_size = g_mapped_file_get_length (priv->mapped_file);
+        priv->offset = start * priv->frame_size;
+
+        /* Let the kernel read ahead aggressively, we consume the file linearly */
+        if (priv->contents != NULL)
+            madvise ((gpointer) priv->contents, priv->total_size, MADV_SEQUENTIAL);
+
+        return TRUE;
+    }
+
     priv->fp = fopen (filename, "rb");
 
     fseek (priv->fp, 0L, SEEK_END);
     priv->total_size = (gsize) ftell (priv->fp);
-    priv->frame_size = priv->width * priv->height * priv->bytes_per_pixel;
     fseek (priv->fp, start * priv->frame_size, SEEK_SET);
     return TRUE;
 }
@@ -106,9 +132,19 @@ ufo_raw_reader_close (UfoReader *reader)
     UfoRawReaderPrivate *priv;
 
     priv = UFO_RAW_READER_GET_PRIVATE (reader);
-    g_assert (priv->fp != NULL);
-    fclose (priv->fp);
-    priv->fp = NULL;
+
+    if (priv->mapped_file != NULL) {
+        g_mapped_file_unref (priv->mapped_file);
+        priv->mapped_file = NULL;
+        priv->contents = NULL;
+        priv->offset = 0;
+    }
+    else {
+        g_assert (priv->fp != NULL);
+        fclose (priv->fp);
+        priv->fp = NULL;
+    }
+
     priv->total_size = 0;
 }
 
@@ -119,6 +155,10 @@ ufo_raw_reader_data_available (UfoReader *reader)
     glong pos;
 
     priv = UFO_RAW_READER_GET_PRIVATE (reader);
+
+    if (priv->mapped_file != NULL)
+        return priv->offset + priv->pre_offset + priv->frame_size <= priv->total_size;
+
     pos = ftell (priv->fp);
     return priv->fp != NULL && pos >= 0 && (((gulong) pos) + priv->pre_offset + priv->frame_size) <= priv->total_size;
 }
@@ -137,6 +177,41 @@ ufo_raw_reader_read (UfoReader *reader,
     priv = UFO_RAW_READER_GET_PRIVATE (reader);
     data = (gchar *) ufo_buffer_get_host_array (buffer, NULL);
 
+    if (priv->mapped_file != NULL) {
+        const gchar *frame;
+        gsize row_size;
+        gsize next;
+
+        frame = priv->contents + priv->offset + priv->pre_offset;
+        row_size = priv->width * priv->bytes_per_pixel;
+
+        /*
+         * Copy straight from the page cache. Unlike the stream path we can
+         * skip rows outside the ROI without touching them at all.
+         */
+        if (roi_y == 0 && roi_height == priv->height && roi_step == 1) {
+            memcpy (data, frame, priv->frame_size);
+        }
+        else {
+            for (guint y = roi_y, i = 0; y < roi_y + roi_height && i < requisition->dims[1]; y += roi_step, i++)
+                memcpy (data + i * row_size, frame + y * row_size, row_size);
+        }
+
+        priv->offset += priv->pre_offset + priv->frame_size + priv->post_offset;
+
+        /* Hint that the next frame is going to be needed soon */
+        next = priv->offset + priv->pre_offset;
+
+        if (next + priv->frame_size <= priv->total_size) {
+            gsize page_size = (gsize) sysconf (_SC_PAGESIZE);
+            gsize aligned = next - next % page_size;
+
+            madvise ((gpointer) (priv->contents + aligned), priv->frame_size + next - aligned, MADV_WILLNEED);
+        }
+
+        return;
+    }
+
     fseek (priv->fp, priv->pre_offset, SEEK_CUR);
 
     /* We never read more than we can store */
@@ -201,6 +276,9 @@ ufo_raw_reader_set_property (GObject *object,
         case PROP_POST_OFFSET:
             priv->post_offset = g_value_get_ulong (value);
             break;
+        case PROP_MMAP:
+            priv->use_mmap = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -231,6 +309,9 @@ ufo_raw_reader_get_property (GObject *object,
         case PROP_POST_OFFSET:
             g_value_set_ulong (value, priv->post_offset);
             break;
+        case PROP_MMAP:
+            g_value_set_boolean (value, priv->use_mmap);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -249,6 +330,11 @@ ufo_raw_reader_finalize (GObject *object)
         priv->fp = NULL;
     }
 
+    if (priv->mapped_file != NULL) {
+        g_mapped_file_unref (priv->mapped_file);
+        priv->mapped_file = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_raw_reader_parent_class)->finalize (object);
 }
 
@@ -307,6 +393,13 @@ ufo_raw_reader_class_init (UfoRawReaderClass *klass)
             0, G_MAXULONG, 0,
             G_PARAM_READWRITE);
 
+    properties[PROP_MMAP] =
+        g_param_spec_boolean("mmap",
+            "Map the file into memory instead of reading it",
+            "Map the file into memory instead of reading it",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -325,4 +418,8 @@ ufo_raw_reader_init (UfoRawReader *self)
     priv->bitdepth = UFO_BUFFER_DEPTH_INVALID;
     priv->pre_offset = 0L;
     priv->post_offset = 0L;
+    priv->mapped_file = NULL;
+    priv->contents = NULL;
+    priv->offset = 0;
+    priv->use_mmap = FALSE;
 }
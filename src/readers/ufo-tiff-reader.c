@@ -18,14 +18,31 @@
  */
 
 #include <tiffio.h>
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "readers/ufo-reader.h"
 #include "readers/ufo-tiff-reader.h"
 
+/*
+ * Every additional thread opens the file once more, which only pays off if it
+ * decodes a few compressed blocks.
+ */
+#define MIN_BLOCKS_PER_THREAD   4
 
 struct _UfoTiffReaderPrivate {
     TIFF    *tiff;
     gboolean more;
+    gchar   *filename;
+    guint    directory;
+
+    /* Additional handles used to decode strips and tiles concurrently */
+    TIFF   **handles;
+    guint   *handle_directories;
+    guint    n_handles;
 };
 
 static void ufo_reader_interface_init (UfoReaderIface *iface);
@@ -71,6 +88,18 @@ ufo_tiff_reader_open (UfoReader *reader,
     for (guint i = 0; i < start; i++)
         priv->more = TIFFReadDirectory (priv->tiff) == 1;
 
+    g_free (priv->filename);
+    priv->filename = g_strdup (filename);
+    priv->directory = start;
+
+#ifdef _OPENMP
+    priv->n_handles = (guint) omp_get_max_threads ();
+#else
+    priv->n_handles = 1;
+#endif
+    priv->handles = g_new0 (TIFF *, priv->n_handles);
+    priv->handle_directories = g_new0 (guint, priv->n_handles);
+
     return TRUE;
 }
 
@@ -83,6 +112,17 @@ ufo_tiff_reader_close (UfoReader *reader)
     g_assert (priv->tiff != NULL);
     TIFFClose (priv->tiff);
     priv->tiff = NULL;
+
+    for (guint i = 0; i < priv->n_handles; i++) {
+        if (priv->handles[i] != NULL)
+            TIFFClose (priv->handles[i]);
+    }
+
+    g_free (priv->handles);
+    g_free (priv->handle_directories);
+    priv->handles = NULL;
+    priv->handle_directories = NULL;
+    priv->n_handles = 0;
 }
 
 static gboolean
@@ -145,6 +185,224 @@ read_data (UfoTiffReaderPrivate *priv,
     }
 }
 
+/*
+ * libtiff handles are not thread-safe, hence every thread but the calling one
+ * decodes with its own handle that is positioned on the directory of the main
+ * handle.
+ */
+static TIFF *
+get_thread_handle (UfoTiffReaderPrivate *priv)
+{
+    guint index = 0;
+
+#ifdef _OPENMP
+    index = (guint) omp_get_thread_num ();
+#endif
+
+    if (index == 0)
+        return priv->tiff;
+
+    if (index >= priv->n_handles)
+        return NULL;
+
+    if (priv->handles[index] == NULL) {
+        priv->handles[index] = TIFFOpen (priv->filename, "r");
+        priv->handle_directories[index] = 0;
+
+        if (priv->handles[index] == NULL)
+            return NULL;
+    }
+
+    if (priv->handle_directories[index] != priv->directory) {
+        if (priv->handle_directories[index] + 1 == priv->directory) {
+            if (TIFFReadDirectory (priv->handles[index]) != 1)
+                return NULL;
+        }
+        else if (TIFFSetDirectory (priv->handles[index], (tdir_t) priv->directory) != 1) {
+            return NULL;
+        }
+
+        priv->handle_directories[index] = priv->directory;
+    }
+
+    return priv->handles[index];
+}
+
+#ifdef _OPENMP
+/*
+ * Return the number of threads to decode n_blocks strips or tiles with.
+ * Uncompressed blocks are merely copied, so another handle costs more than it
+ * saves.
+ */
+static gint
+get_num_threads (UfoTiffReaderPrivate *priv, gint n_blocks)
+{
+    guint16 compression = COMPRESSION_NONE;
+
+    TIFFGetField (priv->tiff, TIFFTAG_COMPRESSION, &compression);
+
+    if (compression == COMPRESSION_NONE)
+        return 1;
+
+    return CLAMP (n_blocks / MIN_BLOCKS_PER_THREAD, 1, (gint) priv->n_handles);
+}
+#endif
+
+/*
+ * Copy all rows of a decoded block of rows starting at first_row that are
+ * part of the ROI to their destination.
+ */
+static void
+copy_block_rows (gchar *dst,
+                 const gchar *src,
+                 guint32 first_row,
+                 guint32 n_rows,
+                 gsize src_stride,
+                 gsize dst_stride,
+                 gsize dst_x_offset,
+                 gsize row_size,
+                 guint roi_y,
+                 guint roi_height,
+                 guint roi_step)
+{
+    guint32 y = first_row;
+
+    if (y < roi_y)
+        y = roi_y;
+
+    /* advance to the first row that is hit by the vertical step */
+    if ((y - roi_y) % roi_step)
+        y += roi_step - (y - roi_y) % roi_step;
+
+    for (; y < first_row + n_rows && y < roi_y + roi_height; y += roi_step) {
+        memcpy (dst + ((y - roi_y) / roi_step) * dst_stride + dst_x_offset,
+                src + (y - first_row) * src_stride,
+                row_size);
+    }
+}
+
+static gboolean
+read_strips (UfoTiffReaderPrivate *priv,
+             UfoBuffer *buffer,
+             UfoRequisition *requisition,
+             guint16 bits,
+             guint roi_y,
+             guint roi_height,
+             guint roi_step)
+{
+    gchar *dst;
+    gsize step;
+    gsize scanline_size;
+    guint32 rows_per_strip;
+    guint32 height;
+    gint first_strip;
+    gint last_strip;
+    tsize_t strip_size;
+    gboolean success = TRUE;
+
+    if (!TIFFGetField (priv->tiff, TIFFTAG_ROWSPERSTRIP, &rows_per_strip) || rows_per_strip == 0)
+        return FALSE;
+
+    TIFFGetField (priv->tiff, TIFFTAG_IMAGELENGTH, &height);
+
+    if (rows_per_strip > height)
+        rows_per_strip = height;
+
+    step = requisition->dims[0] * bits / 8;
+    scanline_size = (gsize) TIFFScanlineSize (priv->tiff);
+    dst = (gchar *) ufo_buffer_get_host_array (buffer, NULL);
+    first_strip = (gint) (roi_y / rows_per_strip);
+    last_strip = (gint) ((roi_y + roi_height - 1) / rows_per_strip);
+    strip_size = TIFFStripSize (priv->tiff);
+
+#pragma omp parallel num_threads(get_num_threads (priv, last_strip - first_strip + 1))
+    {
+        TIFF *tiff = get_thread_handle (priv);
+        gchar *strip = g_malloc (strip_size);
+
+#pragma omp for schedule(dynamic)
+        for (gint s = first_strip; s <= last_strip; s++) {
+            tsize_t size;
+
+            if (tiff == NULL || (size = TIFFReadEncodedStrip (tiff, (tstrip_t) s, strip, (tsize_t) -1)) < 0) {
+                success = FALSE;
+                continue;
+            }
+
+            copy_block_rows (dst, strip, s * rows_per_strip, (guint32) (size / scanline_size),
+                             scanline_size, step, 0, step, roi_y, roi_height, roi_step);
+        }
+
+        g_free (strip);
+    }
+
+    return success;
+}
+
+static gboolean
+read_tiles (UfoTiffReaderPrivate *priv,
+            UfoBuffer *buffer,
+            UfoRequisition *requisition,
+            guint16 bits,
+            guint roi_y,
+            guint roi_height,
+            guint roi_step)
+{
+    gchar *dst;
+    gsize step;
+    gsize bytes_per_pixel;
+    guint32 width;
+    guint32 tile_width;
+    guint32 tile_height;
+    guint32 tiles_across;
+    gint first_tile;
+    gint last_tile;
+    tsize_t tile_size;
+    gboolean success = TRUE;
+
+    /* We cannot split packed 12 bit tiles at arbitrary columns */
+    if (bits % 8)
+        return FALSE;
+
+    TIFFGetField (priv->tiff, TIFFTAG_IMAGEWIDTH, &width);
+    TIFFGetField (priv->tiff, TIFFTAG_TILEWIDTH, &tile_width);
+    TIFFGetField (priv->tiff, TIFFTAG_TILELENGTH, &tile_height);
+
+    bytes_per_pixel = bits / 8;
+    step = requisition->dims[0] * bytes_per_pixel;
+    dst = (gchar *) ufo_buffer_get_host_array (buffer, NULL);
+    tiles_across = (width + tile_width - 1) / tile_width;
+    first_tile = (gint) ((roi_y / tile_height) * tiles_across);
+    last_tile = (gint) (((roi_y + roi_height - 1) / tile_height + 1) * tiles_across - 1);
+    tile_size = TIFFTileSize (priv->tiff);
+
+#pragma omp parallel num_threads(get_num_threads (priv, last_tile - first_tile + 1))
+    {
+        TIFF *tiff = get_thread_handle (priv);
+        gchar *tile = g_malloc (tile_size);
+
+#pragma omp for schedule(dynamic)
+        for (gint t = first_tile; t <= last_tile; t++) {
+            guint32 x = (t % tiles_across) * tile_width;
+            guint32 y = (t / tiles_across) * tile_height;
+            guint32 columns = MIN (tile_width, width - x);
+
+            if (tiff == NULL || TIFFReadEncodedTile (tiff, (ttile_t) t, tile, (tsize_t) -1) < 0) {
+                success = FALSE;
+                continue;
+            }
+
+            copy_block_rows (dst, tile, y, tile_height,
+                             tile_width * bytes_per_pixel, step, x * bytes_per_pixel,
+                             columns * bytes_per_pixel, roi_y, roi_height, roi_step);
+        }
+
+        g_free (tile);
+    }
+
+    return success;
+}
+
 static void
 read_64_bit_data (UfoTiffReaderPrivate *priv,
                   UfoBuffer *buffer,
@@ -181,17 +439,40 @@ ufo_tiff_reader_read (UfoReader *reader,
 {
     UfoTiffReaderPrivate *priv;
     guint16 bits;
+    gboolean done = FALSE;
 
     priv = UFO_TIFF_READER_GET_PRIVATE (reader);
 
     TIFFGetField (priv->tiff, TIFFTAG_BITSPERSAMPLE, &bits);
 
-    if (bits == 64)
-        read_64_bit_data (priv, buffer, requisition, roi_y, roi_height, roi_step);
-    else
-        read_data (priv, buffer, requisition, bits, roi_y, roi_height, roi_step);
+    /*
+     * Single-channel images are decoded block-wise in parallel, RGB and 64 bit
+     * data need per-pixel rearrangement and go through the scanline path.
+     */
+    if (bits != 64 && requisition->n_dims == 2) {
+        if (TIFFIsTiled (priv->tiff)) {
+            done = read_tiles (priv, buffer, requisition, bits, roi_y, roi_height, roi_step);
+
+            if (!done)
+                g_warning ("Could not decode tiles of `%s'", priv->filename);
+
+            /* TIFFReadScanline cannot read tiled images anyway */
+            done = TRUE;
+        }
+        else if (TIFFNumberOfStrips (priv->tiff) > 1) {
+            done = read_strips (priv, buffer, requisition, bits, roi_y, roi_height, roi_step);
+        }
+    }
+
+    if (!done) {
+        if (bits == 64)
+            read_64_bit_data (priv, buffer, requisition, roi_y, roi_height, roi_step);
+        else
+            read_data (priv, buffer, requisition, bits, roi_y, roi_height, roi_step);
+    }
 
     priv->more = TIFFReadDirectory (priv->tiff) == 1;
+    priv->directory++;
 }
 
 static gboolean
@@ -246,6 +527,9 @@ ufo_tiff_reader_finalize (GObject *object)
     if (priv->tiff != NULL)
         ufo_tiff_reader_close (UFO_READER (object));
 
+    g_free (priv->filename);
+    priv->filename = NULL;
+
     G_OBJECT_CLASS (ufo_tiff_reader_parent_class)->finalize (object);
 }
 
@@ -278,5 +562,10 @@ ufo_tiff_reader_init (UfoTiffReader *self)
     self->priv = priv = UFO_TIFF_READER_GET_PRIVATE (self);
     priv->tiff = NULL;
     priv->more = FALSE;
+    priv->filename = NULL;
+    priv->directory = 0;
+    priv->handles = NULL;
+    priv->handle_directories = NULL;
+    priv->n_handles = 0;
     TIFFSetWarningHandler(NULL);
 }
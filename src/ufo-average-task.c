@@ -23,8 +23,21 @@
 #include "ufo-average-task.h"
 
 
+typedef enum {
+    SUMMATION_SIMPLE = 0,
+    SUMMATION_KAHAN,
+} Summation;
+
+static GEnumValue summation_values[] = {
+    { SUMMATION_SIMPLE, "SUMMATION_SIMPLE", "simple" },
+    { SUMMATION_KAHAN,  "SUMMATION_KAHAN",  "kahan" },
+    { 0, NULL, NULL}
+};
+
 struct _UfoAverageTaskPrivate {
     gfloat *averaged;
+    gfloat *compensation;
+    Summation summation;
     gboolean is_data_averaged;
     guint counter;
     guint n_generate;
@@ -33,6 +46,7 @@ struct _UfoAverageTaskPrivate {
 enum {
     PROP_0,
     PROP_NUM_GENERATE,
+    PROP_SUMMATION,
     N_PROPERTIES
 };
 
@@ -75,6 +89,11 @@ ufo_average_task_get_requisition (UfoTask *task,
         priv->averaged = g_malloc0 (requisition->dims[0] *
                                     requisition->dims[1] * sizeof (gfloat));
     }
+
+    if (priv->summation == SUMMATION_KAHAN && priv->compensation == NULL) {
+        priv->compensation = g_malloc0 (requisition->dims[0] *
+                                        requisition->dims[1] * sizeof (gfloat));
+    }
 }
 
 static guint
@@ -113,8 +132,25 @@ ufo_average_task_process (UfoTask *task,
     in_array = ufo_buffer_get_host_array (inputs[0], NULL);
     out_array = ufo_buffer_get_host_array (output, NULL);
 
-    for (gsize i = 0; i < n_pixels; i++)
-        out_array[i] += in_array[i];
+    if (priv->summation == SUMMATION_KAHAN) {
+        gfloat *compensation = priv->compensation;
+
+        /* Compensated summation keeps the low-order bits lost when adding
+         * thousands of frames to a large running sum */
+#pragma omp parallel for simd
+        for (gsize i = 0; i < n_pixels; i++) {
+            const gfloat y = in_array[i] - compensation[i];
+            const gfloat t = out_array[i] + y;
+
+            compensation[i] = (t - out_array[i]) - y;
+            out_array[i] = t;
+        }
+    }
+    else {
+#pragma omp parallel for simd
+        for (gsize i = 0; i < n_pixels; i++)
+            out_array[i] += in_array[i];
+    }
 
     priv->counter++;
     return TRUE;
@@ -138,8 +174,12 @@ ufo_average_task_generate (UfoTask *task,
     n_pixels = requisition->dims[0] * requisition->dims[1];
 
     if (!priv->is_data_averaged) {
+        const gfloat scale = 1.0f / (gfloat) priv->counter;
+        gfloat *averaged = priv->averaged;
+
+#pragma omp parallel for simd
         for (gsize i = 0; i < n_pixels; i++)
-            priv->averaged[i] = out_array[i] / (gfloat) priv->counter;
+            averaged[i] = out_array[i] * scale;
 
         priv->is_data_averaged = TRUE;
     }
@@ -173,6 +213,11 @@ ufo_average_task_finalize (GObject *object)
         g_free (priv->averaged);
         priv->averaged = NULL;
     }
+
+    g_free (priv->compensation);
+    priv->compensation = NULL;
+
+    G_OBJECT_CLASS (ufo_average_task_parent_class)->finalize (object);
 }
 
 static void
@@ -187,6 +232,9 @@ ufo_average_task_set_property (GObject *object,
         case PROP_NUM_GENERATE:
             priv->n_generate = g_value_get_uint (value);
             break;
+        case PROP_SUMMATION:
+            priv->summation = g_value_get_enum (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -205,6 +253,9 @@ ufo_average_task_get_property (GObject *object,
         case PROP_NUM_GENERATE:
             g_value_set_uint (value, priv->n_generate);
             break;
+        case PROP_SUMMATION:
+            g_value_set_enum (value, priv->summation);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -229,6 +280,13 @@ ufo_average_task_class_init (UfoAverageTaskClass *klass)
             1, G_MAXUINT, 1,
             G_PARAM_READWRITE);
 
+    properties[PROP_SUMMATION] =
+        g_param_spec_enum ("summation",
+            "Summation method (simple, kahan)",
+            "Summation method (simple, kahan)",
+            g_enum_register_static ("summation", summation_values),
+            SUMMATION_SIMPLE, G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -241,6 +299,8 @@ ufo_average_task_init(UfoAverageTask *self)
     self->priv = UFO_AVERAGE_TASK_GET_PRIVATE(self);
     self->priv->counter = 0;
     self->priv->averaged = NULL;
+    self->priv->compensation = NULL;
+    self->priv->summation = SUMMATION_SIMPLE;
     self->priv->n_generate = 1;
     self->priv->is_data_averaged = FALSE;
 }
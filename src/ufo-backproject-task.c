@@ -24,7 +24,9 @@
 #endif
 
 #include <math.h>
+#include <string.h>
 #include "ufo-backproject-task.h"
+#include "common/ufo-tuning.h"
 
 
 typedef enum {
@@ -38,10 +40,18 @@ static GEnumValue mode_values[] = {
     { 0, NULL, NULL}
 };
 
+/* Unroll factors of the projection loop tried when tuning, 0 builds the kernel
+ * without UNROLL */
+static const guint unroll_values[] = {0, 2, 4, 8, 16};
+
 struct _UfoBackprojectTaskPrivate {
+    UfoResources *resources;
     cl_context context;
     cl_kernel nearest_kernel;
     cl_kernel texture_kernel;
+    cl_kernel tuned_kernel;
+    UfoTuningParameters tuning;
+    gboolean tuned;
     cl_mem sin_lut;
     cl_mem cos_lut;
     gfloat *host_sin_lut;
@@ -86,12 +96,141 @@ enum {
 
 static GParamSpec *properties[N_PROPERTIES] = { NULL, };
 
+typedef struct {
+    UfoBackprojectTaskPrivate *priv;
+    cl_command_queue cmd_queue;
+    cl_kernel kernels[G_N_ELEMENTS (unroll_values)];
+    cl_mem in_mem;
+    cl_mem out_mem;
+    gfloat axis_pos;
+    const gsize *dims;
+} TuningData;
+
 UfoNode *
 ufo_backproject_task_new (void)
 {
     return UFO_NODE (g_object_new (UFO_TYPE_BACKPROJECT_TASK, NULL));
 }
 
+static void
+set_kernel_args (UfoBackprojectTaskPrivate *priv,
+                 cl_kernel kernel,
+                 cl_mem in_mem,
+                 cl_mem out_mem,
+                 gfloat axis_pos)
+{
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &out_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (cl_mem), &priv->sin_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, sizeof (cl_mem), &priv->cos_lut));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 4, sizeof (guint),  &priv->roi_x));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 5, sizeof (guint),  &priv->roi_y));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 6, sizeof (guint),  &priv->offset));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 7, sizeof (guint),  &priv->burst_projections));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 8, sizeof (gfloat), &axis_pos));
+}
+
+/*
+ * Return the kernel of the current mode with the projection loop unrolled
+ * *unroll* times, owned by the resources.
+ */
+static cl_kernel
+get_unrolled_kernel (UfoBackprojectTaskPrivate *priv, guint unroll)
+{
+    cl_kernel kernel;
+    gchar *options;
+
+    if (!unroll) {
+        return priv->mode == MODE_TEXTURE ? priv->texture_kernel : priv->nearest_kernel;
+    }
+
+    options = g_strdup_printf ("-DUNROLL=%u", unroll);
+    kernel = ufo_resources_get_kernel (priv->resources, "backproject.cl",
+                                       priv->mode == MODE_TEXTURE ? "backproject_tex" : "backproject_nearest",
+                                       options, NULL);
+    g_free (options);
+
+    return kernel;
+}
+
+static gboolean
+run_candidate (const UfoTuningParameters *parameters, gpointer user_data)
+{
+    TuningData *data = (TuningData *) user_data;
+    cl_kernel kernel = NULL;
+
+    for (guint i = 0; i < G_N_ELEMENTS (unroll_values); i++) {
+        if (unroll_values[i] == parameters->unroll) {
+            kernel = data->kernels[i];
+        }
+    }
+
+    if (!kernel) {
+        return FALSE;
+    }
+
+    set_kernel_args (data->priv, kernel, data->in_mem, data->out_mem, data->axis_pos);
+
+    return clEnqueueNDRangeKernel (data->cmd_queue, kernel, 2, NULL, data->dims,
+                                   ufo_tuning_get_local_work_size (parameters),
+                                   0, NULL, NULL) == CL_SUCCESS;
+}
+
+/*
+ * Find the local work size and unroll factor for the current mode, either in
+ * the device profile or by timing all candidates on the current input. The
+ * kernel overwrites the output, thus the candidate runs do no harm.
+ */
+static void
+tune (UfoBackprojectTaskPrivate *priv,
+      cl_command_queue cmd_queue,
+      cl_mem in_mem,
+      cl_mem out_mem,
+      gfloat axis_pos,
+      UfoRequisition *requisition)
+{
+    TuningData data;
+    GArray *candidates;
+    const gchar *name;
+
+    name = priv->mode == MODE_TEXTURE ? "backproject-texture" : "backproject-nearest";
+
+    if (!ufo_tuning_lookup (cmd_queue, name, &priv->tuning) ||
+        !ufo_tuning_fits_kernel (cmd_queue, get_unrolled_kernel (priv, priv->tuning.unroll), &priv->tuning)) {
+        data.priv = priv;
+        data.cmd_queue = cmd_queue;
+        data.in_mem = in_mem;
+        data.out_mem = out_mem;
+        data.axis_pos = axis_pos;
+        data.dims = requisition->dims;
+
+        for (guint i = 0; i < G_N_ELEMENTS (unroll_values); i++) {
+            data.kernels[i] = get_unrolled_kernel (priv, unroll_values[i]);
+        }
+
+        /* The kernels have no bounds check, so the work groups must divide the slice */
+        candidates = ufo_tuning_candidates_new (cmd_queue, 2, requisition->dims,
+                                                unroll_values, G_N_ELEMENTS (unroll_values), NULL, 0);
+
+        if (!ufo_tuning_search (cmd_queue, name, candidates, run_candidate, &data, &priv->tuning)) {
+            memset (&priv->tuning, 0, sizeof (UfoTuningParameters));
+        }
+
+        g_array_free (candidates, TRUE);
+    }
+
+    g_debug ("%s: local work size %zu %zu, unroll %u", name,
+             priv->tuning.local_work_size[0], priv->tuning.local_work_size[1], priv->tuning.unroll);
+
+    if (priv->tuning.unroll) {
+        priv->tuned_kernel = get_unrolled_kernel (priv, priv->tuning.unroll);
+
+        if (priv->tuned_kernel) {
+            UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->tuned_kernel));
+        }
+    }
+}
+
 static gboolean
 ufo_backproject_task_process (UfoTask *task,
                               UfoBuffer **inputs,
@@ -106,6 +245,7 @@ ufo_backproject_task_process (UfoTask *task,
     cl_mem out_mem;
     cl_kernel kernel;
     gfloat axis_pos;
+    const gsize *local_work_size;
 
     priv = UFO_BACKPROJECT_TASK (task)->priv;
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
@@ -132,18 +272,26 @@ ufo_backproject_task_process (UfoTask *task,
         axis_pos = priv->axis_pos;
     }
 
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &in_mem));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &out_mem));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (cl_mem), &priv->sin_lut));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, sizeof (cl_mem), &priv->cos_lut));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 4, sizeof (guint),  &priv->roi_x));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 5, sizeof (guint),  &priv->roi_y));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 6, sizeof (guint),  &priv->offset));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 7, sizeof (guint),  &priv->burst_projections));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 8, sizeof (gfloat), &axis_pos));
+    if (!priv->tuned) {
+        tune (priv, cmd_queue, in_mem, out_mem, axis_pos, requisition);
+        priv->tuned = TRUE;
+    }
 
+    if (priv->tuned_kernel) {
+        kernel = priv->tuned_kernel;
+    }
+
+    /* A work group size from the profile may not divide this slice */
+    local_work_size = ufo_tuning_get_local_work_size (&priv->tuning);
+
+    if (local_work_size && (requisition->dims[0] % local_work_size[0] ||
+                            requisition->dims[1] % local_work_size[1])) {
+        local_work_size = NULL;
+    }
+
+    set_kernel_args (priv, kernel, in_mem, out_mem, axis_pos);
     profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-    ufo_profiler_call (profiler, cmd_queue, kernel, 2, requisition->dims, NULL);
+    ufo_profiler_call (profiler, cmd_queue, kernel, 2, requisition->dims, local_work_size);
 
     return TRUE;
 }
@@ -157,6 +305,7 @@ ufo_backproject_task_setup (UfoTask *task,
 
     priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (task);
 
+    priv->resources = g_object_ref (resources);
     priv->context = ufo_resources_get_context (resources);
     priv->nearest_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_nearest", NULL, error);
     priv->texture_kernel = ufo_resources_get_kernel (resources, "backproject.cl", "backproject_tex", NULL, error);
@@ -315,6 +464,16 @@ ufo_backproject_task_finalize (GObject *object)
         priv->texture_kernel = NULL;
     }
 
+    if (priv->tuned_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->tuned_kernel));
+        priv->tuned_kernel = NULL;
+    }
+
+    if (priv->resources) {
+        g_object_unref (priv->resources);
+        priv->resources = NULL;
+    }
+
     if (priv->context) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
         priv->context = NULL;
@@ -523,6 +682,9 @@ ufo_backproject_task_init (UfoBackprojectTask *self)
     self->priv = priv = UFO_BACKPROJECT_TASK_GET_PRIVATE (self);
     priv->nearest_kernel = NULL;
     priv->texture_kernel = NULL;
+    priv->tuned_kernel = NULL;
+    priv->resources = NULL;
+    priv->tuned = FALSE;
     priv->n_projections = 0;
     priv->offset = 0;
     priv->axis_pos = -1.0;
@@ -24,6 +24,7 @@
 #endif
 #include <math.h>
 #include "ufo-blur-task.h"
+#include "common/ufo-tile.h"
 
 
 struct _UfoBlurTaskPrivate {
@@ -32,6 +33,8 @@ struct _UfoBlurTaskPrivate {
     cl_context  context;
     cl_kernel   h_kernel;
     cl_kernel   v_kernel;
+    cl_kernel   h_tiled_kernel;
+    cl_kernel   v_tiled_kernel;
     cl_mem      weights_mem;
     cl_mem      intermediate_mem;
 };
@@ -75,11 +78,23 @@ ufo_blur_task_setup (UfoTask *task,
 
     priv->v_kernel = ufo_resources_get_kernel (resources, "gaussian.cl", "v_gaussian", NULL, error);
 
+    if (error && *error)
+        return;
+
+    priv->h_tiled_kernel = ufo_resources_get_kernel (resources, "gaussian.cl", "h_gaussian_tiled", NULL, error);
+
+    if (error && *error)
+        return;
+
+    priv->v_tiled_kernel = ufo_resources_get_kernel (resources, "gaussian.cl", "v_gaussian_tiled", NULL, error);
+
     if (error && *error)
         return;
 
     UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->h_kernel), error);
     UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->v_kernel), error);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->h_tiled_kernel), error);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->v_tiled_kernel), error);
 
     priv->context = ufo_resources_get_context (resources);
     UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
@@ -101,9 +116,12 @@ ufo_blur_task_get_requisition (UfoTask *task,
         guint kernel_size_2;
         gfloat *weights;
         gfloat sum;
+        cl_int num_weights;
         cl_int err;
+        cl_kernel kernels[] = {priv->h_kernel, priv->v_kernel, priv->h_tiled_kernel, priv->v_tiled_kernel};
 
         kernel_size = priv->size;
+        num_weights = (cl_int) kernel_size;
         kernel_size_2 = kernel_size / 2;
         sum = 0.0;
         weights = g_malloc0 (kernel_size * sizeof(gfloat));
@@ -125,10 +143,10 @@ ufo_blur_task_get_requisition (UfoTask *task,
                                             kernel_size * sizeof(gfloat), weights, &err);
         UFO_RESOURCES_CHECK_CLERR (err);
 
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->h_kernel, 2, sizeof(cl_mem), &priv->weights_mem));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->v_kernel, 2, sizeof(cl_mem), &priv->weights_mem));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->h_kernel, 3, sizeof(guint), &kernel_size_2));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->v_kernel, 3, sizeof(guint), &kernel_size_2));
+        for (guint i = 0; i < G_N_ELEMENTS (kernels); i++) {
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernels[i], 2, sizeof(cl_mem), &priv->weights_mem));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernels[i], 3, sizeof(cl_int), &num_weights));
+        }
 
         g_free(weights);
     }
@@ -165,6 +183,39 @@ ufo_blur_task_get_mode (UfoTask *task)
     return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
 }
 
+static void
+gaussian_pass (UfoProfiler *profiler,
+               cl_command_queue cmd_queue,
+               cl_kernel kernel,
+               cl_kernel tiled_kernel,
+               cl_mem in_mem,
+               cl_mem out_mem,
+               gsize *halo,
+               UfoRequisition *requisition)
+{
+    gsize global_size[2];
+    gsize local_size[2];
+    gsize local_mem_size;
+
+    if (ufo_tile_get_work_size (cmd_queue, tiled_kernel, requisition->dims, halo,
+                                global_size, local_size, &local_mem_size)) {
+        cl_int width = (cl_int) requisition->dims[0];
+        cl_int height = (cl_int) requisition->dims[1];
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (tiled_kernel, 0, sizeof(cl_mem), &in_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (tiled_kernel, 1, sizeof(cl_mem), &out_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (tiled_kernel, 4, local_mem_size, NULL));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (tiled_kernel, 5, sizeof(cl_int), &width));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (tiled_kernel, 6, sizeof(cl_int), &height));
+        ufo_profiler_call (profiler, cmd_queue, tiled_kernel, 2, global_size, local_size);
+        return;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof(cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof(cl_mem), &out_mem));
+    ufo_profiler_call (profiler, cmd_queue, kernel, 2, requisition->dims, NULL);
+}
+
 static gboolean
 ufo_blur_task_process (UfoTask *task,
                                 UfoBuffer **inputs,
@@ -173,31 +224,29 @@ ufo_blur_task_process (UfoTask *task,
 {
     UfoBlurTaskPrivate *priv;
     UfoGpuNode *node;
+    UfoProfiler *profiler;
     cl_command_queue cmd_queue;
     cl_mem in_mem;
     cl_mem out_mem;
+    gsize h_halo[2];
+    gsize v_halo[2];
 
     priv = UFO_BLUR_TASK_GET_PRIVATE (task);
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
     cmd_queue = ufo_gpu_node_get_cmd_queue (node);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
 
-    in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->h_kernel, 0, sizeof(cl_mem), &in_mem));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->h_kernel, 1, sizeof(cl_mem), &priv->intermediate_mem));
+    h_halo[0] = v_halo[1] = priv->size - 1;
+    h_halo[1] = v_halo[0] = 0;
 
-    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (cmd_queue,
-                                                       priv->h_kernel,
-                                                       2, NULL, requisition->dims, NULL,
-                                                       0, NULL, NULL));
+    in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
+    gaussian_pass (profiler, cmd_queue, priv->h_kernel, priv->h_tiled_kernel,
+                   in_mem, priv->intermediate_mem, h_halo, requisition);
 
     out_mem = ufo_buffer_get_device_array (output, cmd_queue);
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->v_kernel, 0, sizeof(cl_mem), &priv->intermediate_mem));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->v_kernel, 1, sizeof(cl_mem), &out_mem));
+    gaussian_pass (profiler, cmd_queue, priv->v_kernel, priv->v_tiled_kernel,
+                   priv->intermediate_mem, out_mem, v_halo, requisition);
 
-    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (cmd_queue,
-                                                       priv->v_kernel,
-                                                       2, NULL, requisition->dims, NULL,
-                                                       0, NULL, NULL));
     return TRUE;
 }
 
@@ -260,6 +309,16 @@ ufo_blur_task_finalize (GObject *object)
         priv->v_kernel = NULL;
     }
 
+    if (priv->h_tiled_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->h_tiled_kernel));
+        priv->h_tiled_kernel = NULL;
+    }
+
+    if (priv->v_tiled_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->v_tiled_kernel));
+        priv->v_tiled_kernel = NULL;
+    }
+
     if (priv->weights_mem) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->weights_mem));
         priv->weights_mem = NULL;
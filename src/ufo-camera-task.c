@@ -22,6 +22,7 @@
 #include <uca/uca-camera.h>
 
 #include "ufo-camera-task.h"
+#include "common/ufo-pinned.h"
 
 
 struct _UfoCameraTaskPrivate {
@@ -34,6 +35,7 @@ struct _UfoCameraTaskPrivate {
     guint       n_bits;
     gchar      *name;
     gchar      *properties;
+    UfoPinnedPool *pinned;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -106,6 +108,13 @@ ufo_camera_task_setup (UfoTask *task,
 
     priv->pm = uca_plugin_manager_new ();
 
+    if (priv->pinned == NULL) {
+        priv->pinned = ufo_pinned_pool_new (ufo_resources_get_context (resources), error);
+
+        if (priv->pinned == NULL)
+            return;
+    }
+
     if (priv->camera == NULL) {
         GError *tmp_error = NULL;
         priv->camera = create_camera (priv->pm, priv->name, &tmp_error);
@@ -187,7 +196,8 @@ ufo_camera_task_generate (UfoTask *task,
     if (priv->current < priv->count) {
         gfloat *host_array;
 
-        host_array = ufo_buffer_get_host_array (output, NULL);
+        /* Grab into pinned memory so that the upload can use DMA */
+        host_array = ufo_pinned_pool_attach (priv->pinned, output);
         uca_camera_grab (priv->camera, (gpointer) host_array, &tmp_error);
 
         if (tmp_error != NULL) {
@@ -292,6 +302,11 @@ ufo_camera_task_dispose (GObject *object)
         priv->pm = NULL;
     }
 
+    if (priv->pinned != NULL) {
+        ufo_pinned_pool_destroy (priv->pinned);
+        priv->pinned = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_camera_task_parent_class)->dispose (object);
 }
 
@@ -17,18 +17,62 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include "config.h"
+
+#include <math.h>
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
 #include "ufo-center-of-rotation-task.h"
+#include "common/ufo-fft.h"
 
 /**
  * SECTION:ufo-center-of-rotation-task
  * @Short_description: Compute the center of rotation
  * @Title: center_of_rotation
  *
+ * With #UfoCenterOfRotationTask:method set to correlation, the rows 180
+ * degrees apart are cross-correlated in Fourier space and the peak is refined
+ * to sub-pixel precision, instead of trying every displacement. This method
+ * is only available if the filters were built with FFT support.
  */
 
+typedef enum {
+    METHOD_BRUTE_FORCE,
+    METHOD_CORRELATION,
+} Method;
+
+static GEnumValue method_values[] = {
+    { METHOD_BRUTE_FORCE, "METHOD_BRUTE_FORCE", "brute-force" },
+    { METHOD_CORRELATION, "METHOD_CORRELATION", "correlation" },
+    { 0, NULL, NULL}
+};
+
 struct _UfoCenterOfRotationTaskPrivate {
     gdouble angle_step;
     gdouble center;
+    gdouble confidence;
+    Method method;
+    guint num_pairs;
+
+    cl_context context;
+    cl_kernel spread_kernel;
+    cl_kernel mean_kernel;
+    cl_kernel cross_kernel;
+    UfoFft *fft;
+    UfoFft *ifft;
+    UfoFftParameter fft_param;
+    UfoFftParameter ifft_param;
+    cl_mem spectra_mem;
+    cl_mem energies_mem;
+    gsize spectra_size;
+    gsize num_rows;
+    gfloat *correlation;
+    gfloat *energies;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -43,6 +87,9 @@ enum {
     PROP_0,
     PROP_ANGLE_STEP,
     PROP_CENTER,
+    PROP_METHOD,
+    PROP_NUM_PAIRS,
+    PROP_CONFIDENCE,
     N_PROPERTIES
 };
 
@@ -54,11 +101,50 @@ ufo_center_of_rotation_task_new (void)
     return UFO_NODE (g_object_new (UFO_TYPE_CENTER_OF_ROTATION_TASK, NULL));
 }
 
+static guint32
+pow2round (guint32 x)
+{
+    --x;
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+    return x+1;
+}
+
 static void
 ufo_center_of_rotation_task_setup (UfoTask *task,
                                    UfoResources *resources,
                                    GError **error)
 {
+    UfoCenterOfRotationTaskPrivate *priv;
+
+    priv = UFO_CENTER_OF_ROTATION_TASK_GET_PRIVATE (task);
+
+    if (priv->method != METHOD_CORRELATION)
+        return;
+
+#ifdef HAVE_FFT
+    priv->context = ufo_resources_get_context (resources);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
+
+    priv->spread_kernel = ufo_resources_get_kernel (resources, "center-of-rotation.cl", "spread_pairs", NULL, error);
+    priv->mean_kernel = ufo_resources_get_kernel (resources, "center-of-rotation.cl", "subtract_mean", NULL, error);
+    priv->cross_kernel = ufo_resources_get_kernel (resources, "center-of-rotation.cl", "cross_power", NULL, error);
+
+    if (priv->spread_kernel != NULL)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->spread_kernel), error);
+
+    if (priv->mean_kernel != NULL)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->mean_kernel), error);
+
+    if (priv->cross_kernel != NULL)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->cross_kernel), error);
+#else
+    g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                         "center-of-rotation: correlation method requires FFT support");
+#endif
 }
 
 static void
@@ -86,6 +172,14 @@ ufo_center_of_rotation_task_get_num_dimensions (UfoTask *task, guint input)
 static UfoTaskMode
 ufo_center_of_rotation_task_get_mode (UfoTask *task)
 {
+    UfoCenterOfRotationTaskPrivate *priv;
+
+    priv = UFO_CENTER_OF_ROTATION_TASK_GET_PRIVATE (task);
+
+    /* Only the correlation needs a GPU, brute force works on host memory */
+    if (priv->method == METHOD_CORRELATION)
+        return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
+
     return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_CPU;
 }
 
@@ -108,6 +202,180 @@ minimum_index (gfloat *data, guint n_elements)
     return index;
 }
 
+#ifdef HAVE_FFT
+static void
+update_buffers (UfoCenterOfRotationTaskPrivate *priv,
+                cl_command_queue queue,
+                gsize padded_width,
+                gsize num_rows)
+{
+    gsize spectra_size;
+    cl_int cl_err;
+
+    /* All rows are transformed in-place with the stride of the half spectrum,
+     * the summed cross-power spectrum in the first row is transformed back */
+    priv->fft_param.size[0] = padded_width;
+    priv->fft_param.batch = num_rows;
+    priv->ifft_param.size[0] = padded_width;
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_update (priv->fft, priv->context, queue, &priv->fft_param));
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_update (priv->ifft, priv->context, queue, &priv->ifft_param));
+
+    spectra_size = 2 * (padded_width / 2 + 1) * num_rows * sizeof (gfloat);
+
+    if (priv->spectra_mem != NULL && priv->spectra_size != spectra_size) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->spectra_mem));
+        priv->spectra_mem = NULL;
+    }
+
+    if (priv->spectra_mem == NULL) {
+        priv->spectra_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE, spectra_size, NULL, &cl_err);
+        UFO_RESOURCES_CHECK_CLERR (cl_err);
+        priv->spectra_size = spectra_size;
+        priv->correlation = g_realloc (priv->correlation, padded_width * sizeof (gfloat));
+    }
+
+    if (priv->energies_mem != NULL && priv->num_rows != num_rows) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->energies_mem));
+        priv->energies_mem = NULL;
+    }
+
+    if (priv->energies_mem == NULL) {
+        priv->energies_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE, num_rows * sizeof (gfloat), NULL, &cl_err);
+        UFO_RESOURCES_CHECK_CLERR (cl_err);
+        priv->num_rows = num_rows;
+        priv->energies = g_realloc (priv->energies, num_rows * sizeof (gfloat));
+    }
+}
+
+/*
+ * Cross-correlate the first row of every pair with the mirrored second row in
+ * Fourier space. The rows are padded to twice their width so the correlation
+ * does not wrap around. The peak of the correlation averaged over all pairs is
+ * the displacement of the mirrored rows, refined by fitting a parabola through
+ * its neighbours.
+ */
+static void
+correlate_pairs (UfoCenterOfRotationTaskPrivate *priv,
+                 UfoBuffer *input,
+                 cl_command_queue queue,
+                 UfoProfiler *profiler,
+                 guint width,
+                 guint height)
+{
+    cl_mem in_mem;
+    guint offset;
+    guint available;
+    guint num_pairs;
+    cl_int pair_step;
+    cl_int cl_width;
+    cl_int cl_offset;
+    cl_int cl_num_pairs;
+    cl_int stride;
+    gsize padded_width;
+    gsize global_work_size[2];
+    gint peak;
+    gfloat peak_value;
+    gdouble displacement;
+    gdouble energy_0 = 0.0;
+    gdouble energy_180 = 0.0;
+
+    /* With one pair, compare first and last row like the brute-force method */
+    offset = priv->num_pairs == 1 ? height - 1 : (guint) round (G_PI / priv->angle_step);
+
+    if (offset == 0 || offset >= height) {
+        g_warning ("center-of-rotation: sinogram of %u rows does not span 180 degrees, "
+                   "using first and last row", height);
+        offset = height - 1;
+    }
+
+    available = height - offset;
+    num_pairs = priv->num_pairs == 0 ? available : MIN (priv->num_pairs, available);
+    padded_width = pow2round (2 * width);
+
+    update_buffers (priv, queue, padded_width, 2 * num_pairs);
+
+    in_mem = ufo_buffer_get_device_array (input, queue);
+    stride = (cl_int) (2 * (padded_width / 2 + 1));
+    cl_width = (cl_int) width;
+    cl_offset = (cl_int) offset;
+    cl_num_pairs = (cl_int) num_pairs;
+    pair_step = (cl_int) MAX (1, available / num_pairs);
+
+    global_work_size[0] = padded_width;
+    global_work_size[1] = 2 * num_pairs;
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 0, sizeof (cl_mem), &priv->spectra_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 1, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 2, sizeof (cl_int), &cl_width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 3, sizeof (cl_int), &pair_step));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 4, sizeof (cl_int), &cl_offset));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 5, sizeof (cl_int), &cl_num_pairs));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 6, sizeof (cl_int), &stride));
+    ufo_profiler_call (profiler, queue, priv->spread_kernel, 2, global_work_size, NULL);
+
+    global_work_size[0] = 2 * num_pairs;
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mean_kernel, 0, sizeof (cl_mem), &priv->spectra_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mean_kernel, 1, sizeof (cl_mem), &priv->energies_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mean_kernel, 2, sizeof (cl_int), &cl_width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mean_kernel, 3, sizeof (cl_int), &stride));
+    ufo_profiler_call (profiler, queue, priv->mean_kernel, 1, global_work_size, NULL);
+
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler,
+                                                priv->spectra_mem, priv->spectra_mem,
+                                                UFO_FFT_FORWARD, 0, NULL, NULL));
+
+    global_work_size[0] = (gsize) stride / 2;
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->cross_kernel, 0, sizeof (cl_mem), &priv->spectra_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->cross_kernel, 1, sizeof (cl_int), &cl_num_pairs));
+    ufo_profiler_call (profiler, queue, priv->cross_kernel, 1, global_work_size, NULL);
+
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->ifft, queue, profiler,
+                                                priv->spectra_mem, priv->spectra_mem,
+                                                UFO_FFT_BACKWARD, 0, NULL, NULL));
+
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (queue, priv->energies_mem, CL_FALSE,
+                                                    0, 2 * num_pairs * sizeof (gfloat), priv->energies,
+                                                    0, NULL, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (queue, priv->spectra_mem, CL_TRUE,
+                                                    0, padded_width * sizeof (gfloat), priv->correlation,
+                                                    0, NULL, NULL));
+
+    /* Displacements are in (-width, width), negative ones wrap around */
+    peak = 0;
+    peak_value = priv->correlation[0];
+
+    for (gint d = -((gint) width) + 1; d < (gint) width; d++) {
+        const gfloat value = priv->correlation[d < 0 ? (gint) padded_width + d : d];
+
+        if (value > peak_value) {
+            peak = d;
+            peak_value = value;
+        }
+    }
+
+    displacement = (gdouble) peak;
+
+    if (ABS (peak) < (gint) width - 1) {
+        const gfloat left = priv->correlation[(peak - 1 + padded_width) % padded_width];
+        const gfloat right = priv->correlation[(peak + 1 + padded_width) % padded_width];
+        const gfloat denominator = left - 2.0f * peak_value + right;
+
+        if (denominator < 0.0f)
+            displacement += 0.5 * (left - right) / denominator;
+    }
+
+    for (guint i = 0; i < num_pairs; i++) {
+        energy_0 += priv->energies[i];
+        energy_180 += priv->energies[num_pairs + i];
+    }
+
+    priv->center = (width + displacement) / 2.0;
+
+    /* The inverse transform is not normalized on any FFT backend */
+    priv->confidence = energy_0 > 0.0 && energy_180 > 0.0 ?
+                       peak_value / padded_width / sqrt (energy_0 * energy_180) : 0.0;
+}
+#endif
+
 static gboolean
 ufo_center_of_rotation_task_process (UfoTask *task,
                                      UfoBuffer **inputs,
@@ -131,6 +399,19 @@ ufo_center_of_rotation_task_process (UfoTask *task,
     width = (guint) in_req.dims[0];
     height = (guint) in_req.dims[1];
 
+#ifdef HAVE_FFT
+    if (priv->method == METHOD_CORRELATION) {
+        UfoGpuNode *node;
+
+        node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
+        correlate_pairs (priv, inputs[0], ufo_gpu_node_get_cmd_queue (node),
+                         ufo_task_node_get_profiler (UFO_TASK_NODE (task)), width, height);
+        g_object_notify_by_pspec (G_OBJECT (task), properties[PROP_CENTER]);
+        g_object_notify_by_pspec (G_OBJECT (task), properties[PROP_CONFIDENCE]);
+        return TRUE;
+    }
+#endif
+
     proj_0 = ufo_buffer_get_host_array (inputs[0], NULL);
     proj_180 = proj_0 + (height - 1) * width;
 
@@ -176,6 +457,12 @@ ufo_center_of_rotation_task_set_property (GObject *object,
         case PROP_ANGLE_STEP:
             priv->angle_step = g_value_get_double (value);
             break;
+        case PROP_METHOD:
+            priv->method = g_value_get_enum (value);
+            break;
+        case PROP_NUM_PAIRS:
+            priv->num_pairs = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -197,6 +484,15 @@ ufo_center_of_rotation_task_get_property (GObject *object,
         case PROP_CENTER:
             g_value_set_double (value, priv->center);
             break;
+        case PROP_METHOD:
+            g_value_set_enum (value, priv->method);
+            break;
+        case PROP_NUM_PAIRS:
+            g_value_set_uint (value, priv->num_pairs);
+            break;
+        case PROP_CONFIDENCE:
+            g_value_set_double (value, priv->confidence);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -206,6 +502,55 @@ ufo_center_of_rotation_task_get_property (GObject *object,
 static void
 ufo_center_of_rotation_task_finalize (GObject *object)
 {
+    UfoCenterOfRotationTaskPrivate *priv;
+
+    priv = UFO_CENTER_OF_ROTATION_TASK_GET_PRIVATE (object);
+
+    if (priv->spread_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->spread_kernel));
+        priv->spread_kernel = NULL;
+    }
+
+    if (priv->mean_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->mean_kernel));
+        priv->mean_kernel = NULL;
+    }
+
+    if (priv->cross_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->cross_kernel));
+        priv->cross_kernel = NULL;
+    }
+
+    if (priv->spectra_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->spectra_mem));
+        priv->spectra_mem = NULL;
+    }
+
+    if (priv->energies_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->energies_mem));
+        priv->energies_mem = NULL;
+    }
+
+    if (priv->context) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
+#ifdef HAVE_FFT
+    if (priv->fft) {
+        ufo_fft_destroy (priv->fft);
+        priv->fft = NULL;
+    }
+
+    if (priv->ifft) {
+        ufo_fft_destroy (priv->ifft);
+        priv->ifft = NULL;
+    }
+#endif
+
+    g_free (priv->correlation);
+    g_free (priv->energies);
+
     G_OBJECT_CLASS (ufo_center_of_rotation_task_parent_class)->finalize (object);
 }
 
@@ -243,6 +588,27 @@ ufo_center_of_rotation_task_class_init (UfoCenterOfRotationTaskClass *klass)
             -G_MAXDOUBLE, G_MAXDOUBLE, 0.0,
             G_PARAM_READABLE);
 
+    properties[PROP_METHOD] =
+        g_param_spec_enum ("method",
+            "Search method (brute-force, correlation)",
+            "Search method (brute-force, correlation)",
+            g_enum_register_static ("UfoCenterOfRotationMethod", method_values),
+            METHOD_BRUTE_FORCE, G_PARAM_READWRITE);
+
+    properties[PROP_NUM_PAIRS] =
+        g_param_spec_uint ("num-pairs",
+            "Number of row pairs averaged by the correlation method, 0 for all",
+            "Number of row pairs averaged by the correlation method, 0 for all",
+            0, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
+    properties[PROP_CONFIDENCE] =
+        g_param_spec_double ("confidence",
+            "Normalized correlation at the center found by the correlation method",
+            "Normalized correlation at the center found by the correlation method",
+            -1.0, 1.0, 0.0,
+            G_PARAM_READABLE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -255,4 +621,32 @@ ufo_center_of_rotation_task_init(UfoCenterOfRotationTask *self)
     self->priv = UFO_CENTER_OF_ROTATION_TASK_GET_PRIVATE(self);
     self->priv->angle_step = G_PI / 180.0;
     self->priv->center = 0.0;
+    self->priv->confidence = 0.0;
+    self->priv->method = METHOD_BRUTE_FORCE;
+    self->priv->num_pairs = 1;
+    self->priv->context = NULL;
+    self->priv->spread_kernel = NULL;
+    self->priv->mean_kernel = NULL;
+    self->priv->cross_kernel = NULL;
+#ifdef HAVE_FFT
+    self->priv->fft = ufo_fft_new ();
+    self->priv->ifft = ufo_fft_new ();
+#else
+    self->priv->fft = NULL;
+    self->priv->ifft = NULL;
+#endif
+    self->priv->fft_param.dimensions = UFO_FFT_1D;
+    self->priv->fft_param.layout = UFO_FFT_LAYOUT_REAL;
+    self->priv->fft_param.size[0] = 1;
+    self->priv->fft_param.size[1] = 1;
+    self->priv->fft_param.size[2] = 1;
+    self->priv->fft_param.batch = 1;
+    self->priv->fft_param.zeropad = TRUE;
+    self->priv->ifft_param = self->priv->fft_param;
+    self->priv->spectra_mem = NULL;
+    self->priv->energies_mem = NULL;
+    self->priv->spectra_size = 0;
+    self->priv->num_rows = 0;
+    self->priv->correlation = NULL;
+    self->priv->energies = NULL;
 }
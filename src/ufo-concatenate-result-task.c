@@ -186,8 +186,8 @@ ufo_concatenate_result_task_process (UfoTask *task,
         priv->data[piv_file_idx] = g_realloc (priv->data[piv_file_idx], sizeof (UfoRingCoordinate) * priv->alloc_size + sizeof (float));
     }
 
-    for (unsigned i = 0; i < nb_coord; ++i)
-        priv->data[piv_file_idx]->coord[priv->idx++] = coord[i];
+    memcpy (&priv->data[piv_file_idx]->coord[priv->idx], coord, nb_coord * sizeof (UfoRingCoordinate));
+    priv->idx += nb_coord;
 
     priv->data[piv_file_idx]->nb_elt += (float) nb_coord;
 
@@ -0,0 +1,481 @@
+/*
+ * Copyright (C) 2011-2016 Karlsruhe Institute of Technology
+ *
+ * This file is part of Ufo.
+ *
+ * This library is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation, either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
+#include "ufo-fft-filter-task.h"
+#include "common/ufo-fft.h"
+#include "common/ufo-filter-coefficients.h"
+
+/**
+ * SECTION:ufo-fft-filter-task
+ * @Short_description: Zero-pad, filter in frequency domain and crop
+ * @Title: fft-filter
+ *
+ * Fuses fft, filter and ifft into one node. All rows of the input are padded
+ * to the next power of two, transformed with one batched real-to-complex plan,
+ * multiplied with the filter selected by #UfoFftFilterTask:filter and
+ * transformed back. The padded half spectrum lives in a single device buffer
+ * which is re-used for all inputs of the same size.
+ */
+
+struct _UfoFftFilterTaskPrivate {
+    UfoFft *fft;
+    UfoFftParameter fft_param;
+    UfoFilterParameter param;
+
+    cl_context context;
+    cl_kernel spread_kernel;
+    cl_kernel filter_kernel;
+    cl_kernel pack_kernel;
+    cl_mem filter_mem;
+    cl_mem complex_mem;
+    gsize complex_size;
+    gsize filter_width;
+};
+
+static void ufo_task_interface_init (UfoTaskIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (UfoFftFilterTask, ufo_fft_filter_task, UFO_TYPE_TASK_NODE,
+                         G_IMPLEMENT_INTERFACE (UFO_TYPE_TASK,
+                                                ufo_task_interface_init))
+
+#define UFO_FFT_FILTER_TASK_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), UFO_TYPE_FFT_FILTER_TASK, UfoFftFilterTaskPrivate))
+
+enum {
+    PROP_0,
+    PROP_FILTER,
+    PROP_CUTOFF,
+    PROP_BW_ORDER,
+    PROP_FB_TAU,
+    PROP_FB_THETA,
+    PROP_SCALE,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
+UfoNode *
+ufo_fft_filter_task_new (void)
+{
+    return UFO_NODE (g_object_new (UFO_TYPE_FFT_FILTER_TASK, NULL));
+}
+
+static guint32
+pow2round(guint32 x)
+{
+    --x;
+    x |= x >> 1;
+    x |= x >> 2;
+    x |= x >> 4;
+    x |= x >> 8;
+    x |= x >> 16;
+    return x+1;
+}
+
+static void
+ufo_fft_filter_task_setup (UfoTask *task,
+                           UfoResources *resources,
+                           GError **error)
+{
+    UfoFftFilterTaskPrivate *priv;
+
+    priv = UFO_FFT_FILTER_TASK_GET_PRIVATE (task);
+
+    priv->context = ufo_resources_get_context (resources);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
+
+    priv->spread_kernel = ufo_resources_get_kernel (resources, "fft.cl", "fft_spread_real", NULL, error);
+    priv->filter_kernel = ufo_resources_get_kernel (resources, "filter.cl", "filter", NULL, error);
+    priv->pack_kernel = ufo_resources_get_kernel (resources, "fft.cl", "fft_pack_real", NULL, error);
+
+    if (priv->spread_kernel != NULL)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->spread_kernel), error);
+
+    if (priv->filter_kernel != NULL)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->filter_kernel), error);
+
+    if (priv->pack_kernel != NULL)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->pack_kernel), error);
+}
+
+static void
+ufo_fft_filter_task_get_requisition (UfoTask *task,
+                                     UfoBuffer **inputs,
+                                     UfoRequisition *requisition,
+                                     GError **error)
+{
+    UfoFftFilterTaskPrivate *priv;
+    UfoProfiler *profiler;
+    cl_command_queue queue;
+    gsize padded_width;
+    gsize complex_size;
+    cl_int cl_err;
+
+    priv = UFO_FFT_FILTER_TASK_GET_PRIVATE (task);
+    ufo_buffer_get_requisition (inputs[0], requisition);
+
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+    queue = ufo_gpu_node_get_cmd_queue (UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task))));
+    padded_width = pow2round ((guint32) requisition->dims[0]);
+
+    /* One plan transforms all rows of the input at once */
+    priv->fft_param.size[0] = padded_width;
+    priv->fft_param.batch = requisition->dims[1];
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (ufo_fft_update (priv->fft, priv->context, queue, &priv->fft_param), error);
+
+    /* real rows are transformed in-place with the stride of the half spectrum */
+    complex_size = 2 * (padded_width / 2 + 1) * requisition->dims[1] * sizeof (gfloat);
+
+    if (priv->complex_mem != NULL && priv->complex_size != complex_size) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->complex_mem));
+        priv->complex_mem = NULL;
+    }
+
+    if (priv->complex_mem == NULL) {
+        priv->complex_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE, complex_size, NULL, &cl_err);
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (cl_err, error);
+        priv->complex_size = complex_size;
+    }
+
+    if (priv->filter_mem != NULL && priv->filter_width != padded_width) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->filter_mem));
+        priv->filter_mem = NULL;
+    }
+
+    if (priv->filter_mem == NULL) {
+        priv->filter_mem = ufo_filter_coefficients_new (&priv->param, 2 * padded_width,
+                                                        priv->context, queue, profiler);
+        priv->filter_width = padded_width;
+    }
+}
+
+static guint
+ufo_fft_filter_task_get_num_inputs (UfoTask *task)
+{
+    return 1;
+}
+
+static guint
+ufo_fft_filter_task_get_num_dimensions (UfoTask *task,
+                                        guint input)
+{
+    g_return_val_if_fail (input == 0, 0);
+    return 2;
+}
+
+static UfoTaskMode
+ufo_fft_filter_task_get_mode (UfoTask *task)
+{
+    return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
+}
+
+static gboolean
+ufo_fft_filter_task_equal_real (UfoNode *n1,
+                                UfoNode *n2)
+{
+    g_return_val_if_fail (UFO_IS_FFT_FILTER_TASK (n1) && UFO_IS_FFT_FILTER_TASK (n2), FALSE);
+    return TRUE;
+}
+
+static gboolean
+ufo_fft_filter_task_process (UfoTask *task,
+                             UfoBuffer **inputs,
+                             UfoBuffer *output,
+                             UfoRequisition *requisition)
+{
+    UfoFftFilterTaskPrivate *priv;
+    UfoProfiler *profiler;
+    cl_command_queue queue;
+    cl_mem in_mem;
+    cl_mem out_mem;
+    cl_int width;
+    cl_int height;
+    cl_int stride;
+    gfloat scale;
+    gsize global_work_size[3];
+
+    priv = UFO_FFT_FILTER_TASK_GET_PRIVATE (task);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+    queue = ufo_gpu_node_get_cmd_queue (UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task))));
+    in_mem = ufo_buffer_get_device_array (inputs[0], queue);
+    out_mem = ufo_buffer_get_device_array (output, queue);
+
+    width = (cl_int) requisition->dims[0];
+    height = (cl_int) requisition->dims[1];
+    stride = (cl_int) (2 * (priv->fft_param.size[0] / 2 + 1));
+
+    /* Same normalization as fft ! filter ! ifft crop-width=width */
+    scale = 1.0f / ((gfloat) width);
+
+    global_work_size[0] = priv->fft_param.size[0];
+    global_work_size[1] = requisition->dims[1];
+    global_work_size[2] = 1;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 0, sizeof (cl_mem), (gpointer) &priv->complex_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 1, sizeof (cl_mem), (gpointer) &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 2, sizeof (cl_int), &width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 3, sizeof (cl_int), &height));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->spread_kernel, 4, sizeof (cl_int), &stride));
+    ufo_profiler_call (profiler, queue, priv->spread_kernel, 3, global_work_size, NULL);
+
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler,
+                                                priv->complex_mem, priv->complex_mem,
+                                                UFO_FFT_FORWARD, 0, NULL, NULL));
+
+    /* Multiply in-place, the filter kernel indexes rows by its global size */
+    global_work_size[0] = (gsize) stride;
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->filter_kernel, 0, sizeof (cl_mem), &priv->complex_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->filter_kernel, 1, sizeof (cl_mem), &priv->complex_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->filter_kernel, 2, sizeof (cl_mem), &priv->filter_mem));
+    ufo_profiler_call (profiler, queue, priv->filter_kernel, 2, global_work_size, NULL);
+
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler,
+                                                priv->complex_mem, priv->complex_mem,
+                                                UFO_FFT_BACKWARD, 0, NULL, NULL));
+
+    global_work_size[0] = priv->fft_param.size[0];
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 0, sizeof (cl_mem), (gpointer) &priv->complex_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 1, sizeof (cl_mem), (gpointer) &out_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 2, sizeof (cl_int), &width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 3, sizeof (cl_int), &height));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 4, sizeof (cl_int), &stride));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->pack_kernel, 5, sizeof (gfloat), &scale));
+    ufo_profiler_call (profiler, queue, priv->pack_kernel, 3, global_work_size, NULL);
+
+    return TRUE;
+}
+
+static void
+ufo_fft_filter_task_finalize (GObject *object)
+{
+    UfoFftFilterTaskPrivate *priv;
+
+    priv = UFO_FFT_FILTER_TASK_GET_PRIVATE (object);
+
+    if (priv->spread_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->spread_kernel));
+        priv->spread_kernel = NULL;
+    }
+
+    if (priv->filter_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->filter_kernel));
+        priv->filter_kernel = NULL;
+    }
+
+    if (priv->pack_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->pack_kernel));
+        priv->pack_kernel = NULL;
+    }
+
+    if (priv->filter_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->filter_mem));
+        priv->filter_mem = NULL;
+    }
+
+    if (priv->complex_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->complex_mem));
+        priv->complex_mem = NULL;
+    }
+
+    if (priv->context) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
+    if (priv->fft) {
+        ufo_fft_destroy (priv->fft);
+        priv->fft = NULL;
+    }
+
+    G_OBJECT_CLASS (ufo_fft_filter_task_parent_class)->finalize (object);
+}
+
+static void
+ufo_task_interface_init (UfoTaskIface *iface)
+{
+    iface->setup = ufo_fft_filter_task_setup;
+    iface->get_requisition = ufo_fft_filter_task_get_requisition;
+    iface->get_num_inputs = ufo_fft_filter_task_get_num_inputs;
+    iface->get_num_dimensions = ufo_fft_filter_task_get_num_dimensions;
+    iface->get_mode = ufo_fft_filter_task_get_mode;
+    iface->process = ufo_fft_filter_task_process;
+}
+
+static void
+ufo_fft_filter_task_set_property (GObject *object,
+                                  guint property_id,
+                                  const GValue *value,
+                                  GParamSpec *pspec)
+{
+    UfoFftFilterTaskPrivate *priv = UFO_FFT_FILTER_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_FILTER:
+            priv->param.type = g_value_get_enum (value);
+            break;
+        case PROP_CUTOFF:
+            priv->param.cutoff = g_value_get_float (value);
+            break;
+        case PROP_BW_ORDER:
+            priv->param.bw_order = g_value_get_float (value);
+            break;
+        case PROP_FB_TAU:
+            priv->param.fb_tau = g_value_get_float (value);
+            break;
+        case PROP_FB_THETA:
+            priv->param.fb_theta = g_value_get_float (value);
+            break;
+        case PROP_SCALE:
+            priv->param.scale = g_value_get_float (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_fft_filter_task_get_property (GObject *object,
+                                  guint property_id,
+                                  GValue *value,
+                                  GParamSpec *pspec)
+{
+    UfoFftFilterTaskPrivate *priv = UFO_FFT_FILTER_TASK_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_FILTER:
+            g_value_set_enum (value, priv->param.type);
+            break;
+        case PROP_CUTOFF:
+            g_value_set_float (value, priv->param.cutoff);
+            break;
+        case PROP_BW_ORDER:
+            g_value_set_float (value, priv->param.bw_order);
+            break;
+        case PROP_FB_TAU:
+            g_value_set_float (value, priv->param.fb_tau);
+            break;
+        case PROP_FB_THETA:
+            g_value_set_float (value, priv->param.fb_theta);
+            break;
+        case PROP_SCALE:
+            g_value_set_float (value, priv->param.scale);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_fft_filter_task_class_init (UfoFftFilterTaskClass *klass)
+{
+    GObjectClass *oclass;
+    UfoNodeClass *node_class;
+
+    oclass = G_OBJECT_CLASS (klass);
+    node_class = UFO_NODE_CLASS (klass);
+
+    oclass->finalize = ufo_fft_filter_task_finalize;
+    oclass->set_property = ufo_fft_filter_task_set_property;
+    oclass->get_property = ufo_fft_filter_task_get_property;
+
+    properties[PROP_FILTER] =
+        g_param_spec_enum ("filter",
+            "Type of filter (\"ramp\", \"ramp-fromreal\", \"butterworth\", \"faris-byer\", \"hamming\",\"bh3\")",
+            "Type of filter (\"ramp\", \"ramp-fromreal\", \"butterworth\", \"faris-byer\", \"hamming\",\"bh3\")",
+            g_enum_register_static ("fft-filter", ufo_filter_type_values),
+            0, G_PARAM_READWRITE);
+
+    properties[PROP_CUTOFF] =
+        g_param_spec_float ("cutoff",
+            "Relative cutoff frequency",
+            "Relative cutoff frequency",
+            0.0f, 1.0f, 0.5f,
+            G_PARAM_READWRITE);
+
+    properties[PROP_BW_ORDER] =
+        g_param_spec_float ("order",
+            "Order of the Butterworth filter",
+            "Order of the Butterworth filter",
+            2.0f, 32.0f, 4.0f,
+            G_PARAM_READWRITE);
+
+    properties[PROP_FB_TAU] =
+        g_param_spec_float ("tau",
+            "Tau parameter for Faris-Byer filter",
+            "Tau parameter for Faris-Byer filter",
+            -G_MAXFLOAT, G_MAXFLOAT, 1.0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_FB_THETA] =
+        g_param_spec_float ("theta",
+            "Theta parameter for Faris-Byer filter",
+            "Theta parameter for Faris-Byer filter",
+            -G_MAXFLOAT, G_MAXFLOAT, 1.0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_SCALE] =
+        g_param_spec_float ("scale",
+            "Every component is multiplied by scale",
+            "Every component is multiplied by scale",
+            -G_MAXFLOAT, G_MAXFLOAT, 1.0f,
+            G_PARAM_READWRITE);
+
+    for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
+        g_object_class_install_property (oclass, i, properties[i]);
+
+    node_class->equal = ufo_fft_filter_task_equal_real;
+
+    g_type_class_add_private(klass, sizeof(UfoFftFilterTaskPrivate));
+}
+
+static void
+ufo_fft_filter_task_init (UfoFftFilterTask *self)
+{
+    UfoFftFilterTaskPrivate *priv;
+    self->priv = priv = UFO_FFT_FILTER_TASK_GET_PRIVATE (self);
+    priv->fft = ufo_fft_new ();
+    priv->fft_param.dimensions = UFO_FFT_1D;
+    priv->fft_param.layout = UFO_FFT_LAYOUT_REAL;
+    priv->fft_param.size[0] = 1;
+    priv->fft_param.size[1] = 1;
+    priv->fft_param.size[2] = 1;
+    priv->fft_param.batch = 1;
+    priv->fft_param.zeropad = TRUE;
+    priv->context = NULL;
+    priv->spread_kernel = NULL;
+    priv->filter_kernel = NULL;
+    priv->pack_kernel = NULL;
+    priv->filter_mem = NULL;
+    priv->complex_mem = NULL;
+    priv->complex_size = 0;
+    priv->filter_width = 0;
+    priv->param.type = UFO_FILTER_RAMP_FROMREAL;
+    priv->param.cutoff = 0.5f;
+    priv->param.bw_order = 4.0f;
+    priv->param.fb_tau = 0.1f;
+    priv->param.fb_theta = 1.0f;
+    priv->param.scale = 1.0f;
+}
@@ -37,6 +37,7 @@ struct _UfoFftTaskPrivate {
     cl_kernel kernel;
 
     gboolean zeropad;
+    gboolean half_spectrum;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -54,6 +55,7 @@ enum {
     PROP_SIZE_X,
     PROP_SIZE_Y,
     PROP_SIZE_Z,
+    PROP_HALF_SPECTRUM,
     N_PROPERTIES
 };
 
@@ -87,7 +89,9 @@ ufo_fft_task_setup (UfoTask *task,
     priv = UFO_FFT_TASK_GET_PRIVATE (task);
 
     if (priv->zeropad) {
-        priv->kernel = ufo_resources_get_kernel (resources, "fft.cl", "fft_spread", NULL, error);
+        priv->kernel = ufo_resources_get_kernel (resources, "fft.cl",
+                                                 priv->half_spectrum ? "fft_spread_real" : "fft_spread",
+                                                 NULL, error);
     }
 
     priv->context = ufo_resources_get_context (resources);
@@ -111,16 +115,21 @@ ufo_fft_task_get_requisition (UfoTask *task,
     ufo_buffer_get_requisition (inputs[0], &in_req);
 
     priv->param.zeropad = priv->zeropad;
-    priv->param.size[0] = priv->zeropad ? pow2round (in_req.dims[0]) : in_req.dims[0] / 2;
+    priv->param.layout = priv->half_spectrum ? UFO_FFT_LAYOUT_REAL : UFO_FFT_LAYOUT_COMPLEX;
+
+    if (priv->zeropad)
+        priv->param.size[0] = pow2round (in_req.dims[0]);
+    else
+        priv->param.size[0] = priv->half_spectrum ? in_req.dims[0] : in_req.dims[0] / 2;
 
     switch (priv->param.dimensions) {
         case UFO_FFT_1D:
-            priv->param.batch = in_req.n_dims == 2 ? in_req.dims[1] : 1;
+            priv->param.batch = in_req.n_dims > 1 ? in_req.dims[1] : 1;
             break;
 
         case UFO_FFT_2D:
             priv->param.size[1] = priv->zeropad ? pow2round (in_req.dims[1]) : in_req.dims[1];
-            priv->param.batch = in_req.n_dims == 3 ? in_req.dims[2] : 1;
+            priv->param.batch = 1;
             break;
 
         case UFO_FFT_3D:
@@ -131,7 +140,7 @@ ufo_fft_task_get_requisition (UfoTask *task,
     UFO_RESOURCES_CHECK_SET_AND_RETURN (ufo_fft_update (priv->fft, priv->context, queue, &priv->param), error);
 
     *requisition = in_req;  /* keep third dimension for 2D batching */
-    requisition->dims[0] = 2 * priv->param.size[0];
+    requisition->dims[0] = priv->half_spectrum ? 2 * (priv->param.size[0] / 2 + 1) : 2 * priv->param.size[0];
     requisition->dims[1] = priv->param.dimensions == UFO_FFT_1D ? in_req.dims[1] : priv->param.size[1];
 }
 
@@ -177,7 +186,9 @@ ufo_fft_task_process (UfoTask *task,
     cl_mem out_mem;
     cl_int width;
     cl_int height;
+    cl_int stride;
     gsize global_work_size[3];
+    gsize num_frames;
 
     priv = UFO_FFT_TASK_GET_PRIVATE (task);
     profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
@@ -197,7 +208,13 @@ ufo_fft_task_process (UfoTask *task,
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 2, sizeof (cl_int), &width));
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 3, sizeof (cl_int), &height));
 
-        global_work_size[0] = requisition->dims[0] >> 1;
+        if (priv->half_spectrum) {
+            /* real rows are padded in-place to the length of the half spectrum */
+            stride = (cl_int) requisition->dims[0];
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 4, sizeof (cl_int), &stride));
+        }
+
+        global_work_size[0] = priv->param.size[0];
         global_work_size[1] = requisition->dims[1];
         global_work_size[2] = requisition->n_dims == 3 ? requisition->dims[2] : 1;
 
@@ -206,10 +223,13 @@ ufo_fft_task_process (UfoTask *task,
                                                            0, NULL, NULL));
     }
 
-    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler,
-                                                priv->zeropad ? out_mem : in_mem,
-                                                out_mem, UFO_FFT_FORWARD,
-                                                0, NULL, NULL));
+    /* frames stacked along the third dimension are transformed in one go */
+    num_frames = priv->param.dimensions < UFO_FFT_3D && in_req.n_dims == 3 ? in_req.dims[2] : 1;
+
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute_batch (priv->fft, queue, profiler,
+                                                      priv->zeropad ? out_mem : in_mem,
+                                                      out_mem, UFO_FFT_FORWARD, num_frames,
+                                                      0, NULL, NULL));
 
     return TRUE;
 }
@@ -274,6 +294,9 @@ ufo_fft_task_set_property (GObject *object,
         case PROP_SIZE_Z:
             priv->param.size[2] = g_value_get_uint (value);
             break;
+        case PROP_HALF_SPECTRUM:
+            priv->half_spectrum = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -304,6 +327,9 @@ ufo_fft_task_get_property (GObject *object,
         case PROP_SIZE_Z:
             g_value_set_uint (value, priv->param.size[2]);
             break;
+        case PROP_HALF_SPECTRUM:
+            g_value_set_boolean (value, priv->half_spectrum);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -358,6 +384,13 @@ ufo_fft_task_class_init (UfoFftTaskClass *klass)
             1, 8192, 1,
             G_PARAM_READWRITE);
 
+    properties[PROP_HALF_SPECTRUM] =
+        g_param_spec_boolean("half-spectrum",
+            "Compute only the non-redundant half of the spectrum of real input",
+            "Compute only the non-redundant half of the spectrum of real input",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -375,6 +408,7 @@ ufo_fft_task_init (UfoFftTask *self)
 
     priv->kernel = NULL;
     priv->zeropad = TRUE;
+    priv->half_spectrum = FALSE;
     priv->fft = ufo_fft_new ();
     priv->param.dimensions = UFO_FFT_1D;
     priv->param.size[0] = 1;
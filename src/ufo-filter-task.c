@@ -22,10 +22,9 @@
 #else
 #include <CL/cl.h>
 #endif
-#include <math.h>
 
 #include "ufo-filter-task.h"
-#include "common/ufo-fft.h"
+#include "common/ufo-filter-coefficients.h"
 
 /**
  * SECTION:ufo-filter-task
@@ -37,55 +36,14 @@
  * #UfoFilterTask:filter property.
  */
 
-typedef void (*SetupFunc)(UfoFilterTaskPrivate *priv, gfloat *coefficients, guint width);
-
 static void ufo_task_interface_init (UfoTaskIface *iface);
-static void compute_ramp_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-static void compute_real_space_ramp_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-static void compute_butterworth_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-static void compute_faris_byer_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-static void compute_hamming_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-static void compute_bh3_coefficients (UfoFilterTaskPrivate *, gfloat *, guint);
-
-typedef enum {
-    FILTER_RAMP = 0,
-    FILTER_RAMP_FROMREAL,
-    FILTER_BUTTERWORTH,
-    FILTER_FARIS_BYER,
-    FILTER_HAMMING,
-    FILTER_BH3,
-} Filter;
-
-static GEnumValue filter_values[] = {
-    { FILTER_RAMP,          "FILTER_RAMP",          "ramp" },
-    { FILTER_RAMP_FROMREAL, "FILTER_RAMP_FROMREAL", "ramp-fromreal" },
-    { FILTER_BUTTERWORTH,   "FILTER_BUTTERWORTH",   "butterworth"},
-    { FILTER_FARIS_BYER,    "FILTER_FARIS_BYER",    "faris-byer"},
-    { FILTER_HAMMING,       "FILTER_HAMMING",       "hamming"},
-    { FILTER_BH3,           "FILTER_BH3",           "bh3" },
-    { 0, NULL, NULL}
-};
-
-static SetupFunc filter_funcs[] = {
-    &compute_ramp_coefficients,
-    &compute_real_space_ramp_coefficients,
-    &compute_butterworth_coefficients,
-    &compute_faris_byer_coefficients,
-    &compute_hamming_coefficients,
-    &compute_bh3_coefficients,
-};
 
 struct _UfoFilterTaskPrivate {
     cl_context context;
     cl_kernel kernel;
     cl_mem filter_mem;
-    gfloat cutoff;
-    gfloat bw_order;
-    gfloat fb_tau;
-    gfloat fb_theta;
-    gfloat scale;
-    Filter filter;
-    UfoFft *fft;
+    UfoFilterParameter param;
+    gboolean half_spectrum;
 };
 
 G_DEFINE_TYPE_WITH_CODE (UfoFilterTask, ufo_filter_task, UFO_TYPE_TASK_NODE,
@@ -102,6 +60,7 @@ enum {
     PROP_FB_TAU,
     PROP_FB_THETA,
     PROP_SCALE,
+    PROP_HALF_SPECTRUM,
     N_PROPERTIES
 };
 
@@ -125,6 +84,7 @@ ufo_filter_task_process (UfoTask *task,
     cl_command_queue cmd_queue;
     cl_mem in_mem;
     cl_mem out_mem;
+    gsize global_size[2];
 
     priv = UFO_FILTER_TASK (task)->priv;
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
@@ -136,8 +96,12 @@ ufo_filter_task_process (UfoTask *task,
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 1, sizeof (cl_mem), &out_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 2, sizeof (cl_mem), &priv->filter_mem));
 
+    /* The filter is applied row-wise, so the frames of a batch are just more rows */
+    global_size[0] = requisition->dims[0];
+    global_size[1] = requisition->dims[1] * (requisition->n_dims == 3 ? requisition->dims[2] : 1);
+
     profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-    ufo_profiler_call (profiler, cmd_queue, priv->kernel, 2, requisition->dims, NULL);
+    ufo_profiler_call (profiler, cmd_queue, priv->kernel, 2, global_size, NULL);
 
     return TRUE;
 }
@@ -158,122 +122,6 @@ ufo_filter_task_setup (UfoTask *task,
         UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel), error);
 }
 
-static void
-mirror_coefficients (gfloat *filter, guint width)
-{
-    for (guint k = width/2 + 2; k < width; k += 2) {
-        filter[k] = filter[width - k];
-        filter[k + 1] = filter[width - k + 1];
-    }
-}
-
-static void
-compute_ramp_coefficients (UfoFilterTaskPrivate *priv,
-                           gfloat *filter,
-                           guint width)
-{
-    const gdouble step = 2.0 / width;
-
-    for (guint k = 1; k < width / 4 + 1; k++) {
-        filter[2*k] = k * step * priv->scale;
-        filter[2*k + 1] = filter[2*k];
-    }
-}
-
-static void
-compute_real_space_ramp_coefficients (UfoFilterTaskPrivate *priv,
-                                      gfloat *filter,
-                                      guint width)
-{
-    filter[0] = filter[1] = 0.25 * priv->scale;
-
-    for (guint k = 1; k < width / 4 + 1; k++) {
-        filter[2*k] = k % 2 ? - priv->scale / (k * k * G_PI * G_PI) : 0.0;
-        filter[2*k + 1] = filter[2*k];
-    }
-}
-
-static void
-compute_butterworth_coefficients (UfoFilterTaskPrivate *priv,
-                                  gfloat *filter,
-                                  guint width)
-{
-    const gdouble step = 2.0 / width;
-
-    for (guint k = 0; k < (width / 4) + 1; k++) {
-        const gdouble f = k * step;
-        filter[2*k] = (gfloat) (f / (1.0 + pow (f / priv->cutoff, 2.0 * priv->bw_order)) * priv->scale);
-        filter[2*k+1] = filter[2*k];
-    }
-}
-
-static void
-compute_hamming_coefficients (UfoFilterTaskPrivate *priv,
-                              gfloat *filter,
-                              guint width)
-{
-    const gdouble step = 2.0 / width;
-
-    for (guint k = 0; k < (width / 4) + 1; k++) {
-        const gdouble f = k * step;
-
-        filter[2*k] = f < priv->cutoff ? f * (0.54 + 0.46 * cos (G_PI * f / priv->cutoff)) * priv->scale : 0;
-        filter[2*k+1] = filter[2*k];
-    }
-}
-
-static void
-compute_bh3_coefficients (UfoFilterTaskPrivate *priv,
-                           gfloat *filter,
-                           guint width)
-{
-    const gdouble step = 2.0 / width;
-    const gdouble a0 = 0.42;
-    const gdouble a1 = 0.5;
-    const gdouble a2 = 0.08;
-    for (guint k = 1; k < width / 4 + 1; k++) {
-        const gdouble f = k * step;
-        filter[2*k] = f * ( a0 + a1 * cos(f * G_PI) + a2 * cos(2.0 * f * G_PI ) ) * priv->scale;
-        filter[2*k + 1] = filter[2*k];
-    }
-}
-
-static guint
-get_padding_value (guint x)
-{
-    guint padding = 2 * x;
-    guint result = 1;
-
-    while (result < padding)
-        result *= 2;
-
-    return result;
-}
-
-static void
-compute_faris_byer_coefficients (UfoFilterTaskPrivate *priv,
-                                 gfloat *filter,
-                                 guint width)
-{
-    const gdouble pi_squared_tau = G_PI * G_PI * priv->fb_tau;
-    const gdouble sin_theta_2 = - sin (priv->fb_theta) / 2;
-    const guint padding = get_padding_value (width);
-
-    filter[0] = 0;
-
-    for (guint x = 1; x <= width / 2; x++) {
-        if (x % 2 != 0)
-            filter[x] = 1 / (pi_squared_tau * x);
-    }
-
-    for (guint i = width / 2 + 1; i < width; i++) {
-        guint x = width + 1 - i;
-
-        if (x % 2 != 0)
-            filter[padding - width - i - 1] = sin_theta_2 / (x * x * pi_squared_tau);
-    }
-}
-
 static void
 ufo_filter_task_get_requisition (UfoTask *task,
                                  UfoBuffer **inputs,
@@ -286,45 +134,20 @@ ufo_filter_task_get_requisition (UfoTask *task,
     ufo_buffer_get_requisition (inputs[0], requisition);
 
     if (priv->filter_mem == NULL) {
-        cl_int cl_err;
+        cl_command_queue queue;
+        UfoProfiler *profiler;
         guint width;
-        gfloat *coefficients;
 
+        /* a half spectrum uses the first coefficients of the full spectrum */
         width = (guint) requisition->dims[0];
-        coefficients = g_malloc0 (width * sizeof (gfloat));
-
-        coefficients[0] = 0.5 / width;
-        coefficients[1] = coefficients[0];
-
-        filter_funcs[priv->filter] (priv, coefficients, width);
-        mirror_coefficients (coefficients, width);
-
-        priv->filter_mem = clCreateBuffer (priv->context,
-                                           CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
-                                           width * sizeof(float),
-                                           coefficients,
-                                           &cl_err);
-        UFO_RESOURCES_CHECK_CLERR (cl_err);
-        g_free (coefficients);
-
-        if (priv->filter == FILTER_RAMP_FROMREAL) {
-            UfoFftParameter param;
-            cl_command_queue queue;
-            UfoProfiler *profiler;
-
-            param.dimensions = UFO_FFT_1D;
-            param.size[0] = requisition->dims[0] / 2;
-            param.size[1] = 1;
-            param.size[2] = 1;
-            param.batch = 1;
-
-            priv->fft = ufo_fft_new ();
-            profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-            queue = ufo_gpu_node_get_cmd_queue (UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task))));
-            UFO_RESOURCES_CHECK_CLERR (ufo_fft_update (priv->fft, priv->context, queue, &param));
-            UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler, priv->filter_mem, priv->filter_mem,
-                                                        UFO_FFT_FORWARD, 0, NULL, NULL));
-        }
+
+        if (priv->half_spectrum)
+            width = 4 * (width / 2 - 1);
+
+        profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+        queue = ufo_gpu_node_get_cmd_queue (UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task))));
+        priv->filter_mem = ufo_filter_coefficients_new (&priv->param, width,
+                                                        priv->context, queue, profiler);
     }
 }
 
@@ -373,11 +196,6 @@ ufo_filter_task_finalize (GObject *object)
         priv->filter_mem = NULL;
     }
 
-    if (priv->fft != NULL) {
-        ufo_fft_destroy (priv->fft);
-        priv->fft = NULL;
-    }
-
     G_OBJECT_CLASS (ufo_filter_task_parent_class)->finalize (object);
 }
 
@@ -402,22 +220,25 @@ ufo_filter_task_set_property (GObject *object,
 
     switch (property_id) {
         case PROP_FILTER:
-            priv->filter = g_value_get_enum (value);
+            priv->param.type = g_value_get_enum (value);
             break;
         case PROP_CUTOFF:
-            priv->cutoff = g_value_get_float (value);
+            priv->param.cutoff = g_value_get_float (value);
             break;
         case PROP_BW_ORDER:
-            priv->bw_order = g_value_get_float (value);
+            priv->param.bw_order = g_value_get_float (value);
             break;
         case PROP_FB_TAU:
-            priv->fb_tau = g_value_get_float (value);
+            priv->param.fb_tau = g_value_get_float (value);
             break;
         case PROP_FB_THETA:
-            priv->fb_theta = g_value_get_float (value);
+            priv->param.fb_theta = g_value_get_float (value);
             break;
         case PROP_SCALE:
-            priv->scale = g_value_get_float (value);
+            priv->param.scale = g_value_get_float (value);
+            break;
+        case PROP_HALF_SPECTRUM:
+            priv->half_spectrum = g_value_get_boolean (value);
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -435,22 +256,25 @@ ufo_filter_task_get_property (GObject *object,
 
     switch (property_id) {
         case PROP_FILTER:
-            g_value_set_enum (value, priv->filter);
+            g_value_set_enum (value, priv->param.type);
             break;
         case PROP_CUTOFF:
-            g_value_set_float (value, priv->cutoff);
+            g_value_set_float (value, priv->param.cutoff);
             break;
         case PROP_BW_ORDER:
-            g_value_set_float (value, priv->bw_order);
+            g_value_set_float (value, priv->param.bw_order);
             break;
         case PROP_FB_TAU:
-            g_value_set_float (value, priv->fb_tau);
+            g_value_set_float (value, priv->param.fb_tau);
             break;
         case PROP_FB_THETA:
-            g_value_set_float (value, priv->fb_theta);
+            g_value_set_float (value, priv->param.fb_theta);
             break;
         case PROP_SCALE:
-            g_value_set_float (value, priv->scale);
+            g_value_set_float (value, priv->param.scale);
+            break;
+        case PROP_HALF_SPECTRUM:
+            g_value_set_boolean (value, priv->half_spectrum);
             break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -475,7 +299,7 @@ ufo_filter_task_class_init (UfoFilterTaskClass *klass)
         g_param_spec_enum ("filter",
             "Type of filter (\"ramp\", \"ramp-fromreal\", \"butterworth\", \"faris-byer\", \"hamming\",\"bh3\")",
             "Type of filter (\"ramp\", \"ramp-fromreal\", \"butterworth\", \"faris-byer\", \"hamming\",\"bh3\")",
-            g_enum_register_static ("filter", filter_values),
+            g_enum_register_static ("filter", ufo_filter_type_values),
             0, G_PARAM_READWRITE);
 
     properties[PROP_CUTOFF] =
@@ -513,6 +337,13 @@ ufo_filter_task_class_init (UfoFilterTaskClass *klass)
             -G_MAXFLOAT, G_MAXFLOAT, 1.0f,
             G_PARAM_READWRITE);
 
+    properties[PROP_HALF_SPECTRUM] =
+        g_param_spec_boolean ("half-spectrum",
+            "Input is the non-redundant half of the spectrum of real data",
+            "Input is the non-redundant half of the spectrum of real data",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -528,11 +359,11 @@ ufo_filter_task_init (UfoFilterTask *self)
     self->priv = priv = UFO_FILTER_TASK_GET_PRIVATE (self);
     priv->kernel = NULL;
     priv->filter_mem = NULL;
-    priv->filter = FILTER_RAMP_FROMREAL;
-    priv->cutoff = 0.5f;
-    priv->bw_order = 4.0f;
-    priv->fb_tau = 0.1f;
-    priv->fb_theta = 1.0f;
-    priv->scale = 1.0f;
-    priv->fft = NULL;
+    priv->param.type = UFO_FILTER_RAMP_FROMREAL;
+    priv->param.cutoff = 0.5f;
+    priv->param.bw_order = 4.0f;
+    priv->param.fb_tau = 0.1f;
+    priv->param.fb_theta = 1.0f;
+    priv->param.scale = 1.0f;
+    priv->half_spectrum = FALSE;
 }
@@ -26,12 +26,36 @@
 #include "ufo-flat-field-correct-task.h"
 
 
+typedef enum {
+    REDUCTION_NONE = 0,
+    REDUCTION_MEAN,
+    REDUCTION_MEDIAN,
+} Reduction;
+
+static GEnumValue reduction_values[] = {
+    { REDUCTION_NONE,   "REDUCTION_NONE",   "none" },
+    { REDUCTION_MEAN,   "REDUCTION_MEAN",   "mean" },
+    { REDUCTION_MEDIAN, "REDUCTION_MEDIAN", "median" },
+    { 0, NULL, NULL}
+};
+
 struct _UfoFlatFieldCorrectTaskPrivate {
     gboolean fix_nan_and_inf;
     gboolean absorptivity;
     gboolean sinogram_input;
     gfloat dark_scale;
+    Reduction reduction;
+    gboolean interpolate_flats;
+    guint num_projections;
+    guint current;
+    cl_context context;
     cl_kernel kernel;
+    cl_kernel reduce_kernel;
+    cl_kernel prepare_kernel;
+
+    /* Resident references, either gain and offset or dark, flat before the
+     * scan and the difference of the flat after and before the scan */
+    cl_mem references[3];
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -48,6 +72,9 @@ enum {
     PROP_ABSORPTIVITY,
     PROP_SINOGRAM_INPUT,
     PROP_DARK_SCALE,
+    PROP_REDUCTION_MODE,
+    PROP_INTERPOLATE_FLATS,
+    PROP_NUM_PROJECTIONS,
     N_PROPERTIES
 };
 
@@ -65,12 +92,65 @@ ufo_flat_field_correct_task_setup (UfoTask *task,
                                    GError **error)
 {
     UfoFlatFieldCorrectTaskPrivate *priv;
+    const gchar *kernel_name;
 
     priv = UFO_FLAT_FIELD_CORRECT_TASK_GET_PRIVATE (task);
-    priv->kernel = ufo_resources_get_kernel (resources, "ffc.cl", "flat_correct", NULL, error);
 
-    if (priv->kernel)
-        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel), error);
+    if (priv->reduction == REDUCTION_NONE) {
+        priv->kernel = ufo_resources_get_kernel (resources, "ffc.cl", "flat_correct", NULL, error);
+
+        if (priv->kernel)
+            UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel), error);
+
+        return;
+    }
+
+    if (priv->interpolate_flats && !priv->sinogram_input && priv->num_projections < 2) {
+        g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                             "flat-field-correct: interpolate-flats requires num-projections > 1");
+        return;
+    }
+
+    kernel_name = priv->interpolate_flats ? "flat_correct_interpolate" : "flat_correct_cached";
+    priv->kernel = ufo_resources_get_kernel (resources, "ffc.cl", kernel_name, NULL, error);
+
+    if (error && *error)
+        return;
+
+    kernel_name = priv->reduction == REDUCTION_MEDIAN ? "ffc_reduce_median" : "ffc_reduce_mean";
+    priv->reduce_kernel = ufo_resources_get_kernel (resources, "ffc.cl", kernel_name, NULL, error);
+
+    if (error && *error)
+        return;
+
+    kernel_name = priv->interpolate_flats ? "ffc_prepare_interpolate" : "ffc_prepare";
+    priv->prepare_kernel = ufo_resources_get_kernel (resources, "ffc.cl", kernel_name, NULL, error);
+
+    if (error && *error)
+        return;
+
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel), error);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->reduce_kernel), error);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->prepare_kernel), error);
+
+    priv->context = ufo_resources_get_context (resources);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
+    priv->current = 0;
+}
+
+static gsize
+get_num_frame_pixels (UfoRequisition *requisition, gboolean sinogram_input)
+{
+    return sinogram_input ? requisition->dims[0] : requisition->dims[0] * requisition->dims[1];
+}
+
+static guint
+get_num_frames (UfoRequisition *requisition, gboolean sinogram_input)
+{
+    if (sinogram_input)
+        return requisition->n_dims > 1 ? requisition->dims[1] : 1;
+
+    return requisition->n_dims > 2 ? requisition->dims[2] : 1;
 }
 
 static void
@@ -79,10 +159,40 @@ ufo_flat_field_correct_task_get_requisition (UfoTask *task,
                                              UfoRequisition *requisition,
                                              GError **error)
 {
+    UfoFlatFieldCorrectTaskPrivate *priv;
+    UfoRequisition ref_req;
+    UfoRequisition frame_req;
+
+    priv = UFO_FLAT_FIELD_CORRECT_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], requisition);
 
-    if (ufo_buffer_cmp_dimensions (inputs[1], requisition) != 0 ||
-        ufo_buffer_cmp_dimensions (inputs[2], requisition) != 0) {
+    if (priv->reduction != REDUCTION_NONE) {
+        /* Darks and flats are stacks of frames of the projection size */
+        for (guint i = 1; i < 3; i++) {
+            ufo_buffer_get_requisition (inputs[i], &ref_req);
+
+            if (ref_req.dims[0] != requisition->dims[0] ||
+                (!priv->sinogram_input && ref_req.dims[1] != requisition->dims[1])) {
+                g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
+                                     "flat-field-correct dark and flat frames must match the input size");
+                return;
+            }
+        }
+
+        if (priv->interpolate_flats && get_num_frames (&ref_req, priv->sinogram_input) < 2) {
+            g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
+                                 "flat-field-correct needs at least two flats to interpolate");
+        }
+
+        return;
+    }
+
+    /* A batch of frames shares one dark and flat frame */
+    frame_req = *requisition;
+    frame_req.n_dims = MIN (frame_req.n_dims, 2);
+
+    if (ufo_buffer_cmp_dimensions (inputs[1], &frame_req) != 0 ||
+        ufo_buffer_cmp_dimensions (inputs[2], &frame_req) != 0) {
         g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
                              "flat-field-correct inputs must have the same size");
     }
@@ -106,8 +216,9 @@ ufo_flat_field_correct_task_get_num_dimensions (UfoTask *task, guint input)
     if (input == 0)
         return 2;
 
-    /* A row of dark frame depend on the sinogram_input flag */
-    return priv->sinogram_input ? 1 : 2;
+    /* A row of dark frame depend on the sinogram_input flag, reduced
+     * references come as a stack of those */
+    return (priv->sinogram_input ? 1 : 2) + (priv->reduction != REDUCTION_NONE ? 1 : 0);
 }
 
 static UfoTaskMode
@@ -116,6 +227,82 @@ ufo_flat_field_correct_task_get_mode (UfoTask *task)
     return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
 }
 
+static void
+reduce_references (UfoFlatFieldCorrectTaskPrivate *priv,
+                   UfoBuffer *buffer,
+                   cl_mem *outputs,
+                   guint n_outputs,
+                   cl_command_queue cmd_queue,
+                   UfoProfiler *profiler)
+{
+    UfoRequisition requisition;
+    cl_mem stack_mem;
+    cl_mem scratch_mem = NULL;
+    gsize n_pixels;
+    guint n_frames;
+    cl_int err;
+
+    ufo_buffer_get_requisition (buffer, &requisition);
+    n_pixels = get_num_frame_pixels (&requisition, priv->sinogram_input);
+    n_frames = get_num_frames (&requisition, priv->sinogram_input);
+    stack_mem = ufo_buffer_get_device_array (buffer, cmd_queue);
+
+    if (priv->reduction == REDUCTION_MEDIAN) {
+        /* Selection reorders the values, keep the input intact */
+        scratch_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE,
+                                      ufo_buffer_get_size (buffer), NULL, &err);
+        UFO_RESOURCES_CHECK_CLERR (err);
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueCopyBuffer (cmd_queue, stack_mem, scratch_mem,
+                                                        0, 0, ufo_buffer_get_size (buffer),
+                                                        0, NULL, NULL));
+        stack_mem = scratch_mem;
+    }
+
+    /* Split the stack into n_outputs consecutive parts and reduce each */
+    for (guint i = 0; i < n_outputs; i++) {
+        cl_int first = i * n_frames / n_outputs;
+        cl_int count = (i + 1) * n_frames / n_outputs - first;
+
+        if (outputs[i] == NULL) {
+            outputs[i] = clCreateBuffer (priv->context, CL_MEM_READ_WRITE,
+                                         n_pixels * sizeof (gfloat), NULL, &err);
+            UFO_RESOURCES_CHECK_CLERR (err);
+        }
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->reduce_kernel, 0, sizeof (cl_mem), &stack_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->reduce_kernel, 1, sizeof (cl_mem), &outputs[i]));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->reduce_kernel, 2, sizeof (cl_int), &first));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->reduce_kernel, 3, sizeof (cl_int), &count));
+        ufo_profiler_call (profiler, cmd_queue, priv->reduce_kernel, 1, &n_pixels, NULL);
+    }
+
+    if (scratch_mem)
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (scratch_mem));
+}
+
+static void
+prepare_references (UfoFlatFieldCorrectTaskPrivate *priv,
+                    UfoBuffer **inputs,
+                    UfoRequisition *requisition,
+                    cl_command_queue cmd_queue,
+                    UfoProfiler *profiler)
+{
+    gsize n_pixels;
+    guint n_args;
+
+    n_pixels = get_num_frame_pixels (requisition, priv->sinogram_input);
+    reduce_references (priv, inputs[1], &priv->references[0], 1, cmd_queue, profiler);
+    reduce_references (priv, inputs[2], &priv->references[1], priv->interpolate_flats ? 2 : 1,
+                       cmd_queue, profiler);
+    n_args = priv->interpolate_flats ? 3 : 2;
+
+    for (guint i = 0; i < n_args; i++)
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->prepare_kernel, i, sizeof (cl_mem), &priv->references[i]));
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->prepare_kernel, n_args, sizeof (cl_float), &priv->dark_scale));
+    ufo_profiler_call (profiler, cmd_queue, priv->prepare_kernel, 1, &n_pixels, NULL);
+}
+
 static gboolean
 ufo_flat_field_correct_task_process (UfoTask *task,
                                         UfoBuffer **inputs,
@@ -135,9 +322,8 @@ ufo_flat_field_correct_task_process (UfoTask *task,
 
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
     cmd_queue = ufo_gpu_node_get_cmd_queue (node);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
     proj_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
-    dark_mem = ufo_buffer_get_device_array (inputs[1], cmd_queue);
-    flat_mem = ufo_buffer_get_device_array (inputs[2], cmd_queue);
     out_mem = ufo_buffer_get_device_array (output, cmd_queue);
 
     priv = UFO_FLAT_FIELD_CORRECT_TASK_GET_PRIVATE (task);
@@ -145,6 +331,58 @@ ufo_flat_field_correct_task_process (UfoTask *task,
     sino_in = (gint) priv->sinogram_input;
     fix_nan_and_inf = (gint) priv->fix_nan_and_inf;
 
+    if (priv->reduction != REDUCTION_NONE) {
+        /* Darks and flats are reduced once and stay on the device, later
+         * items on their inputs are repeats of the same stack. Each sinogram
+         * belongs to another detector row and comes with its own stack of
+         * reference rows, which are reduced into the same buffers. */
+        if (priv->references[0] == NULL || priv->sinogram_input)
+            prepare_references (priv, inputs, requisition, cmd_queue, profiler);
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 0, sizeof (cl_mem), &out_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 1, sizeof (cl_mem), &proj_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 2, sizeof (cl_mem), &priv->references[0]));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 3, sizeof (cl_mem), &priv->references[1]));
+
+        if (priv->interpolate_flats) {
+            gfloat t_start = 0.0f;
+            gfloat t_step = 0.0f;
+            gfloat t_frame_step = 0.0f;
+
+            if (priv->sinogram_input) {
+                /* Every row of a sinogram is another projection */
+                if (requisition->dims[1] > 1)
+                    t_step = 1.0f / (requisition->dims[1] - 1);
+            }
+            else {
+                /* Every frame of a batch is another projection */
+                t_start = (gfloat) MIN (priv->current, priv->num_projections - 1) / (priv->num_projections - 1);
+                t_frame_step = 1.0f / (priv->num_projections - 1);
+            }
+
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 4, sizeof (cl_mem), &priv->references[2]));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 5, sizeof (cl_int), &sino_in));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 6, sizeof (cl_int), &absorptivity));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 7, sizeof (cl_int), &fix_nan_and_inf));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 8, sizeof (cl_float), &t_start));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 9, sizeof (cl_float), &t_step));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 10, sizeof (cl_float), &t_frame_step));
+        }
+        else {
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 4, sizeof (cl_int), &sino_in));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 5, sizeof (cl_int), &absorptivity));
+            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 6, sizeof (cl_int), &fix_nan_and_inf));
+        }
+
+        ufo_profiler_call (profiler, cmd_queue, priv->kernel, requisition->n_dims, requisition->dims, NULL);
+        priv->current += requisition->n_dims == 3 ? requisition->dims[2] : 1;
+
+        return TRUE;
+    }
+
+    dark_mem = ufo_buffer_get_device_array (inputs[1], cmd_queue);
+    flat_mem = ufo_buffer_get_device_array (inputs[2], cmd_queue);
+
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 0, sizeof (cl_mem), &out_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 1, sizeof (cl_mem), &proj_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 2, sizeof (cl_mem), &dark_mem));
@@ -153,9 +391,7 @@ ufo_flat_field_correct_task_process (UfoTask *task,
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 5, sizeof (cl_int), &absorptivity));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 6, sizeof (cl_int), &fix_nan_and_inf));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 7, sizeof (cl_float), &priv->dark_scale));
-
-    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-    ufo_profiler_call (profiler, cmd_queue, priv->kernel, 2, requisition->dims, NULL);
+    ufo_profiler_call (profiler, cmd_queue, priv->kernel, requisition->n_dims, requisition->dims, NULL);
 
     return TRUE;
 }
@@ -181,6 +417,15 @@ ufo_flat_field_correct_task_set_property (GObject *object,
         case PROP_DARK_SCALE:
             priv->dark_scale = g_value_get_float (value);
             break;
+        case PROP_REDUCTION_MODE:
+            priv->reduction = g_value_get_enum (value);
+            break;
+        case PROP_INTERPOLATE_FLATS:
+            priv->interpolate_flats = g_value_get_boolean (value);
+            break;
+        case PROP_NUM_PROJECTIONS:
+            priv->num_projections = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -208,6 +453,15 @@ ufo_flat_field_correct_task_get_property (GObject *object,
         case PROP_DARK_SCALE:
             g_value_set_float (value, priv->dark_scale);
             break;
+        case PROP_REDUCTION_MODE:
+            g_value_set_enum (value, priv->reduction);
+            break;
+        case PROP_INTERPOLATE_FLATS:
+            g_value_set_boolean (value, priv->interpolate_flats);
+            break;
+        case PROP_NUM_PROJECTIONS:
+            g_value_set_uint (value, priv->num_projections);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -226,6 +480,28 @@ ufo_flat_field_correct_task_finalize (GObject *object)
         priv->kernel = NULL;
     }
 
+    if (priv->reduce_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->reduce_kernel));
+        priv->reduce_kernel = NULL;
+    }
+
+    if (priv->prepare_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->prepare_kernel));
+        priv->prepare_kernel = NULL;
+    }
+
+    for (guint i = 0; i < 3; i++) {
+        if (priv->references[i]) {
+            UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->references[i]));
+            priv->references[i] = NULL;
+        }
+    }
+
+    if (priv->context) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_flat_field_correct_task_parent_class)->finalize (object);
 }
 
@@ -277,6 +553,27 @@ ufo_flat_field_correct_task_class_init (UfoFlatFieldCorrectTaskClass *klass)
             -G_MAXFLOAT, G_MAXFLOAT, 1.0f,
             G_PARAM_READWRITE);
 
+    properties[PROP_REDUCTION_MODE] =
+        g_param_spec_enum ("reduction-mode",
+            "Reduction of dark and flat stacks (none, mean, median)",
+            "Reduction of dark and flat stacks (none, mean, median)",
+            g_enum_register_static ("ffc-reduction", reduction_values),
+            REDUCTION_NONE, G_PARAM_READWRITE);
+
+    properties[PROP_INTERPOLATE_FLATS] =
+        g_param_spec_boolean ("interpolate-flats",
+            "Interpolate between the first and second half of the flat stack",
+            "Interpolate between the first and second half of the flat stack",
+            FALSE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_NUM_PROJECTIONS] =
+        g_param_spec_uint ("num-projections",
+            "Number of projections used for flat interpolation",
+            "Number of projections used for flat interpolation",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -292,4 +589,14 @@ ufo_flat_field_correct_task_init(UfoFlatFieldCorrectTask *self)
     self->priv->sinogram_input = FALSE;
     self->priv->kernel = NULL;
     self->priv->dark_scale = 1.0f;
+    self->priv->reduction = REDUCTION_NONE;
+    self->priv->interpolate_flats = FALSE;
+    self->priv->num_projections = 0;
+    self->priv->current = 0;
+    self->priv->context = NULL;
+    self->priv->reduce_kernel = NULL;
+    self->priv->prepare_kernel = NULL;
+
+    for (guint i = 0; i < 3; i++)
+        self->priv->references[i] = NULL;
 }
@@ -112,11 +112,13 @@ ufo_flatten_inplace_task_process (UfoTask *task,
 
     switch (priv->mode) {
         case MODE_SUM:
+#pragma omp parallel for simd
             for (gsize i = 0; i < n_pixels; i++)
                 out_array[i] += in_array[i];
             break;
 
         case MODE_MIN:
+#pragma omp parallel for simd
             for (gsize i = 0; i < n_pixels; i++) {
                 if (in_array[i] < out_array[i])
                     out_array[i] = in_array[i];
@@ -124,6 +126,7 @@ ufo_flatten_inplace_task_process (UfoTask *task,
             break;
 
         case MODE_MAX:
+#pragma omp parallel for simd
             for (gsize i = 0; i < n_pixels; i++) {
                 if (in_array[i] > out_array[i])
                     out_array[i] = in_array[i];
@@ -35,6 +35,7 @@
 #include "common/ufo-scarray.h"
 #include "common/ufo-ctgeometry.h"
 #include "common/ufo-addressing.h"
+#include "common/ufo-tuning.h"
 #include "ufo-general-backproject-task.h"
 
 #define NUM_VECTOR_ARGUMENTS 11
@@ -44,7 +45,8 @@
 #define REGION_SIZE(region) ((ufo_scarray_get_int ((region), 2)) == 0) ? 0 : \
                             ((ufo_scarray_get_int ((region), 1) - ufo_scarray_get_int ((region), 0) - 1) /\
                             ufo_scarray_get_int ((region), 2) + 1)
-#define NEXT_DIVISOR(dividend, divisor) ((dividend) + (divisor) - (dividend) % (divisor))
+/* Number of slices the work group candidates are timed on */
+#define TUNING_DEPTH 32
 #define DEFINE_FILL_SINCOS(type)                      \
 static void                                           \
 fill_sincos_##type (type *array, const gdouble angle) \
@@ -83,6 +85,16 @@ create_regions_##type (UfoGeneralBackprojectTaskPrivate *priv,
                 region_values[2 * j] = (type) value;                                  \
             }                                                                         \
         }                                                                             \
+        if (priv->cl_regions[i]) {                                                    \
+            /* Next volume tile, reuse the buffers */                                 \
+            UFO_RESOURCES_CHECK_CLERR (clEnqueueWriteBuffer (cmd_queue,               \
+                                                             priv->cl_regions[i],     \
+                                                             CL_TRUE, 0,              \
+                                                             region_size,             \
+                                                             region_values,           \
+                                                             0, NULL, NULL));         \
+            continue;                                                                 \
+        }                                                                             \
         priv->cl_regions[i] = clCreateBuffer (priv->context,                          \
                                               CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,\
                                               region_size,                            \
@@ -398,6 +410,8 @@ struct _UfoGeneralBackprojectTaskPrivate {
     StoreType store_type;
     UfoUniRecoParameter parameter;
     gdouble gray_map_min, gray_map_max;
+    gboolean kernel_cache;
+    gboolean split_devices;
     /* Private */
     gboolean vectorized;
     guint generated;
@@ -406,6 +420,17 @@ struct _UfoGeneralBackprojectTaskPrivate {
     cl_mem *chunks;
     cl_mem *cl_regions, *vector_arguments;
     guint num_slices, num_slices_per_chunk, num_chunks;
+    /* Volume tiles, more than one if the volume doesn't fit to device memory */
+    guint num_slices_per_tile, num_tiles, current_tile;
+    /* Local work size tuned for the device */
+    UfoTuningParameters tuning;
+    gboolean tuned;
+    gdouble region_start, region_step;
+    gfloat *host_projections;
+    gsize projection_width, projection_height, projection_size;
+    /* Command queues the chunks are distributed over, the first one is ours */
+    cl_command_queue *cmd_queues;
+    guint num_cmd_queues;
     guint num_projections;
     gdouble overall_angle;
     AddressingMode addressing_mode;
@@ -457,6 +482,8 @@ enum {
     PROP_ADDRESSING_MODE,
     PROP_GRAY_MAP_MIN,
     PROP_GRAY_MAP_MAX,
+    PROP_KERNEL_CACHE,
+    PROP_SPLIT_DEVICES,
     N_PROPERTIES
 };
 
@@ -1250,6 +1277,168 @@ copy_to_image (const cl_command_queue cmd_queue,
     UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
 }
 
+/*{{{ Kernel binary cache*/
+/*
+ * Compiled programs are stored in the user cache directory under a hash of the
+ * generated source, compiler options and device, so that subsequent runs can
+ * skip the compilation.
+ */
+static gchar *
+get_cache_filename (cl_device_id device, const gchar *source, const gchar *options)
+{
+    GChecksum *checksum;
+    gchar *filename, *path;
+    const cl_device_info device_params[] = {CL_DEVICE_NAME, CL_DEVICE_VENDOR,
+                                            CL_DEVICE_VERSION, CL_DRIVER_VERSION};
+
+    checksum = g_checksum_new (G_CHECKSUM_SHA256);
+    g_checksum_update (checksum, (const guchar *) source, strlen (source) + 1);
+    g_checksum_update (checksum, (const guchar *) (options ? options : ""), strlen (options ? options : "") + 1);
+
+    for (guint i = 0; i < G_N_ELEMENTS (device_params); i++) {
+        gsize size;
+        gchar *value;
+
+        UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, device_params[i], 0, NULL, &size));
+        value = g_malloc0 (size);
+        UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, device_params[i], size, value, NULL));
+        g_checksum_update (checksum, (const guchar *) value, size);
+        g_free (value);
+    }
+
+    filename = g_strdup_printf ("%s.bin", g_checksum_get_string (checksum));
+    path = g_build_filename (g_get_user_cache_dir (), "ufo", "general-backproject", filename, NULL);
+    g_checksum_free (checksum);
+    g_free (filename);
+
+    return path;
+}
+
+static cl_kernel
+load_cached_kernel (cl_context context, cl_device_id device, const gchar *path, const gchar *options)
+{
+    cl_program program;
+    cl_kernel kernel;
+    cl_int error, status;
+    gchar *binary;
+    gsize size;
+
+    if (!g_file_get_contents (path, &binary, &size, NULL)) {
+        return NULL;
+    }
+
+    program = clCreateProgramWithBinary (context, 1, &device, &size, (const guchar **) &binary, &status, &error);
+    g_free (binary);
+
+    if (error != CL_SUCCESS || status != CL_SUCCESS) {
+        if (program) {
+            clReleaseProgram (program);
+        }
+        return NULL;
+    }
+
+    if (clBuildProgram (program, 1, &device, options, NULL, NULL) != CL_SUCCESS) {
+        clReleaseProgram (program);
+        return NULL;
+    }
+
+    kernel = clCreateKernel (program, "backproject", &error);
+    UFO_RESOURCES_CHECK_CLERR (clReleaseProgram (program));
+
+    return error == CL_SUCCESS ? kernel : NULL;
+}
+
+static void
+store_kernel_binary (cl_kernel kernel, cl_device_id device, const gchar *path)
+{
+    cl_program program;
+    cl_uint num_devices;
+    cl_device_id *devices;
+    gsize *sizes;
+    guchar **binaries;
+    gchar *dirname;
+    GError *error = NULL;
+
+    UFO_RESOURCES_CHECK_CLERR (clGetKernelInfo (kernel, CL_KERNEL_PROGRAM, sizeof (cl_program), &program, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_NUM_DEVICES, sizeof (cl_uint), &num_devices, NULL));
+    devices = g_new0 (cl_device_id, num_devices);
+    sizes = g_new0 (gsize, num_devices);
+    binaries = g_new0 (guchar *, num_devices);
+    UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_DEVICES, num_devices * sizeof (cl_device_id), devices, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_BINARY_SIZES, num_devices * sizeof (gsize), sizes, NULL));
+
+    for (guint i = 0; i < num_devices; i++) {
+        binaries[i] = g_malloc (sizes[i]);
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clGetProgramInfo (program, CL_PROGRAM_BINARIES, num_devices * sizeof (guchar *), binaries, NULL));
+    dirname = g_path_get_dirname (path);
+
+    for (guint i = 0; i < num_devices; i++) {
+        if (devices[i] != device || sizes[i] == 0) {
+            continue;
+        }
+        /* g_file_set_contents replaces the file atomically, so concurrent
+         * processes never see a partial binary */
+        if (g_mkdir_with_parents (dirname, 0755) || !g_file_set_contents (path, (const gchar *) binaries[i], sizes[i], &error)) {
+            g_log ("gbp", G_LOG_LEVEL_DEBUG, "Could not cache kernel binary in %s", path);
+            g_clear_error (&error);
+        }
+    }
+
+    for (guint i = 0; i < num_devices; i++) {
+        g_free (binaries[i]);
+    }
+    g_free (dirname);
+    g_free (binaries);
+    g_free (sizes);
+    g_free (devices);
+}
+
+/*
+ * Return a new reference to the backproject kernel built from *source*, either
+ * from the binary cache or compiled by the resources.
+ */
+static cl_kernel
+get_kernel (UfoGeneralBackprojectTaskPrivate *priv,
+            UfoGpuNode *node,
+            const gchar *source,
+            const gchar *options)
+{
+    cl_kernel kernel;
+    cl_device_id device;
+    gchar *path;
+
+    /* Cached binaries are built for one device only */
+    if (!priv->kernel_cache || priv->num_cmd_queues > 1) {
+        kernel = ufo_resources_get_kernel_from_source (priv->resources, source, "backproject", options, NULL);
+        if (kernel) {
+            UFO_RESOURCES_CHECK_CLERR (clRetainKernel (kernel));
+        }
+        return kernel;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (ufo_gpu_node_get_cmd_queue (node), CL_QUEUE_DEVICE,
+                                                      sizeof (cl_device_id), &device, NULL));
+    path = get_cache_filename (device, source, options);
+
+    if ((kernel = load_cached_kernel (priv->context, device, path, options)) != NULL) {
+        g_log ("gbp", G_LOG_LEVEL_DEBUG, "Loaded kernel binary from %s", path);
+        g_free (path);
+        return kernel;
+    }
+
+    kernel = ufo_resources_get_kernel_from_source (priv->resources, source, "backproject", options, NULL);
+    if (kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (kernel));
+        store_kernel_binary (kernel, device, path);
+    }
+    g_free (path);
+
+    return kernel;
+}
+/*}}}*/
+
 static void
 node_setup (UfoGeneralBackprojectTaskPrivate *priv,
             UfoGpuNode *node)
@@ -1336,11 +1525,7 @@ node_setup (UfoGeneralBackprojectTaskPrivate *priv,
         g_free (compiler_options);
         return;
     }
-    priv->kernel = ufo_resources_get_kernel_from_source (priv->resources,
-                                                         kernel_code,
-                                                         "backproject",
-                                                         compiler_options,
-                                                         NULL);
+    priv->kernel = get_kernel (priv, node, kernel_code, compiler_options);
     g_free (kernel_code);
 
     if (priv->num_projections % priv->burst) {
@@ -1358,22 +1543,283 @@ node_setup (UfoGeneralBackprojectTaskPrivate *priv,
         }
 
         /* If num_projections % priv->burst != 0 we need one more kernel to process the remaining projections */
-        priv->rest_kernel = ufo_resources_get_kernel_from_source (priv->resources,
-                                                                  kernel_code,
-                                                                  "backproject",
-                                                                  compiler_options,
-                                                                  NULL);
+        priv->rest_kernel = get_kernel (priv, node, kernel_code, compiler_options);
         /* g_printf ("%s", kernel_code); */
         g_free (kernel_code);
     }
     g_free (template);
     g_free (compiler_options);
+}
+/*}}}*/
 
-    if (priv->kernel) {
-        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->kernel));
+/*{{{ Volume tiling and device split */
+/*
+ * Collect the command queues the volume chunks are distributed over. Our own
+ * queue always comes first, the queues of the other GPUs in the context follow
+ * if splitting is enabled.
+ */
+static void
+setup_cmd_queues (UfoGeneralBackprojectTaskPrivate *priv, UfoTask *task, UfoResources *resources)
+{
+    UfoGpuNode *node;
+    GList *queues, *it;
+    cl_command_queue own_queue;
+
+    node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
+    own_queue = ufo_gpu_node_get_cmd_queue (node);
+    queues = priv->split_devices ? ufo_resources_get_cmd_queues (resources) : NULL;
+
+    g_free (priv->cmd_queues);
+    priv->cmd_queues = g_new0 (cl_command_queue, g_list_length (queues) + 1);
+    priv->cmd_queues[0] = own_queue;
+    priv->num_cmd_queues = 1;
+
+    for (it = queues; it != NULL; it = g_list_next (it)) {
+        if (it->data != own_queue) {
+            priv->cmd_queues[priv->num_cmd_queues++] = (cl_command_queue) it->data;
+        }
     }
-    if (priv->rest_kernel) {
-        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->rest_kernel));
+
+    g_list_free (queues);
+    g_log ("gbp", G_LOG_LEVEL_DEBUG, "Splitting volume over %u command queues", priv->num_cmd_queues);
+}
+
+/*
+ * Smallest global memory and maximum allocation size over all devices we
+ * distribute the volume to.
+ */
+static void
+get_device_memory_sizes (UfoGeneralBackprojectTaskPrivate *priv, cl_ulong *global_mem_size, cl_ulong *max_mem_alloc_size)
+{
+    cl_device_id device;
+    cl_ulong value;
+    guint i;
+
+    *global_mem_size = G_MAXUINT64;
+    *max_mem_alloc_size = G_MAXUINT64;
+
+    for (i = 0; i < priv->num_cmd_queues; i++) {
+        UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (priv->cmd_queues[i], CL_QUEUE_DEVICE,
+                                                          sizeof (cl_device_id), &device, NULL));
+        UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, CL_DEVICE_GLOBAL_MEM_SIZE,
+                                                    sizeof (cl_ulong), &value, NULL));
+        *global_mem_size = MIN (*global_mem_size, value);
+        UFO_RESOURCES_CHECK_CLERR (clGetDeviceInfo (device, CL_DEVICE_MAX_MEM_ALLOC_SIZE,
+                                                    sizeof (cl_ulong), &value, NULL));
+        *max_mem_alloc_size = MIN (*max_mem_alloc_size, value);
+    }
+}
+
+/*
+ * Select the kernel for projection *count* and set its rotation angle argument.
+ * *burst* is set to the number of projections the kernel processes at once and
+ * *index* to the position of this projection within the burst.
+ */
+static cl_kernel
+set_projection_angle (UfoGeneralBackprojectTaskPrivate *priv, guint count, guint *burst, guint *index)
+{
+    cl_kernel kernel;
+    gdouble rot_angle;
+    cl_float f_tomo_angle[2];
+    cl_double d_tomo_angle[2];
+    guint ki;
+
+    if (count >= priv->num_projections / priv->burst * priv->burst) {
+        kernel = priv->rest_kernel;
+        *burst = priv->num_projections % priv->burst;
+        *index = (count - priv->num_projections / priv->burst * priv->burst) % *burst;
+    } else {
+        kernel = priv->kernel;
+        *burst = priv->burst;
+        *index = count % *burst;
+    }
+
+    /* Setup tomographic rotation angle dependent arguments */
+    ki = STATIC_ARG_OFFSET + *burst;
+    rot_angle = ufo_scarray_get_double (priv->geometry->axis->angle->z, count);
+    if (priv->compute_type == CT_FLOAT) {
+        fill_sincos_cl_float (f_tomo_angle, rot_angle);
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki + *index, sizeof (cl_float2), f_tomo_angle));
+    } else {
+        fill_sincos_cl_double (d_tomo_angle, rot_angle);
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki + *index, sizeof (cl_double2), d_tomo_angle));
+    }
+
+    return kernel;
+}
+
+typedef struct {
+    cl_command_queue cmd_queue;
+    cl_kernel kernel;
+    gsize dims[3];
+} TuningData;
+
+static gboolean
+run_candidate (const UfoTuningParameters *parameters, gpointer user_data)
+{
+    TuningData *data = (TuningData *) user_data;
+    gsize global_work_size[3];
+
+    ufo_tuning_get_global_work_size (parameters, 3, data->dims, global_work_size);
+
+    return clEnqueueNDRangeKernel (data->cmd_queue, data->kernel, 3, NULL, global_work_size,
+                                   ufo_tuning_get_local_work_size (parameters),
+                                   0, NULL, NULL) == CL_SUCCESS;
+}
+
+/*
+ * Find the local work size either in the device profile or by timing the
+ * candidates on the first TUNING_DEPTH slices of the first chunk. *kernel* must
+ * be set up for the first burst, which overwrites the chunk anyway. The burst
+ * itself is part of the generated code and stays as configured. The generated
+ * code also depends on the data types and the reconstructed parameter, each
+ * variant is tuned separately.
+ */
+static void
+tune (UfoGeneralBackprojectTaskPrivate *priv, cl_kernel kernel, guint burst, guint ki,
+      UfoRequisition *requisition)
+{
+    TuningData data;
+    GArray *candidates;
+    gint real_size[4];
+    gchar *name;
+
+    name = g_strdup_printf ("general-backproject-%u-%s-%s-%s-%s", burst,
+                            compute_type_values[priv->compute_type].value_nick,
+                            ft_values[priv->result_type].value_nick,
+                            st_values[priv->store_type].value_nick,
+                            parameter_values[priv->parameter].value_nick);
+
+    if (!ufo_tuning_lookup (priv->cmd_queues[0], name, &priv->tuning) ||
+        !ufo_tuning_fits_kernel (priv->cmd_queues[0], kernel, &priv->tuning)) {
+        data.cmd_queue = priv->cmd_queues[0];
+        data.kernel = kernel;
+        data.dims[0] = requisition->dims[0];
+        data.dims[1] = requisition->dims[1];
+        data.dims[2] = MIN (MIN (priv->num_slices, priv->num_slices_per_chunk), TUNING_DEPTH);
+        real_size[0] = (gint) data.dims[0];
+        real_size[1] = (gint) data.dims[1];
+        real_size[2] = (gint) data.dims[2];
+        real_size[3] = 0;
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, REAL_SIZE_ARG_INDEX, sizeof (cl_int3), real_size));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki, sizeof (cl_mem), &priv->chunks[0]));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki + 1, sizeof (cl_mem), &priv->cl_regions[0]));
+        candidates = ufo_tuning_candidates_new (data.cmd_queue, 3, NULL, NULL, 0, NULL, 0);
+
+        if (!ufo_tuning_search (data.cmd_queue, name, candidates,
+                                run_candidate, &data, &priv->tuning)) {
+            memset (&priv->tuning, 0, sizeof (UfoTuningParameters));
+            priv->tuning.local_work_size[0] = 16;
+            priv->tuning.local_work_size[1] = 8;
+            priv->tuning.local_work_size[2] = 8;
+        }
+
+        g_array_free (candidates, TRUE);
+    }
+
+    g_free (name);
+}
+
+/*
+ * Backproject the last *burst* projections ending with projection *count* into
+ * all chunks of the current tile. Chunk i is computed on command queue
+ * i mod num_cmd_queues, all queues are finished before returning because the
+ * projection images are overwritten by the next burst.
+ */
+static void
+backproject_burst (UfoTask *task, cl_kernel kernel, guint burst, guint count, UfoRequisition *requisition)
+{
+    UfoGeneralBackprojectTaskPrivate *priv;
+    UfoProfiler *profiler;
+    cl_command_queue cmd_queue;
+    guint i, ki, first_slice, tile_end;
+    cl_int iteration;
+    const gsize *local_work_size;
+    gsize dims[3], global_work_size[3];
+    gint real_size[4];
+
+    priv = UFO_GENERAL_BACKPROJECT_TASK_GET_PRIVATE (task);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+    iteration = (cl_int) (count + 1 - burst);
+    ki = STATIC_ARG_OFFSET + 2 * burst;
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki++, sizeof (cl_int), &iteration));
+
+    if (!priv->tuned) {
+        tune (priv, kernel, burst, ki, requisition);
+        priv->tuned = TRUE;
+    }
+
+    dims[0] = requisition->dims[0];
+    dims[1] = requisition->dims[1];
+    dims[2] = priv->num_slices_per_chunk;
+    ufo_tuning_get_global_work_size (&priv->tuning, 3, dims, global_work_size);
+    local_work_size = ufo_tuning_get_local_work_size (&priv->tuning);
+    real_size[0] = requisition->dims[0];
+    real_size[1] = requisition->dims[1];
+    real_size[3] = 0;
+    if (!iteration) {
+        g_log ("gbp", G_LOG_LEVEL_DEBUG, "Global work size: %lu %lu %lu, local: %lu %lu %lu",
+               global_work_size[0], global_work_size[1], global_work_size[2],
+               priv->tuning.local_work_size[0], priv->tuning.local_work_size[1],
+               priv->tuning.local_work_size[2]);
+    }
+
+    tile_end = MIN (priv->num_slices, (priv->current_tile + 1) * priv->num_slices_per_tile);
+
+    for (i = 0; i < priv->num_chunks; i++) {
+        first_slice = priv->current_tile * priv->num_slices_per_tile + i * priv->num_slices_per_chunk;
+        if (first_slice >= tile_end) {
+            /* The last tile might be smaller */
+            break;
+        }
+        /* The last chunk might be smaller */
+        real_size[2] = (gint) (MIN (tile_end, first_slice + priv->num_slices_per_chunk) - first_slice);
+        cmd_queue = priv->cmd_queues[i % priv->num_cmd_queues];
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, REAL_SIZE_ARG_INDEX, sizeof (cl_int3), real_size));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki, sizeof (cl_mem), &priv->chunks[i]));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki + 1, sizeof (cl_mem), &priv->cl_regions[i]));
+        ufo_profiler_call (profiler, cmd_queue, kernel, 3, global_work_size, local_work_size);
+    }
+
+    for (i = 0; i < priv->num_cmd_queues; i++) {
+        UFO_RESOURCES_CHECK_CLERR (clFinish (priv->cmd_queues[i]));
+    }
+}
+
+/*
+ * Reconstruct the next volume tile from the projections kept in host memory.
+ */
+static void
+backproject_next_tile (UfoTask *task, UfoRequisition *requisition)
+{
+    UfoGeneralBackprojectTaskPrivate *priv;
+    cl_kernel kernel;
+    guint count, burst, index;
+    const size_t origin[] = {0, 0, 0};
+    size_t region[3] = {0, 0, 1};
+    typedef void (*CreateRegionFunc) (UfoGeneralBackprojectTaskPrivate *, const cl_command_queue,
+                                      const gdouble, const gdouble);
+    CreateRegionFunc create_regions[2] = {create_regions_cl_float, create_regions_cl_double};
+
+    priv = UFO_GENERAL_BACKPROJECT_TASK_GET_PRIVATE (task);
+    region[0] = priv->projection_width;
+    region[1] = priv->projection_height;
+    priv->current_tile++;
+    g_log ("gbp", G_LOG_LEVEL_DEBUG, "Reconstructing tile %u of %u", priv->current_tile + 1, priv->num_tiles);
+    create_regions[priv->compute_type] (priv, priv->cmd_queues[0],
+                                        priv->region_start +
+                                        priv->current_tile * priv->num_slices_per_tile * priv->region_step,
+                                        priv->region_step);
+
+    for (count = 0; count < priv->num_projections; count++) {
+        kernel = set_projection_angle (priv, count, &burst, &index);
+        UFO_RESOURCES_CHECK_CLERR (clEnqueueWriteImage (priv->cmd_queues[0], priv->projections[index],
+                                                        CL_TRUE, origin, region, 0, 0,
+                                                        priv->host_projections + count * priv->projection_size,
+                                                        0, NULL, NULL));
+        if (index + 1 == burst) {
+            backproject_burst (task, kernel, burst, count, requisition);
+        }
     }
 }
 /*}}}*/
@@ -1400,6 +1846,7 @@ ufo_general_backproject_task_setup (UfoTask *task,
     priv->chunks = NULL;
     priv->cl_regions = NULL;
     priv->vector_arguments = NULL;
+    priv->host_projections = NULL;
 
     /* Check parameter values */
     if (!priv->num_projections) {
@@ -1435,6 +1882,7 @@ ufo_general_backproject_task_setup (UfoTask *task,
     UFO_RESOURCES_CHECK_CLERR (clRetainContext (priv->context));
     priv->sampler = clCreateSampler (priv->context, (cl_bool) FALSE, priv->addressing_mode, CL_FILTER_LINEAR, &cl_error);
     UFO_RESOURCES_CHECK_CLERR (cl_error);
+    setup_cmd_queues (priv, task, resources);
 }
 
 static void
@@ -1448,9 +1896,8 @@ ufo_general_backproject_task_get_requisition (UfoTask *task,
     cl_command_queue cmd_queue;
     UfoRequisition in_req;
     gdouble region_start, region_stop, region_step;
-    gsize slice_size, chunk_size, volume_size, projections_size;
-    GValue *max_global_mem_size_gvalue, *max_mem_alloc_size_gvalue;
-    cl_ulong max_global_mem_size, max_mem_alloc_size;
+    gsize slice_size, chunk_size, volume_size, projections_size, reserved_size;
+    cl_ulong max_global_mem_size, max_mem_alloc_size, device_volume_size;
     cl_int cl_error;
     guint i;
     typedef void (*CreateRegionFunc) (UfoGeneralBackprojectTaskPrivate *, const cl_command_queue,
@@ -1503,37 +1950,65 @@ ufo_general_backproject_task_get_requisition (UfoTask *task,
         }
         g_log ("gbp", G_LOG_LEVEL_DEBUG, "region: %g %g %g", region_start, region_stop, region_step);
         priv->num_slices = (gsize) ceil ((region_stop - region_start) / region_step);
-        max_global_mem_size_gvalue = ufo_gpu_node_get_info (node, UFO_GPU_NODE_INFO_GLOBAL_MEM_SIZE);
-        max_global_mem_size = g_value_get_ulong (max_global_mem_size_gvalue);
-        g_value_unset (max_global_mem_size_gvalue);
-        projections_size = priv->burst * in_req.dims[0] * in_req.dims[1] * sizeof (cl_float);
+        priv->region_start = region_start;
+        priv->region_step = region_step;
+        get_device_memory_sizes (priv, &max_global_mem_size, &max_mem_alloc_size);
+        priv->projection_width = in_req.dims[0];
+        priv->projection_height = in_req.dims[1];
+        priv->projection_size = in_req.dims[0] * in_req.dims[1];
+        projections_size = priv->burst * priv->projection_size * sizeof (cl_float);
         slice_size = requisition->dims[0] * requisition->dims[1] * get_type_size (priv->store_type);
         volume_size = slice_size * priv->num_slices;
-        max_mem_alloc_size_gvalue = ufo_gpu_node_get_info (node, UFO_GPU_NODE_INFO_MAX_MEM_ALLOC_SIZE);
-        max_mem_alloc_size = g_value_get_ulong (max_mem_alloc_size_gvalue);
-        g_value_unset (max_mem_alloc_size_gvalue);
-        priv->num_slices_per_chunk = (guint) floor ((gdouble) MIN (max_mem_alloc_size, volume_size) / ((gdouble) slice_size));
-        if (projections_size + volume_size > max_global_mem_size) {
+        /* Leave room for the projection images and our input and output buffers */
+        reserved_size = projections_size + priv->projection_size * sizeof (cl_float) + slice_size;
+        if (reserved_size + slice_size > max_global_mem_size || slice_size > max_mem_alloc_size) {
             g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
-                                 "Volume size doesn't fit to memory");
+                                 "Slice size doesn't fit to memory");
             return;
         }
-
-        priv->projections = (cl_mem *) g_malloc (priv->burst * sizeof (cl_mem));
-        /* Create subvolumes (because one large volume might be larger than the maximum allocatable memory chunk */
-        priv->num_chunks = (priv->num_slices - 1) / priv->num_slices_per_chunk + 1;
+        device_volume_size = max_global_mem_size - reserved_size;
+
+        /* Create subvolumes (because one large volume might be larger than the
+         * maximum allocatable memory chunk), make sure every device gets at
+         * least one */
+        priv->num_slices_per_chunk = (guint) (MIN (max_mem_alloc_size, device_volume_size) / slice_size);
+        priv->num_slices_per_chunk = MIN (priv->num_slices_per_chunk,
+                                          (priv->num_slices - 1) / priv->num_cmd_queues + 1);
         chunk_size = priv->num_slices_per_chunk * slice_size;
+
+        /* Reconstruct as many chunks at once as fit to the devices, the rest
+         * of the volume is reconstructed tile by tile after all projections
+         * arrived */
+        priv->num_slices_per_tile = (guint) MIN (priv->num_slices,
+                                                 device_volume_size / chunk_size *
+                                                 priv->num_cmd_queues * priv->num_slices_per_chunk);
+        priv->num_chunks = (priv->num_slices_per_tile - 1) / priv->num_slices_per_chunk + 1;
+        priv->num_tiles = (priv->num_slices - 1) / priv->num_slices_per_tile + 1;
+        priv->current_tile = 0;
         g_log ("gbp", G_LOG_LEVEL_DEBUG, "Max alloc size: %lu, max global size: %lu", max_mem_alloc_size, max_global_mem_size);
         g_log ("gbp", G_LOG_LEVEL_DEBUG, "Num chunks: %d, chunk size: %lu, num slices per chunk: %u",
                priv->num_chunks, chunk_size, priv->num_slices_per_chunk);
-        g_log ("gbp", G_LOG_LEVEL_DEBUG, "Volume size: %lu, num slices: %u", volume_size, priv->num_slices);
+        g_log ("gbp", G_LOG_LEVEL_DEBUG, "Volume size: %lu, num slices: %u, num tiles: %u",
+               volume_size, priv->num_slices, priv->num_tiles);
+
+        if (priv->num_tiles > 1) {
+            /* Projections are needed again for the subsequent tiles */
+            priv->host_projections = g_try_malloc (priv->num_projections * priv->projection_size * sizeof (gfloat));
+            if (!priv->host_projections) {
+                g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
+                                     "Volume size doesn't fit to device memory and projections not to host memory");
+                return;
+            }
+        }
+
+        priv->projections = (cl_mem *) g_malloc (priv->burst * sizeof (cl_mem));
         priv->chunks = (cl_mem *) g_malloc (priv->num_chunks * sizeof (cl_mem));
         if (!priv->chunks) {
             g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
                                  "Error allocating volume chunks");
             return;
         }
-        priv->cl_regions = (cl_mem *) g_malloc (priv->num_chunks * sizeof (cl_mem));
+        priv->cl_regions = (cl_mem *) g_malloc0 (priv->num_chunks * sizeof (cl_mem));
         if (!priv->cl_regions) {
             g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
                                  "Error allocating volume chunks");
@@ -1541,10 +2016,10 @@ ufo_general_backproject_task_get_requisition (UfoTask *task,
         }
         for (i = 0; i < priv->num_chunks; i++) {
             g_log ("gbp", G_LOG_LEVEL_DEBUG, "Creating chunk %d with size %lu",
-                   i, MIN (volume_size, (i + 1) * chunk_size) - i * chunk_size);
+                   i, MIN (priv->num_slices_per_tile * slice_size, (i + 1) * chunk_size) - i * chunk_size);
             priv->chunks[i] = clCreateBuffer (priv->context,
                                               CL_MEM_WRITE_ONLY,
-                                              MIN (volume_size, (i + 1) * chunk_size) - i * chunk_size,
+                                              MIN (priv->num_slices_per_tile * slice_size, (i + 1) * chunk_size) - i * chunk_size,
                                               NULL,
                                               &cl_error);
             UFO_RESOURCES_CHECK_CLERR (cl_error);
@@ -1590,18 +2065,9 @@ ufo_general_backproject_task_process (UfoTask *task,
     UfoGeneralBackprojectTaskPrivate *priv;
     UfoRequisition in_req;
     UfoGpuNode *node;
-    UfoProfiler *profiler;
-    guint i, index, ki;
-    guint count, burst, num_slices_current_chunk;
+    guint index, count, burst;
     cl_kernel kernel;
     cl_command_queue cmd_queue;
-    gdouble rot_angle;
-    cl_float f_tomo_angle[2];
-    cl_double d_tomo_angle[2];
-    cl_int iteration;
-    const gsize local_work_size[3] = {16, 8, 8};
-    gsize global_work_size[3];
-    gint real_size[4];
 
     priv = UFO_GENERAL_BACKPROJECT_TASK_GET_PRIVATE (task);
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
@@ -1609,60 +2075,18 @@ ufo_general_backproject_task_process (UfoTask *task,
     ufo_buffer_get_requisition (inputs[0], &in_req);
     g_object_get (task, "num_processed", &count, NULL);
 
-    if (count >= priv->num_projections / priv->burst * priv->burst) {
-        kernel = priv->rest_kernel;
-        burst = priv->num_projections % priv->burst;
-        index = (count - priv->num_projections / priv->burst * priv->burst) % burst;
-    } else {
-        kernel = priv->kernel;
-        burst = priv->burst;
-        index = count % burst;
-    }
-
-    global_work_size[0] = requisition->dims[0] % local_work_size[0] ?
-                          NEXT_DIVISOR (requisition->dims[0], local_work_size[0]) :
-                          requisition->dims[0];
-    global_work_size[1] = requisition->dims[1] % local_work_size[1] ?
-                          NEXT_DIVISOR (requisition->dims[1], local_work_size[1]) :
-                          requisition->dims[1];
-    global_work_size[2] = priv->num_slices_per_chunk % local_work_size[2] ?
-                          NEXT_DIVISOR (priv->num_slices_per_chunk, local_work_size[2]) :
-                          priv->num_slices_per_chunk;
-    real_size[0] = requisition->dims[0];
-    real_size[1] = requisition->dims[1];
-    real_size[3] = 0;
-    if (!count) {
-        g_log ("gbp", G_LOG_LEVEL_DEBUG, "Global work size: %lu %lu %lu, local: %lu %lu %lu",
-               global_work_size[0], global_work_size[1], global_work_size[2],
-               local_work_size[0], local_work_size[1], local_work_size[2]);
-    }
+    kernel = set_projection_angle (priv, count, &burst, &index);
+    copy_to_image (cmd_queue, inputs[0], priv->projections[index], in_req.dims[0], in_req.dims[1]);
 
-    /* Setup tomographic rotation angle dependent arguments */
-    ki = STATIC_ARG_OFFSET + burst;
-    rot_angle = ufo_scarray_get_double (priv->geometry->axis->angle->z, count);
-    if (priv->compute_type == CT_FLOAT) {
-        fill_sincos_cl_float (f_tomo_angle, rot_angle);
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki + index, sizeof (cl_float2), f_tomo_angle));
-    } else {
-        fill_sincos_cl_double (d_tomo_angle, rot_angle);
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki + index, sizeof (cl_double2), d_tomo_angle));
+    if (priv->host_projections) {
+        /* The first tile is reconstructed right away, keep the projection for the others */
+        memcpy (priv->host_projections + count * priv->projection_size,
+                ufo_buffer_get_host_array (inputs[0], NULL),
+                priv->projection_size * sizeof (gfloat));
     }
-    copy_to_image (cmd_queue, inputs[0], priv->projections[index], in_req.dims[0], in_req.dims[1]);
 
     if (index + 1 == burst) {
-        profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-        ki += index + 1;
-        iteration = (cl_int) (count + 1 - burst);
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki++, sizeof (cl_int), &iteration));
-        for (i = 0; i < priv->num_chunks; i++) {
-            /* The last chunk might be smaller */
-            num_slices_current_chunk = MIN (priv->num_slices,  (i + 1) * priv->num_slices_per_chunk) - i * priv->num_slices_per_chunk;
-            real_size[2] = (gint) num_slices_current_chunk;
-            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, REAL_SIZE_ARG_INDEX, sizeof (cl_int3), real_size));
-            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki, sizeof (cl_mem), &priv->chunks[i]));
-            UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, ki + 1, sizeof (cl_mem), &priv->cl_regions[i]));
-            ufo_profiler_call_blocking (profiler, cmd_queue, kernel, 3, global_work_size, local_work_size);
-        }
+        backproject_burst (task, kernel, burst, count, requisition);
     }
 
     return TRUE;
@@ -1677,7 +2101,7 @@ ufo_general_backproject_task_generate (UfoTask *task,
     UfoGpuNode *node;
     cl_command_queue cmd_queue;
     cl_mem out_mem;
-    guint count, chunk_index;
+    guint count, chunk_index, tile_slice;
     /* TODO: handle other data types */
     size_t bpp;
     size_t src_row_pitch, src_slice_pitch;
@@ -1688,8 +2112,6 @@ ufo_general_backproject_task_generate (UfoTask *task,
     priv = UFO_GENERAL_BACKPROJECT_TASK_GET_PRIVATE (task);
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
     cmd_queue = ufo_gpu_node_get_cmd_queue (node);
-    out_mem = ufo_buffer_get_device_array (output, cmd_queue);
-    chunk_index = priv->generated / priv->num_slices_per_chunk;
     bpp = get_type_size (priv->store_type);
     g_object_get (task, "num_processed", &count, NULL);
 
@@ -1698,9 +2120,17 @@ ufo_general_backproject_task_generate (UfoTask *task,
         return FALSE;
     }
 
+    if (priv->generated == (priv->current_tile + 1) * priv->num_slices_per_tile) {
+        /* Current tile has been sent, reconstruct the next one */
+        backproject_next_tile (task, requisition);
+    }
+
+    tile_slice = priv->generated - priv->current_tile * priv->num_slices_per_tile;
+    chunk_index = tile_slice / priv->num_slices_per_chunk;
+    out_mem = ufo_buffer_get_device_array (output, cmd_queue);
     src_row_pitch = requisition->dims[0] * bpp;
     src_slice_pitch = src_row_pitch * requisition->dims[1];
-    src_origin[2] = priv->generated % priv->num_slices_per_chunk;
+    src_origin[2] = tile_slice % priv->num_slices_per_chunk;
     region[0] = src_row_pitch;
     region[1] = requisition->dims[1];
     g_log ("gbp", G_LOG_LEVEL_DEBUG, "Generating slice %u from chunk %u", priv->generated + 1, chunk_index);
@@ -1708,12 +2138,17 @@ ufo_general_backproject_task_generate (UfoTask *task,
     g_log ("gbp", G_LOG_LEVEL_DEBUG, "region: %lu %lu %lu", region[0], region[1], region[2]);
     g_log ("gbp", G_LOG_LEVEL_DEBUG, "row pitch %lu, slice pitch %lu", src_row_pitch, src_slice_pitch);
 
+    /* Copy on the queue of the device which computed the chunk */
+    cmd_queue = priv->cmd_queues[chunk_index % priv->num_cmd_queues];
     UFO_RESOURCES_CHECK_CLERR (clEnqueueCopyBufferRect (cmd_queue,
                                                         priv->chunks[chunk_index], out_mem,
                                                         src_origin, dst_origin, region,
                                                         src_row_pitch, src_slice_pitch,
                                                         src_row_pitch, 0,
                                                         0, NULL, NULL));
+    if (cmd_queue != priv->cmd_queues[0]) {
+        UFO_RESOURCES_CHECK_CLERR (clFinish (cmd_queue));
+    }
 
     priv->generated++;
 
@@ -1823,6 +2258,12 @@ ufo_general_backproject_task_set_property (GObject *object,
         case PROP_GRAY_MAP_MAX:
             priv->gray_map_max = g_value_get_double (value);
             break;
+        case PROP_KERNEL_CACHE:
+            priv->kernel_cache = g_value_get_boolean (value);
+            break;
+        case PROP_SPLIT_DEVICES:
+            priv->split_devices = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -1928,6 +2369,12 @@ ufo_general_backproject_task_get_property (GObject *object,
         case PROP_GRAY_MAP_MAX:
             g_value_set_double (value, priv->gray_map_max);
             break;
+        case PROP_KERNEL_CACHE:
+            g_value_set_boolean (value, priv->kernel_cache);
+            break;
+        case PROP_SPLIT_DEVICES:
+            g_value_set_boolean (value, priv->split_devices);
+            break;
         case PROP_ADDRESSING_MODE:
             g_value_set_enum (value, priv->addressing_mode);
             break;
@@ -1979,6 +2426,11 @@ ufo_general_backproject_task_finalize (GObject *object)
         priv->cl_regions = NULL;
     }
 
+    g_free (priv->host_projections);
+    priv->host_projections = NULL;
+    g_free (priv->cmd_queues);
+    priv->cmd_queues = NULL;
+
     if (priv->vector_arguments) {
         for (i = 0; i < NUM_VECTOR_ARGUMENTS; i++) {
             UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->vector_arguments[i]));
@@ -2264,6 +2716,20 @@ ufo_general_backproject_task_class_init (UfoGeneralBackprojectTaskClass *klass)
             -G_MAXDOUBLE, G_MAXDOUBLE, 0,
             G_PARAM_READWRITE);
 
+    properties[PROP_KERNEL_CACHE] =
+        g_param_spec_boolean ("kernel-cache",
+            "Cache compiled kernels in the user cache directory",
+            "Cache compiled kernels in the user cache directory",
+            TRUE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_SPLIT_DEVICES] =
+        g_param_spec_boolean ("split-devices",
+            "Distribute the reconstructed slices over all GPUs",
+            "Distribute the reconstructed slices over all GPUs",
+            FALSE,
+            G_PARAM_READWRITE);
+
     properties[PROP_NUM_PROJECTIONS] =
         g_param_spec_uint ("num-projections",
             "Number of projections",
@@ -2294,6 +2760,8 @@ ufo_general_backproject_task_init(UfoGeneralBackprojectTask *self)
     self->priv->addressing_mode = CL_ADDRESS_CLAMP;
     self->priv->gray_map_min = 0.0;
     self->priv->gray_map_max = 0.0;
+    self->priv->kernel_cache = TRUE;
+    self->priv->split_devices = FALSE;
 
     /* Value arrays */
     self->priv->region = ufo_scarray_new (3, G_TYPE_DOUBLE, NULL);
@@ -2305,6 +2773,12 @@ ufo_general_backproject_task_init(UfoGeneralBackprojectTask *self)
     self->priv->vectorized = FALSE;
     self->priv->num_slices = 0;
     self->priv->num_slices_per_chunk = 0;
+    self->priv->num_tiles = 0;
+    self->priv->current_tile = 0;
+    self->priv->tuned = FALSE;
+    self->priv->host_projections = NULL;
+    self->priv->cmd_queues = NULL;
+    self->priv->num_cmd_queues = 0;
     self->priv->generated = 0;
 }
 /*}}}*/
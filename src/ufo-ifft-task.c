@@ -36,6 +36,7 @@ struct _UfoIfftTaskPrivate {
 
     gint crop_width;
     gint crop_height;
+    gboolean half_spectrum;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -51,6 +52,7 @@ enum {
     PROP_DIMENSIONS,
     PROP_CROP_WIDTH,
     PROP_CROP_HEIGHT,
+    PROP_HALF_SPECTRUM,
     N_PROPERTIES
 };
 
@@ -70,7 +72,9 @@ ufo_ifft_task_setup (UfoTask *task,
     UfoIfftTaskPrivate *priv;
 
     priv = UFO_IFFT_TASK_GET_PRIVATE (task);
-    priv->kernel = ufo_resources_get_kernel (resources, "fft.cl", "fft_pack", NULL, error);
+    priv->kernel = ufo_resources_get_kernel (resources, "fft.cl",
+                                             priv->half_spectrum ? "fft_pack_real" : "fft_pack",
+                                             NULL, error);
     priv->context = ufo_resources_get_context (resources);
 
     UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
@@ -98,17 +102,26 @@ ufo_ifft_task_get_requisition (UfoTask *task,
     priv = UFO_IFFT_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], &in_req);
 
-    priv->param.zeropad = FALSE;
-    priv->param.size[0] = in_req.dims[0] / 2;
+    if (priv->half_spectrum) {
+        /* transform in-place, the real result is stored with the row stride of the input */
+        priv->param.layout = UFO_FFT_LAYOUT_REAL;
+        priv->param.zeropad = TRUE;
+        priv->param.size[0] = 2 * (in_req.dims[0] / 2 - 1);
+    }
+    else {
+        priv->param.layout = UFO_FFT_LAYOUT_COMPLEX;
+        priv->param.zeropad = FALSE;
+        priv->param.size[0] = in_req.dims[0] / 2;
+    }
 
     switch (priv->param.dimensions) {
         case UFO_FFT_1D:
-            priv->param.batch = in_req.n_dims == 2 ? in_req.dims[1] : 1;
+            priv->param.batch = in_req.n_dims > 1 ? in_req.dims[1] : 1;
             break;
 
         case UFO_FFT_2D:
             priv->param.size[1] = in_req.dims[1];
-            priv->param.batch = in_req.n_dims == 3 ? in_req.dims[2] : 1;
+            priv->param.batch = 1;
             break;
 
         case UFO_FFT_3D:
@@ -164,9 +177,11 @@ ufo_ifft_task_process (UfoTask *task,
     cl_mem out_mem;
     cl_int width;
     cl_int height;
+    cl_int stride;
     cl_command_queue queue;
     gfloat scale;
     gsize global_work_size[3];
+    gsize num_frames;
 
     priv = UFO_IFFT_TASK_GET_PRIVATE (task);
     profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
@@ -177,9 +192,12 @@ ufo_ifft_task_process (UfoTask *task,
     if (ufo_buffer_get_layout (inputs[0]) != UFO_BUFFER_LAYOUT_COMPLEX_INTERLEAVED)
         g_warning ("ifft: input is not complex");
 
-    /* In-place IFFT */
-    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute (priv->fft, queue, profiler, in_mem, in_mem, UFO_FFT_BACKWARD,
-                                                0, NULL, NULL));
+    ufo_buffer_get_requisition (inputs[0], &in_req);
+    num_frames = priv->param.dimensions < UFO_FFT_3D && in_req.n_dims == 3 ? in_req.dims[2] : 1;
+
+    /* In-place IFFT of all frames at once */
+    UFO_RESOURCES_CHECK_CLERR (ufo_fft_execute_batch (priv->fft, queue, profiler, in_mem, in_mem, UFO_FFT_BACKWARD,
+                                                      num_frames, 0, NULL, NULL));
 
     /* Scale and reshape if necessary */
     scale = 1.0f / ((gfloat) requisition->dims[0]);
@@ -191,10 +209,9 @@ ufo_ifft_task_process (UfoTask *task,
     width = (cl_int) requisition->dims[0];
     height = (cl_int) requisition->dims[1];
 
-    ufo_buffer_get_requisition (inputs[0], &in_req);
     ufo_buffer_set_layout (output, UFO_BUFFER_LAYOUT_REAL);
 
-    global_work_size[0] = in_req.dims[0] >> 1;
+    global_work_size[0] = priv->param.size[0];
     global_work_size[1] = in_req.dims[1];
     global_work_size[2] = requisition->n_dims == 3 ? in_req.dims[2] : 1;
 
@@ -202,7 +219,15 @@ ufo_ifft_task_process (UfoTask *task,
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 1, sizeof (cl_mem), (gpointer) &out_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 2, sizeof (cl_int), &width));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 3, sizeof (cl_int), &height));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 4, sizeof (gfloat), &scale));
+
+    if (priv->half_spectrum) {
+        stride = (cl_int) in_req.dims[0];
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 4, sizeof (cl_int), &stride));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 5, sizeof (gfloat), &scale));
+    }
+    else {
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 4, sizeof (gfloat), &scale));
+    }
 
     UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (queue, priv->kernel,
                                                        3, NULL, global_work_size, NULL,
@@ -264,6 +289,9 @@ ufo_ifft_task_set_property (GObject *object,
         case PROP_CROP_HEIGHT:
             priv->crop_height = g_value_get_int (value);
             break;
+        case PROP_HALF_SPECTRUM:
+            priv->half_spectrum = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -288,6 +316,9 @@ ufo_ifft_task_get_property (GObject *object,
         case PROP_CROP_HEIGHT:
             g_value_set_int (value, priv->crop_height);
             break;
+        case PROP_HALF_SPECTRUM:
+            g_value_set_boolean (value, priv->half_spectrum);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -328,6 +359,13 @@ ufo_ifft_task_class_init (UfoIfftTaskClass *klass)
             -1, G_MAXINT, -1,
             G_PARAM_READWRITE);
 
+    properties[PROP_HALF_SPECTRUM] =
+        g_param_spec_boolean ("half-spectrum",
+            "Input is the non-redundant half of the spectrum of real data",
+            "Input is the non-redundant half of the spectrum of real data",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -343,6 +381,7 @@ ufo_ifft_task_init (UfoIfftTask *self)
     self->priv = priv = UFO_IFFT_TASK_GET_PRIVATE (self);
     priv->crop_width = -1;
     priv->crop_height = -1;
+    priv->half_spectrum = FALSE;
     priv->kernel = NULL;
     priv->context = NULL;
     priv->fft = ufo_fft_new ();
@@ -32,6 +32,7 @@
 #include "ufo-lamino-backproject-task.h"
 #include "lamino-roi.h"
 #include "common/ufo-addressing.h"
+#include "common/ufo-tuning.h"
 
 /* Copy only neccessary projection region */
 /* TODO: make this a parameter? */
@@ -41,7 +42,8 @@
 #define REGION_SIZE(region) ((EXTRACT_INT ((region), 2)) == 0) ? 0 : \
                             ((EXTRACT_INT ((region), 1) - EXTRACT_INT ((region), 0) - 1) /\
                             EXTRACT_INT ((region), 2) + 1)
-#define PAD_TO_DIVIDE(dividend, divisor) ((dividend) + (divisor) - (dividend) % (divisor))
+/* Number of slices the candidates are timed on when tuning */
+#define TUNING_DEPTH 32
 
 
 typedef enum {
@@ -59,19 +61,25 @@ static GEnumValue parameter_values[] = {
     { 0, NULL, NULL}
 };
 
+/* Projections per kernel invocation the kernel files are generated for, the
+ * ones up to BURST are tried when tuning */
+static const guint burst_values[] = {1, 2, 4, 8, 16};
+
 struct _UfoLaminoBackprojectTaskPrivate {
     /* private */
     gboolean generated;
     guint count;
-    /* sine and cosine table size based on BURST */
-    gsize table_size;
+    /* tuned launch parameters, burst is at most BURST */
+    UfoTuningParameters tuning;
+    gboolean tuned;
 
     /* OpenCL */
     cl_context context;
-    cl_kernel vector_kernel;
-    cl_kernel scalar_kernel;
+    /* kernels for every burst in burst_values up to BURST, the first one is
+     * used for the projections left over by the burst */
+    cl_kernel kernels[G_N_ELEMENTS (burst_values)];
     cl_sampler sampler;
-    /* Buffered images for invoking backprojection on BURST projections at once.
+    /* Buffered images for invoking backprojection on burst projections at once.
      * We potentially don't need to copy the last image and can use the one from
      * framework directly but it seems to have no performance effects. */
     cl_mem images[BURST];
@@ -121,6 +129,31 @@ enum {
 
 static GParamSpec *properties[N_PROPERTIES] = { NULL, };
 
+/* Kernel arguments which do not depend on the burst */
+typedef struct {
+    cl_mem out_mem;
+    gint real_size[4];
+    gfloat x_center[2];
+    gfloat y_center;
+    gfloat x_region[2];
+    gfloat y_region[2];
+    gfloat z_region[2];
+    gfloat lamino_angles[2];
+    gfloat roll_angles[2];
+    gfloat sin_lamino;
+    gfloat cos_lamino;
+    gfloat norm_factor;
+    gfloat sin_roll;
+    gfloat cos_roll;
+} KernelArgs;
+
+typedef struct {
+    UfoLaminoBackprojectTaskPrivate *priv;
+    cl_command_queue cmd_queue;
+    KernelArgs args;
+    gsize dims[3];
+} TuningData;
+
 static void
 set_region (GValueArray *src, GValueArray **dst)
 {
@@ -155,6 +188,177 @@ copy_to_image (UfoBuffer *input,
     UFO_RESOURCES_CHECK_CLERR (clReleaseEvent (event));
 }
 
+static cl_mem
+create_image (UfoLaminoBackprojectTaskPrivate *priv, UfoRequisition *in_req)
+{
+    cl_image_format image_fmt;
+    cl_mem image;
+    cl_int cl_error;
+
+    /* TODO: dangerous, don't rely on the ufo-buffer */
+    image_fmt.image_channel_order = CL_INTENSITY;
+    image_fmt.image_channel_data_type = CL_FLOAT;
+    /* TODO: what with the "other" API? */
+    image = clCreateImage2D (priv->context,
+                             CL_MEM_READ_ONLY,
+                             &image_fmt,
+                             in_req->dims[0],
+                             in_req->dims[1],
+                             0,
+                             NULL,
+                             &cl_error);
+    UFO_RESOURCES_CHECK_CLERR (cl_error);
+
+    return image;
+}
+
+static cl_kernel
+get_burst_kernel (UfoLaminoBackprojectTaskPrivate *priv, guint burst)
+{
+    for (guint i = 0; i < G_N_ELEMENTS (burst_values); i++) {
+        if (burst_values[i] == burst) {
+            return priv->kernels[i];
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Set the arguments following the *burst* images, the sine and cosine tables
+ * hold *burst* elements.
+ */
+static void
+set_kernel_args (UfoLaminoBackprojectTaskPrivate *priv,
+                 cl_kernel kernel,
+                 guint burst,
+                 const KernelArgs *args,
+                 gfloat *sines,
+                 gfloat *cosines,
+                 gint cumulate)
+{
+    guint i = burst;
+    gsize table_size = burst * sizeof (cl_float);
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_mem), &args->out_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_sampler), &priv->sampler));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_int3), args->real_size));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), args->x_center));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &args->y_center));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), args->x_region));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), args->y_region));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), args->z_region));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), args->lamino_angles));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), args->roll_angles));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &args->sin_lamino));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &args->cos_lamino));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, table_size, sines));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, table_size, cosines));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &args->norm_factor));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &args->sin_roll));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &args->cos_roll));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i, sizeof (cl_int), (cl_int *) &cumulate));
+}
+
+static gboolean
+run_candidate (const UfoTuningParameters *parameters, gpointer user_data)
+{
+    TuningData *data = (TuningData *) user_data;
+    UfoLaminoBackprojectTaskPrivate *priv = data->priv;
+    cl_kernel kernel;
+    gsize global_work_size[3];
+
+    if (!(kernel = get_burst_kernel (priv, parameters->burst))) {
+        return FALSE;
+    }
+
+    for (guint i = 0; i < parameters->burst; i++) {
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i, sizeof (cl_mem), &priv->images[i]));
+    }
+
+    set_kernel_args (priv, kernel, parameters->burst, &data->args, priv->sines, priv->cosines, 0);
+    ufo_tuning_get_global_work_size (parameters, 3, data->dims, global_work_size);
+
+    return clEnqueueNDRangeKernel (data->cmd_queue, kernel, 3, NULL, global_work_size,
+                                   ufo_tuning_get_local_work_size (parameters),
+                                   0, NULL, NULL) == CL_SUCCESS;
+}
+
+/*
+ * Find the local work size and burst, either in the device profile or by
+ * timing all candidates on the first TUNING_DEPTH slices. This happens when
+ * the first projection is in images[0], it is copied to the other images for
+ * the timing. The candidates do not cumulate, so the first real invocation
+ * overwrites their output.
+ */
+static void
+tune (UfoLaminoBackprojectTaskPrivate *priv,
+      UfoGpuNode *node,
+      cl_command_queue cmd_queue,
+      const KernelArgs *args,
+      UfoRequisition *requisition,
+      UfoRequisition *in_req)
+{
+    TuningData data;
+    GArray *candidates;
+    GValue *work_group_size;
+    guint num_bursts = 0;
+    gchar *name;
+    const size_t origin[3] = {0, 0, 0};
+    const size_t region[3] = {in_req->dims[0], in_req->dims[1], 1};
+
+    name = g_strdup_printf ("lamino-backproject-%s", parameter_values[priv->parameter].value_nick);
+
+    if (ufo_tuning_lookup (cmd_queue, name, &priv->tuning) &&
+        ufo_tuning_fits_kernel (cmd_queue, get_burst_kernel (priv, priv->tuning.burst), &priv->tuning)) {
+        goto exit;
+    }
+
+    for (guint i = 0; i < BURST; i++) {
+        if (priv->images[i] == NULL) {
+            priv->images[i] = create_image (priv, in_req);
+        }
+        if (i) {
+            UFO_RESOURCES_CHECK_CLERR (clEnqueueCopyImage (cmd_queue, priv->images[0], priv->images[i],
+                                                           origin, origin, region, 0, NULL, NULL));
+        }
+    }
+
+    while (num_bursts < G_N_ELEMENTS (burst_values) && burst_values[num_bursts] <= BURST) {
+        num_bursts++;
+    }
+
+    data.priv = priv;
+    data.cmd_queue = cmd_queue;
+    data.args = *args;
+    data.dims[0] = requisition->dims[0];
+    data.dims[1] = requisition->dims[1];
+    data.dims[2] = MIN (requisition->dims[2], TUNING_DEPTH);
+    data.args.real_size[2] = (gint) data.dims[2];
+
+    candidates = ufo_tuning_candidates_new (cmd_queue, 3, NULL, NULL, 0, burst_values, num_bursts);
+
+    if (!ufo_tuning_search (cmd_queue, name, candidates, run_candidate, &data, &priv->tuning)) {
+        /* keep the warp size satisfied but make sure the local grid is
+         * localized around a point in 3D for efficient caching, let last axis
+         * depend on maximum work group size */
+        work_group_size = ufo_gpu_node_get_info (node, UFO_GPU_NODE_INFO_MAX_WORK_GROUP_SIZE);
+        priv->tuning.local_work_size[0] = 16;
+        priv->tuning.local_work_size[1] = 8;
+        priv->tuning.local_work_size[2] = g_value_get_ulong (work_group_size) / 128;
+        priv->tuning.unroll = 0;
+        priv->tuning.burst = BURST;
+        g_value_unset (work_group_size);
+    }
+
+    g_array_free (candidates, TRUE);
+
+exit:
+    g_debug ("%s: local work size %zu %zu %zu, burst %u", name, priv->tuning.local_work_size[0],
+             priv->tuning.local_work_size[1], priv->tuning.local_work_size[2], priv->tuning.burst);
+    g_free (name);
+}
+
 UfoNode *
 ufo_lamino_backproject_task_new (void)
 {
@@ -169,7 +373,7 @@ ufo_lamino_backproject_task_setup (UfoTask *task,
     UfoLaminoBackprojectTaskPrivate *priv;
     cl_int cl_error;
     gint i;
-    gchar *vector_kernel_name;
+    gchar *kernel_name;
     gchar *kernel_filename;
 
     priv = UFO_LAMINO_BACKPROJECT_TASK_GET_PRIVATE (task);
@@ -184,13 +388,6 @@ ufo_lamino_backproject_task_setup (UfoTask *task,
         return;
     }
 
-    vector_kernel_name = g_strdup_printf ("backproject_burst_%d", BURST);
-
-    if (!vector_kernel_name) {
-        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP, "Unable to create burst kernel name");
-        return;
-    }
-
     priv->context = ufo_resources_get_context (resources);
 
     switch (priv->parameter) {
@@ -211,32 +408,27 @@ ufo_lamino_backproject_task_setup (UfoTask *task,
             return;
     }
 
-    priv->vector_kernel = ufo_resources_get_kernel (resources, kernel_filename, vector_kernel_name, NULL, error);
-    priv->scalar_kernel = ufo_resources_get_kernel (resources, kernel_filename, "backproject_burst_1", NULL, error);
     priv->sampler = clCreateSampler (priv->context, (cl_bool) FALSE, priv->addressing_mode, CL_FILTER_LINEAR, &cl_error);
 
     UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
     UFO_RESOURCES_CHECK_SET_AND_RETURN (cl_error, error);
 
-    if (priv->vector_kernel)
-        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->vector_kernel), error);
+    for (i = 0; i < (gint) G_N_ELEMENTS (burst_values) && burst_values[i] <= BURST; i++) {
+        kernel_name = g_strdup_printf ("backproject_burst_%u", burst_values[i]);
+        priv->kernels[i] = ufo_resources_get_kernel (resources, kernel_filename, kernel_name, NULL, error);
+        g_free (kernel_name);
+
+        if (priv->kernels[i] == NULL) {
+            g_free (kernel_filename);
+            return;
+        }
 
-    if (priv->scalar_kernel)
-        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->scalar_kernel), error);
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernels[i]), error);
+    }
 
     for (i = 0; i < BURST; i++)
         priv->images[i] = NULL;
 
-    switch (BURST) {
-        case 1: priv->table_size = sizeof (cl_float); break;
-        case 2: priv->table_size = sizeof (cl_float2); break;
-        case 4: priv->table_size = sizeof (cl_float4); break;
-        case 8: priv->table_size = sizeof (cl_float8); break;
-        case 16: priv->table_size = sizeof (cl_float16); break;
-        default: g_warning ("Unsupported vector size"); break;
-    }
-
-    g_free (vector_kernel_name);
     g_free (kernel_filename);
 }
 
@@ -291,100 +483,81 @@ ufo_lamino_backproject_task_process (UfoTask *task,
     UfoRequisition in_req;
     UfoGpuNode *node;
     UfoProfiler *profiler;
+    KernelArgs args;
     gfloat tomo_angle, *sines, *cosines;
-    gint i, index;
+    gint index;
     gint cumulate;
-    gsize table_size;
+    guint burst;
     gboolean scalar;
     /* regions stripped off the "to" value */
-    gfloat x_region[2], y_region[2], z_region[2], x_center[2], z_ends[2], lamino_angles[2], roll_angles[2],
-           y_center, sin_lamino, cos_lamino, norm_factor, sin_roll, cos_roll;
+    gfloat z_ends[2];
     gint x_copy_region[2], y_copy_region[2];
     cl_kernel kernel;
     cl_command_queue cmd_queue;
-    cl_mem out_mem;
-    cl_int cl_error;
-    /* image creation and copying */
-    cl_image_format image_fmt;
+    /* image copying */
     size_t origin[3];
     size_t region[3];
-    /* keep the warp size satisfied but make sure the local grid is localized
-     * around a point in 3D for efficient caching */
-    const gint real_size[4] = {requisition->dims[0], requisition->dims[1], requisition->dims[2], 0};
-    gsize local_work_size[3] = {16, 8, 8};
     gsize global_work_size[3];
-    GValue *work_group_size;
 
     priv = UFO_LAMINO_BACKPROJECT_TASK (task)->priv;
     node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
-    work_group_size = ufo_gpu_node_get_info (node, UFO_GPU_NODE_INFO_MAX_WORK_GROUP_SIZE);
-
-    /* Let last axis depend on maximum work group size */
-    local_work_size[2] = g_value_get_ulong (work_group_size) / 128;
-    g_value_unset (work_group_size);
-
-    global_work_size[0] = requisition->dims[0] % local_work_size[0] ?
-                          PAD_TO_DIVIDE (requisition->dims[0], local_work_size[0]) :
-                          requisition->dims[0];
-    global_work_size[1] = requisition->dims[1] % local_work_size[1] ?
-                          PAD_TO_DIVIDE (requisition->dims[1], local_work_size[1]) :
-                          requisition->dims[1];
-    global_work_size[2] = requisition->dims[2] % local_work_size[2] ?
-                          PAD_TO_DIVIDE (requisition->dims[2], local_work_size[2]) :
-                          requisition->dims[2];
-
     cmd_queue = ufo_gpu_node_get_cmd_queue (node);
-    out_mem = ufo_buffer_get_device_array (output, cmd_queue);
+    args.out_mem = ufo_buffer_get_device_array (output, cmd_queue);
+    args.real_size[0] = requisition->dims[0];
+    args.real_size[1] = requisition->dims[1];
+    args.real_size[2] = requisition->dims[2];
+    args.real_size[3] = 0;
     ufo_buffer_get_requisition (inputs[0], &in_req);
 
-    index = priv->count % BURST;
+    /* The burst is only known after tuning, which happens with the first
+     * projection stored in the first image */
+    index = priv->tuned ? priv->count % priv->tuning.burst : 0;
     tomo_angle = priv->tomo_angle > -G_MAXFLOAT ? priv->tomo_angle :
                  priv->overall_angle * priv->count / priv->num_projections;
-    norm_factor = fabs (priv->overall_angle) / priv->num_projections;
+    args.norm_factor = fabs (priv->overall_angle) / priv->num_projections;
     priv->sines[index] = sin (tomo_angle);
     priv->cosines[index] = cos (tomo_angle);
-    x_region[0] = (gfloat) EXTRACT_INT (priv->x_region, 0);
-    x_region[1] = (gfloat) EXTRACT_INT (priv->x_region, 2);
-    y_region[0] = (gfloat) EXTRACT_INT (priv->y_region, 0);
-    y_region[1] = (gfloat) EXTRACT_INT (priv->y_region, 2);
+    args.x_region[0] = (gfloat) EXTRACT_INT (priv->x_region, 0);
+    args.x_region[1] = (gfloat) EXTRACT_INT (priv->x_region, 2);
+    args.y_region[0] = (gfloat) EXTRACT_INT (priv->y_region, 0);
+    args.y_region[1] = (gfloat) EXTRACT_INT (priv->y_region, 2);
 
     if (priv->parameter == PARAMETER_Z) {
-        z_ends[0] = z_region[0] = EXTRACT_FLOAT (priv->region, 0);
-        z_region[1] = EXTRACT_FLOAT (priv->region, 2);
+        z_ends[0] = args.z_region[0] = EXTRACT_FLOAT (priv->region, 0);
+        args.z_region[1] = EXTRACT_FLOAT (priv->region, 2);
         z_ends[1] = EXTRACT_FLOAT (priv->region, 1);
     } else {
-        z_ends[0] = z_region[0] = priv->z;
+        z_ends[0] = args.z_region[0] = priv->z;
         z_ends[1] = priv->z + 1.0f;
     }
 
     if (priv->parameter == PARAMETER_X_CENTER) {
-        x_center[0] = EXTRACT_FLOAT (priv->region, 0) - EXTRACT_INT (priv->projection_offset, 0);
-        x_center[1] = EXTRACT_FLOAT (priv->region, 2);
+        args.x_center[0] = EXTRACT_FLOAT (priv->region, 0) - EXTRACT_INT (priv->projection_offset, 0);
+        args.x_center[1] = EXTRACT_FLOAT (priv->region, 2);
     } else {
-        x_center[0] = x_center[1] = EXTRACT_FLOAT (priv->center, 0) - EXTRACT_INT (priv->projection_offset, 0);
+        args.x_center[0] = args.x_center[1] = EXTRACT_FLOAT (priv->center, 0) - EXTRACT_INT (priv->projection_offset, 0);
     }
 
     if (priv->parameter == PARAMETER_LAMINO_ANGLE) {
-        lamino_angles[0] = EXTRACT_FLOAT (priv->region, 0);
-        lamino_angles[1] = EXTRACT_FLOAT (priv->region, 2);
+        args.lamino_angles[0] = EXTRACT_FLOAT (priv->region, 0);
+        args.lamino_angles[1] = EXTRACT_FLOAT (priv->region, 2);
     } else {
-        lamino_angles[0] = lamino_angles[1] = priv->lamino_angle;
+        args.lamino_angles[0] = args.lamino_angles[1] = priv->lamino_angle;
     }
 
     if (priv->parameter == PARAMETER_ROLL_ANGLE) {
-        roll_angles[0] = EXTRACT_FLOAT (priv->region, 0);
-        roll_angles[1] = EXTRACT_FLOAT (priv->region, 2);
+        args.roll_angles[0] = EXTRACT_FLOAT (priv->region, 0);
+        args.roll_angles[1] = EXTRACT_FLOAT (priv->region, 2);
     } else {
-        roll_angles[0] = roll_angles[1] = priv->roll_angle;
+        args.roll_angles[0] = args.roll_angles[1] = priv->roll_angle;
     }
 
-    y_center = EXTRACT_FLOAT (priv->center, 1) - EXTRACT_INT (priv->projection_offset, 1);
-    sin_lamino = sinf (priv->lamino_angle);
-    cos_lamino = cosf (priv->lamino_angle);
+    args.y_center = EXTRACT_FLOAT (priv->center, 1) - EXTRACT_INT (priv->projection_offset, 1);
+    args.sin_lamino = sinf (priv->lamino_angle);
+    args.cos_lamino = cosf (priv->lamino_angle);
     /* Minus the value because we are rotating back */
-    sin_roll = sinf (-priv->roll_angle);
-    cos_roll = cosf (-priv->roll_angle);
-    scalar = priv->count >= priv->num_projections / BURST * BURST ? 1 : 0;
+    args.sin_roll = sinf (-priv->roll_angle);
+    args.cos_roll = cosf (-priv->roll_angle);
 
     /* If COPY_PROJECTION_REGION is True we copy only the part necessary  */
     /* for a given tomographic and laminographic angle */
@@ -408,67 +581,45 @@ ufo_lamino_backproject_task_process (UfoTask *task,
     region[2] = 1;
 
     if (priv->images[index] == NULL) {
-        /* TODO: dangerous, don't rely on the ufo-buffer */
-        image_fmt.image_channel_order = CL_INTENSITY;
-        image_fmt.image_channel_data_type = CL_FLOAT;
-        /* TODO: what with the "other" API? */
-        priv->images[index] = clCreateImage2D (priv->context,
-                                               CL_MEM_READ_ONLY,
-                                               &image_fmt,
-                                               in_req.dims[0],
-                                               in_req.dims[1],
-                                               0,
-                                               NULL,
-                                               &cl_error);
-        UFO_RESOURCES_CHECK_CLERR (cl_error);
+        priv->images[index] = create_image (priv, &in_req);
     }
 
     copy_to_image (inputs[0], priv->images[index], cmd_queue, origin, region, in_req.dims[0]);
 
+    if (!priv->tuned) {
+        tune (priv, node, cmd_queue, &args, requisition, &in_req);
+        priv->tuned = TRUE;
+    }
+
+    burst = priv->tuning.burst;
+    scalar = priv->count >= priv->num_projections / burst * burst ? 1 : 0;
+
     if (scalar) {
-        kernel = priv->scalar_kernel;
+        kernel = priv->kernels[0];
         cumulate = priv->count;
-        table_size = sizeof (cl_float);
         sines = &priv->sines[index];
         cosines = &priv->cosines[index];
-        i = 1;
+        burst = 1;
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &priv->images[index]));
     } else {
-        kernel = priv->vector_kernel;
-        cumulate = priv->count + 1 == BURST ? 0 : 1;
-        table_size = priv->table_size;
+        kernel = get_burst_kernel (priv, burst);
+        cumulate = priv->count + 1 == burst ? 0 : 1;
         sines = priv->sines;
         cosines = priv->cosines;
-        i = BURST;
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, index, sizeof (cl_mem), &priv->images[index]));
     }
 
-    if (scalar || index == BURST - 1) {
-        /* Execute the kernel after BURST images have arrived, i.e. we use more
+    if (scalar || index == (gint) burst - 1) {
+        /* Execute the kernel after burst images have arrived, i.e. we use more
          * projections at one invocation, so the number of read/writes to the
-         * result is reduced by a factor of BURST. If there are not enough
+         * result is reduced by a factor of burst. If there are not enough
          * projecttions left, execute the scalar kernel */
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_mem), &out_mem));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_sampler), &priv->sampler));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_int3), real_size));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), x_center));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), (cl_float *) &y_center));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), x_region));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), y_region));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), z_region));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), lamino_angles));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float2), roll_angles));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &sin_lamino));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &cos_lamino));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, table_size, sines));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, table_size, cosines));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &norm_factor));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &sin_roll));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i++, sizeof (cl_float), &cos_roll));
-        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, i, sizeof (cl_int), (cl_int *) &cumulate));
+        set_kernel_args (priv, kernel, burst, &args, sines, cosines, cumulate);
+        ufo_tuning_get_global_work_size (&priv->tuning, 3, requisition->dims, global_work_size);
 
         profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
-        ufo_profiler_call (profiler, cmd_queue, kernel, 3, global_work_size, local_work_size);
+        ufo_profiler_call (profiler, cmd_queue, kernel, 3, global_work_size,
+                           ufo_tuning_get_local_work_size (&priv->tuning));
     }
 
     priv->count++;
@@ -624,13 +775,11 @@ ufo_lamino_backproject_task_finalize (GObject *object)
     g_value_array_free (priv->projection_offset);
     g_value_array_free (priv->center);
 
-    if (priv->vector_kernel) {
-        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->vector_kernel));
-        priv->vector_kernel = NULL;
-    }
-    if (priv->scalar_kernel) {
-        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->scalar_kernel));
-        priv->scalar_kernel = NULL;
+    for (i = 0; i < (gint) G_N_ELEMENTS (burst_values); i++) {
+        if (priv->kernels[i]) {
+            UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->kernels[i]));
+            priv->kernels[i] = NULL;
+        }
     }
     if (priv->context) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
@@ -828,4 +977,5 @@ ufo_lamino_backproject_task_init(UfoLaminoBackprojectTask *self)
     self->priv->count = 0;
     self->priv->addressing_mode = CL_ADDRESS_CLAMP;
     self->priv->generated = FALSE;
+    self->priv->tuned = FALSE;
 }
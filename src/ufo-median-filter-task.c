@@ -24,6 +24,7 @@
 #endif
 
 #include "ufo-median-filter-task.h"
+#include "common/ufo-tile.h"
 
 /**
  * SECTION:ufo-median-filter-task
@@ -32,10 +33,29 @@
  *
  */
 
+/*
+ * If requested, from this box size on a sliding histogram is used instead of
+ * sorting all elements of the box for each pixel. The histogram works on the
+ * input quantized to 16 bit and is only exact for integer data in that range.
+ */
+#define HISTOGRAM_MIN_SIZE      9
+#define HISTOGRAM_LOCAL_SIZE    16
+#define HISTOGRAM_BAND          64
+#define MIN_MAX_LOCAL_SIZE      128
+#define MIN_MAX_NUM_GROUPS      64
+
 struct _UfoMedianFilterTaskPrivate {
+    cl_context context;
     cl_kernel inner_kernel;
+    cl_kernel tiled_kernel;
     cl_kernel fill_kernel;
+    cl_kernel quantize_kernel;
+    cl_kernel min_max_kernel;
+    cl_mem partial_mem;
+    cl_mem quantized_mem;
+    gsize quantized_size;
     guint size;
+    gboolean histogram;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -49,6 +69,7 @@ G_DEFINE_TYPE_WITH_CODE (UfoMedianFilterTask, ufo_median_filter_task, UFO_TYPE_T
 enum {
     PROP_0,
     PROP_SIZE,
+    PROP_HISTOGRAM,
     N_PROPERTIES
 };
 
@@ -60,6 +81,12 @@ ufo_median_filter_task_new (void)
     return UFO_NODE (g_object_new (UFO_TYPE_MEDIAN_FILTER_TASK, NULL));
 }
 
+static gboolean
+use_histogram (UfoMedianFilterTaskPrivate *priv)
+{
+    return priv->histogram && priv->size >= HISTOGRAM_MIN_SIZE;
+}
+
 static void
 ufo_median_filter_task_setup (UfoTask *task,
                               UfoResources *resources,
@@ -72,17 +99,49 @@ ufo_median_filter_task_setup (UfoTask *task,
     option = g_strdup_printf (" -DMEDIAN_BOX_SIZE=%i ", priv->size);
 
     priv->inner_kernel = ufo_resources_get_kernel (resources, "median.cl",
-            "filter_inner", option, error);
+            use_histogram (priv) ? "filter_inner_histogram" : "filter_inner",
+            option, error);
 
     priv->fill_kernel = ufo_resources_get_kernel (resources, "median.cl",
             "fill", option, error);
 
+    if (!use_histogram (priv)) {
+        priv->tiled_kernel = ufo_resources_get_kernel (resources, "median.cl",
+                "filter_inner_tiled", option, error);
+
+        if (priv->tiled_kernel != NULL)
+            UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->tiled_kernel), error);
+    }
+
     if (priv->inner_kernel != NULL)
         UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->inner_kernel), error);
 
     if (priv->fill_kernel != NULL)
         UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->fill_kernel), error);
 
+    if (use_histogram (priv)) {
+        cl_int err;
+
+        priv->context = ufo_resources_get_context (resources);
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
+
+        priv->quantize_kernel = ufo_resources_get_kernel (resources, "median.cl",
+                "quantize", option, error);
+
+        priv->min_max_kernel = ufo_resources_get_kernel (resources, "convert.cl",
+                "find_min_max", NULL, error);
+
+        if (priv->quantize_kernel != NULL)
+            UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->quantize_kernel), error);
+
+        if (priv->min_max_kernel != NULL)
+            UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->min_max_kernel), error);
+
+        priv->partial_mem = clCreateBuffer (priv->context, CL_MEM_WRITE_ONLY,
+                                            MIN_MAX_NUM_GROUPS * sizeof (cl_float2), NULL, &err);
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (err, error);
+    }
+
     g_free (option);
 }
 
@@ -114,6 +173,98 @@ ufo_median_filter_task_get_mode (UfoTask *task)
     return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
 }
 
+static void
+find_min_max (UfoMedianFilterTaskPrivate *priv,
+              UfoProfiler *profiler,
+              cl_command_queue cmd_queue,
+              cl_mem in_mem,
+              cl_ulong n_pixels,
+              gfloat *min,
+              gfloat *max)
+{
+    cl_float2 partial[MIN_MAX_NUM_GROUPS];
+    cl_ulong offset = 0;
+    gsize local_size = MIN_MAX_LOCAL_SIZE;
+    gsize global_size = MIN_MAX_LOCAL_SIZE * MIN_MAX_NUM_GROUPS;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 1, sizeof (cl_mem), &priv->partial_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 2, local_size * sizeof (cl_float2), NULL));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 3, sizeof (cl_ulong), &offset));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 4, sizeof (cl_ulong), &n_pixels));
+    ufo_profiler_call (profiler, cmd_queue, priv->min_max_kernel, 1, &global_size, &local_size);
+
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (cmd_queue, priv->partial_mem, CL_TRUE,
+                                                    0, sizeof (partial), partial, 0, NULL, NULL));
+
+    *min = G_MAXFLOAT;
+    *max = -G_MAXFLOAT;
+
+    for (guint i = 0; i < MIN_MAX_NUM_GROUPS; i++) {
+        *min = MIN (*min, partial[i].s[0]);
+        *max = MAX (*max, partial[i].s[1]);
+    }
+}
+
+static void
+filter_histogram (UfoMedianFilterTaskPrivate *priv,
+                  UfoProfiler *profiler,
+                  cl_command_queue cmd_queue,
+                  cl_mem in_mem,
+                  cl_mem out_mem,
+                  UfoRequisition *requisition)
+{
+    gfloat min, max, scale;
+    gsize size;
+    gsize depth;
+    gsize inner_height;
+    gsize global_size[3];
+    gsize local_size[3] = {HISTOGRAM_LOCAL_SIZE, 1, 1};
+    cl_int width = (cl_int) requisition->dims[0];
+    cl_int height = (cl_int) requisition->dims[1];
+    cl_int band = HISTOGRAM_BAND;
+
+    depth = requisition->n_dims == 3 ? requisition->dims[2] : 1;
+    size = requisition->dims[0] * requisition->dims[1] * depth * sizeof (cl_ushort);
+
+    if (priv->quantized_size < size) {
+        cl_int err;
+
+        if (priv->quantized_mem != NULL)
+            UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->quantized_mem));
+
+        priv->quantized_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE, size, NULL, &err);
+        UFO_RESOURCES_CHECK_CLERR (err);
+        priv->quantized_size = size;
+    }
+
+    find_min_max (priv, profiler, cmd_queue, in_mem,
+                  requisition->dims[0] * requisition->dims[1] * depth, &min, &max);
+    scale = max > min ? 65535.0f / (max - min) : 0.0f;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->quantize_kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->quantize_kernel, 1, sizeof (cl_mem), &priv->quantized_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->quantize_kernel, 2, sizeof (gfloat), &min));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->quantize_kernel, 3, sizeof (gfloat), &scale));
+    ufo_profiler_call (profiler, cmd_queue, priv->quantize_kernel, requisition->n_dims, requisition->dims, NULL);
+
+    /* Each work item slides down a band of rows in one column */
+    inner_height = requisition->dims[1] - (priv->size - 1);
+    global_size[0] = requisition->dims[0] - (priv->size - 1);
+    global_size[0] = (global_size[0] + HISTOGRAM_LOCAL_SIZE - 1) / HISTOGRAM_LOCAL_SIZE * HISTOGRAM_LOCAL_SIZE;
+    global_size[1] = (inner_height + HISTOGRAM_BAND - 1) / HISTOGRAM_BAND;
+    global_size[2] = depth;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 1, sizeof (cl_mem), &priv->quantized_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 2, sizeof (cl_mem), &out_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 3, HISTOGRAM_LOCAL_SIZE * 512 * sizeof (cl_ushort), NULL));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 4, sizeof (cl_int), &width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 5, sizeof (cl_int), &height));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 6, sizeof (cl_int), &band));
+    ufo_profiler_call (profiler, cmd_queue, priv->inner_kernel, 3, global_size, local_size);
+}
+
 static gboolean
 ufo_median_filter_task_process (UfoTask *task,
                                 UfoBuffer **inputs,
@@ -127,7 +278,11 @@ ufo_median_filter_task_process (UfoTask *task,
     cl_mem in_mem;
     cl_mem out_mem;
 
-    size_t inner_size[2];
+    size_t inner_size[3];
+    gsize halo[2];
+    gsize global_size[3];
+    gsize local_size[3];
+    gsize local_mem_size;
 
     priv = UFO_MEDIAN_FILTER_TASK_GET_PRIVATE (task);
 
@@ -140,15 +295,38 @@ ufo_median_filter_task_process (UfoTask *task,
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->fill_kernel, 0, sizeof (cl_mem), &in_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->fill_kernel, 1, sizeof (cl_mem), &out_mem));
 
-    ufo_profiler_call (profiler, cmd_queue, priv->fill_kernel, 2, requisition->dims, NULL);
+    ufo_profiler_call (profiler, cmd_queue, priv->fill_kernel, requisition->n_dims, requisition->dims, NULL);
 
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 0, sizeof (cl_mem), &in_mem));
-    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 1, sizeof (cl_mem), &out_mem));
+    if (use_histogram (priv)) {
+        filter_histogram (priv, profiler, cmd_queue, in_mem, out_mem, requisition);
+        return TRUE;
+    }
 
     inner_size[0] = requisition->dims[0] - (priv->size - 1);
     inner_size[1] = requisition->dims[1] - (priv->size - 1);
+    halo[0] = halo[1] = priv->size - 1;
+
+    /* Frames of a batch are filtered by the third dimension of one launch */
+    inner_size[2] = global_size[2] = requisition->n_dims == 3 ? requisition->dims[2] : 1;
+    local_size[2] = 1;
+
+    if (ufo_tile_get_work_size (cmd_queue, priv->tiled_kernel, inner_size, halo,
+                                global_size, local_size, &local_mem_size)) {
+        cl_int width = (cl_int) requisition->dims[0];
+        cl_int height = (cl_int) requisition->dims[1];
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 0, sizeof (cl_mem), &in_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 1, sizeof (cl_mem), &out_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 2, local_mem_size, NULL));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 3, sizeof (cl_int), &width));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 4, sizeof (cl_int), &height));
+        ufo_profiler_call (profiler, cmd_queue, priv->tiled_kernel, 3, global_size, local_size);
+        return TRUE;
+    }
 
-    ufo_profiler_call (profiler, cmd_queue, priv->inner_kernel, 2, inner_size, NULL);
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->inner_kernel, 1, sizeof (cl_mem), &out_mem));
+    ufo_profiler_call (profiler, cmd_queue, priv->inner_kernel, 3, inner_size, NULL);
 
     return TRUE;
 }
@@ -176,6 +354,9 @@ ufo_median_filter_task_set_property (GObject *object,
                     priv->size = new_size;
             }
             break;
+        case PROP_HISTOGRAM:
+            priv->histogram = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -196,6 +377,9 @@ ufo_median_filter_task_get_property (GObject *object,
         case PROP_SIZE:
             g_value_set_uint (value, priv->size);
             break;
+        case PROP_HISTOGRAM:
+            g_value_set_boolean (value, priv->histogram);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -214,11 +398,41 @@ ufo_median_filter_task_finalize (GObject *object)
         priv->inner_kernel = NULL;
     }
 
+    if (priv->tiled_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->tiled_kernel));
+        priv->tiled_kernel = NULL;
+    }
+
     if (priv->fill_kernel) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->fill_kernel));
         priv->fill_kernel = NULL;
     }
 
+    if (priv->quantize_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->quantize_kernel));
+        priv->quantize_kernel = NULL;
+    }
+
+    if (priv->min_max_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->min_max_kernel));
+        priv->min_max_kernel = NULL;
+    }
+
+    if (priv->partial_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->partial_mem));
+        priv->partial_mem = NULL;
+    }
+
+    if (priv->quantized_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->quantized_mem));
+        priv->quantized_mem = NULL;
+    }
+
+    if (priv->context) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_median_filter_task_parent_class)->finalize (object);
 }
 
@@ -249,6 +463,13 @@ ufo_median_filter_task_class_init (UfoMedianFilterTaskClass *klass)
             3, 33, 3,
             G_PARAM_READWRITE);
 
+    properties[PROP_HISTOGRAM] =
+        g_param_spec_boolean ("histogram",
+            "Use an approximate sliding histogram for large boxes",
+            "Use an approximate sliding histogram for large boxes",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -260,4 +481,14 @@ ufo_median_filter_task_init(UfoMedianFilterTask *self)
 {
     self->priv = UFO_MEDIAN_FILTER_TASK_GET_PRIVATE(self);
     self->priv->size = 3;
+    self->priv->histogram = FALSE;
+    self->priv->context = NULL;
+    self->priv->inner_kernel = NULL;
+    self->priv->tiled_kernel = NULL;
+    self->priv->fill_kernel = NULL;
+    self->priv->quantize_kernel = NULL;
+    self->priv->min_max_kernel = NULL;
+    self->priv->partial_mem = NULL;
+    self->priv->quantized_mem = NULL;
+    self->priv->quantized_size = 0;
 }
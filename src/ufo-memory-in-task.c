@@ -18,6 +18,7 @@
  */
 
 #include "ufo-memory-in-task.h"
+#include "common/ufo-pinned.h"
 
 
 struct _UfoMemoryInTaskPrivate {
@@ -28,6 +29,7 @@ struct _UfoMemoryInTaskPrivate {
     UfoBufferDepth   bitdepth;
     guint   number;
     guint   read;
+    UfoPinnedPool *pinned;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -65,10 +67,15 @@ ufo_memory_in_task_setup (UfoTask *task,
 
     priv = UFO_MEMORY_IN_TASK_GET_PRIVATE (task);
 
-    if (priv->pointer == NULL)
+    if (priv->pointer == NULL) {
         g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP, "`pointer' property not set");
+        return;
+    }
 
     priv->read = 0;
+
+    if (priv->pinned == NULL)
+        priv->pinned = ufo_pinned_pool_new (ufo_resources_get_context (resources), error);
 }
 
 static void
@@ -117,7 +124,7 @@ ufo_memory_in_task_generate (UfoTask *task,
     if (priv->read == priv->number)
         return FALSE;
 
-    data = (guint8 *) ufo_buffer_get_host_array (output, NULL);
+    data = (guint8 *) ufo_pinned_pool_attach (priv->pinned, output);
     memcpy (data, &priv->pointer[priv->read * priv->width * priv->height], priv->width * priv->height * priv->bytes_per_pixel);
 
     if (priv->bitdepth != UFO_BUFFER_DEPTH_32F)
@@ -206,6 +213,13 @@ ufo_memory_in_task_get_property (GObject *object,
 static void
 ufo_memory_in_task_finalize (GObject *object)
 {
+    UfoMemoryInTaskPrivate *priv = UFO_MEMORY_IN_TASK_GET_PRIVATE (object);
+
+    if (priv->pinned != NULL) {
+        ufo_pinned_pool_destroy (priv->pinned);
+        priv->pinned = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_memory_in_task_parent_class)->finalize (object);
 }
 
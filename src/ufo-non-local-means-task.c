@@ -25,12 +25,30 @@
 
 #include "ufo-non-local-means-task.h"
 
+/* Upper bound of search offsets processed by one pair of fast launches */
+#define MAX_OFFSETS_PER_BATCH   32
 
 struct _UfoNonLocalMeansTaskPrivate {
     guint search_radius;
     guint patch_radius;
+    guint slice_radius;
     gfloat sigma;
+    gboolean fast;
+    gboolean half_storage;
     cl_kernel kernel;
+
+    /* fast mode */
+    cl_context context;
+    cl_kernel column_kernel;
+    cl_kernel row_kernel;
+    cl_kernel normalize_kernel;
+    cl_mem sums_mem;
+    cl_mem numerator_mem;
+    cl_mem denominator_mem;
+    gsize num_pixels;
+    guint batch_size;
+    gsize row_size;
+    cl_ulong max_alloc_size;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -46,6 +64,9 @@ enum {
     PROP_SEARCH_RADIUS,
     PROP_PATCH_RADIUS,
     PROP_SIGMA,
+    PROP_FAST,
+    PROP_SLICE_RADIUS,
+    PROP_HALF_STORAGE,
     N_PROPERTIES
 };
 
@@ -63,12 +84,35 @@ ufo_non_local_means_task_setup (UfoTask *task,
                                 GError **error)
 {
     UfoNonLocalMeansTaskPrivate *priv;
+    const gchar *options;
 
     priv = UFO_NON_LOCAL_MEANS_TASK_GET_PRIVATE (task);
-    priv->kernel = ufo_resources_get_kernel (resources, "nlm.cl", "nlm_noise_reduction", NULL, error);
 
-    if (priv->kernel)
-        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel), error);
+    if (!priv->fast) {
+        priv->kernel = ufo_resources_get_kernel (resources, "nlm.cl", "nlm_noise_reduction", NULL, error);
+
+        if (priv->kernel)
+            UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel), error);
+
+        return;
+    }
+
+    options = priv->half_storage ? " -DNLM_HALF " : NULL;
+    priv->column_kernel = ufo_resources_get_kernel (resources, "nlm.cl", "nlm_column_sums", options, error);
+    priv->row_kernel = ufo_resources_get_kernel (resources, "nlm.cl", "nlm_row_weights", options, error);
+    priv->normalize_kernel = ufo_resources_get_kernel (resources, "nlm.cl", "nlm_normalize", options, error);
+
+    if (priv->column_kernel)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->column_kernel), error);
+
+    if (priv->row_kernel)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->row_kernel), error);
+
+    if (priv->normalize_kernel)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->normalize_kernel), error);
+
+    priv->context = ufo_resources_get_context (resources);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
 }
 
 static void
@@ -99,6 +143,170 @@ ufo_non_local_means_task_get_mode (UfoTask *task)
     return UFO_TASK_MODE_PROCESSOR | UFO_TASK_MODE_GPU;
 }
 
+static void
+release_fast_buffers (UfoNonLocalMeansTaskPrivate *priv)
+{
+    if (priv->sums_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->sums_mem));
+        priv->sums_mem = NULL;
+    }
+
+    if (priv->numerator_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->numerator_mem));
+        priv->numerator_mem = NULL;
+    }
+
+    if (priv->denominator_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->denominator_mem));
+        priv->denominator_mem = NULL;
+    }
+}
+
+/*
+ * Allocate the column sums for as many search offsets as fit into one buffer,
+ * half storage doubles that number.
+ */
+static void
+update_fast_buffers (UfoNonLocalMeansTaskPrivate *priv, gsize num_pixels, guint num_offsets)
+{
+    gsize sum_size;
+    guint batch_size;
+    cl_int cl_err;
+
+    sum_size = num_pixels * (priv->half_storage ? sizeof (cl_half) : sizeof (gfloat));
+    batch_size = (guint) MAX (1, MIN (priv->max_alloc_size / sum_size, MAX_OFFSETS_PER_BATCH));
+    batch_size = MIN (batch_size, num_offsets);
+
+    if (priv->sums_mem != NULL && priv->num_pixels == num_pixels && priv->batch_size == batch_size)
+        return;
+
+    release_fast_buffers (priv);
+
+    priv->sums_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE, batch_size * sum_size, NULL, &cl_err);
+    UFO_RESOURCES_CHECK_CLERR (cl_err);
+    priv->numerator_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE, num_pixels * sizeof (gfloat), NULL, &cl_err);
+    UFO_RESOURCES_CHECK_CLERR (cl_err);
+    priv->denominator_mem = clCreateBuffer (priv->context, CL_MEM_READ_WRITE, num_pixels * sizeof (gfloat), NULL, &cl_err);
+    UFO_RESOURCES_CHECK_CLERR (cl_err);
+
+    priv->num_pixels = num_pixels;
+    priv->batch_size = batch_size;
+}
+
+/*
+ * Process batches of search offsets. For each batch the column sums of the
+ * squared differences are computed first, then each work group prefix-sums
+ * them along its part of a row, turns the patch distances into weights and
+ * accumulates them.
+ */
+static void
+process_fast (UfoNonLocalMeansTaskPrivate *priv,
+              UfoGpuNode *node,
+              cl_command_queue cmd_queue,
+              UfoProfiler *profiler,
+              cl_mem in_mem,
+              cl_mem out_mem,
+              UfoRequisition *requisition)
+{
+    cl_int width, height, depth;
+    cl_int search_radius, slice_radius, patch_radius;
+    cl_int first_offset, num_batch_offsets, first;
+    guint num_offsets;
+    gsize num_pixels;
+    gsize tile_size;
+    gsize global_work_size[3];
+    gsize local_work_size[2];
+
+    width = (cl_int) requisition->dims[0];
+    height = (cl_int) requisition->dims[1];
+    depth = requisition->n_dims == 3 ? (cl_int) requisition->dims[2] : 1;
+    num_pixels = (gsize) width * height * depth;
+
+    if (priv->row_size == 0) {
+        GValue *value;
+        cl_device_id device;
+        gsize kernel_size;
+        gsize max_size;
+
+        UFO_RESOURCES_CHECK_CLERR (clGetCommandQueueInfo (cmd_queue, CL_QUEUE_DEVICE, sizeof (cl_device_id), &device, NULL));
+        UFO_RESOURCES_CHECK_CLERR (clGetKernelWorkGroupInfo (priv->row_kernel, device, CL_KERNEL_WORK_GROUP_SIZE,
+                                                             sizeof (gsize), &kernel_size, NULL));
+
+        value = ufo_gpu_node_get_info (node, UFO_GPU_NODE_INFO_MAX_WORK_GROUP_SIZE);
+        max_size = MIN (MIN (g_value_get_ulong (value), kernel_size), 256);
+        g_value_unset (value);
+
+        /* The row kernel may be limited below the device by its local tiles */
+        priv->row_size = 1;
+
+        while (priv->row_size * 2 <= max_size)
+            priv->row_size *= 2;
+
+        value = ufo_gpu_node_get_info (node, UFO_GPU_NODE_INFO_MAX_MEM_ALLOC_SIZE);
+        priv->max_alloc_size = g_value_get_ulong (value);
+        g_value_unset (value);
+    }
+
+    /* Independent slices unless slices are searched as well */
+    search_radius = (cl_int) priv->search_radius;
+    slice_radius = (cl_int) MIN (priv->slice_radius, (guint) depth - 1);
+    patch_radius = (cl_int) priv->patch_radius;
+    num_offsets = (2 * search_radius + 1) * (2 * search_radius + 1) * (2 * slice_radius + 1);
+
+    update_fast_buffers (priv, num_pixels, num_offsets);
+
+    tile_size = priv->row_size + 2 * patch_radius;
+    local_work_size[0] = priv->row_size;
+    local_work_size[1] = 1;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->column_kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->column_kernel, 1, sizeof (cl_mem), &priv->sums_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->column_kernel, 3, sizeof (cl_int), &search_radius));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->column_kernel, 4, sizeof (cl_int), &slice_radius));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->column_kernel, 5, sizeof (cl_int), &patch_radius));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->column_kernel, 6, sizeof (cl_int), &width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->column_kernel, 7, sizeof (cl_int), &height));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->column_kernel, 8, sizeof (cl_int), &depth));
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 1, sizeof (cl_mem), &priv->sums_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 2, sizeof (cl_mem), &priv->numerator_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 3, sizeof (cl_mem), &priv->denominator_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 6, sizeof (cl_int), &search_radius));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 7, sizeof (cl_int), &slice_radius));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 8, sizeof (cl_int), &patch_radius));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 9, sizeof (gfloat), &priv->sigma));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 10, sizeof (cl_int), &width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 11, sizeof (cl_int), &height));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 12, sizeof (cl_int), &depth));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 14, tile_size * sizeof (gfloat), NULL));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 15, tile_size * sizeof (gfloat), NULL));
+
+    for (guint offset = 0; offset < num_offsets; offset += priv->batch_size) {
+        first_offset = (cl_int) offset;
+        num_batch_offsets = (cl_int) MIN (priv->batch_size, num_offsets - offset);
+        first = offset == 0;
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->column_kernel, 2, sizeof (cl_int), &first_offset));
+        global_work_size[0] = (gsize) width;
+        global_work_size[1] = (gsize) depth;
+        global_work_size[2] = (gsize) num_batch_offsets;
+        ufo_profiler_call (profiler, cmd_queue, priv->column_kernel, 3, global_work_size, NULL);
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 4, sizeof (cl_int), &first_offset));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 5, sizeof (cl_int), &num_batch_offsets));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->row_kernel, 13, sizeof (cl_int), &first));
+        global_work_size[0] = ((width + priv->row_size - 1) / priv->row_size) * priv->row_size;
+        global_work_size[1] = (gsize) height * depth;
+        ufo_profiler_call (profiler, cmd_queue, priv->row_kernel, 2, global_work_size, local_work_size);
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->normalize_kernel, 0, sizeof (cl_mem), &priv->numerator_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->normalize_kernel, 1, sizeof (cl_mem), &priv->denominator_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->normalize_kernel, 2, sizeof (cl_mem), &out_mem));
+    ufo_profiler_call (profiler, cmd_queue, priv->normalize_kernel, 1, &num_pixels, NULL);
+}
+
 static gboolean
 ufo_non_local_means_task_process (UfoTask *task,
                                   UfoBuffer **inputs,
@@ -117,14 +325,18 @@ ufo_non_local_means_task_process (UfoTask *task,
     cmd_queue = ufo_gpu_node_get_cmd_queue (node);
     in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
     out_mem = ufo_buffer_get_device_array (output, cmd_queue);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+
+    if (priv->fast) {
+        process_fast (priv, node, cmd_queue, profiler, in_mem, out_mem, requisition);
+        return TRUE;
+    }
 
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 0, sizeof (cl_mem), &in_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 1, sizeof (cl_mem), &out_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 2, sizeof (guint), &priv->search_radius));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 3, sizeof (guint), &priv->patch_radius));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 4, sizeof (gfloat), &priv->sigma));
-
-    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
     ufo_profiler_call (profiler, cmd_queue, priv->kernel, 2, requisition->dims, NULL);
 
     return TRUE;
@@ -158,6 +370,15 @@ ufo_non_local_means_task_set_property (GObject *object,
         case PROP_SIGMA:
             priv->sigma = g_value_get_float (value);
             break;
+        case PROP_FAST:
+            priv->fast = g_value_get_boolean (value);
+            break;
+        case PROP_SLICE_RADIUS:
+            priv->slice_radius = g_value_get_uint (value);
+            break;
+        case PROP_HALF_STORAGE:
+            priv->half_storage = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -182,6 +403,15 @@ ufo_non_local_means_task_get_property (GObject *object,
         case PROP_SIGMA:
             g_value_set_float (value, priv->sigma);
             break;
+        case PROP_FAST:
+            g_value_set_boolean (value, priv->fast);
+            break;
+        case PROP_SLICE_RADIUS:
+            g_value_set_uint (value, priv->slice_radius);
+            break;
+        case PROP_HALF_STORAGE:
+            g_value_set_boolean (value, priv->half_storage);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -200,6 +430,28 @@ ufo_non_local_means_task_finalize (GObject *object)
         priv->kernel = NULL;
     }
 
+    if (priv->column_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->column_kernel));
+        priv->column_kernel = NULL;
+    }
+
+    if (priv->row_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->row_kernel));
+        priv->row_kernel = NULL;
+    }
+
+    if (priv->normalize_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->normalize_kernel));
+        priv->normalize_kernel = NULL;
+    }
+
+    release_fast_buffers (priv);
+
+    if (priv->context) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_non_local_means_task_parent_class)->finalize (object);
 }
 
@@ -244,6 +496,27 @@ ufo_non_local_means_task_class_init (UfoNonLocalMeansTaskClass *klass)
             0.0f, G_MAXFLOAT, 0.1f,
             G_PARAM_READWRITE);
 
+    properties[PROP_FAST] =
+        g_param_spec_boolean ("fast",
+            "Use integral images of the patch distances",
+            "Use integral images of the patch distances",
+            FALSE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_SLICE_RADIUS] =
+        g_param_spec_uint ("slice-radius",
+            "Search and patch radius across slices of 3D input in fast mode",
+            "Search and patch radius across slices of 3D input in fast mode",
+            0, 64, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_HALF_STORAGE] =
+        g_param_spec_boolean ("half-storage",
+            "Store intermediate sums as half floats in fast mode",
+            "Store intermediate sums as half floats in fast mode",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -258,4 +531,18 @@ ufo_non_local_means_task_init(UfoNonLocalMeansTask *self)
     self->priv->search_radius = 10;
     self->priv->patch_radius = 3;
     self->priv->sigma = 0.1f;
+    self->priv->slice_radius = 0;
+    self->priv->fast = FALSE;
+    self->priv->half_storage = FALSE;
+    self->priv->kernel = NULL;
+    self->priv->context = NULL;
+    self->priv->column_kernel = NULL;
+    self->priv->row_kernel = NULL;
+    self->priv->normalize_kernel = NULL;
+    self->priv->sums_mem = NULL;
+    self->priv->numerator_mem = NULL;
+    self->priv->denominator_mem = NULL;
+    self->priv->num_pixels = 0;
+    self->priv->batch_size = 0;
+    self->priv->row_size = 0;
 }
@@ -28,10 +28,12 @@
 
 #include "ufo-ordfilt-task.h"
 #include "ufo-priv.h"
+#include "common/ufo-tile.h"
 
 struct _UfoOrdfiltTaskPrivate {
     cl_kernel k_bitonic_ordfilt;
     cl_kernel k_load_elements_from_patern;
+    cl_kernel k_load_elements_tiled;
     size_t max_alloc_size;
     gpointer context;
 };
@@ -89,6 +91,11 @@ ufo_ordfilt_task_setup (UfoTask *task,
 
     if (priv->k_load_elements_from_patern != NULL)
         UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->k_load_elements_from_patern));
+
+    priv->k_load_elements_tiled = ufo_resources_get_kernel (resources, "ordfilt.cl", "load_elements_from_pattern_tiled", NULL, error);
+
+    if (priv->k_load_elements_tiled != NULL)
+        UFO_RESOURCES_CHECK_CLERR (clRetainKernel (priv->k_load_elements_tiled));
 }
 
 static void
@@ -162,8 +169,50 @@ launch_kernel_1D (cl_kernel k, UfoBuffer *ufo_src, UfoBuffer *ufo_dst,
                                                        0, NULL, NULL));
 }
 
+static gboolean
+launch_kernel_2D_tiled (cl_kernel kernel, cl_mem src, cl_mem pattern, cl_mem dst,
+                        UfoBuffer *ufo_dst, cl_command_queue cmd_queue, size_t dimension,
+                        size_t num_ones, unsigned width, unsigned height,
+                        unsigned y_offset, unsigned mod)
+{
+    UfoRequisition requisition;
+    size_t size[2];
+    size_t halo[2];
+    size_t global_work_size[2];
+    size_t local_work_size[2];
+    size_t local_mem_size;
+    cl_int rows;
+
+    ufo_buffer_get_requisition (ufo_dst, &requisition);
+    size[0] = requisition.dims[0];
+    size[1] = requisition.dims[1] - mod;
+    rows = (cl_int) size[1];
+    halo[0] = halo[1] = dimension - 1;
+
+    if (!ufo_tile_get_work_size (cmd_queue, kernel, size, halo, global_work_size,
+                                 local_work_size, &local_mem_size))
+        return FALSE;
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &src));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &dst));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (cl_mem), &pattern));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, sizeof (cl_int), &dimension));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 4, sizeof (cl_int), &num_ones));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 5, sizeof (cl_int), &width));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 6, sizeof (cl_int), &height));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 7, sizeof (cl_uint), &y_offset));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 8, sizeof (cl_int), &rows));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 9, local_mem_size, NULL));
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueNDRangeKernel (cmd_queue,
+                                                       kernel,
+                                                       2, NULL, global_work_size,
+                                                       local_work_size,
+                                                       0, NULL, NULL));
+    return TRUE;
+}
+
 static void
-launch_kernel_2D(cl_kernel kernel, UfoBuffer *ufo_src, UfoBuffer *ufo_pattern,
+launch_kernel_2D(cl_kernel kernel, cl_kernel tiled_kernel, UfoBuffer *ufo_src, UfoBuffer *ufo_pattern,
                  UfoBuffer *ufo_dst, cl_command_queue cmd_queue, size_t dimension,
                  size_t num_ones, unsigned height, unsigned y_offset, unsigned mod)
 {
@@ -177,6 +226,15 @@ launch_kernel_2D(cl_kernel kernel, UfoBuffer *ufo_src, UfoBuffer *ufo_pattern,
     src = ufo_buffer_get_device_array(ufo_src, cmd_queue);
     pattern = ufo_buffer_get_device_array(ufo_pattern, cmd_queue);
 
+    /* Prefer staging the filter footprint in local memory, which fails only
+     * for patterns too large for the device */
+    ufo_buffer_get_requisition (ufo_src, &requisition);
+
+    if (launch_kernel_2D_tiled (tiled_kernel, src, pattern, dst, ufo_dst, cmd_queue,
+                                dimension, num_ones, (unsigned) requisition.dims[0],
+                                height, y_offset, mod))
+        return;
+
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &src));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &dst));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (cl_mem), &pattern));
@@ -254,7 +312,7 @@ compute_ordfilt (UfoOrdfiltTaskPrivate *priv, UfoBuffer *src, UfoBuffer *pattern
 
     /* loads surrounding number_ones pixels of each pixel in image.
      * Result in buffer */
-    launch_kernel_2D (priv->k_load_elements_from_patern, src, pattern,
+    launch_kernel_2D (priv->k_load_elements_from_patern, priv->k_load_elements_tiled, src, pattern,
                       ufo_buffer, cmd_queue, pattern_requisition.dims[0],
                       number_ones, height, y_offset, 0);
     /* Create image of threshold telling how likely a pixel is a center of a
@@ -266,7 +324,7 @@ compute_ordfilt (UfoOrdfiltTaskPrivate *priv, UfoBuffer *src, UfoBuffer *pattern
         /* start at mod offset, since first iteration manipulated
          * iter * height + mod rows */
         y_offset = mod + iter * (height - mod) / iter_count;
-        launch_kernel_2D (priv->k_load_elements_from_patern, src, pattern,
+        launch_kernel_2D (priv->k_load_elements_from_patern, priv->k_load_elements_tiled, src, pattern,
                           ufo_buffer, cmd_queue, pattern_requisition.dims[0],
                           number_ones, height, y_offset, mod);
         launch_kernel_1D (priv->k_bitonic_ordfilt, ufo_buffer, dst, cmd_queue,
@@ -297,6 +355,23 @@ ufo_ordfilt_task_process (UfoTask *task,
 static void
 ufo_ordfilt_task_finalize (GObject *object)
 {
+    UfoOrdfiltTaskPrivate *priv = UFO_ORDFILT_TASK_GET_PRIVATE (object);
+
+    if (priv->k_bitonic_ordfilt) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->k_bitonic_ordfilt));
+        priv->k_bitonic_ordfilt = NULL;
+    }
+
+    if (priv->k_load_elements_from_patern) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->k_load_elements_from_patern));
+        priv->k_load_elements_from_patern = NULL;
+    }
+
+    if (priv->k_load_elements_tiled) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->k_load_elements_tiled));
+        priv->k_load_elements_tiled = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_ordfilt_task_parent_class)->finalize (object);
 }
 
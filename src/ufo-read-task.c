@@ -17,6 +17,12 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#ifdef __APPLE__
+#include <OpenCL/cl.h>
+#else
+#include <CL/cl.h>
+#endif
+
 #include <gmodule.h>
 #include <stdlib.h>
 #include <string.h>
@@ -28,6 +34,7 @@
 #include "readers/ufo-reader.h"
 #include "readers/ufo-edf-reader.h"
 #include "readers/ufo-raw-reader.h"
+#include "common/ufo-pinned.h"
 
 #ifdef HAVE_TIFF
 #include "readers/ufo-tiff-reader.h"
@@ -63,6 +70,13 @@ static GEnumValue type_values[] = {
     { 0, NULL, NULL}
 };
 
+typedef struct {
+    UfoBuffer       *buffer;
+    UfoRequisition   requisition;
+    gboolean         last;
+    GError          *error;
+} PrefetchSlot;
+
 struct _UfoReadTaskPrivate {
     gchar   *path;
     GList   *filenames;
@@ -96,6 +110,17 @@ struct _UfoReadTaskPrivate {
 #endif
 
     FileType         type;
+
+    cl_context       context;
+    UfoPinnedPool   *pinned;
+    guint            prefetch;
+    PrefetchSlot    *slots;
+    PrefetchSlot    *pending;
+    GAsyncQueue     *free_slots;
+    GAsyncQueue     *filled_slots;
+    GThread         *prefetch_thread;
+    gint             stop_prefetch;
+    gboolean         prefetch_done;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -121,9 +146,16 @@ enum {
     PROP_RAW_BITDEPTH,
     PROP_RAW_PRE_OFFSET,
     PROP_RAW_POST_OFFSET,
+    PROP_RAW_MMAP,
+#ifdef WITH_HDF5
+    PROP_HDF5_BATCH,
+    PROP_HDF5_SWMR,
+    PROP_HDF5_SWMR_TIMEOUT,
+#endif
     PROP_TYPE,
     PROP_RETRIES,
     PROP_RETRY_TIMEOUT,
+    PROP_PREFETCH,
     N_PROPERTIES
 };
 
@@ -226,6 +258,12 @@ ufo_read_task_setup (UfoTask *task,
 
     priv->start = 0;
     priv->current = 0;
+
+    priv->context = ufo_resources_get_context (resources);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
+
+    if (priv->pinned == NULL)
+        priv->pinned = ufo_pinned_pool_new (priv->context, error);
 }
 
 static UfoReader *
@@ -250,23 +288,24 @@ get_reader (UfoReadTaskPrivate *priv, const gchar *filename)
     return NULL;
 }
 
-static void
-ufo_read_task_get_requisition (UfoTask *task,
-                               UfoBuffer **inputs,
-                               UfoRequisition *requisition,
-                               GError **error)
+/*
+ * Advance to the next file if necessary and determine the requisition of the
+ * next frame. Returns FALSE if an error occured or no more data is available,
+ * in which case priv->done is set.
+ */
+static gboolean
+read_next_meta (UfoReadTaskPrivate *priv,
+                UfoRequisition *requisition,
+                GError **error)
 {
-    UfoReadTaskPrivate *priv;
     const gchar *filename;
 
-    priv = UFO_READ_TASK_GET_PRIVATE (UFO_READ_TASK (task));
-
     if (priv->reader == NULL) {
         filename = (gchar *) priv->current_element->data;
         priv->reader = get_reader (priv, filename);
 
         if (!ufo_reader_open (priv->reader, filename, priv->start, error))
-            return;
+            return FALSE;
 
         priv->start = 0;
     }
@@ -283,7 +322,7 @@ ufo_read_task_get_requisition (UfoTask *task,
             if (priv->retries == 0 || priv->current == priv->number) {
                 priv->done = TRUE;
                 priv->reader = NULL;
-                return;
+                return FALSE;
             }
 
             for (tries = 0; tries < priv->retries && priv->current_element == NULL; tries++) {
@@ -308,7 +347,7 @@ ufo_read_task_get_requisition (UfoTask *task,
             if (priv->current_element == NULL) {
                 priv->done = TRUE;
                 priv->reader = NULL;
-                return;
+                return FALSE;
             }
         }
 
@@ -316,11 +355,11 @@ ufo_read_task_get_requisition (UfoTask *task,
         priv->reader = get_reader (priv, filename);
 
         if (!ufo_reader_open (priv->reader, filename, 0, error))
-            return;
+            return FALSE;
     }
 
     if (!ufo_reader_get_meta (priv->reader, requisition, &priv->depth, error))
-        return;
+        return FALSE;
 
     if (priv->depth > 32)
         /*
@@ -348,6 +387,153 @@ ufo_read_task_get_requisition (UfoTask *task,
 
     /* update height for reduced vertical ROI */
     requisition->dims[1] = priv->roi_height / priv->roi_step;
+
+    return TRUE;
+}
+
+static void
+read_next_frame (UfoReadTaskPrivate *priv,
+                 UfoBuffer *buffer,
+                 UfoRequisition *requisition)
+{
+    /* Read straight into pinned memory so that the upload can use DMA */
+    ufo_pinned_pool_attach (priv->pinned, buffer);
+    ufo_reader_read (priv->reader, buffer, requisition, priv->roi_y, priv->roi_height, priv->roi_step);
+
+    if ((priv->depth != UFO_BUFFER_DEPTH_32F) && priv->convert)
+        ufo_buffer_convert (buffer, priv->depth);
+
+    priv->current++;
+}
+
+static gpointer
+prefetch_thread_func (UfoReadTaskPrivate *priv)
+{
+    PrefetchSlot *slot;
+
+    while (TRUE) {
+        slot = g_async_queue_pop (priv->free_slots);
+
+        if (g_atomic_int_get (&priv->stop_prefetch)) {
+            g_async_queue_push (priv->free_slots, slot);
+            break;
+        }
+
+        if (priv->current == priv->number || priv->done ||
+            !read_next_meta (priv, &slot->requisition, &slot->error)) {
+            slot->last = TRUE;
+            g_async_queue_push (priv->filled_slots, slot);
+            break;
+        }
+
+        if (slot->buffer == NULL)
+            slot->buffer = ufo_buffer_new (&slot->requisition, priv->context);
+        else if (ufo_buffer_cmp_dimensions (slot->buffer, &slot->requisition))
+            ufo_buffer_resize (slot->buffer, &slot->requisition);
+
+        read_next_frame (priv, slot->buffer, &slot->requisition);
+        g_async_queue_push (priv->filled_slots, slot);
+    }
+
+    return NULL;
+}
+
+static void
+start_prefetching (UfoReadTaskPrivate *priv)
+{
+    priv->slots = g_new0 (PrefetchSlot, priv->prefetch);
+    priv->free_slots = g_async_queue_new ();
+    priv->filled_slots = g_async_queue_new ();
+    priv->stop_prefetch = 0;
+
+    for (guint i = 0; i < priv->prefetch; i++)
+        g_async_queue_push (priv->free_slots, &priv->slots[i]);
+
+    priv->prefetch_thread = g_thread_new ("read-prefetch", (GThreadFunc) prefetch_thread_func, priv);
+}
+
+static void
+stop_prefetching (UfoReadTaskPrivate *priv)
+{
+    if (priv->prefetch_thread != NULL) {
+        PrefetchSlot *slot;
+
+        g_atomic_int_set (&priv->stop_prefetch, 1);
+
+        /* Return all slots so that a reader thread blocked on a full queue
+         * wakes up, it may stop at any point before the end of the stream */
+        if (priv->pending != NULL) {
+            g_async_queue_push (priv->free_slots, priv->pending);
+            priv->pending = NULL;
+        }
+
+        while ((slot = g_async_queue_try_pop (priv->filled_slots)) != NULL)
+            g_async_queue_push (priv->free_slots, slot);
+
+        g_thread_join (priv->prefetch_thread);
+        priv->prefetch_thread = NULL;
+    }
+
+    if (priv->slots != NULL) {
+        for (guint i = 0; i < priv->prefetch; i++) {
+            if (priv->slots[i].buffer != NULL)
+                g_object_unref (priv->slots[i].buffer);
+
+            g_clear_error (&priv->slots[i].error);
+        }
+
+        g_free (priv->slots);
+        priv->slots = NULL;
+    }
+
+    if (priv->free_slots != NULL) {
+        g_async_queue_unref (priv->free_slots);
+        g_async_queue_unref (priv->filled_slots);
+        priv->free_slots = NULL;
+        priv->filled_slots = NULL;
+    }
+}
+
+static void
+ufo_read_task_get_requisition (UfoTask *task,
+                               UfoBuffer **inputs,
+                               UfoRequisition *requisition,
+                               GError **error)
+{
+    UfoReadTaskPrivate *priv;
+
+    priv = UFO_READ_TASK_GET_PRIVATE (UFO_READ_TASK (task));
+
+    if (priv->prefetch == 0) {
+        read_next_meta (priv, requisition, error);
+        return;
+    }
+
+    /*
+     * priv->done and the reader state belong to the prefetch thread from now
+     * on, we only keep track of the slots it hands to us.
+     */
+    if (priv->prefetch_done)
+        return;
+
+    if (priv->prefetch_thread == NULL)
+        start_prefetching (priv);
+
+    if (priv->pending == NULL)
+        priv->pending = g_async_queue_pop (priv->filled_slots);
+
+    if (priv->pending->last) {
+        priv->prefetch_done = TRUE;
+
+        if (priv->pending->error != NULL) {
+            g_propagate_error (error, priv->pending->error);
+            priv->pending->error = NULL;
+        }
+
+        return;
+    }
+
+    *requisition = priv->pending->requisition;
 }
 
 static guint
@@ -378,15 +564,23 @@ ufo_read_task_generate (UfoTask *task,
 
     priv = UFO_READ_TASK_GET_PRIVATE (UFO_READ_TASK (task));
 
+    if (priv->prefetch > 0) {
+        if (priv->prefetch_done || priv->pending == NULL)
+            return FALSE;
+
+        /* Hand out the prefetched data and recycle the slot with our memory,
+         * which has to be pinned as well to keep all slots pinned */
+        ufo_pinned_pool_attach (priv->pinned, output);
+        ufo_buffer_swap_data (priv->pending->buffer, output);
+        g_async_queue_push (priv->free_slots, priv->pending);
+        priv->pending = NULL;
+        return TRUE;
+    }
+
     if (priv->current == priv->number || priv->done)
         return FALSE;
 
-    ufo_reader_read (priv->reader, output, requisition, priv->roi_y, priv->roi_height, priv->roi_step);
-
-    if ((priv->depth != UFO_BUFFER_DEPTH_32F) && priv->convert)
-        ufo_buffer_convert (output, priv->depth);
-
-    priv->current++;
+    read_next_frame (priv, output, requisition);
     return TRUE;
 }
 
@@ -439,6 +633,20 @@ ufo_read_task_set_property (GObject *object,
         case PROP_RAW_POST_OFFSET:
             g_object_set_property (G_OBJECT (priv->raw_reader), "post-offset", value);
             break;
+        case PROP_RAW_MMAP:
+            g_object_set_property (G_OBJECT (priv->raw_reader), "mmap", value);
+            break;
+#ifdef WITH_HDF5
+        case PROP_HDF5_BATCH:
+            g_object_set_property (G_OBJECT (priv->hdf5_reader), "batch", value);
+            break;
+        case PROP_HDF5_SWMR:
+            g_object_set_property (G_OBJECT (priv->hdf5_reader), "swmr", value);
+            break;
+        case PROP_HDF5_SWMR_TIMEOUT:
+            g_object_set_property (G_OBJECT (priv->hdf5_reader), "swmr-timeout", value);
+            break;
+#endif
         case PROP_TYPE:
             priv->type = g_value_get_enum (value);
             break;
@@ -448,6 +656,9 @@ ufo_read_task_set_property (GObject *object,
         case PROP_RETRY_TIMEOUT:
             priv->retry_timeout = g_value_get_uint (value);
             break;
+        case PROP_PREFETCH:
+            priv->prefetch = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -502,6 +713,20 @@ ufo_read_task_get_property (GObject *object,
         case PROP_RAW_POST_OFFSET:
             g_object_get_property (G_OBJECT (priv->raw_reader), "post-offset", value);
             break;
+        case PROP_RAW_MMAP:
+            g_object_get_property (G_OBJECT (priv->raw_reader), "mmap", value);
+            break;
+#ifdef WITH_HDF5
+        case PROP_HDF5_BATCH:
+            g_object_get_property (G_OBJECT (priv->hdf5_reader), "batch", value);
+            break;
+        case PROP_HDF5_SWMR:
+            g_object_get_property (G_OBJECT (priv->hdf5_reader), "swmr", value);
+            break;
+        case PROP_HDF5_SWMR_TIMEOUT:
+            g_object_get_property (G_OBJECT (priv->hdf5_reader), "swmr-timeout", value);
+            break;
+#endif
         case PROP_TYPE:
             g_value_set_enum (value, priv->type);
             break;
@@ -511,6 +736,9 @@ ufo_read_task_get_property (GObject *object,
         case PROP_RETRY_TIMEOUT:
             g_value_set_uint (value, priv->retry_timeout);
             break;
+        case PROP_PREFETCH:
+            g_value_set_uint (value, priv->prefetch);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -524,6 +752,13 @@ ufo_read_task_dispose (GObject *object)
 
     priv = UFO_READ_TASK_GET_PRIVATE (object);
 
+    stop_prefetching (priv);
+
+    if (priv->pinned != NULL) {
+        ufo_pinned_pool_destroy (priv->pinned);
+        priv->pinned = NULL;
+    }
+
     g_object_unref (priv->edf_reader);
     g_object_unref (priv->raw_reader);
 
@@ -553,6 +788,11 @@ ufo_read_task_finalize (GObject *object)
         priv->filenames = NULL;
     }
 
+    if (priv->context) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
+        priv->context = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_read_task_parent_class)->finalize (object);
 }
 
@@ -668,6 +908,36 @@ ufo_read_task_class_init(UfoReadTaskClass *klass)
             0, G_MAXULONG, 0,
             G_PARAM_READWRITE);
 
+    properties[PROP_RAW_MMAP] =
+        g_param_spec_boolean ("raw-mmap",
+            "Map raw files into memory instead of reading them",
+            "Map raw files into memory instead of reading them",
+            FALSE,
+            G_PARAM_READWRITE);
+
+#ifdef WITH_HDF5
+    properties[PROP_HDF5_BATCH] =
+        g_param_spec_uint ("hdf5-batch",
+            "Number of HDF5 frames read at once, 0 derives it from the chunk layout",
+            "Number of HDF5 frames read at once, 0 derives it from the chunk layout",
+            0, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_SWMR] =
+        g_param_spec_boolean ("hdf5-swmr",
+            "Follow an HDF5 file that is being written in SWMR mode",
+            "Follow an HDF5 file that is being written in SWMR mode",
+            FALSE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_SWMR_TIMEOUT] =
+        g_param_spec_uint ("hdf5-swmr-timeout",
+            "Seconds to wait for new HDF5 frames in SWMR mode",
+            "Seconds to wait for new HDF5 frames in SWMR mode",
+            0, G_MAXUINT, 10,
+            G_PARAM_READWRITE);
+#endif
+
     properties[PROP_TYPE] =
         g_param_spec_enum ("type",
             "Override type detection based on extension",
@@ -690,6 +960,13 @@ ufo_read_task_class_init(UfoReadTaskClass *klass)
             0, G_MAXUINT, 1,
             G_PARAM_READWRITE);
 
+    properties[PROP_PREFETCH] =
+        g_param_spec_uint ("prefetch",
+            "Number of frames to read ahead in a background thread",
+            "Number of frames to read ahead in a background thread, 0 disables prefetching",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -729,4 +1006,12 @@ ufo_read_task_init(UfoReadTask *self)
     priv->done = FALSE;
     priv->single = FALSE;
     priv->type = TYPE_UNSPECIFIED;
+    priv->context = NULL;
+    priv->prefetch = 0;
+    priv->slots = NULL;
+    priv->pending = NULL;
+    priv->free_slots = NULL;
+    priv->filled_slots = NULL;
+    priv->prefetch_thread = NULL;
+    priv->prefetch_done = FALSE;
 }
@@ -24,10 +24,12 @@
 #endif
 
 #include "ufo-remove-outliers-task.h"
+#include "common/ufo-tile.h"
 
 
 struct _UfoRemoveOutliersTaskPrivate {
     cl_kernel kernel;
+    cl_kernel tiled_kernel;
     guint size;
     gfloat threshold;
     gint sign;
@@ -69,9 +71,14 @@ ufo_remove_outliers_task_setup (UfoTask *task,
     option = g_strdup_printf (" -DBOX_SIZE=%i ", priv->size);
 
     priv->kernel = ufo_resources_get_kernel (resources, "rm-outliers.cl", "filter", option, error);
+    priv->tiled_kernel = ufo_resources_get_kernel (resources, "rm-outliers.cl", "filter_tiled", option, error);
+    g_free (option);
 
     if (priv->kernel != NULL)
         UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel), error);
+
+    if (priv->tiled_kernel != NULL)
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->tiled_kernel), error);
 }
 
 static void
@@ -114,6 +121,10 @@ ufo_remove_outliers_task_process (UfoTask *task,
     cl_command_queue cmd_queue;
     cl_mem in_mem;
     cl_mem out_mem;
+    gsize halo[2];
+    gsize global_size[2];
+    gsize local_size[2];
+    gsize local_mem_size;
 
     priv = UFO_REMOVE_OUTLIERS_TASK_GET_PRIVATE (task);
 
@@ -123,6 +134,24 @@ ufo_remove_outliers_task_process (UfoTask *task,
     out_mem = ufo_buffer_get_device_array (output, cmd_queue);
     profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
 
+    halo[0] = halo[1] = priv->size - 1;
+
+    if (ufo_tile_get_work_size (cmd_queue, priv->tiled_kernel, requisition->dims, halo,
+                                global_size, local_size, &local_mem_size)) {
+        cl_int width = (cl_int) requisition->dims[0];
+        cl_int height = (cl_int) requisition->dims[1];
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 0, sizeof (cl_mem), &in_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 1, sizeof (cl_mem), &out_mem));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 2, local_mem_size, NULL));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 3, sizeof (gfloat), &priv->threshold));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 4, sizeof (gint), &priv->sign));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 5, sizeof (cl_int), &width));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->tiled_kernel, 6, sizeof (cl_int), &height));
+        ufo_profiler_call (profiler, cmd_queue, priv->tiled_kernel, 2, global_size, local_size);
+        return TRUE;
+    }
+
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 0, sizeof (cl_mem), &in_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 1, sizeof (cl_mem), &out_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 2, sizeof (gfloat), &priv->threshold));
@@ -209,6 +238,10 @@ ufo_remove_outliers_task_finalize (GObject *object)
         priv->kernel = NULL;
     }
 
+    if (priv->tiled_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->tiled_kernel));
+        priv->tiled_kernel = NULL;
+    }
 
     G_OBJECT_CLASS (ufo_remove_outliers_task_parent_class)->finalize (object);
 }
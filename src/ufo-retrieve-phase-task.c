@@ -54,6 +54,7 @@ struct _UfoRetrievePhaseTaskPrivate {
     gfloat pixel_size;
     gfloat regularization_rate;
     gfloat binary_filter;
+    gboolean half_spectrum;
 
     gfloat prefac;
     cl_kernel *kernels;
@@ -79,6 +80,7 @@ enum {
     PROP_PIXEL_SIZE,
     PROP_REGULARIZATION_RATE,
     PROP_BINARY_FILTER_THRESHOLDING,
+    PROP_HALF_SPECTRUM,
     N_PROPERTIES
 };
 
@@ -111,7 +113,9 @@ ufo_retrieve_phase_task_setup (UfoTask *task,
     priv->kernels[METHOD_QPHALFSINE] = ufo_resources_get_kernel (resources, "phase-retrieval.cl", "qphalfsine_method", NULL, error);
     priv->kernels[METHOD_QP2] = ufo_resources_get_kernel (resources, "phase-retrieval.cl", "qp2_method", NULL, error);
 
-    priv->mult_by_value_kernel = ufo_resources_get_kernel (resources, "phase-retrieval.cl", "mult_by_value", NULL, error);
+    priv->mult_by_value_kernel = ufo_resources_get_kernel (resources, "phase-retrieval.cl",
+                                                           priv->half_spectrum ? "mult_by_value_half" : "mult_by_value",
+                                                           NULL, error);
 
     UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext(priv->context), error);
 
@@ -141,9 +145,14 @@ ufo_retrieve_phase_task_get_requisition (UfoTask *task,
                                          UfoRequisition *requisition,
                                          GError **error)
 {
+    UfoRetrievePhaseTaskPrivate *priv;
+    gsize width;
+
+    priv = UFO_RETRIEVE_PHASE_TASK_GET_PRIVATE (task);
     ufo_buffer_get_requisition (inputs[0], requisition);
+    width = priv->half_spectrum ? 4 * (requisition->dims[0] / 2 - 1) : requisition->dims[0];
 
-    if (!IS_POW_OF_2 (requisition->dims[0]) || !IS_POW_OF_2 (requisition->dims[1])) {
+    if (!IS_POW_OF_2 (width) || !IS_POW_OF_2 (requisition->dims[1])) {
         g_set_error_literal (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
                              "Please, perform zeropadding of your dataset along both directions (width, height) up to length of power of 2 (e.g. 256, 512, 1024, 2048, etc.)");
     }
@@ -177,8 +186,10 @@ ufo_retrieve_phase_task_process (UfoTask *task,
     UfoRetrievePhaseTaskPrivate *priv;
     UfoGpuNode *node;
     UfoProfiler *profiler;
+    UfoRequisition filter_requisition;
 
     cl_mem in_mem, out_mem, filter_mem;
+    cl_int filter_width;
     cl_kernel method_kernel;
     cl_command_queue cmd_queue;
 
@@ -190,8 +201,14 @@ ufo_retrieve_phase_task_process (UfoTask *task,
     in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
     profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
 
-    if (ufo_buffer_cmp_dimensions (priv->filter_buffer, requisition) != 0) {
-        ufo_buffer_resize (priv->filter_buffer, requisition);
+    /* the filter of a half spectrum is computed for the full width and cropped */
+    filter_requisition = *requisition;
+
+    if (priv->half_spectrum)
+        filter_requisition.dims[0] = 4 * (requisition->dims[0] / 2 - 1);
+
+    if (ufo_buffer_cmp_dimensions (priv->filter_buffer, &filter_requisition) != 0) {
+        ufo_buffer_resize (priv->filter_buffer, &filter_requisition);
         filter_mem = ufo_buffer_get_device_array (priv->filter_buffer, cmd_queue);
 
         method_kernel = priv->kernels[(gint)priv->method];
@@ -200,7 +217,7 @@ ufo_retrieve_phase_task_process (UfoTask *task,
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (method_kernel, 1, sizeof (gfloat), &priv->regularization_rate));
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (method_kernel, 2, sizeof (gfloat), &priv->binary_filter));
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (method_kernel, 3, sizeof (cl_mem), &filter_mem));
-        ufo_profiler_call (profiler, cmd_queue, method_kernel, requisition->n_dims, requisition->dims, NULL);
+        ufo_profiler_call (profiler, cmd_queue, method_kernel, filter_requisition.n_dims, filter_requisition.dims, NULL);
     }
     else {
         filter_mem = ufo_buffer_get_device_array (priv->filter_buffer, cmd_queue);
@@ -209,6 +226,12 @@ ufo_retrieve_phase_task_process (UfoTask *task,
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 0, sizeof (cl_mem), &in_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 1, sizeof (cl_mem), &filter_mem));
     UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 2, sizeof (cl_mem), &out_mem));
+
+    if (priv->half_spectrum) {
+        filter_width = (cl_int) filter_requisition.dims[0];
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->mult_by_value_kernel, 3, sizeof (cl_int), &filter_width));
+    }
+
     ufo_profiler_call (profiler, cmd_queue, priv->mult_by_value_kernel, requisition->n_dims, requisition->dims, NULL);
     
     return TRUE;
@@ -241,6 +264,9 @@ ufo_retrieve_phase_task_get_property (GObject *object,
         case PROP_BINARY_FILTER_THRESHOLDING:
             g_value_set_float (value, priv->binary_filter);
             break;
+        case PROP_HALF_SPECTRUM:
+            g_value_set_boolean (value, priv->half_spectrum);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -274,6 +300,9 @@ ufo_retrieve_phase_task_set_property (GObject *object,
         case PROP_BINARY_FILTER_THRESHOLDING:
             priv->binary_filter = g_value_get_float (value);
             break;
+        case PROP_HALF_SPECTRUM:
+            priv->half_spectrum = g_value_get_boolean (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -377,6 +406,13 @@ ufo_retrieve_phase_task_class_init (UfoRetrievePhaseTaskClass *klass)
             0, G_MAXFLOAT, 0.1,
             G_PARAM_READWRITE);
 
+    properties[PROP_HALF_SPECTRUM] =
+        g_param_spec_boolean ("half-spectrum",
+            "Input is the non-redundant half of the spectrum of real data",
+            "Input is the non-redundant half of the spectrum of real data",
+            FALSE,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -394,6 +430,7 @@ ufo_retrieve_phase_task_init(UfoRetrievePhaseTask *self)
     priv->pixel_size = 0.75e-6f;
     priv->regularization_rate = 2.5f;
     priv->binary_filter = 0.1f;
+    priv->half_spectrum = FALSE;
     priv->kernels = (cl_kernel *) g_malloc0(N_METHODS * sizeof(cl_kernel));
     priv->filter_buffer = NULL;
 }
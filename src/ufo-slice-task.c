@@ -101,9 +101,25 @@ ufo_slice_task_process (UfoTask *task,
                         UfoRequisition *requisition)
 {
     UfoSliceTaskPrivate *priv;
+    UfoRequisition in_req;
+    GValue *value;
 
     priv = UFO_SLICE_TASK_GET_PRIVATE (task);
-    priv->copy = ufo_buffer_dup (inputs[0]);
+    ufo_buffer_get_requisition (inputs[0], &in_req);
+
+    if (priv->copy != NULL && ufo_buffer_cmp_dimensions (priv->copy, &in_req) != 0) {
+        g_object_unref (priv->copy);
+        priv->copy = NULL;
+    }
+
+    if (priv->copy == NULL)
+        priv->copy = ufo_buffer_dup (inputs[0]);
+
+    /* Partial stacks from stack carry the number of valid frames */
+    value = ufo_buffer_get_metadata (inputs[0], "stack-items");
+
+    if (value != NULL)
+        priv->last = MIN (priv->last, g_value_get_uint (value));
 
     /* Force CPU memory */
     ufo_buffer_get_host_array (priv->copy, NULL);
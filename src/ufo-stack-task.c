@@ -24,7 +24,6 @@
 struct _UfoStackTaskPrivate {
     guint n_items;
     guint current;
-    gboolean generated;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -58,7 +57,6 @@ ufo_stack_task_setup (UfoTask *task,
 
     priv = UFO_STACK_TASK_GET_PRIVATE (task);
     priv->current = 0;
-    priv->generated = FALSE;
 }
 
 static void
@@ -115,14 +113,7 @@ ufo_stack_task_process (UfoTask *task,
     memcpy (out_mem + priv->current * size, in_mem, size);
     priv->current++;
 
-    if (priv->current == priv->n_items) {
-        // g_warning ("StackTask: stack full, ready for generating. [current %d]", priv->current);
-        priv->current = 0;
-        priv->generated = FALSE;
-        return FALSE;
-    }
-
-    return TRUE;
+    return priv->current < priv->n_items;
 }
 
 static gboolean
@@ -131,16 +122,34 @@ ufo_stack_task_generate (UfoTask *task,
                          UfoRequisition *requisition)
 {
     UfoStackTaskPrivate *priv;
+    GValue value = G_VALUE_INIT;
 
     priv = UFO_STACK_TASK_GET_PRIVATE (task);
 
-    if (!priv->generated) {
-        priv->generated = TRUE;
-        return TRUE;
-    }
-    else {
+    if (priv->current == 0)
         return FALSE;
+
+    /*
+     * The last stack of a stream may be partial. Clear the unused frames and
+     * record the number of valid ones, so that slice can drop the rest again.
+     */
+    if (priv->current < priv->n_items) {
+        guint8 *out_mem;
+        gsize size;
+
+        size = ufo_buffer_get_size (output) / priv->n_items;
+        out_mem = (guint8 *) ufo_buffer_get_host_array (output, NULL);
+        memset (out_mem + priv->current * size, 0, (priv->n_items - priv->current) * size);
     }
+
+    g_value_init (&value, G_TYPE_UINT);
+    g_value_set_uint (&value, priv->current);
+    ufo_buffer_set_metadata (output, "stack-items", &value);
+    g_value_unset (&value);
+
+    priv->current = 0;
+
+    return TRUE;
 }
 
 static void
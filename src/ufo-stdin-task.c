@@ -19,6 +19,7 @@
 
 #include <stdio.h>
 #include "ufo-stdin-task.h"
+#include "common/ufo-pinned.h"
 
 
 struct _UfoStdinTaskPrivate {
@@ -27,6 +28,7 @@ struct _UfoStdinTaskPrivate {
     gsize bytes_per_pixel;
     UfoBufferDepth bitdepth;
     gboolean convert;
+    UfoPinnedPool *pinned;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -59,6 +61,12 @@ ufo_stdin_task_setup (UfoTask *task,
                       UfoResources *resources,
                       GError **error)
 {
+    UfoStdinTaskPrivate *priv;
+
+    priv = UFO_STDIN_TASK_GET_PRIVATE (task);
+
+    if (priv->pinned == NULL)
+        priv->pinned = ufo_pinned_pool_new (ufo_resources_get_context (resources), error);
 }
 
 static void
@@ -104,7 +112,7 @@ ufo_stdin_task_generate (UfoTask *task,
     gboolean succeeded;
 
     priv = UFO_STDIN_TASK_GET_PRIVATE (task);
-    data = (gchar *) ufo_buffer_get_host_array (output, NULL);
+    data = (gchar *) ufo_pinned_pool_attach (priv->pinned, output);
     succeeded = fread (data, priv->bytes_per_pixel * priv->width * priv->height, 1, stdin) == 1;
 
     if (succeeded && priv->convert && priv->bitdepth != UFO_BUFFER_DEPTH_32F)
@@ -185,6 +193,13 @@ ufo_stdin_task_get_property (GObject *object,
 static void
 ufo_stdin_task_finalize (GObject *object)
 {
+    UfoStdinTaskPrivate *priv = UFO_STDIN_TASK_GET_PRIVATE (object);
+
+    if (priv->pinned != NULL) {
+        ufo_pinned_pool_destroy (priv->pinned);
+        priv->pinned = NULL;
+    }
+
     G_OBJECT_CLASS (ufo_stdin_task_parent_class)->finalize (object);
 }
 
@@ -22,7 +22,11 @@
 #else
 #include <CL/cl.h>
 #endif
+#include <glib/gstdio.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "ufo-transpose-projections-task.h"
 
@@ -35,6 +39,15 @@ struct _UfoTransposeProjectionsTaskPrivate {
     guint current_sino;
     guint n_sinos;
     guint sino_width;
+
+    /* out-of-core mode */
+    gchar *scratch_dir;
+    guint buffer_size;
+    gint fd;
+    gfloat *tile;
+    guint tile_height;
+    guint tile_start;
+    guint n_tiled;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -48,6 +61,8 @@ G_DEFINE_TYPE_WITH_CODE (UfoTransposeProjectionsTask, ufo_transpose_projections_
 enum {
     PROP_0,
     PROP_NUM_PROJECTIONS,
+    PROP_SCRATCH_DIRECTORY,
+    PROP_BUFFER_SIZE,
     N_PROPERTIES
 };
 
@@ -59,6 +74,128 @@ ufo_transpose_projections_task_new (void)
     return UFO_NODE (g_object_new (UFO_TYPE_TRANSPOSE_PROJECTIONS_TASK, NULL));
 }
 
+static gboolean
+write_all (gint fd, gconstpointer data, gsize size, goffset offset)
+{
+    const gchar *current = data;
+
+    while (size > 0) {
+        gssize written = pwrite (fd, current, size, offset);
+
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return FALSE;
+        }
+
+        current += written;
+        offset += written;
+        size -= written;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+read_all (gint fd, gpointer data, gsize size, goffset offset)
+{
+    gchar *current = data;
+
+    while (size > 0) {
+        gssize n_read = pread (fd, current, size, offset);
+
+        if (n_read < 0) {
+            if (errno == EINTR)
+                continue;
+
+            return FALSE;
+        }
+
+        if (n_read == 0) {
+            /* beyond the end of the file, i.e. missing projections */
+            memset (current, 0, size);
+            break;
+        }
+
+        current += n_read;
+        offset += n_read;
+        size -= n_read;
+    }
+
+    return TRUE;
+}
+
+static gboolean
+open_scratch_file (UfoTransposeProjectionsTaskPrivate *priv,
+                   const gchar *dirname,
+                   GError **error)
+{
+    gchar *template;
+    gsize row_size;
+
+    template = g_build_filename (dirname, "ufo-transpose-XXXXXX", NULL);
+    priv->fd = g_mkstemp (template);
+
+    if (priv->fd < 0) {
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (errno),
+                     "Could not create scratch file in `%s': %s", dirname, g_strerror (errno));
+        g_free (template);
+        return FALSE;
+    }
+
+    /* the file is removed as soon as it is closed */
+    g_unlink (template);
+    g_free (template);
+
+    /*
+     * Projections are collected in tiles of tile_height rows per sinogram, so
+     * that each sinogram part of a tile can be written with one contiguous
+     * write.
+     */
+    row_size = priv->sino_width * sizeof (gfloat);
+    priv->tile_height = MAX (1, ((gsize) priv->buffer_size << 20) / (row_size * priv->n_sinos));
+    priv->tile_height = MIN (priv->tile_height, priv->n_projections);
+    priv->tile = g_malloc (row_size * priv->n_sinos * priv->tile_height);
+    priv->tile_start = 0;
+    priv->n_tiled = 0;
+
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise (priv->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    return TRUE;
+}
+
+static gboolean
+flush_tile (UfoTransposeProjectionsTaskPrivate *priv)
+{
+    gsize row_size;
+    gint error_code = 0;
+
+    if (priv->n_tiled == 0)
+        return TRUE;
+
+    row_size = priv->sino_width * sizeof (gfloat);
+
+#pragma omp parallel for
+    for (guint i = 0; i < priv->n_sinos; i++) {
+        goffset offset = ((goffset) i * priv->n_projections + priv->tile_start) * row_size;
+
+        if (!write_all (priv->fd, priv->tile + (gsize) i * priv->tile_height * priv->sino_width,
+                        priv->n_tiled * row_size, offset))
+            error_code = errno;
+    }
+
+    if (error_code != 0)
+        g_warning ("Could not write to scratch file: %s", g_strerror (error_code));
+
+    priv->tile_start += priv->n_tiled;
+    priv->n_tiled = 0;
+
+    return error_code == 0;
+}
+
 static gboolean
 ufo_transpose_projections_task_process (UfoTask *task,
                                  UfoBuffer **inputs,
@@ -80,6 +217,28 @@ ufo_transpose_projections_task_process (UfoTask *task,
     sino_index = (priv->projection - 1) * priv->sino_width;
     host_array = ufo_buffer_get_host_array (inputs[0], NULL);
     row_mem_offset = priv->sino_width;
+
+    if (priv->fd >= 0) {
+        gsize tile_index = priv->n_tiled * priv->sino_width;
+
+        sino_mem_offset = row_mem_offset * priv->tile_height;
+
+#pragma omp parallel for
+        for (i = 0; i < priv->n_sinos; i++) {
+            memcpy (priv->tile + tile_index + i * sino_mem_offset,
+                    host_array + i * row_mem_offset,
+                    sizeof (float) * priv->sino_width);
+        }
+
+        priv->n_tiled++;
+        priv->projection++;
+
+        if (priv->n_tiled == priv->tile_height)
+            return flush_tile (priv);
+
+        return TRUE;
+    }
+
     sino_mem_offset = row_mem_offset * priv->n_projections;
 
 #pragma omp parallel
@@ -109,6 +268,25 @@ ufo_transpose_projections_task_generate (UfoTask *task,
     if (priv->current_sino == priv->n_sinos)
         return FALSE;
 
+    if (priv->fd >= 0) {
+        gsize size = priv->sino_offset * sizeof (gfloat);
+        goffset offset = (goffset) priv->current_sino * size;
+
+        if (!flush_tile (priv))
+            return FALSE;
+
+        if (!read_all (priv->fd, ufo_buffer_get_host_array (output, NULL), size, offset)) {
+            g_warning ("Could not read from scratch file: %s", g_strerror (errno));
+            return FALSE;
+        }
+
+#ifdef POSIX_FADV_WILLNEED
+        posix_fadvise (priv->fd, offset + size, size, POSIX_FADV_WILLNEED);
+#endif
+        priv->current_sino++;
+        return TRUE;
+    }
+
     index = priv->current_sino * priv->sino_offset;
     ufo_buffer_set_host_array (output, priv->sinograms + index, FALSE);
 
@@ -138,13 +316,28 @@ ufo_transpose_projections_task_get_requisition (UfoTask *task,
     requisition->dims[0] = in_req.dims[0];
     requisition->dims[1] = priv->n_projections;
 
-    if (priv->sinograms == NULL) {
+    if (priv->sinograms == NULL && priv->fd < 0) {
+        gsize size;
+
         priv->sino_width = (guint) in_req.dims[0];
         priv->n_sinos = (guint) in_req.dims[1];
-        priv->sinograms = g_malloc0 (sizeof (gfloat) * priv->n_projections * priv->sino_width * priv->n_sinos);
         priv->sino_offset = priv->sino_width * priv->n_projections;
         priv->current_sino = 0;
         priv->projection = 1;
+        size = sizeof (gfloat) * priv->sino_offset * priv->n_sinos;
+
+        if (priv->scratch_dir != NULL && priv->scratch_dir[0] != '\0') {
+            open_scratch_file (priv, priv->scratch_dir, error);
+            return;
+        }
+
+        priv->sinograms = g_try_malloc0 (size);
+
+        if (priv->sinograms == NULL) {
+            g_warning ("Could not allocate %" G_GSIZE_FORMAT " MB for sinograms, transposing out of core",
+                       size >> 20);
+            open_scratch_file (priv, g_get_tmp_dir (), error);
+        }
     }
 }
 
@@ -188,6 +381,18 @@ ufo_transpose_projections_task_finalize (GObject *object)
         g_free (priv->sinograms);
         priv->sinograms = NULL;
     }
+
+    if (priv->fd >= 0) {
+        close (priv->fd);
+        priv->fd = -1;
+    }
+
+    g_free (priv->tile);
+    priv->tile = NULL;
+    g_free (priv->scratch_dir);
+    priv->scratch_dir = NULL;
+
+    G_OBJECT_CLASS (ufo_transpose_projections_task_parent_class)->finalize (object);
 }
 
 static void
@@ -214,6 +419,13 @@ ufo_transpose_projections_task_set_property (GObject *object,
         case PROP_NUM_PROJECTIONS:
             priv->n_projections = g_value_get_uint (value);
             break;
+        case PROP_SCRATCH_DIRECTORY:
+            g_free (priv->scratch_dir);
+            priv->scratch_dir = g_value_dup_string (value);
+            break;
+        case PROP_BUFFER_SIZE:
+            priv->buffer_size = g_value_get_uint (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -232,6 +444,12 @@ ufo_transpose_projections_task_get_property (GObject *object,
         case PROP_NUM_PROJECTIONS:
             g_value_set_uint (value, priv->n_projections);
             break;
+        case PROP_SCRATCH_DIRECTORY:
+            g_value_set_string (value, priv->scratch_dir ? priv->scratch_dir : "");
+            break;
+        case PROP_BUFFER_SIZE:
+            g_value_set_uint (value, priv->buffer_size);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
             break;
@@ -258,6 +476,20 @@ ufo_transpose_projections_task_class_init (UfoTransposeProjectionsTaskClass *kla
             1, G_MAXUINT, 1,
             G_PARAM_READWRITE);
 
+    properties[PROP_SCRATCH_DIRECTORY] =
+        g_param_spec_string ("scratch-directory",
+            "Directory for the out-of-core scratch file",
+            "Directory for the out-of-core scratch file, if empty sinograms are kept in memory",
+            "",
+            G_PARAM_READWRITE);
+
+    properties[PROP_BUFFER_SIZE] =
+        g_param_spec_uint ("buffer-size",
+            "Size of the out-of-core tile buffer in MB",
+            "Size of the out-of-core tile buffer in MB",
+            1, G_MAXUINT, 512,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -273,4 +505,8 @@ ufo_transpose_projections_task_init (UfoTransposeProjectionsTask *self)
     self->priv = priv = UFO_TRANSPOSE_PROJECTIONS_TASK_GET_PRIVATE (self);
     priv->sinograms = NULL;
     priv->n_projections = 1;
+    priv->scratch_dir = NULL;
+    priv->buffer_size = 512;
+    priv->fd = -1;
+    priv->tile = NULL;
 }
@@ -33,6 +33,7 @@
 #include "ufo-write-task.h"
 #include "writers/ufo-writer.h"
 #include "writers/ufo-raw-writer.h"
+#include "common/ufo-pinned.h"
 
 #ifdef HAVE_TIFF
 #include "writers/ufo-tiff-writer.h"
@@ -46,6 +47,28 @@
 #include "writers/ufo-hdf5-writer.h"
 #endif
 
+typedef struct {
+    gpointer data;
+    gsize allocated;
+    gsize size;
+    UfoRequisition requisition;
+    guint num_frames;
+    guint *counters;            /* file counter of each frame */
+    UfoBufferDepth depth;
+    gfloat min;
+    gfloat max;
+    gboolean rescale;
+    gboolean converted;
+    gboolean stop;
+} WriteJob;
+
+typedef struct {
+    struct _UfoWriteTaskPrivate *priv;
+    UfoWriter *writer;
+    gboolean opened;
+    GThread *thread;
+} WriterThread;
+
 struct _UfoWriteTaskPrivate {
     gchar *filename;
     guint counter;
@@ -66,6 +89,16 @@ struct _UfoWriteTaskPrivate {
     cl_context context;
     cl_kernel kernel;
     UfoBuffer *tmp;
+    UfoPinnedPool *pinned;
+
+    gboolean device_conversion;
+    cl_kernel min_max_kernel;
+    cl_kernel convert_8bit_kernel;
+    cl_kernel convert_16bit_kernel;
+    cl_mem partial_mem;
+    cl_mem converted_mem;
+    gpointer converted_data;
+    gsize converted_size;
 
     UfoWriter     *writer;
     UfoRawWriter  *raw_writer;
@@ -82,6 +115,15 @@ struct _UfoWriteTaskPrivate {
 #ifdef WITH_HDF5
     UfoHdf5Writer *hdf5_writer;
 #endif
+
+    guint          queue_size;
+    guint          n_writer_threads;
+    WriteJob      *jobs;
+    WriteJob       stop_job;
+    GAsyncQueue   *free_jobs;
+    GAsyncQueue   *pending_jobs;
+    WriterThread  *threads;
+    guint          n_threads;
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -102,14 +144,26 @@ enum {
     PROP_MINIMUM,
     PROP_MAXIMUM,
     PROP_RESCALE,
+    PROP_QUEUE_SIZE,
+    PROP_WRITER_THREADS,
+    PROP_DEVICE_CONVERSION,
 #ifdef HAVE_JPEG
     PROP_JPEG_QUALITY,
+#endif
+#ifdef WITH_HDF5
+    PROP_HDF5_CHUNK_HEIGHT,
+    PROP_HDF5_CHUNK_CACHE_SIZE,
+    PROP_HDF5_COMPRESSION,
+    PROP_HDF5_COMPRESSION_LEVEL,
 #endif
     N_PROPERTIES
 };
 
 static GParamSpec *properties[N_PROPERTIES] = { NULL, };
 
+#define MIN_MAX_LOCAL_SIZE  128
+#define MIN_MAX_NUM_GROUPS  64
+
 UfoNode *
 ufo_write_task_new (void)
 {
@@ -117,12 +171,18 @@ ufo_write_task_new (void)
 }
 
 static gchar *
-get_current_filename (UfoWriteTaskPrivate *priv)
+get_filename (UfoWriteTaskPrivate *priv, guint counter)
 {
     if (priv->multi_file)
         return g_strdup (priv->filename);
 
-    return g_strdup_printf (priv->filename, priv->counter);
+    return g_strdup_printf (priv->filename, counter);
+}
+
+static gchar *
+get_current_filename (UfoWriteTaskPrivate *priv)
+{
+    return get_filename (priv, priv->counter);
 }
 
 static guint
@@ -152,6 +212,340 @@ can_be_written (const gchar *filename, GError **error)
     return TRUE;
 }
 
+/*
+ * Return the counter of the next frame and advance it. Files which cannot be
+ * written are skipped with a warning, so that the frame ends up in the next
+ * writable file.
+ */
+static guint
+claim_counter (UfoWriteTaskPrivate *priv)
+{
+    guint counter;
+
+    /* A multi-file target was checked in setup */
+    while (!priv->multi_file) {
+        GError *error = NULL;
+        gchar *filename = get_current_filename (priv);
+        gboolean writable = can_be_written (filename, &error);
+
+        g_free (filename);
+
+        if (writable)
+            break;
+
+        g_warning ("%s", error->message);
+        g_error_free (error);
+        priv->counter += priv->counter_step;
+    }
+
+    counter = priv->counter;
+    priv->counter += priv->counter_step;
+    return counter;
+}
+
+/*
+ * Create another writer of the same kind with the same configuration, so that
+ * several threads can write separate files concurrently.
+ */
+static UfoWriter *
+clone_writer (UfoWriteTaskPrivate *priv)
+{
+    GObject *clone;
+    GParamSpec **pspecs;
+    guint n_pspecs;
+
+    clone = g_object_new (G_OBJECT_TYPE (priv->writer), NULL);
+    pspecs = g_object_class_list_properties (G_OBJECT_GET_CLASS (priv->writer), &n_pspecs);
+
+    for (guint i = 0; i < n_pspecs; i++) {
+        GValue value = G_VALUE_INIT;
+
+        if ((pspecs[i]->flags & G_PARAM_READWRITE) != G_PARAM_READWRITE)
+            continue;
+
+        g_value_init (&value, pspecs[i]->value_type);
+        g_object_get_property (G_OBJECT (priv->writer), pspecs[i]->name, &value);
+        g_object_set_property (clone, pspecs[i]->name, &value);
+        g_value_unset (&value);
+    }
+
+    g_free (pspecs);
+
+#ifdef HAVE_JPEG
+    if (UFO_IS_JPEG_WRITER (clone))
+        ufo_jpeg_writer_set_quality (UFO_JPEG_WRITER (clone), priv->jpeg_quality);
+#endif
+
+    return UFO_WRITER (clone);
+}
+
+static gpointer
+writer_thread_func (WriterThread *thread)
+{
+    UfoWriteTaskPrivate *priv;
+    UfoWriterImage image;
+    WriteJob *job;
+    gsize offset;
+
+    priv = thread->priv;
+
+    while (TRUE) {
+        job = g_async_queue_pop (priv->pending_jobs);
+
+        if (job->stop)
+            break;
+
+        offset = job->size / job->num_frames;
+        image.requisition = &job->requisition;
+        image.min = job->min;
+        image.max = job->max;
+        image.rescale = job->rescale;
+
+        for (guint i = 0; i < job->num_frames; i++) {
+            if (!priv->multi_file || !thread->opened) {
+                gchar *filename = get_filename (priv, job->counters[i]);
+
+                ufo_writer_open (thread->writer, filename);
+                g_free (filename);
+                thread->opened = TRUE;
+            }
+
+            image.data = ((guint8 *) job->data) + i * offset;
+            image.depth = job->depth;
+
+            if (job->converted)
+                ufo_writer_write_converted (thread->writer, &image);
+            else
+                ufo_writer_write (thread->writer, &image);
+
+            if (!priv->multi_file) {
+                ufo_writer_close (thread->writer);
+                thread->opened = FALSE;
+            }
+        }
+
+        g_async_queue_push (priv->free_jobs, job);
+    }
+
+    return NULL;
+}
+
+static void
+start_writer_threads (UfoWriteTaskPrivate *priv)
+{
+    priv->jobs = g_new0 (WriteJob, priv->queue_size);
+    priv->free_jobs = g_async_queue_new ();
+    priv->pending_jobs = g_async_queue_new ();
+    priv->stop_job.stop = TRUE;
+
+    for (guint i = 0; i < priv->queue_size; i++)
+        g_async_queue_push (priv->free_jobs, &priv->jobs[i]);
+
+    /* Frames of a single file must be written in order by one thread */
+    priv->n_threads = priv->multi_file || priv->filename == NULL ? 1 : priv->n_writer_threads;
+    priv->threads = g_new0 (WriterThread, priv->n_threads);
+
+    for (guint i = 0; i < priv->n_threads; i++) {
+        priv->threads[i].priv = priv;
+        priv->threads[i].writer = i == 0 ? g_object_ref (priv->writer) : clone_writer (priv);
+        priv->threads[i].opened = FALSE;
+        priv->threads[i].thread = g_thread_new ("write", (GThreadFunc) writer_thread_func, &priv->threads[i]);
+    }
+}
+
+static void
+stop_writer_threads (UfoWriteTaskPrivate *priv)
+{
+    if (priv->threads == NULL)
+        return;
+
+    /* Pending jobs are queued before the stop requests and thus flushed */
+    for (guint i = 0; i < priv->n_threads; i++)
+        g_async_queue_push (priv->pending_jobs, &priv->stop_job);
+
+    for (guint i = 0; i < priv->n_threads; i++) {
+        g_thread_join (priv->threads[i].thread);
+
+        if (priv->threads[i].opened)
+            ufo_writer_close (priv->threads[i].writer);
+
+        g_object_unref (priv->threads[i].writer);
+    }
+
+    for (guint i = 0; i < priv->queue_size; i++) {
+        g_free (priv->jobs[i].data);
+        g_free (priv->jobs[i].counters);
+    }
+
+    g_free (priv->threads);
+    g_free (priv->jobs);
+    g_async_queue_unref (priv->free_jobs);
+    g_async_queue_unref (priv->pending_jobs);
+    priv->threads = NULL;
+    priv->jobs = NULL;
+    priv->free_jobs = NULL;
+    priv->pending_jobs = NULL;
+}
+
+static void
+enqueue_frames (UfoWriteTaskPrivate *priv,
+                gpointer data,
+                gsize size,
+                guint num_frames,
+                UfoRequisition *requisition,
+                UfoBufferDepth depth,
+                gboolean converted)
+{
+    WriteJob *job;
+
+    if (priv->threads == NULL)
+        start_writer_threads (priv);
+
+    /* Blocks until a writer thread returned a job if the queue is full */
+    job = g_async_queue_pop (priv->free_jobs);
+
+    if (job->allocated < size) {
+        g_free (job->data);
+        job->data = g_malloc (size);
+        job->allocated = size;
+    }
+
+    memcpy (job->data, data, size);
+    job->size = size;
+    job->requisition = *requisition;
+
+    /* File names are resolved in order here, the threads only write */
+    job->counters = g_renew (guint, job->counters, num_frames);
+    job->num_frames = num_frames;
+
+    for (guint i = 0; i < num_frames; i++)
+        job->counters[i] = claim_counter (priv);
+
+    job->depth = depth;
+    job->min = priv->minimum;
+    job->max = priv->maximum;
+    job->rescale = priv->rescale;
+    job->converted = converted;
+    job->stop = FALSE;
+
+    g_async_queue_push (priv->pending_jobs, job);
+}
+
+static void
+find_min_max_on_device (UfoWriteTaskPrivate *priv,
+                        UfoProfiler *profiler,
+                        cl_command_queue cmd_queue,
+                        cl_mem in_mem,
+                        cl_ulong offset,
+                        cl_ulong n_pixels,
+                        gfloat *min,
+                        gfloat *max)
+{
+    cl_float2 partial[MIN_MAX_NUM_GROUPS];
+    gsize local_size = MIN_MAX_LOCAL_SIZE;
+    gsize global_size = MIN_MAX_LOCAL_SIZE * MIN_MAX_NUM_GROUPS;
+
+    if (priv->maximum > -G_MAXFLOAT && priv->minimum < G_MAXFLOAT) {
+        *min = priv->minimum;
+        *max = priv->maximum;
+        return;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 1, sizeof (cl_mem), &priv->partial_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 2, local_size * sizeof (cl_float2), NULL));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 3, sizeof (cl_ulong), &offset));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->min_max_kernel, 4, sizeof (cl_ulong), &n_pixels));
+    ufo_profiler_call (profiler, cmd_queue, priv->min_max_kernel, 1, &global_size, &local_size);
+
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (cmd_queue, priv->partial_mem, CL_TRUE,
+                                                    0, sizeof (partial), partial, 0, NULL, NULL));
+
+    *min = G_MAXFLOAT;
+    *max = -G_MAXFLOAT;
+
+    for (guint i = 0; i < MIN_MAX_NUM_GROUPS; i++) {
+        *min = MIN (*min, partial[i].s[0]);
+        *max = MAX (*max, partial[i].s[1]);
+    }
+}
+
+/*
+ * Rescale and narrow the frames on the device so that only 8 or 16 bit data
+ * has to be transferred back to the host. Returns the converted host data.
+ */
+static gpointer
+convert_on_device (UfoWriteTaskPrivate *priv,
+                   UfoProfiler *profiler,
+                   cl_command_queue cmd_queue,
+                   cl_mem in_mem,
+                   gsize n_pixels,
+                   guint num_frames,
+                   gsize *size)
+{
+    cl_kernel kernel;
+    gfloat range;
+    gsize bytes_per_pixel;
+
+    if (priv->depth == UFO_BUFFER_DEPTH_8U) {
+        kernel = priv->convert_8bit_kernel;
+        bytes_per_pixel = 1;
+        range = 255.0f;
+    }
+    else {
+        kernel = priv->convert_16bit_kernel;
+        bytes_per_pixel = 2;
+        range = 65535.0f;
+    }
+
+    *size = n_pixels * num_frames * bytes_per_pixel;
+
+    if (priv->converted_size < *size) {
+        cl_int err;
+
+        if (priv->converted_mem != NULL)
+            UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->converted_mem));
+
+        priv->converted_mem = clCreateBuffer (priv->context, CL_MEM_WRITE_ONLY, *size, NULL, &err);
+        UFO_RESOURCES_CHECK_CLERR (err);
+        priv->converted_data = ufo_pinned_pool_get (priv->pinned, priv, *size);
+        priv->converted_size = *size;
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 0, sizeof (cl_mem), &in_mem));
+    UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 1, sizeof (cl_mem), &priv->converted_mem));
+
+    for (guint i = 0; i < num_frames; i++) {
+        cl_ulong offset = (cl_ulong) i * n_pixels;
+        gfloat shift = 0.0f;
+        gfloat scale = 1.0f;
+        gfloat lower = 0.0f;
+        gfloat upper = range;
+
+        if (priv->rescale) {
+            gfloat min, max;
+
+            find_min_max_on_device (priv, profiler, cmd_queue, in_mem, offset, n_pixels, &min, &max);
+            shift = min;
+            scale = range / (max - min);
+            lower = MIN (min, max);
+            upper = MAX (min, max);
+        }
+
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 2, sizeof (cl_ulong), &offset));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 3, sizeof (gfloat), &shift));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 4, sizeof (gfloat), &scale));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 5, sizeof (gfloat), &lower));
+        UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (kernel, 6, sizeof (gfloat), &upper));
+        ufo_profiler_call (profiler, cmd_queue, kernel, 1, &n_pixels, NULL);
+    }
+
+    UFO_RESOURCES_CHECK_CLERR (clEnqueueReadBuffer (cmd_queue, priv->converted_mem, CL_TRUE,
+                                                    0, *size, priv->converted_data, 0, NULL, NULL));
+
+    return priv->converted_data;
+}
+
 static void
 ufo_write_task_setup (UfoTask *task,
                       UfoResources *resources,
@@ -163,6 +557,17 @@ ufo_write_task_setup (UfoTask *task,
 
     priv = UFO_WRITE_TASK_GET_PRIVATE (task);
 
+    priv->context = ufo_resources_get_context (resources);
+    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
+
+    /* Device data is read back into pinned memory before writing it, also when
+     * writing to stdout */
+    if (priv->pinned == NULL)
+        priv->pinned = ufo_pinned_pool_new (priv->context, error);
+
+    if (priv->pinned == NULL)
+        return;
+
     /* If no filename has been specified we write to stdout */
     if (priv->filename == NULL) {
         priv->writer = UFO_WRITER (priv->raw_writer);
@@ -250,13 +655,31 @@ ufo_write_task_setup (UfoTask *task,
 
     g_free (dirname);
 
-    priv->context = ufo_resources_get_context (resources);
-    UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainContext (priv->context), error);
-
     priv->kernel = ufo_resources_get_kernel (resources, "split.cl", "unsplit", NULL, error);
 
     if (priv->kernel != NULL)
         UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->kernel), error);
+
+    if (priv->device_conversion && priv->depth != UFO_BUFFER_DEPTH_32F) {
+        cl_int err;
+
+        priv->min_max_kernel = ufo_resources_get_kernel (resources, "convert.cl", "find_min_max", NULL, error);
+        priv->convert_8bit_kernel = ufo_resources_get_kernel (resources, "convert.cl", "convert_to_8bit", NULL, error);
+        priv->convert_16bit_kernel = ufo_resources_get_kernel (resources, "convert.cl", "convert_to_16bit", NULL, error);
+
+        if (priv->min_max_kernel != NULL)
+            UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->min_max_kernel), error);
+
+        if (priv->convert_8bit_kernel != NULL)
+            UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->convert_8bit_kernel), error);
+
+        if (priv->convert_16bit_kernel != NULL)
+            UFO_RESOURCES_CHECK_SET_AND_RETURN (clRetainKernel (priv->convert_16bit_kernel), error);
+
+        priv->partial_mem = clCreateBuffer (priv->context, CL_MEM_WRITE_ONLY,
+                                            MIN_MAX_NUM_GROUPS * sizeof (cl_float2), NULL, &err);
+        UFO_RESOURCES_CHECK_SET_AND_RETURN (err, error);
+    }
 }
 
 static void
@@ -297,12 +720,24 @@ ufo_write_task_process (UfoTask *task,
     UfoWriteTaskPrivate *priv;
     UfoWriterImage image;
     UfoRequisition in_req;
+    UfoGpuNode *node;
+    UfoProfiler *profiler;
+    cl_command_queue cmd_queue;
+    cl_mem in_mem;
+    UfoBufferDepth depth;
+    gboolean converted;
     guint8 *data;
     guint num_frames;
+    gsize n_pixels;
+    gsize size;
     gsize offset;
 
     priv = UFO_WRITE_TASK_GET_PRIVATE (UFO_WRITE_TASK (task));
     ufo_buffer_get_requisition (inputs[0], &in_req);
+    node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
+    cmd_queue = ufo_gpu_node_get_cmd_queue (node);
+    profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
+    converted = priv->convert_8bit_kernel != NULL && priv->depth != UFO_BUFFER_DEPTH_32F;
 
     /* 
      * If we have a cube with a depth of three planes we try to write color
@@ -310,54 +745,63 @@ ufo_write_task_process (UfoTask *task,
      * as single files.
      */
     if (in_req.n_dims == 3 && in_req.dims[2] == 3) {
-        UfoGpuNode *node;
-        UfoProfiler *profiler;
-        cl_command_queue cmd_queue;
-        cl_mem in_mem;
         cl_mem out_mem;
 
         if (!priv->tmp)
             priv->tmp = ufo_buffer_new (&in_req, priv->context);
 
-        node = UFO_GPU_NODE (ufo_task_node_get_proc_node (UFO_TASK_NODE (task)));
-        cmd_queue = ufo_gpu_node_get_cmd_queue (node);
         in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
         out_mem = ufo_buffer_get_device_array (priv->tmp, cmd_queue);
 
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 0, sizeof (cl_mem), &in_mem));
         UFO_RESOURCES_CHECK_CLERR (clSetKernelArg (priv->kernel, 1, sizeof (cl_mem), &out_mem));
-        profiler = ufo_task_node_get_profiler (UFO_TASK_NODE (task));
         ufo_profiler_call (profiler, cmd_queue, priv->kernel, 3, in_req.dims, NULL);
 
         num_frames = 1;
-        data = (guint8 *) ufo_buffer_get_host_array (priv->tmp, NULL);
+        n_pixels = in_req.dims[0] * in_req.dims[1] * 3;
+
+        if (converted)
+            data = convert_on_device (priv, profiler, cmd_queue, out_mem, n_pixels, num_frames, &size);
+        else
+            data = (guint8 *) ufo_pinned_pool_download (priv->pinned, priv->tmp, cmd_queue);
     }
     else {
         num_frames = in_req.n_dims == 3 ? in_req.dims[2] : 1;
-        data = (guint8 *) ufo_buffer_get_host_array (inputs[0], NULL);
+        n_pixels = in_req.dims[0] * in_req.dims[1];
+
+        if (converted) {
+            in_mem = ufo_buffer_get_device_array (inputs[0], cmd_queue);
+            data = convert_on_device (priv, profiler, cmd_queue, in_mem, n_pixels, num_frames, &size);
+        }
+        else
+            data = (guint8 *) ufo_pinned_pool_download (priv->pinned, inputs[0], cmd_queue);
     }
 
-    offset = ufo_buffer_get_size (inputs[0]) / num_frames;
+    if (converted)
+        depth = priv->depth == UFO_BUFFER_DEPTH_8U ? UFO_BUFFER_DEPTH_8U : UFO_BUFFER_DEPTH_16U;
+    else {
+        depth = priv->depth;
+        size = ufo_buffer_get_size (inputs[0]);
+    }
+
+    if (priv->queue_size > 0) {
+        enqueue_frames (priv, data, size, num_frames, &in_req, depth, converted);
+        return TRUE;
+    }
+
+    offset = size / num_frames;
 
     image.requisition = &in_req;
-    image.depth = priv->depth;
+    image.depth = depth;
     image.min = priv->minimum;
     image.max = priv->maximum;
     image.rescale = priv->rescale;
 
     for (guint i = 0; i < num_frames; i++) {
-retry:
-        if (!priv->multi_file || !priv->opened) {
-            GError *error = NULL;
-            gchar *filename = get_current_filename (priv);
+        guint counter = claim_counter (priv);
 
-            if (!can_be_written (filename, &error)) {
-                g_warning ("%s", error->message);
-                g_free (filename);
-                g_error_free (error);
-                priv->counter += priv->counter_step;
-                goto retry;
-            }
+        if (!priv->multi_file || !priv->opened) {
+            gchar *filename = get_filename (priv, counter);
 
             ufo_writer_open (priv->writer, filename);
             g_free (filename);
@@ -365,14 +809,16 @@ retry:
         }
 
         image.data = data + i * offset;
-        ufo_writer_write (priv->writer, &image);
+
+        if (converted)
+            ufo_writer_write_converted (priv->writer, &image);
+        else
+            ufo_writer_write (priv->writer, &image);
 
         if (!priv->multi_file) {
             ufo_writer_close (priv->writer);
             priv->opened = FALSE;
         }
-
-        priv->counter += priv->counter_step;
     }
 
     return TRUE;
@@ -428,11 +874,34 @@ ufo_write_task_set_property (GObject *object,
         case PROP_RESCALE:
             priv->rescale = g_value_get_boolean (value);
             break;
+        case PROP_QUEUE_SIZE:
+            priv->queue_size = g_value_get_uint (value);
+            break;
+        case PROP_WRITER_THREADS:
+            priv->n_writer_threads = g_value_get_uint (value);
+            break;
+        case PROP_DEVICE_CONVERSION:
+            priv->device_conversion = g_value_get_boolean (value);
+            break;
 #ifdef HAVE_JPEG
         case PROP_JPEG_QUALITY:
             priv->jpeg_quality = g_value_get_uint (value);
             ufo_jpeg_writer_set_quality (priv->jpeg_writer, priv->jpeg_quality);
             break;
+#endif
+#ifdef WITH_HDF5
+        case PROP_HDF5_CHUNK_HEIGHT:
+            g_object_set_property (G_OBJECT (priv->hdf5_writer), "chunk-height", value);
+            break;
+        case PROP_HDF5_CHUNK_CACHE_SIZE:
+            g_object_set_property (G_OBJECT (priv->hdf5_writer), "chunk-cache-size", value);
+            break;
+        case PROP_HDF5_COMPRESSION:
+            g_object_set_property (G_OBJECT (priv->hdf5_writer), "compression", value);
+            break;
+        case PROP_HDF5_COMPRESSION_LEVEL:
+            g_object_set_property (G_OBJECT (priv->hdf5_writer), "compression-level", value);
+            break;
 #endif
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -477,10 +946,33 @@ ufo_write_task_get_property (GObject *object,
         case PROP_MINIMUM:
             g_value_set_float (value, priv->minimum);
             break;
+        case PROP_QUEUE_SIZE:
+            g_value_set_uint (value, priv->queue_size);
+            break;
+        case PROP_WRITER_THREADS:
+            g_value_set_uint (value, priv->n_writer_threads);
+            break;
+        case PROP_DEVICE_CONVERSION:
+            g_value_set_boolean (value, priv->device_conversion);
+            break;
 #ifdef HAVE_JPEG
         case PROP_JPEG_QUALITY:
             g_value_set_uint (value, priv->jpeg_quality);
             break;
+#endif
+#ifdef WITH_HDF5
+        case PROP_HDF5_CHUNK_HEIGHT:
+            g_object_get_property (G_OBJECT (priv->hdf5_writer), "chunk-height", value);
+            break;
+        case PROP_HDF5_CHUNK_CACHE_SIZE:
+            g_object_get_property (G_OBJECT (priv->hdf5_writer), "chunk-cache-size", value);
+            break;
+        case PROP_HDF5_COMPRESSION:
+            g_object_get_property (G_OBJECT (priv->hdf5_writer), "compression", value);
+            break;
+        case PROP_HDF5_COMPRESSION_LEVEL:
+            g_object_get_property (G_OBJECT (priv->hdf5_writer), "compression-level", value);
+            break;
 #endif
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
@@ -495,6 +987,8 @@ ufo_write_task_dispose (GObject *object)
 
     priv = UFO_WRITE_TASK_GET_PRIVATE (object);
 
+    stop_writer_threads (priv);
+
     g_object_unref (priv->raw_writer);
 
 #ifdef HAVE_TIFF
@@ -535,6 +1029,39 @@ ufo_write_task_finalize (GObject *object)
         priv->tmp = NULL;
     }
 
+    if (priv->min_max_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->min_max_kernel));
+        priv->min_max_kernel = NULL;
+    }
+
+    if (priv->convert_8bit_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->convert_8bit_kernel));
+        priv->convert_8bit_kernel = NULL;
+    }
+
+    if (priv->convert_16bit_kernel) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseKernel (priv->convert_16bit_kernel));
+        priv->convert_16bit_kernel = NULL;
+    }
+
+    if (priv->partial_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->partial_mem));
+        priv->partial_mem = NULL;
+    }
+
+    if (priv->converted_mem) {
+        UFO_RESOURCES_CHECK_CLERR (clReleaseMemObject (priv->converted_mem));
+        priv->converted_mem = NULL;
+    }
+
+    /* converted_data belongs to the pool */
+    if (priv->pinned != NULL) {
+        ufo_pinned_pool_destroy (priv->pinned);
+        priv->pinned = NULL;
+    }
+
+    priv->converted_data = NULL;
+
     if (priv->context) {
         UFO_RESOURCES_CHECK_CLERR (clReleaseContext (priv->context));
         priv->context = NULL;
@@ -620,6 +1147,27 @@ ufo_write_task_class_init (UfoWriteTaskClass *klass)
             TRUE,
             G_PARAM_READWRITE);
 
+    properties[PROP_QUEUE_SIZE] =
+        g_param_spec_uint ("queue-size",
+            "Number of frames buffered for background writing",
+            "Number of frames buffered for background writing, 0 writes synchronously",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_WRITER_THREADS] =
+        g_param_spec_uint ("writer-threads",
+            "Number of background writer threads",
+            "Number of background writer threads, only used if each frame goes to a separate file",
+            1, G_MAXUINT, 1,
+            G_PARAM_READWRITE);
+
+    properties[PROP_DEVICE_CONVERSION] =
+        g_param_spec_boolean ("device-conversion",
+            "Convert to 8 or 16 bit on the device",
+            "Convert to 8 or 16 bit on the device, so that only the narrowed data is transferred",
+            FALSE,
+            G_PARAM_READWRITE);
+
 #ifdef HAVE_JPEG
     properties[PROP_JPEG_QUALITY] =
         g_param_spec_uint ("jpeg-quality",
@@ -628,6 +1176,37 @@ ufo_write_task_class_init (UfoWriteTaskClass *klass)
             0, 100, 95, G_PARAM_READWRITE);
 #endif
 
+#ifdef WITH_HDF5
+    properties[PROP_HDF5_CHUNK_HEIGHT] =
+        g_param_spec_uint ("hdf5-chunk-height",
+            "Number of rows per HDF5 chunk, 0 stores whole frames",
+            "Number of rows per HDF5 chunk, 0 stores whole frames",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_CHUNK_CACHE_SIZE] =
+        g_param_spec_ulong ("hdf5-chunk-cache-size",
+            "Size of the HDF5 chunk cache in bytes, 0 uses the HDF5 default",
+            "Size of the HDF5 chunk cache in bytes, 0 uses the HDF5 default",
+            0, G_MAXULONG, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_COMPRESSION] =
+        g_param_spec_enum ("hdf5-compression",
+            "HDF5 compression filter",
+            "HDF5 compression filter",
+            ufo_hdf5_compression_get_type (),
+            UFO_HDF5_COMPRESSION_NONE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_HDF5_COMPRESSION_LEVEL] =
+        g_param_spec_uint ("hdf5-compression-level",
+            "HDF5 deflate compression level",
+            "HDF5 deflate compression level",
+            0, 9, 4,
+            G_PARAM_READWRITE);
+#endif
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (gobject_class, i, properties[i]);
 
@@ -654,6 +1233,22 @@ ufo_write_task_init(UfoWriteTask *self)
     self->priv->context = NULL;
     self->priv->kernel = NULL;
     self->priv->tmp = NULL;
+    self->priv->queue_size = 0;
+    self->priv->n_writer_threads = 1;
+    self->priv->device_conversion = FALSE;
+    self->priv->min_max_kernel = NULL;
+    self->priv->convert_8bit_kernel = NULL;
+    self->priv->convert_16bit_kernel = NULL;
+    self->priv->partial_mem = NULL;
+    self->priv->converted_mem = NULL;
+    self->priv->converted_data = NULL;
+    self->priv->pinned = NULL;
+    self->priv->converted_size = 0;
+    self->priv->jobs = NULL;
+    self->priv->free_jobs = NULL;
+    self->priv->pending_jobs = NULL;
+    self->priv->threads = NULL;
+    self->priv->n_threads = 0;
 
 #ifdef HAVE_TIFF
     self->priv->tiff_writer = ufo_tiff_writer_new ();
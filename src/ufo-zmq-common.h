@@ -47,5 +47,36 @@ typedef struct {
     guint8 type;
 } __attribute__((packed)) ZmqReply;
 
+/*
+ * In the push and publish modes every message consists of a ZmqFrameHeader
+ * part followed by num_frames parts with the raw float data of frames of the
+ * same shape. Dimensions are stored in UfoRequisition order and host byte
+ * order. The encoding and compression fields hold the UfoFrameEncoding and
+ * UfoFrameCompression of all frames in the message, with anything but float32
+ * and no compression each frame part is the output of ufo_frame_encode.
+ */
+#define ZMQ_FRAME_MAGIC                     0x5a4f4655  /* "UFOZ" */
+
+#define ZMQ_FRAME_DATA                      0
+#define ZMQ_FRAME_STOP                      1
+
+typedef enum {
+    ZMQ_MODE_REQUEST = 0,
+    ZMQ_MODE_PUSH,
+    ZMQ_MODE_PUBLISH,
+} ZmqMode;
+
+typedef struct {
+    guint32 magic;
+    guint8 type;
+    guint8 n_dims;
+    guint16 num_frames;
+    guint8 encoding;
+    guint8 compression;
+    guint16 reserved;
+    guint64 index;
+    guint32 dims[ZMQ_MAX_DIMENSIONS];
+} __attribute__((packed)) ZmqFrameHeader;
+
 
 #endif
@@ -28,16 +28,71 @@
 #include <json-glib/json-glib.h>
 #include "ufo-zmq-pub-task.h"
 #include "ufo-zmq-common.h"
+#include "common/ufo-pinned.h"
+#include "common/ufo-frame-codec.h"
 
 
+/*
+ * Frames are handed to ZeroMQ without copying, thus the data must live until
+ * ZeroMQ has sent it. A slot owns a pinned buffer which receives a copy of the
+ * input and returns to the free queue once ZeroMQ releases the message.
+ */
+typedef struct {
+    UfoBuffer *buffer;
+    GAsyncQueue *free_slots;
+} SendSlot;
+
+/* One frame part of the next message together with the means to release it */
+typedef struct {
+    gpointer data;
+    gsize size;
+    zmq_free_fn *free_fn;
+    gpointer hint;
+} PendingFrame;
+
 struct _UfoZmqPubTaskPrivate {
     gpointer context;
     gpointer socket;
+    ZmqMode mode;
+    gchar *endpoint;
     guint expected_subscribers;
+    guint frames_per_message;
+    UfoFrameEncoding encoding;
+    UfoFrameCompression compression;
     guint64 current;
     GHashTable *counts;
     JsonBuilder *builder;
     JsonGenerator *generator;
+    /* push and publish modes */
+    cl_context cl_context;
+    UfoPinnedPool *pinned;
+    SendSlot *slots;
+    guint num_slots;
+    GAsyncQueue *free_slots;
+    PendingFrame *pending;
+    guint num_pending;
+    UfoRequisition pending_requisition;
+};
+
+static GEnumValue mode_values[] = {
+    { ZMQ_MODE_REQUEST, "ZMQ_MODE_REQUEST", "request" },
+    { ZMQ_MODE_PUSH,    "ZMQ_MODE_PUSH",    "push" },
+    { ZMQ_MODE_PUBLISH, "ZMQ_MODE_PUBLISH", "publish" },
+    { 0, NULL, NULL}
+};
+
+static GEnumValue encoding_values[] = {
+    { UFO_FRAME_ENCODING_FLOAT32, "UFO_FRAME_ENCODING_FLOAT32", "float32" },
+    { UFO_FRAME_ENCODING_FLOAT16, "UFO_FRAME_ENCODING_FLOAT16", "float16" },
+    { UFO_FRAME_ENCODING_UINT16,  "UFO_FRAME_ENCODING_UINT16",  "uint16" },
+    { 0, NULL, NULL}
+};
+
+static GEnumValue compression_values[] = {
+    { UFO_FRAME_COMPRESSION_NONE, "UFO_FRAME_COMPRESSION_NONE", "none" },
+    { UFO_FRAME_COMPRESSION_LZ4,  "UFO_FRAME_COMPRESSION_LZ4",  "lz4" },
+    { UFO_FRAME_COMPRESSION_ZSTD, "UFO_FRAME_COMPRESSION_ZSTD", "zstd" },
+    { 0, NULL, NULL}
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -51,6 +106,11 @@ G_DEFINE_TYPE_WITH_CODE (UfoZmqPubTask, ufo_zmq_pub_task, UFO_TYPE_TASK_NODE,
 enum {
     PROP_0,
     PROP_EXPECTED_SUBSCRIBERS,
+    PROP_MODE,
+    PROP_ENDPOINT,
+    PROP_FRAMES_PER_MESSAGE,
+    PROP_ENCODING,
+    PROP_COMPRESSION,
     N_PROPERTIES
 };
 
@@ -94,15 +154,52 @@ send_registration_reply:
     return success;
 }
 
+static void
+wait_for_subscriptions (UfoZmqPubTaskPrivate *priv)
+{
+    /* With ZMQ_XPUB_VERBOSE each subscriber delivers its subscription */
+    for (guint subscribed = 0; subscribed < priv->expected_subscribers; ) {
+        zmq_msg_t msg;
+
+        zmq_msg_init (&msg);
+
+        if (zmq_msg_recv (&msg, priv->socket, 0) > 0 && ((guint8 *) zmq_msg_data (&msg))[0] == 1)
+            subscribed++;
+
+        zmq_msg_close (&msg);
+    }
+}
+
+static gboolean
+is_encoded (UfoZmqPubTaskPrivate *priv)
+{
+    return priv->encoding != UFO_FRAME_ENCODING_FLOAT32 ||
+           priv->compression != UFO_FRAME_COMPRESSION_NONE;
+}
+
 static void
 ufo_zmq_pub_task_setup (UfoTask *task,
                         UfoResources *resources,
                         GError **error)
 {
     UfoZmqPubTaskPrivate *priv;
+    const gint socket_types[] = { ZMQ_REP, ZMQ_PUSH, ZMQ_XPUB };
 
     priv = UFO_ZMQ_PUB_TASK_GET_PRIVATE (task);
 
+    if (is_encoded (priv) && priv->mode == ZMQ_MODE_REQUEST) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "zmq-pub: encoding and compression require push or publish mode");
+        return;
+    }
+
+    if (!ufo_frame_compression_available (priv->compression)) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
+                     "zmq-pub: `%s' compression is not available in this build",
+                     compression_values[priv->compression].value_nick);
+        return;
+    }
+
     priv->context = zmq_ctx_new ();
     priv->current = 0;
 
@@ -112,7 +209,7 @@ ufo_zmq_pub_task_setup (UfoTask *task,
         return;
     }
 
-    priv->socket = zmq_socket (priv->context, ZMQ_REP);
+    priv->socket = zmq_socket (priv->context, socket_types[priv->mode]);
 
     if (priv->socket == NULL) {
         g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
@@ -120,25 +217,63 @@ ufo_zmq_pub_task_setup (UfoTask *task,
         return;
     }
 
-    if (zmq_bind (priv->socket, "tcp://*:5555") != 0) {
+    if (priv->mode == ZMQ_MODE_PUBLISH) {
+        gint verbose = 1;
+
+        zmq_setsockopt (priv->socket, ZMQ_XPUB_VERBOSE, &verbose, sizeof (verbose));
+    }
+
+    if (zmq_bind (priv->socket, priv->endpoint) != 0) {
         g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
-                     "zmq bind failed: %s\n", zmq_strerror (zmq_errno ()));
+                     "zmq bind to `%s' failed: %s\n", priv->endpoint, zmq_strerror (zmq_errno ()));
         return;
     }
 
-    for (guint registered = 0; registered < priv->expected_subscribers; ) {
-        zmq_msg_t msg;
-        ZmqRequest *request;
+    if (priv->mode == ZMQ_MODE_REQUEST) {
+        for (guint registered = 0; registered < priv->expected_subscribers; ) {
+            zmq_msg_t msg;
+            ZmqRequest *request;
 
-        zmq_msg_init_size (&msg, sizeof (ZmqRequest));
-        zmq_msg_recv (&msg, priv->socket, 0);
+            zmq_msg_init_size (&msg, sizeof (ZmqRequest));
+            zmq_msg_recv (&msg, priv->socket, 0);
 
-        request = zmq_msg_data (&msg);
+            request = zmq_msg_data (&msg);
 
-        if (handle_registration (priv, request, TRUE))
-            registered++;
+            if (handle_registration (priv, request, TRUE))
+                registered++;
 
-        zmq_msg_close (&msg);
+            zmq_msg_close (&msg);
+        }
+
+        return;
+    }
+
+    /* A pusher blocks until a puller connects, a publisher would drop frames */
+    if (priv->mode == ZMQ_MODE_PUBLISH)
+        wait_for_subscriptions (priv);
+
+    priv->pending = g_new0 (PendingFrame, priv->frames_per_message);
+    priv->num_pending = 0;
+
+    /* Encoded frames are sent from their own memory, no slots needed */
+    if (is_encoded (priv))
+        return;
+
+    priv->pinned = ufo_pinned_pool_new (ufo_resources_get_context (resources), error);
+
+    if (priv->pinned == NULL)
+        return;
+
+    priv->cl_context = ufo_resources_get_context (resources);
+    priv->free_slots = g_async_queue_new ();
+
+    /* One message can be in flight while the next one is filled */
+    priv->num_slots = 2 * priv->frames_per_message + 2;
+    priv->slots = g_new0 (SendSlot, priv->num_slots);
+
+    for (guint i = 0; i < priv->num_slots; i++) {
+        priv->slots[i].free_slots = priv->free_slots;
+        g_async_queue_push (priv->free_slots, &priv->slots[i]);
     }
 }
 
@@ -195,13 +330,9 @@ requisition_to_json_array (UfoRequisition *requisition)
     return node;
 }
 
-static gboolean
-ufo_zmq_pub_task_process (UfoTask *task,
-                          UfoBuffer **inputs,
-                          UfoBuffer *output,
-                          UfoRequisition *requisition)
+static void
+serve_requests (UfoZmqPubTaskPrivate *priv, UfoBuffer *input)
 {
-    UfoZmqPubTaskPrivate *priv;
     UfoRequisition req;
     guint num_to_serve;
     gsize size;
@@ -212,9 +343,8 @@ ufo_zmq_pub_task_process (UfoTask *task,
     gsize header_size;
     GList *new_subscribers = NULL;
 
-    priv = UFO_ZMQ_PUB_TASK_GET_PRIVATE (task);
-    ufo_buffer_get_requisition (inputs[0], &req);
-    size = ufo_buffer_get_size (inputs[0]);
+    ufo_buffer_get_requisition (input, &req);
+    size = ufo_buffer_get_size (input);
 
     json_builder_reset (priv->builder);
     json_builder_begin_object (priv->builder);
@@ -241,7 +371,7 @@ ufo_zmq_pub_task_process (UfoTask *task,
     json_node_unref (tree);
 
     num_to_serve = g_hash_table_size (priv->counts);
-    src = (gchar *) ufo_buffer_get_host_array (inputs[0], NULL);
+    src = (gchar *) ufo_buffer_get_host_array (input, NULL);
 
     priv->current++;
 
@@ -318,6 +448,154 @@ ufo_zmq_pub_task_process (UfoTask *task,
 
     g_list_free (new_subscribers);
     g_free (header);
+}
+
+static void
+release_slot (void *data, void *hint)
+{
+    SendSlot *slot = (SendSlot *) hint;
+
+    /* Called by ZeroMQ, possibly from its I/O thread */
+    g_async_queue_push (slot->free_slots, slot);
+}
+
+static void
+free_encoded (void *data, void *hint)
+{
+    g_free (data);
+}
+
+static void
+send_message_part (UfoZmqPubTaskPrivate *priv, zmq_msg_t *msg, gint flags)
+{
+    if (zmq_msg_send (msg, priv->socket, flags) < 0) {
+        g_warning ("zmq-pub: could not send message: %s", zmq_strerror (zmq_errno ()));
+        zmq_msg_close (msg);
+    }
+}
+
+static void
+send_header (UfoZmqPubTaskPrivate *priv, guint8 type, UfoRequisition *requisition, guint num_frames)
+{
+    zmq_msg_t msg;
+    ZmqFrameHeader *header;
+
+    zmq_msg_init_size (&msg, sizeof (ZmqFrameHeader));
+    header = zmq_msg_data (&msg);
+    memset (header, 0, sizeof (ZmqFrameHeader));
+    header->magic = ZMQ_FRAME_MAGIC;
+    header->type = type;
+    header->num_frames = (guint16) num_frames;
+    header->encoding = (guint8) priv->encoding;
+    header->compression = (guint8) priv->compression;
+    header->index = priv->current;
+
+    if (requisition != NULL) {
+        header->n_dims = (guint8) requisition->n_dims;
+
+        for (guint i = 0; i < requisition->n_dims; i++)
+            header->dims[i] = (guint32) requisition->dims[i];
+    }
+
+    send_message_part (priv, &msg, num_frames > 0 ? ZMQ_SNDMORE : 0);
+}
+
+/*
+ * Send all pending frames as one multipart message. The frame data is not
+ * copied, slots and encoded data are released by ZeroMQ once the message has
+ * been sent.
+ */
+static void
+send_pending (UfoZmqPubTaskPrivate *priv)
+{
+    if (priv->num_pending == 0)
+        return;
+
+    send_header (priv, ZMQ_FRAME_DATA, &priv->pending_requisition, priv->num_pending);
+
+    for (guint i = 0; i < priv->num_pending; i++) {
+        zmq_msg_t msg;
+        PendingFrame *frame = &priv->pending[i];
+
+        zmq_msg_init_data (&msg, frame->data, frame->size, frame->free_fn, frame->hint);
+        send_message_part (priv, &msg, i + 1 < priv->num_pending ? ZMQ_SNDMORE : 0);
+    }
+
+    priv->current += priv->num_pending;
+    priv->num_pending = 0;
+}
+
+static gboolean
+same_shape (UfoRequisition *a, UfoRequisition *b)
+{
+    if (a->n_dims != b->n_dims)
+        return FALSE;
+
+    for (guint i = 0; i < a->n_dims; i++) {
+        if (a->dims[i] != b->dims[i])
+            return FALSE;
+    }
+
+    return TRUE;
+}
+
+static void
+queue_frame (UfoZmqPubTaskPrivate *priv, UfoBuffer *input)
+{
+    UfoRequisition requisition;
+    PendingFrame *frame;
+    SendSlot *slot;
+
+    ufo_buffer_get_requisition (input, &requisition);
+
+    /* Frames in one message share their shape */
+    if (priv->num_pending > 0 && !same_shape (&priv->pending_requisition, &requisition))
+        send_pending (priv);
+
+    frame = &priv->pending[priv->num_pending++];
+    priv->pending_requisition = requisition;
+
+    if (is_encoded (priv)) {
+        frame->data = ufo_frame_encode (ufo_buffer_get_host_array (input, NULL),
+                                        ufo_buffer_get_size (input) / sizeof (gfloat),
+                                        priv->encoding, priv->compression, &frame->size);
+        frame->free_fn = free_encoded;
+        frame->hint = NULL;
+    }
+    else {
+        slot = g_async_queue_pop (priv->free_slots);
+
+        if (slot->buffer == NULL)
+            slot->buffer = ufo_buffer_new (&requisition, priv->cl_context);
+        else if (ufo_buffer_cmp_dimensions (slot->buffer, &requisition))
+            ufo_buffer_resize (slot->buffer, &requisition);
+
+        /* The input belongs upstream, copy it once into our pinned memory */
+        frame->size = ufo_buffer_get_size (slot->buffer);
+        frame->data = ufo_pinned_pool_attach (priv->pinned, slot->buffer);
+        memcpy (frame->data, ufo_buffer_get_host_array (input, NULL), frame->size);
+        frame->free_fn = release_slot;
+        frame->hint = slot;
+    }
+
+    if (priv->num_pending == priv->frames_per_message)
+        send_pending (priv);
+}
+
+static gboolean
+ufo_zmq_pub_task_process (UfoTask *task,
+                          UfoBuffer **inputs,
+                          UfoBuffer *output,
+                          UfoRequisition *requisition)
+{
+    UfoZmqPubTaskPrivate *priv;
+
+    priv = UFO_ZMQ_PUB_TASK_GET_PRIVATE (task);
+
+    if (priv->mode == ZMQ_MODE_REQUEST)
+        serve_requests (priv, inputs[0]);
+    else
+        queue_frame (priv, inputs[0]);
 
     return TRUE;
 }
@@ -334,6 +612,22 @@ ufo_zmq_pub_task_set_property (GObject *object,
         case PROP_EXPECTED_SUBSCRIBERS:
             priv->expected_subscribers = g_value_get_uint (value);
             break;
+        case PROP_MODE:
+            priv->mode = g_value_get_enum (value);
+            break;
+        case PROP_ENDPOINT:
+            g_free (priv->endpoint);
+            priv->endpoint = g_value_dup_string (value);
+            break;
+        case PROP_FRAMES_PER_MESSAGE:
+            priv->frames_per_message = g_value_get_uint (value);
+            break;
+        case PROP_ENCODING:
+            priv->encoding = g_value_get_enum (value);
+            break;
+        case PROP_COMPRESSION:
+            priv->compression = g_value_get_enum (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -352,6 +646,21 @@ ufo_zmq_pub_task_get_property (GObject *object,
         case PROP_EXPECTED_SUBSCRIBERS:
             g_value_set_uint (value, priv->expected_subscribers);
             break;
+        case PROP_MODE:
+            g_value_set_enum (value, priv->mode);
+            break;
+        case PROP_ENDPOINT:
+            g_value_set_string (value, priv->endpoint);
+            break;
+        case PROP_FRAMES_PER_MESSAGE:
+            g_value_set_uint (value, priv->frames_per_message);
+            break;
+        case PROP_ENCODING:
+            g_value_set_enum (value, priv->encoding);
+            break;
+        case PROP_COMPRESSION:
+            g_value_set_enum (value, priv->compression);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -370,6 +679,21 @@ ufo_zmq_pub_task_dispose (GObject *object)
     G_OBJECT_CLASS (ufo_zmq_pub_task_parent_class)->dispose (object);
 }
 
+static void
+send_stop (UfoZmqPubTaskPrivate *priv)
+{
+    guint num_stops;
+
+    send_pending (priv);
+
+    /* Pushed messages go to one puller each, so every expected puller needs
+     * its own stop message */
+    num_stops = priv->mode == ZMQ_MODE_PUSH ? MAX (priv->expected_subscribers, 1) : 1;
+
+    for (guint i = 0; i < num_stops; i++)
+        send_header (priv, ZMQ_FRAME_STOP, NULL, 0);
+}
+
 static void
 ufo_zmq_pub_task_finalize (GObject *object)
 {
@@ -377,7 +701,10 @@ ufo_zmq_pub_task_finalize (GObject *object)
     guint num_to_serve;
 
     priv = UFO_ZMQ_PUB_TASK_GET_PRIVATE (object);
-    num_to_serve = g_hash_table_size (priv->counts);
+    num_to_serve = priv->mode == ZMQ_MODE_REQUEST ? g_hash_table_size (priv->counts) : 0;
+
+    if (priv->mode != ZMQ_MODE_REQUEST && priv->pending != NULL)
+        send_stop (priv);
 
     while (num_to_serve > 0) {
         zmq_msg_t msg;
@@ -407,10 +734,29 @@ ufo_zmq_pub_task_finalize (GObject *object)
         zmq_msg_close (&msg);
     }
 
+    /* Blocks until all queued messages are sent and their slots released */
     zmq_close (priv->socket);
     zmq_ctx_destroy (priv->context);
 
     g_hash_table_destroy (priv->counts);
+    g_free (priv->endpoint);
+
+    if (priv->slots) {
+        for (guint i = 0; i < priv->num_slots; i++) {
+            if (priv->slots[i].buffer)
+                g_object_unref (priv->slots[i].buffer);
+        }
+
+        g_free (priv->slots);
+        g_async_queue_unref (priv->free_slots);
+    }
+
+    g_free (priv->pending);
+
+    if (priv->pinned) {
+        ufo_pinned_pool_destroy (priv->pinned);
+        priv->pinned = NULL;
+    }
 
     G_OBJECT_CLASS (ufo_zmq_pub_task_parent_class)->finalize (object);
 }
@@ -443,6 +789,41 @@ ufo_zmq_pub_task_class_init (UfoZmqPubTaskClass *klass)
             0, G_MAXUINT, 0,
             G_PARAM_READWRITE);
 
+    properties[PROP_MODE] =
+        g_param_spec_enum ("mode",
+            "Distribution mode (request, push, publish)",
+            "Distribution mode (request, push, publish)",
+            g_enum_register_static ("UfoZmqPubMode", mode_values),
+            ZMQ_MODE_REQUEST, G_PARAM_READWRITE);
+
+    properties[PROP_ENDPOINT] =
+        g_param_spec_string ("endpoint",
+            "ZMQ endpoint to bind to",
+            "ZMQ endpoint to bind to",
+            "tcp://*:5555",
+            G_PARAM_READWRITE);
+
+    properties[PROP_FRAMES_PER_MESSAGE] =
+        g_param_spec_uint ("frames-per-message",
+            "Number of frames sent in one message in push and publish mode",
+            "Number of frames sent in one message in push and publish mode",
+            1, G_MAXUINT16, 1,
+            G_PARAM_READWRITE);
+
+    properties[PROP_ENCODING] =
+        g_param_spec_enum ("encoding",
+            "Frame encoding in push and publish mode (float32, float16, uint16)",
+            "Frame encoding in push and publish mode (float32, float16, uint16)",
+            g_enum_register_static ("UfoZmqPubEncoding", encoding_values),
+            UFO_FRAME_ENCODING_FLOAT32, G_PARAM_READWRITE);
+
+    properties[PROP_COMPRESSION] =
+        g_param_spec_enum ("compression",
+            "Frame compression in push and publish mode (none, lz4, zstd)",
+            "Frame compression in push and publish mode (none, lz4, zstd)",
+            g_enum_register_static ("UfoZmqPubCompression", compression_values),
+            UFO_FRAME_COMPRESSION_NONE, G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -456,6 +837,15 @@ ufo_zmq_pub_task_init(UfoZmqPubTask *self)
     self->priv->context = NULL;
     self->priv->socket = NULL;
     self->priv->expected_subscribers = 0;
+    self->priv->mode = ZMQ_MODE_REQUEST;
+    self->priv->endpoint = g_strdup ("tcp://*:5555");
+    self->priv->frames_per_message = 1;
+    self->priv->encoding = UFO_FRAME_ENCODING_FLOAT32;
+    self->priv->compression = UFO_FRAME_COMPRESSION_NONE;
+    self->priv->pinned = NULL;
+    self->priv->slots = NULL;
+    self->priv->free_slots = NULL;
+    self->priv->pending = NULL;
     self->priv->counts = g_hash_table_new (g_direct_hash, g_direct_equal);
     self->priv->builder = json_builder_new_immutable ();
     self->priv->generator = json_generator_new ();
@@ -28,14 +28,29 @@
 #include <json-glib/json-glib.h>
 #include "ufo-zmq-sub-task.h"
 #include "ufo-zmq-common.h"
+#include "common/ufo-pinned.h"
+#include "common/ufo-frame-codec.h"
 
 
 struct _UfoZmqSubTaskPrivate {
     gint32 id;
     gpointer context;
     gpointer socket;
+    ZmqMode mode;
     gchar *address;
+    gchar *endpoint;
     gboolean stop;
+    /* push and publish modes */
+    UfoPinnedPool *pinned;
+    ZmqFrameHeader header;
+    guint frames_left;
+};
+
+static GEnumValue mode_values[] = {
+    { ZMQ_MODE_REQUEST, "ZMQ_MODE_REQUEST", "request" },
+    { ZMQ_MODE_PUSH,    "ZMQ_MODE_PUSH",    "push" },
+    { ZMQ_MODE_PUBLISH, "ZMQ_MODE_PUBLISH", "publish" },
+    { 0, NULL, NULL}
 };
 
 static void ufo_task_interface_init (UfoTaskIface *iface);
@@ -49,6 +64,8 @@ G_DEFINE_TYPE_WITH_CODE (UfoZmqSubTask, ufo_zmq_sub_task, UFO_TYPE_TASK_NODE,
 enum {
     PROP_0,
     PROP_ADDRESS,
+    PROP_MODE,
+    PROP_ENDPOINT,
     N_PROPERTIES
 };
 
@@ -71,6 +88,7 @@ ufo_zmq_sub_task_setup (UfoTask *task,
     zmq_msg_t reply_msg;
     ZmqRequest *request;
     ZmqReply *reply;
+    const gint socket_types[] = { ZMQ_REQ, ZMQ_PULL, ZMQ_SUB };
 
     priv = UFO_ZMQ_SUB_TASK_GET_PRIVATE (task);
     priv->context = zmq_ctx_new ();
@@ -81,7 +99,7 @@ ufo_zmq_sub_task_setup (UfoTask *task,
         return;
     }
 
-    priv->socket = zmq_socket (priv->context, ZMQ_REQ);
+    priv->socket = zmq_socket (priv->context, socket_types[priv->mode]);
 
     if (priv->socket == NULL) {
         g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
@@ -89,17 +107,29 @@ ufo_zmq_sub_task_setup (UfoTask *task,
         return;
     }
 
-    addr = g_strdup_printf ("%s:5555", priv->address);
+    if (priv->mode == ZMQ_MODE_PUBLISH)
+        zmq_setsockopt (priv->socket, ZMQ_SUBSCRIBE, "", 0);
+
+    if (priv->endpoint != NULL)
+        addr = g_strdup (priv->endpoint);
+    else
+        addr = g_strdup_printf ("%s:5555", priv->address);
 
     if (zmq_connect (priv->socket, addr) != 0) {
         g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_SETUP,
-                     "zmq connect failed: %s\n", zmq_strerror (zmq_errno ()));
+                     "zmq connect to `%s' failed: %s\n", addr, zmq_strerror (zmq_errno ()));
         g_free (addr);
         return;
     }
 
     g_free (addr);
 
+    if (priv->mode != ZMQ_MODE_REQUEST) {
+        priv->frames_left = 0;
+        priv->pinned = ufo_pinned_pool_new (ufo_resources_get_context (resources), error);
+        return;
+    }
+
     zmq_msg_init_size (&request_msg, sizeof (ZmqRequest));
 
     request = zmq_msg_data (&request_msg);
@@ -167,6 +197,44 @@ request_data (UfoZmqSubTaskPrivate *priv)
     return TRUE;
 }
 
+/*
+ * Receive the header of the next message in push and publish mode. The frames
+ * following it are received one by one by generate.
+ */
+static gboolean
+receive_header (UfoZmqSubTaskPrivate *priv, GError **error)
+{
+    gint size;
+
+    size = zmq_recv (priv->socket, &priv->header, sizeof (ZmqFrameHeader), 0);
+
+    if (size != sizeof (ZmqFrameHeader) || priv->header.magic != ZMQ_FRAME_MAGIC ||
+        priv->header.n_dims > ZMQ_MAX_DIMENSIONS) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
+                     "zmq-sub: received invalid frame header");
+        priv->stop = TRUE;
+        return FALSE;
+    }
+
+    if (priv->header.type == ZMQ_FRAME_STOP) {
+        priv->stop = TRUE;
+        return FALSE;
+    }
+
+    if (priv->header.encoding > UFO_FRAME_ENCODING_UINT16 ||
+        priv->header.compression > UFO_FRAME_COMPRESSION_ZSTD ||
+        !ufo_frame_compression_available (priv->header.compression)) {
+        g_set_error (error, UFO_TASK_ERROR, UFO_TASK_ERROR_GET_REQUISITION,
+                     "zmq-sub: cannot decode frames with encoding %i and compression %i",
+                     priv->header.encoding, priv->header.compression);
+        priv->stop = TRUE;
+        return FALSE;
+    }
+
+    priv->frames_left = priv->header.num_frames;
+    return TRUE;
+}
+
 static void
 ufo_zmq_sub_task_get_requisition (UfoTask *task,
                                   UfoBuffer **inputs,
@@ -182,6 +250,18 @@ ufo_zmq_sub_task_get_requisition (UfoTask *task,
 
     priv = UFO_ZMQ_SUB_TASK_GET_PRIVATE (task);
 
+    if (priv->mode != ZMQ_MODE_REQUEST) {
+        if (priv->frames_left == 0 && !receive_header (priv, error))
+            return;
+
+        requisition->n_dims = priv->header.n_dims;
+
+        for (guint i = 0; i < requisition->n_dims; i++)
+            requisition->dims[i] = priv->header.dims[i];
+
+        return;
+    }
+
     if (!request_data (priv) || priv->stop)
         return;
 
@@ -246,6 +326,39 @@ ufo_zmq_sub_task_generate (UfoTask *task,
         return FALSE;
 
     size = ufo_buffer_get_size (output);
+
+    if (priv->mode != ZMQ_MODE_REQUEST) {
+        gfloat *host_array;
+
+        host_array = ufo_pinned_pool_attach (priv->pinned, output);
+        priv->frames_left--;
+
+        if (priv->header.encoding == UFO_FRAME_ENCODING_FLOAT32 &&
+            priv->header.compression == UFO_FRAME_COMPRESSION_NONE) {
+            /* Receive straight into the (pinned) host memory of the output */
+            if (zmq_recv (priv->socket, host_array, size, 0) != (gint) size) {
+                g_warning ("zmq-sub: frame size does not match its header");
+                return FALSE;
+            }
+
+            return TRUE;
+        }
+
+        zmq_msg_init (&msg);
+        zmq_msg_recv (&msg, priv->socket, 0);
+
+        if (!ufo_frame_decode (zmq_msg_data (&msg), zmq_msg_size (&msg),
+                               host_array, size / sizeof (gfloat),
+                               priv->header.encoding, priv->header.compression)) {
+            g_warning ("zmq-sub: could not decode frame");
+            zmq_msg_close (&msg);
+            return FALSE;
+        }
+
+        zmq_msg_close (&msg);
+        return TRUE;
+    }
+
     zmq_msg_init_size (&msg, size);
     zmq_msg_recv (&msg, priv->socket, 0);
     g_assert (zmq_msg_size (&msg) == size);
@@ -268,6 +381,13 @@ ufo_zmq_sub_task_set_property (GObject *object,
             g_free (priv->address);
             priv->address = g_value_dup_string (value);
             break;
+        case PROP_MODE:
+            priv->mode = g_value_get_enum (value);
+            break;
+        case PROP_ENDPOINT:
+            g_free (priv->endpoint);
+            priv->endpoint = g_value_dup_string (value);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -286,6 +406,12 @@ ufo_zmq_sub_task_get_property (GObject *object,
         case PROP_ADDRESS:
             g_value_set_string (value, priv->address);
             break;
+        case PROP_MODE:
+            g_value_set_enum (value, priv->mode);
+            break;
+        case PROP_ENDPOINT:
+            g_value_set_string (value, priv->endpoint);
+            break;
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -301,6 +427,12 @@ ufo_zmq_sub_task_finalize (GObject *object)
     zmq_close (priv->socket);
     zmq_ctx_destroy (priv->context);
     g_free (priv->address);
+    g_free (priv->endpoint);
+
+    if (priv->pinned) {
+        ufo_pinned_pool_destroy (priv->pinned);
+        priv->pinned = NULL;
+    }
 
     G_OBJECT_CLASS (ufo_zmq_sub_task_parent_class)->finalize (object);
 }
@@ -332,6 +464,20 @@ ufo_zmq_sub_task_class_init (UfoZmqSubTaskClass *klass)
             "tcp://127.0.0.1",
             G_PARAM_READWRITE);
 
+    properties[PROP_MODE] =
+        g_param_spec_enum ("mode",
+            "Distribution mode of the publisher (request, push, publish)",
+            "Distribution mode of the publisher (request, push, publish)",
+            g_enum_register_static ("UfoZmqSubMode", mode_values),
+            ZMQ_MODE_REQUEST, G_PARAM_READWRITE);
+
+    properties[PROP_ENDPOINT] =
+        g_param_spec_string ("endpoint",
+            "ZMQ endpoint to connect to, overrides address",
+            "ZMQ endpoint to connect to, overrides address",
+            NULL,
+            G_PARAM_READWRITE);
+
     for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
         g_object_class_install_property (oclass, i, properties[i]);
 
@@ -345,6 +491,10 @@ ufo_zmq_sub_task_init(UfoZmqSubTask *self)
     self->priv->context = NULL;
     self->priv->socket = NULL;
     self->priv->address = g_strdup ("tcp://127.0.0.1");
+    self->priv->endpoint = NULL;
+    self->priv->mode = ZMQ_MODE_REQUEST;
+    self->priv->pinned = NULL;
+    self->priv->frames_left = 0;
     self->priv->id = (gint32) g_random_int ();
     self->priv->stop = FALSE;
 }
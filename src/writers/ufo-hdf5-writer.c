@@ -17,18 +17,50 @@
  * License along with this library.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <string.h>
+#include "config.h"
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
 #include "common/hdf5.h"
 #include "writers/ufo-writer.h"
 #include "writers/ufo-hdf5-writer.h"
 
+/* Registered ID of the HDF5 LZ4 filter plugin */
+#define H5Z_FILTER_LZ4  32004
+
+/* Number of chunk cache hash slots, a prime as recommended by the HDF5 docs */
+#define CHUNK_CACHE_SLOTS 12421
 
 struct _UfoHdf5WriterPrivate {
     gchar *dataset;
     hid_t file_id;
     hid_t dataset_id;
     guint current;
+
+    guint chunk_height;
+    gulong chunk_cache_size;
+    UfoHdf5Compression compression;
+    guint compression_level;
+
+    /* TRUE if we compress chunks ourselves and bypass the filter pipeline */
+    gboolean direct_chunks;
+    guint chunk_rows;
 };
 
+enum {
+    PROP_0,
+    PROP_CHUNK_HEIGHT,
+    PROP_CHUNK_CACHE_SIZE,
+    PROP_COMPRESSION,
+    PROP_COMPRESSION_LEVEL,
+    N_PROPERTIES
+};
+
+static GParamSpec *properties[N_PROPERTIES] = { NULL, };
+
 static void ufo_writer_interface_init (UfoWriterIface *iface);
 
 G_DEFINE_TYPE_WITH_CODE (UfoHdf5Writer, ufo_hdf5_writer, G_TYPE_OBJECT,
@@ -43,6 +75,24 @@ ufo_hdf5_writer_new (void)
     return g_object_new (UFO_TYPE_HDF5_WRITER, NULL);
 }
 
+GType
+ufo_hdf5_compression_get_type (void)
+{
+    static GType type = 0;
+
+    static const GEnumValue values[] = {
+        { UFO_HDF5_COMPRESSION_NONE,    "UFO_HDF5_COMPRESSION_NONE",    "none" },
+        { UFO_HDF5_COMPRESSION_DEFLATE, "UFO_HDF5_COMPRESSION_DEFLATE", "deflate" },
+        { UFO_HDF5_COMPRESSION_LZ4,     "UFO_HDF5_COMPRESSION_LZ4",     "lz4" },
+        { 0, NULL, NULL }
+    };
+
+    if (type == 0)
+        type = g_enum_register_static ("UfoHdf5Compression", values);
+
+    return type;
+}
+
 static gboolean
 ufo_hdf5_writer_can_open (UfoWriter *writer,
                           const gchar *filename)
@@ -170,6 +220,120 @@ buffer_depth_to_hdf5_type (UfoBufferDepth depth)
     }
 }
 
+static hid_t
+make_access_plist (UfoHdf5WriterPrivate *priv)
+{
+    hid_t dapl;
+
+    dapl = H5Pcreate (H5P_DATASET_ACCESS);
+
+    if (priv->chunk_cache_size > 0)
+        H5Pset_chunk_cache (dapl, CHUNK_CACHE_SLOTS, priv->chunk_cache_size, 1.0);
+
+    return dapl;
+}
+
+static hid_t
+make_create_plist (UfoHdf5WriterPrivate *priv,
+                   hsize_t *chunk_dims)
+{
+    hid_t dcpl;
+
+    dcpl = H5Pcreate (H5P_DATASET_CREATE);
+    H5Pset_chunk (dcpl, 3, chunk_dims);
+    priv->direct_chunks = FALSE;
+
+    switch (priv->compression) {
+        case UFO_HDF5_COMPRESSION_DEFLATE:
+            H5Pset_deflate (dcpl, priv->compression_level);
+#if defined(HAVE_ZLIB) && H5_VERSION_GE(1,10,3)
+            priv->direct_chunks = TRUE;
+#endif
+            break;
+        case UFO_HDF5_COMPRESSION_LZ4:
+            if (H5Zfilter_avail (H5Z_FILTER_LZ4) > 0)
+                H5Pset_filter (dcpl, H5Z_FILTER_LZ4, H5Z_FLAG_MANDATORY, 0, NULL);
+            else
+                g_warning ("hdf5: LZ4 filter plugin not available, writing uncompressed data");
+            break;
+        default:
+            break;
+    }
+
+    return dcpl;
+}
+
+#if defined(HAVE_ZLIB) && H5_VERSION_GE(1,10,3)
+/*
+ * Compress all chunks of one frame in parallel and write them with
+ * H5Dwrite_chunk which bypasses the (single-threaded) filter pipeline. The
+ * result is identical to what the deflate filter would have produced.
+ */
+static gboolean
+write_direct_chunks (UfoHdf5WriterPrivate *priv,
+                     UfoWriterImage *image,
+                     gsize bytes_per_pixel)
+{
+    gsize width;
+    gsize height;
+    gsize row_size;
+    gsize chunk_size;
+    guint n_chunks;
+    gchar **compressed;
+    uLongf *compressed_sizes;
+    gboolean success = TRUE;
+
+    width = image->requisition->dims[0];
+    height = image->requisition->dims[1];
+    row_size = width * bytes_per_pixel;
+    chunk_size = priv->chunk_rows * row_size;
+    n_chunks = (height + priv->chunk_rows - 1) / priv->chunk_rows;
+    compressed = g_new0 (gchar *, n_chunks);
+    compressed_sizes = g_new0 (uLongf, n_chunks);
+
+#pragma omp parallel for schedule(dynamic)
+    for (guint i = 0; i < n_chunks; i++) {
+        const gchar *src;
+        gchar *padded = NULL;
+        gsize rows;
+
+        src = ((const gchar *) image->data) + i * chunk_size;
+        rows = MIN (priv->chunk_rows, height - i * priv->chunk_rows);
+
+        /* Chunks that stick out of the dataset must be stored in full size */
+        if (rows < priv->chunk_rows) {
+            padded = g_malloc0 (chunk_size);
+            memcpy (padded, src, rows * row_size);
+            src = padded;
+        }
+
+        compressed_sizes[i] = compressBound (chunk_size);
+        compressed[i] = g_malloc (compressed_sizes[i]);
+
+        if (compress2 ((Bytef *) compressed[i], &compressed_sizes[i],
+                       (const Bytef *) src, chunk_size, (int) priv->compression_level) != Z_OK)
+            success = FALSE;
+
+        g_free (padded);
+    }
+
+    for (guint i = 0; i < n_chunks && success; i++) {
+        hsize_t offset[3] = { priv->current, i * priv->chunk_rows, 0 };
+
+        if (H5Dwrite_chunk (priv->dataset_id, H5P_DEFAULT, 0, offset,
+                            compressed_sizes[i], compressed[i]) < 0)
+            success = FALSE;
+    }
+
+    for (guint i = 0; i < n_chunks; i++)
+        g_free (compressed[i]);
+
+    g_free (compressed);
+    g_free (compressed_sizes);
+    return success;
+}
+#endif
+
 static void
 ufo_hdf5_writer_write (UfoWriter *writer,
                        UfoWriterImage *image)
@@ -188,30 +352,54 @@ ufo_hdf5_writer_write (UfoWriter *writer,
     mem_type = buffer_depth_to_hdf5_type (image->depth);
 
     if (priv->current == 0) {
+        hid_t dapl;
+
+        dapl = make_access_plist (priv);
+
         if (dataset_exists (priv->file_id, priv->dataset)) {
-            priv->dataset_id = H5Dopen (priv->file_id, priv->dataset, H5P_DEFAULT);
+            /* We do not know type and filters of the existing dataset */
+            priv->dataset_id = H5Dopen (priv->file_id, priv->dataset, dapl);
+            priv->direct_chunks = FALSE;
         }
         else {
             hid_t group_id;
             hid_t dcpl;
             hsize_t max_dims[3] = { H5S_UNLIMITED, image->requisition->dims[1], image->requisition->dims[0] };
+            hsize_t chunk_dims[3] = { 1, image->requisition->dims[1], image->requisition->dims[0] };
+
+            if (priv->chunk_height > 0 && priv->chunk_height < chunk_dims[1])
+                chunk_dims[1] = priv->chunk_height;
 
+            priv->chunk_rows = (guint) chunk_dims[1];
             group_id = make_groups (priv->file_id, priv->dataset);
 
             dst_dataspace_id = H5Screate_simple (3, dims, max_dims);
-            dcpl = H5Pcreate (H5P_DATASET_CREATE);
-            H5Pset_chunk (dcpl, 3, dims);
+            dcpl = make_create_plist (priv, chunk_dims);
             priv->dataset_id = H5Dcreate (group_id, priv->dataset, mem_type, dst_dataspace_id,
-                                          H5P_DEFAULT, dcpl, H5P_DEFAULT);
+                                          H5P_DEFAULT, dcpl, dapl);
 
             H5Pclose (dcpl);
             H5Sclose (dst_dataspace_id);
         }
+
+        H5Pclose (dapl);
     }
     else {
         H5Dset_extent (priv->dataset_id, dims);
     }
 
+#if defined(HAVE_ZLIB) && H5_VERSION_GE(1,10,3)
+    if (priv->direct_chunks && image->requisition->n_dims == 2) {
+        if (write_direct_chunks (priv, image, H5Tget_size (mem_type))) {
+            priv->current++;
+            return;
+        }
+
+        g_warning ("hdf5: direct chunk write failed, using filter pipeline");
+        priv->direct_chunks = FALSE;
+    }
+#endif
+
     dst_dataspace_id = H5Dget_space (priv->dataset_id);
     src_dataspace_id = H5Screate_simple (2, src_dims, NULL);
 
@@ -223,6 +411,60 @@ ufo_hdf5_writer_write (UfoWriter *writer,
     priv->current++;
 }
 
+static void
+ufo_hdf5_writer_set_property (GObject *object,
+                              guint property_id,
+                              const GValue *value,
+                              GParamSpec *pspec)
+{
+    UfoHdf5WriterPrivate *priv = UFO_HDF5_WRITER_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_CHUNK_HEIGHT:
+            priv->chunk_height = g_value_get_uint (value);
+            break;
+        case PROP_CHUNK_CACHE_SIZE:
+            priv->chunk_cache_size = g_value_get_ulong (value);
+            break;
+        case PROP_COMPRESSION:
+            priv->compression = g_value_get_enum (value);
+            break;
+        case PROP_COMPRESSION_LEVEL:
+            priv->compression_level = g_value_get_uint (value);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+ufo_hdf5_writer_get_property (GObject *object,
+                              guint property_id,
+                              GValue *value,
+                              GParamSpec *pspec)
+{
+    UfoHdf5WriterPrivate *priv = UFO_HDF5_WRITER_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_CHUNK_HEIGHT:
+            g_value_set_uint (value, priv->chunk_height);
+            break;
+        case PROP_CHUNK_CACHE_SIZE:
+            g_value_set_ulong (value, priv->chunk_cache_size);
+            break;
+        case PROP_COMPRESSION:
+            g_value_set_enum (value, priv->compression);
+            break;
+        case PROP_COMPRESSION_LEVEL:
+            g_value_set_uint (value, priv->compression_level);
+            break;
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
 static void
 ufo_hdf5_writer_finalize (GObject *object)
 {
@@ -248,8 +490,42 @@ ufo_hdf5_writer_class_init (UfoHdf5WriterClass *klass)
 {
     GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
 
+    gobject_class->set_property = ufo_hdf5_writer_set_property;
+    gobject_class->get_property = ufo_hdf5_writer_get_property;
     gobject_class->finalize = ufo_hdf5_writer_finalize;
 
+    properties[PROP_CHUNK_HEIGHT] =
+        g_param_spec_uint ("chunk-height",
+            "Number of rows per chunk, 0 stores whole frames",
+            "Number of rows per chunk, 0 stores whole frames",
+            0, G_MAXUINT, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_CHUNK_CACHE_SIZE] =
+        g_param_spec_ulong ("chunk-cache-size",
+            "Size of the chunk cache in bytes, 0 uses the HDF5 default",
+            "Size of the chunk cache in bytes, 0 uses the HDF5 default",
+            0, G_MAXULONG, 0,
+            G_PARAM_READWRITE);
+
+    properties[PROP_COMPRESSION] =
+        g_param_spec_enum ("compression",
+            "Compression filter",
+            "Compression filter",
+            ufo_hdf5_compression_get_type (),
+            UFO_HDF5_COMPRESSION_NONE,
+            G_PARAM_READWRITE);
+
+    properties[PROP_COMPRESSION_LEVEL] =
+        g_param_spec_uint ("compression-level",
+            "Deflate compression level",
+            "Deflate compression level",
+            0, 9, 4,
+            G_PARAM_READWRITE);
+
+    for (guint i = PROP_0 + 1; i < N_PROPERTIES; i++)
+        g_object_class_install_property (gobject_class, i, properties[i]);
+
     g_type_class_add_private (gobject_class, sizeof (UfoHdf5WriterPrivate));
 }
 
@@ -260,4 +536,10 @@ ufo_hdf5_writer_init (UfoHdf5Writer *self)
 
     self->priv = priv = UFO_HDF5_WRITER_GET_PRIVATE (self);
     priv->dataset = NULL;
+    priv->chunk_height = 0;
+    priv->chunk_cache_size = 0;
+    priv->compression = UFO_HDF5_COMPRESSION_NONE;
+    priv->compression_level = 4;
+    priv->direct_chunks = FALSE;
+    priv->chunk_rows = 0;
 }
@@ -32,6 +32,12 @@ G_BEGIN_DECLS
 #define UFO_HDF5_WRITER_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), UFO_TYPE_HDF5_WRITER, UfoHdf5WriterClass))
 
 
+typedef enum {
+    UFO_HDF5_COMPRESSION_NONE,
+    UFO_HDF5_COMPRESSION_DEFLATE,
+    UFO_HDF5_COMPRESSION_LZ4,
+} UfoHdf5Compression;
+
 typedef struct _UfoHdf5Writer           UfoHdf5Writer;
 typedef struct _UfoHdf5WriterClass      UfoHdf5WriterClass;
 typedef struct _UfoHdf5WriterPrivate    UfoHdf5WriterPrivate;
@@ -46,8 +52,9 @@ struct _UfoHdf5WriterClass {
     GObjectClass parent_class;
 };
 
-UfoHdf5Writer  *ufo_hdf5_writer_new       (void);
-GType           ufo_hdf5_writer_get_type  (void);
+UfoHdf5Writer  *ufo_hdf5_writer_new            (void);
+GType           ufo_hdf5_writer_get_type       (void);
+GType           ufo_hdf5_compression_get_type  (void);
 
 G_END_DECLS
 
@@ -19,6 +19,14 @@
 
 #include "ufo-writer.h"
 
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_DISPATCH
+#include <immintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#define HAVE_NEON
+#include <arm_neon.h>
+#endif
+
 typedef UfoWriterIface UfoWriterInterface;
 
 G_DEFINE_INTERFACE (UfoWriter, ufo_writer, 0)
@@ -51,22 +59,41 @@ ufo_writer_write (UfoWriter *writer,
     UFO_WRITER_GET_IFACE (writer)->write (writer, image);
 }
 
-static void
-get_min_max (UfoWriterImage *image, gfloat *src, gsize n_elements, gfloat *min, gfloat *max)
+/*
+ * Write an image whose data has already been narrowed to image->depth, e.g. on
+ * the device, without converting it again.
+ */
+void
+ufo_writer_write_converted (UfoWriter *writer,
+                            UfoWriterImage *image)
 {
-    if (image->max > -G_MAXFLOAT && image->min < G_MAXFLOAT) {
-        *max = image->max;
-        *min = image->min;
-        return;
-    }
+    UFO_WRITER_GET_IFACE (writer)->write (writer, image);
+}
 
-    /* TODO: We should issue a warning if only one of max or min was set by the
-     * user ... */
+/*
+ * Conversion routines. All of them work in-place, i.e. dst may alias src. This
+ * is safe as long as each block of source values is loaded before the narrower
+ * results are stored, because the write position never overtakes the read
+ * position.
+ */
+typedef void (*FindMinMaxFunc) (const gfloat *src, gsize n, gfloat *min, gfloat *max);
+typedef void (*Pack8bitFunc) (const gfloat *src, guint8 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper);
+typedef void (*Pack16bitFunc) (const gfloat *src, guint16 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper);
 
-    gfloat cmax = -G_MAXFLOAT;
-    gfloat cmin = G_MAXFLOAT;
+typedef struct {
+    const gchar *name;
+    FindMinMaxFunc find_min_max;
+    Pack8bitFunc pack_8bit;
+    Pack16bitFunc pack_16bit;
+} ConversionFuncs;
 
-    for (gsize i = 0; i < n_elements; i++) {
+static void
+find_min_max_scalar (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    gfloat cmin = *min;
+    gfloat cmax = *max;
+
+    for (gsize i = 0; i < n; i++) {
         if (src[i] < cmin)
             cmin = src[i];
 
@@ -74,8 +101,323 @@ get_min_max (UfoWriterImage *image, gfloat *src, gsize n_elements, gfloat *min,
             cmax = src[i];
     }
 
-    *max = cmax;
     *min = cmin;
+    *max = cmax;
+}
+
+static void
+pack_8bit_scalar (const gfloat *src, guint8 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper)
+{
+    for (gsize i = 0; i < n; i++) {
+        gfloat value = src[i];
+
+        if (value < lower)
+            value = lower;
+        else if (value > upper)
+            value = upper;
+
+        dst[i] = (guint8) ((value - offset) * scale);
+    }
+}
+
+static void
+pack_16bit_scalar (const gfloat *src, guint16 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper)
+{
+    for (gsize i = 0; i < n; i++) {
+        gfloat value = src[i];
+
+        if (value < lower)
+            value = lower;
+        else if (value > upper)
+            value = upper;
+
+        dst[i] = (guint16) ((value - offset) * scale);
+    }
+}
+
+#ifdef HAVE_X86_DISPATCH
+/*
+ * Note that the source operand comes first in min and max, so that NaNs are
+ * skipped like in the scalar comparisons.
+ */
+__attribute__((target ("sse4.1")))
+static void
+find_min_max_sse (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    __m128 vmin = _mm_set1_ps (*min);
+    __m128 vmax = _mm_set1_ps (*max);
+    gfloat lanes_min[4];
+    gfloat lanes_max[4];
+    gsize i = 0;
+
+    for (; i + 4 <= n; i += 4) {
+        __m128 x = _mm_loadu_ps (src + i);
+        vmin = _mm_min_ps (x, vmin);
+        vmax = _mm_max_ps (x, vmax);
+    }
+
+    _mm_storeu_ps (lanes_min, vmin);
+    _mm_storeu_ps (lanes_max, vmax);
+    for (guint j = 0; j < 4; j++) {
+        *min = MIN (*min, lanes_min[j]);
+        *max = MAX (*max, lanes_max[j]);
+    }
+
+    find_min_max_scalar (src + i, n - i, min, max);
+}
+
+__attribute__((target ("sse4.1")))
+static inline __m128i
+clamp_and_scale_sse (const gfloat *src, __m128 offset, __m128 scale, __m128 lower, __m128 upper)
+{
+    __m128 x = _mm_min_ps (_mm_max_ps (_mm_loadu_ps (src), lower), upper);
+    return _mm_cvttps_epi32 (_mm_mul_ps (_mm_sub_ps (x, offset), scale));
+}
+
+__attribute__((target ("sse4.1")))
+static void
+pack_8bit_sse (const gfloat *src, guint8 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper)
+{
+    const __m128 voffset = _mm_set1_ps (offset);
+    const __m128 vscale = _mm_set1_ps (scale);
+    const __m128 vlower = _mm_set1_ps (lower);
+    const __m128 vupper = _mm_set1_ps (upper);
+    gsize i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = clamp_and_scale_sse (src + i, voffset, vscale, vlower, vupper);
+        __m128i b = clamp_and_scale_sse (src + i + 4, voffset, vscale, vlower, vupper);
+        __m128i c = clamp_and_scale_sse (src + i + 8, voffset, vscale, vlower, vupper);
+        __m128i d = clamp_and_scale_sse (src + i + 12, voffset, vscale, vlower, vupper);
+        __m128i packed = _mm_packus_epi16 (_mm_packus_epi32 (a, b), _mm_packus_epi32 (c, d));
+        _mm_storeu_si128 ((__m128i *) (dst + i), packed);
+    }
+
+    pack_8bit_scalar (src + i, dst + i, n - i, offset, scale, lower, upper);
+}
+
+__attribute__((target ("sse4.1")))
+static void
+pack_16bit_sse (const gfloat *src, guint16 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper)
+{
+    const __m128 voffset = _mm_set1_ps (offset);
+    const __m128 vscale = _mm_set1_ps (scale);
+    const __m128 vlower = _mm_set1_ps (lower);
+    const __m128 vupper = _mm_set1_ps (upper);
+    gsize i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m128i a = clamp_and_scale_sse (src + i, voffset, vscale, vlower, vupper);
+        __m128i b = clamp_and_scale_sse (src + i + 4, voffset, vscale, vlower, vupper);
+        _mm_storeu_si128 ((__m128i *) (dst + i), _mm_packus_epi32 (a, b));
+    }
+
+    pack_16bit_scalar (src + i, dst + i, n - i, offset, scale, lower, upper);
+}
+
+__attribute__((target ("avx2")))
+static void
+find_min_max_avx2 (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    __m256 vmin = _mm256_set1_ps (*min);
+    __m256 vmax = _mm256_set1_ps (*max);
+    gfloat lanes_min[8];
+    gfloat lanes_max[8];
+    gsize i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        __m256 x = _mm256_loadu_ps (src + i);
+        vmin = _mm256_min_ps (x, vmin);
+        vmax = _mm256_max_ps (x, vmax);
+    }
+
+    _mm256_storeu_ps (lanes_min, vmin);
+    _mm256_storeu_ps (lanes_max, vmax);
+    for (guint j = 0; j < 8; j++) {
+        *min = MIN (*min, lanes_min[j]);
+        *max = MAX (*max, lanes_max[j]);
+    }
+
+    find_min_max_scalar (src + i, n - i, min, max);
+}
+
+__attribute__((target ("avx2")))
+static inline __m256i
+clamp_and_scale_avx2 (const gfloat *src, __m256 offset, __m256 scale, __m256 lower, __m256 upper)
+{
+    __m256 x = _mm256_min_ps (_mm256_max_ps (_mm256_loadu_ps (src), lower), upper);
+    return _mm256_cvttps_epi32 (_mm256_mul_ps (_mm256_sub_ps (x, offset), scale));
+}
+
+__attribute__((target ("avx2")))
+static void
+pack_8bit_avx2 (const gfloat *src, guint8 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper)
+{
+    const __m256 voffset = _mm256_set1_ps (offset);
+    const __m256 vscale = _mm256_set1_ps (scale);
+    const __m256 vlower = _mm256_set1_ps (lower);
+    const __m256 vupper = _mm256_set1_ps (upper);
+    /* packs work per 128-bit lane, this restores the element order */
+    const __m256i order = _mm256_setr_epi32 (0, 4, 1, 5, 2, 6, 3, 7);
+    gsize i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = clamp_and_scale_avx2 (src + i, voffset, vscale, vlower, vupper);
+        __m256i b = clamp_and_scale_avx2 (src + i + 8, voffset, vscale, vlower, vupper);
+        __m256i c = clamp_and_scale_avx2 (src + i + 16, voffset, vscale, vlower, vupper);
+        __m256i d = clamp_and_scale_avx2 (src + i + 24, voffset, vscale, vlower, vupper);
+        __m256i packed = _mm256_packus_epi16 (_mm256_packus_epi32 (a, b), _mm256_packus_epi32 (c, d));
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_permutevar8x32_epi32 (packed, order));
+    }
+
+    pack_8bit_scalar (src + i, dst + i, n - i, offset, scale, lower, upper);
+}
+
+__attribute__((target ("avx2")))
+static void
+pack_16bit_avx2 (const gfloat *src, guint16 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper)
+{
+    const __m256 voffset = _mm256_set1_ps (offset);
+    const __m256 vscale = _mm256_set1_ps (scale);
+    const __m256 vlower = _mm256_set1_ps (lower);
+    const __m256 vupper = _mm256_set1_ps (upper);
+    gsize i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        __m256i a = clamp_and_scale_avx2 (src + i, voffset, vscale, vlower, vupper);
+        __m256i b = clamp_and_scale_avx2 (src + i + 8, voffset, vscale, vlower, vupper);
+        __m256i packed = _mm256_packus_epi32 (a, b);
+        _mm256_storeu_si256 ((__m256i *) (dst + i), _mm256_permute4x64_epi64 (packed, 0xd8));
+    }
+
+    pack_16bit_scalar (src + i, dst + i, n - i, offset, scale, lower, upper);
+}
+#endif
+
+#ifdef HAVE_NEON
+static void
+find_min_max_neon (const gfloat *src, gsize n, gfloat *min, gfloat *max)
+{
+    float32x4_t vmin = vdupq_n_f32 (*min);
+    float32x4_t vmax = vdupq_n_f32 (*max);
+    gsize i = 0;
+
+    /* minnm and maxnm return the number if one operand is NaN */
+    for (; i + 4 <= n; i += 4) {
+        float32x4_t x = vld1q_f32 (src + i);
+        vmin = vminnmq_f32 (vmin, x);
+        vmax = vmaxnmq_f32 (vmax, x);
+    }
+
+    *min = vminnmvq_f32 (vmin);
+    *max = vmaxnmvq_f32 (vmax);
+    find_min_max_scalar (src + i, n - i, min, max);
+}
+
+static inline uint16x4_t
+clamp_and_scale_neon (const gfloat *src, float32x4_t offset, float32x4_t scale, float32x4_t lower, float32x4_t upper)
+{
+    float32x4_t x = vminq_f32 (vmaxq_f32 (vld1q_f32 (src), lower), upper);
+    return vqmovn_u32 (vcvtq_u32_f32 (vmulq_f32 (vsubq_f32 (x, offset), scale)));
+}
+
+static void
+pack_8bit_neon (const gfloat *src, guint8 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper)
+{
+    const float32x4_t voffset = vdupq_n_f32 (offset);
+    const float32x4_t vscale = vdupq_n_f32 (scale);
+    const float32x4_t vlower = vdupq_n_f32 (lower);
+    const float32x4_t vupper = vdupq_n_f32 (upper);
+    gsize i = 0;
+
+    for (; i + 16 <= n; i += 16) {
+        uint16x8_t ab = vcombine_u16 (clamp_and_scale_neon (src + i, voffset, vscale, vlower, vupper),
+                                      clamp_and_scale_neon (src + i + 4, voffset, vscale, vlower, vupper));
+        uint16x8_t cd = vcombine_u16 (clamp_and_scale_neon (src + i + 8, voffset, vscale, vlower, vupper),
+                                      clamp_and_scale_neon (src + i + 12, voffset, vscale, vlower, vupper));
+        vst1q_u8 (dst + i, vcombine_u8 (vqmovn_u16 (ab), vqmovn_u16 (cd)));
+    }
+
+    pack_8bit_scalar (src + i, dst + i, n - i, offset, scale, lower, upper);
+}
+
+static void
+pack_16bit_neon (const gfloat *src, guint16 *dst, gsize n, gfloat offset, gfloat scale, gfloat lower, gfloat upper)
+{
+    const float32x4_t voffset = vdupq_n_f32 (offset);
+    const float32x4_t vscale = vdupq_n_f32 (scale);
+    const float32x4_t vlower = vdupq_n_f32 (lower);
+    const float32x4_t vupper = vdupq_n_f32 (upper);
+    gsize i = 0;
+
+    for (; i + 8 <= n; i += 8) {
+        vst1q_u16 (dst + i, vcombine_u16 (clamp_and_scale_neon (src + i, voffset, vscale, vlower, vupper),
+                                          clamp_and_scale_neon (src + i + 4, voffset, vscale, vlower, vupper)));
+    }
+
+    pack_16bit_scalar (src + i, dst + i, n - i, offset, scale, lower, upper);
+}
+#endif
+
+static gpointer
+select_conversion_funcs (gpointer data)
+{
+    static ConversionFuncs funcs = {
+        "scalar", find_min_max_scalar, pack_8bit_scalar, pack_16bit_scalar
+    };
+
+#ifdef HAVE_X86_DISPATCH
+    __builtin_cpu_init ();
+
+    if (__builtin_cpu_supports ("avx2")) {
+        funcs.name = "AVX2";
+        funcs.find_min_max = find_min_max_avx2;
+        funcs.pack_8bit = pack_8bit_avx2;
+        funcs.pack_16bit = pack_16bit_avx2;
+    }
+    else if (__builtin_cpu_supports ("sse4.1")) {
+        funcs.name = "SSE4.1";
+        funcs.find_min_max = find_min_max_sse;
+        funcs.pack_8bit = pack_8bit_sse;
+        funcs.pack_16bit = pack_16bit_sse;
+    }
+#endif
+
+#ifdef HAVE_NEON
+    funcs.name = "NEON";
+    funcs.find_min_max = find_min_max_neon;
+    funcs.pack_8bit = pack_8bit_neon;
+    funcs.pack_16bit = pack_16bit_neon;
+#endif
+
+    g_debug ("writer: using %s conversion routines", funcs.name);
+    return &funcs;
+}
+
+static const ConversionFuncs *
+get_conversion_funcs (void)
+{
+    static GOnce once = G_ONCE_INIT;
+
+    g_once (&once, select_conversion_funcs, NULL);
+    return (const ConversionFuncs *) once.retval;
+}
+
+static void
+get_min_max (UfoWriterImage *image, gfloat *src, gsize n_elements, gfloat *min, gfloat *max)
+{
+    if (image->max > -G_MAXFLOAT && image->min < G_MAXFLOAT) {
+        *max = image->max;
+        *min = image->min;
+        return;
+    }
+
+    /* TODO: We should issue a warning if only one of max or min was set by the
+     * user ... */
+
+    *max = -G_MAXFLOAT;
+    *min = G_MAXFLOAT;
+    get_conversion_funcs ()->find_min_max (src, n_elements, min, max);
 }
 
 static gsize
@@ -95,38 +437,16 @@ static void
 convert_and_rescale_to_8bit (UfoWriterImage *image)
 {
     gfloat *src;
-    guint8 *dst;
     gfloat max, min, scale;
     gsize size;
 
     size = get_number_of_pixels (image);
     src = (gfloat *) image->data;
-    dst = (guint8 *) src;
     get_min_max (image, src, size, &min, &max);
     scale = 255.0f / (max - min);
 
-    /* first clip */
-    if (min < max) {
-        for (gsize i = 0; i < size; i++) {
-            if (src[i] < min)
-                src[i] = min;
-            else if (src[i] > max)
-                src[i] = max;
-        }
-    }
-    else {
-        for (gsize i = 0; i < size; i++) {
-            if (src[i] < max)
-                src[i] = max;
-            else if (src[i] > min)
-                src[i] = min;
-        }
-    }
-
-    /* then rescale */
-    for (gsize i = 0; i < size; i++)
-        dst[i] = (guint8) ((src[i] - min) * scale);
-
+    /* values are clipped to [min, max] or [max, min] if the range is inverted */
+    get_conversion_funcs ()->pack_8bit (src, (guint8 *) src, size, min, scale, MIN (min, max), MAX (min, max));
     image->depth = UFO_BUFFER_DEPTH_8U;
 }
 
@@ -134,16 +454,9 @@ static void
 convert_to_8bit (UfoWriterImage *image)
 {
     gfloat *src;
-    guint8 *dst;
-    gsize size;
 
-    size = get_number_of_pixels (image);
     src = (gfloat *) image->data;
-    dst = (guint8 *) src;
-
-    for (gsize i = 0; i < size; i++)
-        dst[i] = (guint8) src[i];
-
+    get_conversion_funcs ()->pack_8bit (src, (guint8 *) src, get_number_of_pixels (image), 0.0f, 1.0f, 0.0f, 255.0f);
     image->depth = UFO_BUFFER_DEPTH_8U;
 }
 
@@ -151,37 +464,15 @@ static void
 convert_and_rescale_to_16bit (UfoWriterImage *image)
 {
     gfloat *src;
-    guint16 *dst;
     gfloat max, min, scale;
     gsize size;
 
     size = get_number_of_pixels (image);
     src = (gfloat *) image->data;
-    dst = (guint16 *) src;
     get_min_max (image, src, size, &min, &max);
     scale = 65535.0f / (max - min);
 
-    if (min < max) {
-        for (gsize i = 0; i < size; i++) {
-            if (src[i] < min)
-                src[i] = min;
-            else if (src[i] > max)
-                src[i] = max;
-        }
-    }
-    else {
-        for (gsize i = 0; i < size; i++) {
-            if (src[i] < max)
-                src[i] = max;
-            else if (src[i] > min)
-                src[i] = min;
-        }
-    }
-
-    /* TODO: good opportunity for some SSE acceleration */
-    for (gsize i = 0; i < size; i++)
-        dst[i] = (guint16) ((src[i] - min) * scale);
-
+    get_conversion_funcs ()->pack_16bit (src, (guint16 *) src, size, min, scale, MIN (min, max), MAX (min, max));
     image->depth = UFO_BUFFER_DEPTH_16U;
 }
 
@@ -189,16 +480,9 @@ static void
 convert_to_16bit (UfoWriterImage *image)
 {
     gfloat *src;
-    guint16 *dst;
-    gsize size;
 
-    size = get_number_of_pixels (image);
     src = (gfloat *) image->data;
-    dst = (guint16 *) src;
-
-    for (gsize i = 0; i < size; i++)
-        dst[i] = (guint16) src[i];
-
+    get_conversion_funcs ()->pack_16bit (src, (guint16 *) src, get_number_of_pixels (image), 0.0f, 1.0f, 0.0f, 65535.0f);
     image->depth = UFO_BUFFER_DEPTH_16U;
 }
 